@@ -0,0 +1,93 @@
+#!/usr/bin/env bash
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Library Public License as published by
+# the Free Software Foundation; either version 2, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Library Public License for more details.
+#
+
+source $CEPH_ROOT/qa/standalone/ceph-helpers.sh
+
+function run() {
+    local dir=$1
+    shift
+
+    export CEPH_MON="127.0.0.1:7142" # git grep '\<7142\>' : there must be only one
+    export CEPH_ARGS
+    CEPH_ARGS+="--fsid=$(uuidgen) --auth-supported=none "
+    CEPH_ARGS+="--mon-host=$CEPH_MON "
+    CEPH_ARGS+="--osd_min_pg_log_entries=5 --osd_max_pg_log_entries=10 "
+    # many small intervals, so most of them are prefetched
+    CEPH_ARGS+="--osd_backfill_scan_prefetch=true "
+    CEPH_ARGS+="--osd_backfill_scan_min=4 --osd_backfill_scan_max=8 "
+    export objects=200
+    export poolname=test
+
+    local funcs=${@:-$(set | sed -n -e 's/^\(TEST_[0-9a-z_]*\) .*/\1/p')}
+    for func in $funcs ; do
+        setup $dir || return 1
+        $func $dir || return 1
+        teardown $dir || return 1
+    done
+}
+
+# Backfill [1] -> [1, 0, 2] with writes landing during backfill, so
+# prefetched intervals must be brought up to date from the pg log.
+# Then take the primary out and read everything back from the
+# backfilled copies.
+function TEST_backfill_prefetch() {
+    local dir=$1
+
+    run_mon $dir a || return 1
+    run_mgr $dir x || return 1
+    run_osd $dir 0 || return 1
+    run_osd $dir 1 || return 1
+    run_osd $dir 2 || return 1
+
+    create_pool $poolname 1 1
+    ceph osd pool set $poolname size 1
+    wait_for_clean || return 1
+
+    for i in $(seq 1 $objects)
+    do
+        echo "obj$i" > $dir/obj$i
+        rados -p $poolname put obj$i $dir/obj$i || return 1
+    done
+
+    local primary=$(get_primary $poolname obj1)
+
+    ceph osd pool set $poolname size 3
+    for i in $(seq 1 $objects)
+    do
+        echo "obj$i rewritten" > $dir/obj$i
+        rados -p $poolname put obj$i $dir/obj$i || return 1
+    done
+
+    wait_for_clean || return 1
+
+    grep -q "using prefetched interval" $dir/osd.$primary.log || return 1
+
+    ceph osd out osd.$primary || return 1
+    wait_for_clean || return 1
+    test $(get_primary $poolname obj1) != $primary || return 1
+
+    for i in $(seq 1 $objects)
+    do
+        rados -p $poolname get obj$i $dir/obj$i.out || return 1
+        cmp $dir/obj$i $dir/obj$i.out || return 1
+    done
+
+    delete_pool $poolname
+    kill_daemons $dir || return 1
+}
+
+main osd-backfill-prefetch "$@"
+
+# Local Variables:
+# compile-command: "make -j4 && ../qa/run-standalone.sh osd-backfill-prefetch.sh"
+# End:
@@ -58,7 +58,7 @@ function TEST_filestore_to_bluestore() {
     ceph-objectstore-tool --type bluestore --data-path $dir/0 --fsid $ofsid \
 			  --op mkfs --no-mon-config || return 1
     ceph-objectstore-tool --data-path $dir/0.old --target-data-path $dir/0 \
-			  --op dup || return 1
+			  --op dup --dup-threads 4 --dup-batch-bytes 1048576 || return 1
     CEPH_ARGS=$O
 
     run_osd_bluestore $dir 0 || return 1
@@ -23,6 +23,9 @@ int ceph_arch_intel_ssse3 = 0;
 int ceph_arch_intel_sse3 = 0;
 int ceph_arch_intel_sse2 = 0;
 int ceph_arch_intel_aesni = 0;
+int ceph_arch_intel_avx2 = 0;
+int ceph_arch_intel_avx512f = 0;
+int ceph_arch_intel_avx512dq = 0;
 
 #ifdef __x86_64__
 #include <cpuid.h>
@@ -36,6 +39,24 @@ int ceph_arch_intel_aesni = 0;
 #define CPUID_SSE3	(1)
 #define CPUID_SSE2	(1 << 26)
 #define CPUID_AESNI (1 << 25)
+#define CPUID_OSXSAVE	(1 << 27)
+#define CPUID_AVX	(1 << 28)
+
+/* EAX=7, ECX=0: extended features in EBX */
+#define CPUID7_AVX2	(1 << 5)
+#define CPUID7_AVX512F	(1 << 16)
+#define CPUID7_AVX512DQ	(1 << 17)
+
+/* XCR0: state the OS saves on context switch */
+#define XCR0_YMM	(0x6)	/* SSE + AVX */
+#define XCR0_ZMM	(0xe6)	/* SSE + AVX + opmask + ZMM */
+
+static unsigned long long xgetbv0(void)
+{
+	unsigned int eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+}
 
 int ceph_arch_intel_probe(void)
 {
@@ -65,6 +86,24 @@ int ceph_arch_intel_probe(void)
   if ((ecx & CPUID_AESNI) != 0) {
           ceph_arch_intel_aesni = 1;
   }
+	/* the wide registers are only usable if the OS saves them */
+	if ((ecx & CPUID_OSXSAVE) != 0 && (ecx & CPUID_AVX) != 0 &&
+	    __get_cpuid_max(0, NULL) >= 7) {
+		unsigned long long xcr0 = xgetbv0();
+		unsigned int eax7, ebx7, ecx7, edx7;
+		__cpuid_count(7, 0, eax7, ebx7, ecx7, edx7);
+		if ((xcr0 & XCR0_YMM) == XCR0_YMM &&
+		    (ebx7 & CPUID7_AVX2) != 0) {
+			ceph_arch_intel_avx2 = 1;
+		}
+		if ((xcr0 & XCR0_ZMM) == XCR0_ZMM &&
+		    (ebx7 & CPUID7_AVX512F) != 0) {
+			ceph_arch_intel_avx512f = 1;
+			if ((ebx7 & CPUID7_AVX512DQ) != 0) {
+				ceph_arch_intel_avx512dq = 1;
+			}
+		}
+	}
 
 	return 0;
 }
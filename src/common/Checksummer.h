@@ -5,6 +5,7 @@
 #define CEPH_OS_BLUESTORE_CHECKSUMMER
 
 #include "xxHash/xxhash.h"
+#include "common/csum_mb.h"
 
 class Checksummer {
 public:
@@ -17,6 +18,10 @@ public:
     CSUM_CRC32C_8 = 6,  // low 8 bits of crc32c
     CSUM_MAX,
   };
+
+  /// max number of csum blocks handed to a multi-buffer kernel at once
+  static const size_t mb_batch = 32;
+
   static const char *get_csum_type_string(unsigned t) {
     switch (t) {
     case CSUM_NONE: return "none";
@@ -86,6 +91,20 @@ public:
       ) {
       return p.crc32c(len, init_value);
     }
+
+    static void calc_mb(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t v[mb_batch];
+      ceph_crc32c_mb(init_value, (const unsigned char *)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i];
+      }
+    }
   };
 
   struct crc32c_16 {
@@ -107,6 +126,20 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xffff;
     }
+
+    static void calc_mb(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t v[mb_batch];
+      ceph_crc32c_mb(init_value, (const unsigned char *)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i] & 0xffff;
+      }
+    }
   };
 
   struct crc32c_8 {
@@ -128,6 +161,20 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xff;
     }
+
+    static void calc_mb(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t v[mb_batch];
+      ceph_crc32c_mb(init_value, (const unsigned char *)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i] & 0xff;
+      }
+    }
   };
 
   struct xxhash32 {
@@ -157,6 +204,20 @@ public:
       }
       return XXH32_digest(state);
     }
+
+    static void calc_mb(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t v[mb_batch];
+      ceph_xxhash32_mb(init_value, (const unsigned char *)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i];
+      }
+    }
   };
 
   struct xxhash64 {
@@ -186,8 +247,32 @@ public:
       }
       return XXH64_digest(state);
     }
+
+    static void calc_mb(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint64_t v[mb_batch];
+      ceph_xxhash64_mb(init_value, (const unsigned char *)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i];
+      }
+    }
   };
 
+  /// number of whole blocks (at most max, capped to mb_batch) that are
+  /// contiguous in memory at p
+  static size_t _contiguous_blocks(
+    const bufferlist::const_iterator& p,
+    size_t csum_block_size,
+    size_t max) {
+    size_t n = p.get_current_ptr().length() / csum_block_size;
+    return std::min(std::min(n, max), mb_batch);
+  }
+
   template<class Alg>
   static int calculate(
     size_t csum_block_size,
@@ -221,9 +306,20 @@ public:
     typename Alg::value_t *pv =
       reinterpret_cast<typename Alg::value_t*>(csum_data->c_str());
     pv += offset / csum_block_size;
-    while (blocks--) {
+    while (blocks) {
+      size_t n = _contiguous_blocks(p, csum_block_size, blocks);
+      if (n > 1) {
+	const char *data;
+	size_t l = p.get_ptr_and_advance(n * csum_block_size, &data);
+	assert(l == n * csum_block_size);
+	Alg::calc_mb(init_value, csum_block_size, n, data, pv);
+	pv += n;
+	blocks -= n;
+	continue;
+      }
       *pv = Alg::calc(state, init_value, csum_block_size, p);
       ++pv;
+      --blocks;
     }
     Alg::fini(&state);
     return 0;
@@ -250,6 +346,28 @@ public:
     pv += offset / csum_block_size;
     size_t pos = offset;
     while (length > 0) {
+      size_t n = _contiguous_blocks(p, csum_block_size,
+				    length / csum_block_size);
+      if (n > 1) {
+	typename Alg::value_t v[mb_batch];
+	const char *data;
+	size_t l = p.get_ptr_and_advance(n * csum_block_size, &data);
+	assert(l == n * csum_block_size);
+	Alg::calc_mb(-1, csum_block_size, n, data, v);
+	for (size_t i = 0; i < n; ++i) {
+	  if (pv[i] != v[i]) {
+	    if (bad_csum) {
+	      *bad_csum = v[i];
+	    }
+	    Alg::fini(&state);
+	    return pos + i * csum_block_size;
+	  }
+	}
+	pv += n;
+	pos += l;
+	length -= l;
+	continue;
+      }
       typename Alg::value_t v = Alg::calc(state, -1, csum_block_size, p);
       if (*pv != v) {
 	if (bad_csum) {
@@ -270,3 +270,38 @@ uint32_t ceph_crc32c_aarch64(uint32_t crc, unsigned char const *buffer, unsigned
 	}
 	return crc;
 }
+
+void ceph_crc32c_aarch64_mb(uint32_t crc, unsigned char const *buffer,
+			    size_t chunk_len, size_t n, uint32_t *out)
+{
+	size_t i = 0;
+
+	/* crc32cx has a latency of several cycles; keep four chunks in flight */
+	for (; i + 4 <= n; i += 4) {
+		const unsigned char *p0 = buffer + i * chunk_len;
+		const unsigned char *p1 = p0 + chunk_len;
+		const unsigned char *p2 = p1 + chunk_len;
+		const unsigned char *p3 = p2 + chunk_len;
+		uint32_t c0 = crc, c1 = crc, c2 = crc, c3 = crc;
+		size_t off = 0;
+
+		for (; off + sizeof(uint64_t) <= chunk_len; off += sizeof(uint64_t)) {
+			CRC32CX(c0, *(const uint64_t *)(p0 + off));
+			CRC32CX(c1, *(const uint64_t *)(p1 + off));
+			CRC32CX(c2, *(const uint64_t *)(p2 + off));
+			CRC32CX(c3, *(const uint64_t *)(p3 + off));
+		}
+		for (; off < chunk_len; off++) {
+			CRC32CB(c0, p0[off]);
+			CRC32CB(c1, p1[off]);
+			CRC32CB(c2, p2[off]);
+			CRC32CB(c3, p3[off]);
+		}
+		out[i] = c0;
+		out[i + 1] = c1;
+		out[i + 2] = c2;
+		out[i + 3] = c3;
+	}
+	for (; i < n; i++)
+		out[i] = ceph_crc32c_aarch64(crc, buffer + i * chunk_len, chunk_len);
+}
@@ -3,6 +3,8 @@
 
 #include "acconfig.h"
 #include "arch/arm.h"
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,6 +14,10 @@ extern "C" {
 
 extern uint32_t ceph_crc32c_aarch64(uint32_t crc, unsigned char const *buffer, unsigned len);
 
+/* crc of n back-to-back chunks of chunk_len bytes, four at a time */
+extern void ceph_crc32c_aarch64_mb(uint32_t crc, unsigned char const *buffer,
+				   size_t chunk_len, size_t n, uint32_t *out);
+
 #else
 
 static inline uint32_t ceph_crc32c_aarch64(uint32_t crc, unsigned char const *buffer, unsigned len)
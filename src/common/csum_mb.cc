@@ -0,0 +1,426 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <stdio.h>
+#include <string.h>
+
+#include "acconfig.h"
+#include "common/csum_mb.h"
+#include "include/crc32c.h"
+#include "arch/probe.h"
+#include "arch/intel.h"
+#include "arch/arm.h"
+#include "common/crc32c_aarch64.h"
+#include "xxHash/xxhash.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * generic: one chunk at a time
+ */
+
+static void crc32c_mb_generic(uint32_t crc, unsigned char const *data,
+			      size_t chunk_len, size_t n, uint32_t *out)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = ceph_crc32c(crc, data + i * chunk_len, chunk_len);
+  }
+}
+
+static void xxhash32_mb_generic(uint32_t seed, unsigned char const *data,
+				size_t chunk_len, size_t n, uint32_t *out)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = XXH32(data + i * chunk_len, chunk_len, seed);
+  }
+}
+
+static void xxhash64_mb_generic(uint64_t seed, unsigned char const *data,
+				size_t chunk_len, size_t n, uint64_t *out)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = XXH64(data + i * chunk_len, chunk_len, seed);
+  }
+}
+
+const ceph_csum_mb_impl_t ceph_csum_mb_generic = {
+  "generic",
+  crc32c_mb_generic,
+  xxhash32_mb_generic,
+  xxhash64_mb_generic
+};
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+/*
+ * xxhash, several chunks per vector.
+ *
+ * The XXH32 (XXH64) bulk loop keeps four 32-bit (64-bit) accumulators
+ * and consumes one 16 (32) byte stripe per round.  We put the
+ * accumulators of B chunks side by side in one vector so a single
+ * vector multiply advances B chunks, and keep K such vectors in flight
+ * to hide the multiply latency.  Chunks must be a whole number of
+ * stripes; the finalization is scalar and follows the reference code.
+ *
+ * These are always_inline so that the target-specific wrappers below
+ * get them compiled for their instruction set.
+ */
+
+#define XXH_PRIME32_1 2654435761U
+#define XXH_PRIME32_2 2246822519U
+#define XXH_PRIME32_3 3266489917U
+#define XXH_PRIME64_1 11400714785074694791ULL
+#define XXH_PRIME64_2 14029467366897019727ULL
+#define XXH_PRIME64_3 1609587929392839161ULL
+#define XXH_PRIME64_4 9650029242287828579ULL
+
+template<typename T, unsigned bytes>
+struct xxh_vec {
+  typedef T type __attribute__((vector_size(bytes)));
+};
+
+typedef xxh_vec<uint32_t, 32>::type xxh_v8u32_t;
+typedef xxh_vec<uint32_t, 64>::type xxh_v16u32_t;
+typedef xxh_vec<uint64_t, 64>::type xxh_v8u64_t;
+
+static inline __attribute__((always_inline))
+uint32_t xxh_rotl32(uint32_t x, int r)
+{
+  return (x << r) | (x >> (32 - r));
+}
+
+static inline __attribute__((always_inline))
+uint64_t xxh_rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline __attribute__((always_inline))
+uint32_t xxh32_finish(const uint32_t *v, size_t len)
+{
+  uint32_t h = xxh_rotl32(v[0], 1) + xxh_rotl32(v[1], 7) +
+    xxh_rotl32(v[2], 12) + xxh_rotl32(v[3], 18);
+  h += (uint32_t)len;
+  h ^= h >> 15;
+  h *= XXH_PRIME32_2;
+  h ^= h >> 13;
+  h *= XXH_PRIME32_3;
+  h ^= h >> 16;
+  return h;
+}
+
+static inline __attribute__((always_inline))
+uint64_t xxh64_merge(uint64_t h, uint64_t v)
+{
+  v *= XXH_PRIME64_2;
+  v = xxh_rotl64(v, 31);
+  v *= XXH_PRIME64_1;
+  h ^= v;
+  return h * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static inline __attribute__((always_inline))
+uint64_t xxh64_finish(const uint64_t *v, size_t len)
+{
+  uint64_t h = xxh_rotl64(v[0], 1) + xxh_rotl64(v[1], 7) +
+    xxh_rotl64(v[2], 12) + xxh_rotl64(v[3], 18);
+  h = xxh64_merge(h, v[0]);
+  h = xxh64_merge(h, v[1]);
+  h = xxh64_merge(h, v[2]);
+  h = xxh64_merge(h, v[3]);
+  h += len;
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+// load one stripe from each of B chunks that are stride bytes apart
+// into one vector.  The vector goes out through a pointer so that no
+// function returns a wide vector by value (-Wpsabi).
+template<typename V, unsigned B>
+static inline __attribute__((always_inline))
+void xxh_load(V *v, const unsigned char *p, size_t stride)
+{
+  static_assert(B == 1, "no wide loader for this arch");
+  memcpy(v, p, sizeof(*v));
+}
+
+#if defined(__x86_64__)
+template<>
+inline __attribute__((target("avx2")))
+void xxh_load<xxh_v8u32_t, 2>(xxh_v8u32_t *v,
+			      const unsigned char *p, size_t stride)
+{
+  // not _mm256_loadu2_m128i, which gcc only has from 10 on
+  *v = (xxh_v8u32_t)_mm256_inserti128_si256(
+    _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+    _mm_loadu_si128((const __m128i *)(p + stride)), 1);
+}
+
+template<>
+inline __attribute__((target("avx512f")))
+void xxh_load<xxh_v16u32_t, 4>(xxh_v16u32_t *v,
+			       const unsigned char *p, size_t stride)
+{
+  __m512i r = _mm512_inserti32x4(
+    _mm512_setzero_si512(), _mm_loadu_si128((const __m128i *)p), 0);
+  r = _mm512_inserti32x4(r, _mm_loadu_si128((const __m128i *)(p + stride)), 1);
+  r = _mm512_inserti32x4(r, _mm_loadu_si128((const __m128i *)(p + 2 * stride)), 2);
+  r = _mm512_inserti32x4(r, _mm_loadu_si128((const __m128i *)(p + 3 * stride)), 3);
+  *v = (xxh_v16u32_t)r;
+}
+
+template<>
+inline __attribute__((target("avx512f")))
+void xxh_load<xxh_v8u64_t, 2>(xxh_v8u64_t *v,
+			      const unsigned char *p, size_t stride)
+{
+  // the masked form with an all-ones mask is the same instruction;
+  // the unmasked intrinsic seeds its passthrough with an undefined
+  // vector, which trips -Wmaybe-uninitialized
+  __m512i z = _mm512_setzero_si512();
+  __m512i r = _mm512_mask_inserti64x4(
+    z, 0xff, z, _mm256_loadu_si256((const __m256i *)p), 0);
+  r = _mm512_mask_inserti64x4(
+    r, 0xff, r, _mm256_loadu_si256((const __m256i *)(p + stride)), 1);
+  *v = (xxh_v8u64_t)r;
+}
+#endif
+
+template<unsigned B, unsigned K>
+static inline __attribute__((always_inline))
+size_t xxhash32_mb_vec(uint32_t seed, unsigned char const *data,
+		       size_t chunk_len, size_t n, uint32_t *out)
+{
+  typedef typename xxh_vec<uint32_t, 16 * B>::type vec_t;
+  size_t i = 0;
+  for (; i + B * K <= n; i += B * K) {
+    vec_t acc[K];
+    for (unsigned k = 0; k < K; ++k) {
+      for (unsigned b = 0; b < B; ++b) {
+	acc[k][4 * b] = seed + XXH_PRIME32_1 + XXH_PRIME32_2;
+	acc[k][4 * b + 1] = seed + XXH_PRIME32_2;
+	acc[k][4 * b + 2] = seed;
+	acc[k][4 * b + 3] = seed - XXH_PRIME32_1;
+      }
+    }
+    const unsigned char *base = data + i * chunk_len;
+    for (size_t off = 0; off < chunk_len; off += 16) {
+      for (unsigned k = 0; k < K; ++k) {
+	vec_t in;
+	xxh_load<vec_t, B>(&in, base + k * B * chunk_len + off, chunk_len);
+	acc[k] += in * XXH_PRIME32_2;
+	acc[k] = (acc[k] << 13) | (acc[k] >> 19);
+	acc[k] *= XXH_PRIME32_1;
+      }
+    }
+    for (unsigned k = 0; k < K; ++k) {
+      for (unsigned b = 0; b < B; ++b) {
+	uint32_t v[4] = { acc[k][4 * b], acc[k][4 * b + 1],
+			  acc[k][4 * b + 2], acc[k][4 * b + 3] };
+	out[i + k * B + b] = xxh32_finish(v, chunk_len);
+      }
+    }
+  }
+  return i;
+}
+
+template<unsigned B, unsigned K>
+static inline __attribute__((always_inline))
+size_t xxhash64_mb_vec(uint64_t seed, unsigned char const *data,
+		       size_t chunk_len, size_t n, uint64_t *out)
+{
+  typedef typename xxh_vec<uint64_t, 32 * B>::type vec_t;
+  size_t i = 0;
+  for (; i + B * K <= n; i += B * K) {
+    vec_t acc[K];
+    for (unsigned k = 0; k < K; ++k) {
+      for (unsigned b = 0; b < B; ++b) {
+	acc[k][4 * b] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+	acc[k][4 * b + 1] = seed + XXH_PRIME64_2;
+	acc[k][4 * b + 2] = seed;
+	acc[k][4 * b + 3] = seed - XXH_PRIME64_1;
+      }
+    }
+    const unsigned char *base = data + i * chunk_len;
+    for (size_t off = 0; off < chunk_len; off += 32) {
+      for (unsigned k = 0; k < K; ++k) {
+	vec_t in;
+	xxh_load<vec_t, B>(&in, base + k * B * chunk_len + off, chunk_len);
+	acc[k] += in * XXH_PRIME64_2;
+	acc[k] = (acc[k] << 31) | (acc[k] >> 33);
+	acc[k] *= XXH_PRIME64_1;
+      }
+    }
+    for (unsigned k = 0; k < K; ++k) {
+      for (unsigned b = 0; b < B; ++b) {
+	uint64_t v[4] = { acc[k][4 * b], acc[k][4 * b + 1],
+			  acc[k][4 * b + 2], acc[k][4 * b + 3] };
+	out[i + k * B + b] = xxh64_finish(v, chunk_len);
+      }
+    }
+  }
+  return i;
+}
+
+// run the widest kernel that fits, then narrower ones, then the
+// generic code for the leftovers (or for chunk sizes we can't stripe)
+#define XXHASH_MB_DISPATCH(bits, stripe, B, K, seed, data, chunk_len, n, out) \
+  do {									\
+    size_t done = 0;							\
+    if (chunk_len >= stripe && chunk_len % stripe == 0) {		\
+      done = xxhash##bits##_mb_vec<B, K>(seed, data, chunk_len, n, out); \
+      done += xxhash##bits##_mb_vec<B, 1>(seed, data + done * chunk_len, \
+					  chunk_len, n - done, out + done); \
+    }									\
+    xxhash##bits##_mb_generic(seed, data + done * chunk_len, chunk_len, \
+			      n - done, out + done);			\
+  } while (0)
+
+#endif // __x86_64__ || __aarch64__
+
+#if defined(__x86_64__)
+
+/*
+ * crc32c: the crc32 instruction has a latency of 3 cycles but a
+ * throughput of 1, so interleave four chunks.
+ */
+__attribute__((target("sse4.2")))
+static void crc32c_mb_sse42(uint32_t crc, unsigned char const *data,
+			    size_t chunk_len, size_t n, uint32_t *out)
+{
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const unsigned char *p0 = data + i * chunk_len;
+    const unsigned char *p1 = p0 + chunk_len;
+    const unsigned char *p2 = p1 + chunk_len;
+    const unsigned char *p3 = p2 + chunk_len;
+    uint64_t c0 = crc, c1 = crc, c2 = crc, c3 = crc;
+    size_t off = 0;
+    for (; off + 8 <= chunk_len; off += 8) {
+      uint64_t w0, w1, w2, w3;
+      memcpy(&w0, p0 + off, 8);
+      memcpy(&w1, p1 + off, 8);
+      memcpy(&w2, p2 + off, 8);
+      memcpy(&w3, p3 + off, 8);
+      c0 = _mm_crc32_u64(c0, w0);
+      c1 = _mm_crc32_u64(c1, w1);
+      c2 = _mm_crc32_u64(c2, w2);
+      c3 = _mm_crc32_u64(c3, w3);
+    }
+    for (; off < chunk_len; ++off) {
+      c0 = _mm_crc32_u8((uint32_t)c0, p0[off]);
+      c1 = _mm_crc32_u8((uint32_t)c1, p1[off]);
+      c2 = _mm_crc32_u8((uint32_t)c2, p2[off]);
+      c3 = _mm_crc32_u8((uint32_t)c3, p3[off]);
+    }
+    out[i] = c0;
+    out[i + 1] = c1;
+    out[i + 2] = c2;
+    out[i + 3] = c3;
+  }
+  crc32c_mb_generic(crc, data + i * chunk_len, chunk_len, n - i, out + i);
+}
+
+__attribute__((target("avx2"), flatten))
+static void xxhash32_mb_avx2(uint32_t seed, unsigned char const *data,
+			     size_t chunk_len, size_t n, uint32_t *out)
+{
+  XXHASH_MB_DISPATCH(32, 16, 2, 4, seed, data, chunk_len, n, out);
+}
+
+__attribute__((target("avx512f"), flatten))
+static void xxhash32_mb_avx512(uint32_t seed, unsigned char const *data,
+			       size_t chunk_len, size_t n, uint32_t *out)
+{
+  XXHASH_MB_DISPATCH(32, 16, 4, 4, seed, data, chunk_len, n, out);
+}
+
+// AVX2 has no 64-bit multiply, so xxhash64 only gets a wide kernel
+// with AVX512DQ.
+__attribute__((target("avx512f,avx512dq"), flatten))
+static void xxhash64_mb_avx512(uint64_t seed, unsigned char const *data,
+			       size_t chunk_len, size_t n, uint64_t *out)
+{
+  XXHASH_MB_DISPATCH(64, 32, 2, 4, seed, data, chunk_len, n, out);
+}
+
+#elif defined(__aarch64__)
+
+#ifdef HAVE_ARMV8_CRC
+static void crc32c_mb_aarch64(uint32_t crc, unsigned char const *data,
+			      size_t chunk_len, size_t n, uint32_t *out)
+{
+  ceph_crc32c_aarch64_mb(crc, data, chunk_len, n, out);
+}
+#endif
+
+// NEON is always there on aarch64; one chunk per 128-bit register,
+// four chunks in flight
+static void xxhash32_mb_neon(uint32_t seed, unsigned char const *data,
+			     size_t chunk_len, size_t n, uint32_t *out)
+{
+  XXHASH_MB_DISPATCH(32, 16, 1, 4, seed, data, chunk_len, n, out);
+}
+
+#endif
+
+/*
+ * choose best implementation based on the CPU architecture.
+ */
+ceph_csum_mb_impl_t ceph_choose_csum_mb(void)
+{
+  // make sure we've probed cpu features; this might depend on the
+  // link order of this file relative to arch/probe.cc.
+  ceph_arch_probe();
+
+  ceph_csum_mb_impl_t r = ceph_csum_mb_generic;
+  static char name[80];
+  const char *crc_name = "generic";
+  const char *xxh32_name = "generic";
+  const char *xxh64_name = "generic";
+
+#if defined(__x86_64__)
+  if (ceph_arch_intel_sse42) {
+    r.crc32c = crc32c_mb_sse42;
+    crc_name = "sse42";
+  }
+  if (ceph_arch_intel_avx512f) {
+    r.xxhash32 = xxhash32_mb_avx512;
+    xxh32_name = "avx512";
+  } else if (ceph_arch_intel_avx2) {
+    r.xxhash32 = xxhash32_mb_avx2;
+    xxh32_name = "avx2";
+  }
+  if (ceph_arch_intel_avx512f && ceph_arch_intel_avx512dq) {
+    r.xxhash64 = xxhash64_mb_avx512;
+    xxh64_name = "avx512";
+  }
+#elif defined(__aarch64__)
+#ifdef HAVE_ARMV8_CRC
+  if (ceph_arch_aarch64_crc32) {
+    r.crc32c = crc32c_mb_aarch64;
+    crc_name = "aarch64";
+  }
+#endif
+  if (ceph_arch_neon) {
+    r.xxhash32 = xxhash32_mb_neon;
+    xxh32_name = "neon";
+  }
+#endif
+
+  snprintf(name, sizeof(name), "crc32c=%s xxhash32=%s xxhash64=%s",
+	   crc_name, xxh32_name, xxh64_name);
+  r.name = name;
+  return r;
+}
+
+/*
+ * static global, see ceph_crc32c_func.
+ */
+ceph_csum_mb_impl_t ceph_csum_mb = ceph_choose_csum_mb();
@@ -0,0 +1,72 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_COMMON_CSUM_MB_H
+#define CEPH_COMMON_CSUM_MB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Multi-buffer checksum kernels.
+ *
+ * Each kernel computes the checksum of n chunks of chunk_len bytes that
+ * are laid out back to back at data, storing one value per chunk in
+ * out[0..n).  Working on several independent chunks at once lets the
+ * kernels keep the multiplier/crc units busy (and use wide SIMD for
+ * xxhash), which a chunk-at-a-time loop cannot do.
+ *
+ * Results are identical to ceph_crc32c(), XXH32() and XXH64() on each
+ * chunk with the same seed.
+ */
+
+typedef void (*ceph_crc32c_mb_func_t)(uint32_t crc,
+				      unsigned char const *data,
+				      size_t chunk_len, size_t n,
+				      uint32_t *out);
+typedef void (*ceph_xxhash32_mb_func_t)(uint32_t seed,
+					unsigned char const *data,
+					size_t chunk_len, size_t n,
+					uint32_t *out);
+typedef void (*ceph_xxhash64_mb_func_t)(uint64_t seed,
+					unsigned char const *data,
+					size_t chunk_len, size_t n,
+					uint64_t *out);
+
+struct ceph_csum_mb_impl_t {
+  const char *name;
+  ceph_crc32c_mb_func_t crc32c;
+  ceph_xxhash32_mb_func_t xxhash32;
+  ceph_xxhash64_mb_func_t xxhash64;
+};
+
+/// portable one-chunk-at-a-time implementation
+extern const ceph_csum_mb_impl_t ceph_csum_mb_generic;
+
+/*
+ * the implementation chosen for this cpu; like ceph_crc32c_func this is
+ * set up during static init.
+ */
+extern ceph_csum_mb_impl_t ceph_csum_mb;
+
+extern ceph_csum_mb_impl_t ceph_choose_csum_mb(void);
+
+static inline void ceph_crc32c_mb(uint32_t crc, unsigned char const *data,
+				  size_t chunk_len, size_t n, uint32_t *out)
+{
+  ceph_csum_mb.crc32c(crc, data, chunk_len, n, out);
+}
+
+static inline void ceph_xxhash32_mb(uint32_t seed, unsigned char const *data,
+				    size_t chunk_len, size_t n, uint32_t *out)
+{
+  ceph_csum_mb.xxhash32(seed, data, chunk_len, n, out);
+}
+
+static inline void ceph_xxhash64_mb(uint64_t seed, unsigned char const *data,
+				    size_t chunk_len, size_t n, uint64_t *out)
+{
+  ceph_csum_mb.xxhash64(seed, data, chunk_len, n, out);
+}
+
+#endif
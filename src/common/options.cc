@@ -2335,6 +2335,31 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_STARTUP)
     .set_description(""),
 
+    Option("osd_op_shard_steal_min_depth", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Queue depth at which idle op threads of other shards help drain a shard")
+    .set_long_description("If nonzero, this overrides the _hdd and _ssd variants.  A thread whose own shard is empty will run items from the deepest other shard once that shard has at least this many items queued; per-PG ordering is preserved.")
+    .add_see_also({"osd_op_shard_steal_min_depth_hdd", "osd_op_shard_steal_min_depth_ssd"}),
+
+    Option("osd_op_shard_steal_min_depth_hdd", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Queue depth at which idle op threads help other shards (hdd); 0 disables stealing")
+    .add_see_also("osd_op_shard_steal_min_depth"),
+
+    Option("osd_op_shard_steal_min_depth_ssd", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(8)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Queue depth at which idle op threads help other shards (ssd); 0 disables stealing")
+    .add_see_also("osd_op_shard_steal_min_depth"),
+
+    Option("osd_op_shard_numa_affinity", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Bind op shard threads to NUMA nodes")
+    .set_long_description("Shards are spread round-robin across the NUMA nodes found in /sys/devices/system/node and each shard's threads are bound to the CPUs of its node.  Idle threads prefer to help shards on their own node."),
+
     Option("osd_skip_data_digest", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(true)
     .set_description(""),
@@ -2830,6 +2855,12 @@ std::vector<Option> get_global_options() {
     .set_default(512)
     .set_description(""),
 
+    Option("osd_backfill_scan_prefetch", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("scan the next local backfill interval in the background while the current one is pushed")
+    .add_see_also("osd_backfill_scan_min")
+    .add_see_also("osd_backfill_scan_max"),
+
     Option("osd_op_thread_timeout", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(15)
     .set_description(""),
@@ -3175,6 +3206,13 @@ std::vector<Option> get_global_options() {
     .add_see_also("osd_min_pg_log_entries")
     .add_see_also("osd_max_pg_log_entries"),
 
+    Option("osd_pg_log_pack_entries", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("number of consecutive pg log entries stored under a single omap key")
+    .set_long_description("0 stores one omap key per log entry. A larger value groups entries into packs, cutting the number of keys and the deletes issued on trim at the cost of rewriting the whole pack when an entry is added. Existing logs are converted when the pg is next loaded and written.  The first start with a non-zero value sets the 'packed pg log' incompat feature in the OSD superblock, so releases that cannot read packed logs refuse to start the OSD. Setting this back to 0 converts the logs again but does not clear the feature.")
+    .add_service("osd"),
+
     Option("osd_force_recovery_pg_log_entries_factor", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(1.3)
     .set_description(""),
@@ -3305,6 +3343,19 @@ std::vector<Option> get_global_options() {
     .set_default(0)
     .set_description("Inject an expensive sleep during deep scrub IO to make it easier to induce preemption"),
 
+    Option("osd_inline_reads", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Run small cached reads on the messenger thread")
+    .set_long_description("A client read of a head object in a clean pg is executed directly by the messenger thread that received it, skipping the op queue, if the pg lock is free, nothing is queued ahead of it on its shard, the object is not being written, and the ObjectStore reports the data as cached.  Everything else is queued as usual.")
+    .add_see_also("osd_inline_read_max_bytes"),
+
+    Option("osd_inline_read_max_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Largest read (in bytes) that osd_inline_reads will run on the messenger thread")
+    .add_see_also("osd_inline_reads"),
+
     Option("osd_enable_op_tracker", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(true)
     .set_description(""),
@@ -3511,6 +3562,17 @@ std::vector<Option> get_global_options() {
     .set_default(4_K)
     .set_description("The block size for index partitions. (0 = rocksdb default)"),
 
+    Option("rocksdb_zero_copy_min_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(512)
+    .set_min(1)
+    .set_description("Smallest value handed out by reference to pinned rocksdb memory on pinned reads; smaller values are copied")
+    .set_long_description("Pinned reads (e.g. omap listings) wrap values in buffers that keep the underlying rocksdb block or iterator alive instead of copying them.  Pinning a whole block for a tiny value wastes cache, so values below this size are still copied."),
+
+    Option("rocksdb_reshard_batch_bytes", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(8_M)
+    .set_min(4_K)
+    .set_description("Size of the write batches used to move keys between column families during an offline reshard"),
+
     Option("mon_rocksdb_options", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("write_buffer_size=33554432,"
 		 "compression=kNoCompression,"
@@ -3659,6 +3721,12 @@ std::vector<Option> get_global_options() {
     .set_default(64_K)
     .set_description(""),
 
+    Option("memstore_page_set_huge_pages", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Allocate memstore_page_set pages from huge-page backed arenas")
+    .set_long_description("Pages are carved from 2MB chunks mapped with MAP_HUGETLB when huge pages are reserved, or advised for transparent huge pages otherwise. Memory freed by removed objects is kept for reuse rather than returned to the system.")
+    .add_see_also("memstore_page_set"),
+
     Option("objectstore_blackhole", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
     .set_description(""),
@@ -3694,6 +3762,18 @@ std::vector<Option> get_global_options() {
     .set_default(16)
     .set_description(""),
 
+    Option("bdev_ioring", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Enables Linux io_uring API instead of libaio")
+    .set_long_description("If the kernel or the build does not support io_uring, the device logs an error and falls back to libaio.  The backend in use is reported as bluestore_bdev_aio_backend in the OSD metadata.")
+    .add_see_also("bdev_ioring_sqthread_poll"),
+
+    Option("bdev_ioring_sqthread_poll", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Use a kernel polling thread for io_uring submission")
+    .set_long_description("With bdev_ioring, let a kernel thread poll the submission queue.  This avoids the io_uring_enter(2) syscall on submission, at the cost of a kernel thread spinning on the submission queue.")
+    .add_see_also("bdev_ioring"),
+
     Option("bdev_block_size", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(4_K)
     .set_description(""),
@@ -3722,6 +3802,11 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description(""),
 
+    Option("bdev_pmem_emulate", Option::TYPE_BOOL, Option::LEVEL_DEV)
+    .set_default(false)
+    .set_description("Drive a regular file with the pmem backend, persisting with msync")
+    .set_long_description("For testing the persistent memory code paths without DAX hardware or a memmap= region."),
+
     Option("bluefs_alloc_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(1_M)
     .set_description(""),
@@ -3770,6 +3855,12 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description(""),
 
+    Option("bluefs_log_flush_pipeline_depth", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2)
+    .set_min(1)
+    .set_description("Maximum number of BlueFS metadata log flushes in flight")
+    .set_long_description("A log flush that finds another one waiting on the device may encode and submit the next batch of log records instead of waiting for it to complete.  Setting this to 1 serializes log flushes."),
+
     Option("bluestore_bluefs", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(true)
     .set_flag(Option::FLAG_CREATE)
@@ -3829,7 +3920,14 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_spdk_io_sleep", Option::TYPE_UINT, Option::LEVEL_DEV)
     .set_default(5)
-    .set_description("Time period to wait if there is no completed I/O from polling"),
+    .set_description("Time period to wait if there is no completed I/O from polling")
+    .set_long_description("Upper bound in microseconds of the backoff sleep between empty completion polls; the sleep starts at 1us and doubles. 0 busy-polls without ever sleeping.")
+    .add_see_also("bluestore_spdk_poll_busy_loops"),
+
+    Option("bluestore_spdk_poll_busy_loops", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(64)
+    .set_description("Number of empty completion polls to spin through before backing off")
+    .add_see_also("bluestore_spdk_io_sleep"),
 
     Option("bluestore_block_path", Option::TYPE_STR, Option::LEVEL_DEV)
     .set_default("")
@@ -4006,6 +4104,29 @@ std::vector<Option> get_global_options() {
     .set_description("Compression ratio required to store compressed data")
     .set_long_description("If we compress data and get less than this we discard the result and store the original uncompressed data."),
 
+    Option("bluestore_compression_algorithm_cold", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_enum_allowed({"", "snappy", "zlib", "zstd", "lz4"})
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Compression algorithm to use for data hinted as cold")
+    .set_long_description("Objects whose allocation hints mark them immutable or append-only and sequentially read are compressed with this algorithm instead of the default one, e.g. lz4 by default and zstd for cold data.  An explicit per-pool algorithm takes precedence.  Empty means use the default algorithm."),
+
+    Option("bluestore_compression_sample_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4_K)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Bytes of a blob to trial-compress before compressing the whole blob")
+    .set_long_description("The sample is taken from a few evenly spaced windows of the blob.  If it does not compress to within bluestore_compression_required_ratio plus bluestore_compression_sample_slop the blob is stored uncompressed without paying for a full compression.  Blobs smaller than four times this size are always compressed in full.  0 disables sampling."),
+
+    Option("bluestore_compression_sample_slop", Option::TYPE_FLOAT, Option::LEVEL_DEV)
+    .set_default(.1)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Ratio above bluestore_compression_required_ratio a sample may compress to and still have the full blob compressed"),
+
+    Option("bluestore_shared_blob_merge", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_description("Write shared blob refcount changes as key/value merges")
+    .set_long_description("When a clone or overwrite only changes the refcounts of an existing shared blob, write the change as a small merge operand instead of rewriting the blob's whole refcount map.  Older releases cannot read these operands: before downgrading, disable this and restart the OSD once, which compacts all pending operands back into full records."),
+
     Option("bluestore_extent_map_shard_max_size", Option::TYPE_SIZE, Option::LEVEL_DEV)
     .set_default(1200)
     .set_description("Max size (bytes) for a single extent map shard before splitting"),
@@ -4026,6 +4147,26 @@ std::vector<Option> get_global_options() {
     .set_default(256)
     .set_description("Preallocated buffer for inline shards"),
 
+    Option("bluestore_onode_warmup", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Save the hot onode set and prefetch it into the cache on mount")
+    .set_long_description("The keys of the most recently used onodes are saved in the key/value store on umount (and periodically, see bluestore_onode_warmup_save_interval).  When the store is mounted again they are loaded back into the onode cache by a background thread, so that a restarted OSD returns to steady state latency quickly.")
+    .add_see_also("bluestore_onode_warmup_max")
+    .add_see_also("bluestore_onode_warmup_save_interval")
+    .add_see_also("bluestore_onode_warmup_extents"),
+
+    Option("bluestore_onode_warmup_max", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(100000)
+    .set_description("Maximum number of onodes saved and prefetched for cache warm-up"),
+
+    Option("bluestore_onode_warmup_save_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("How frequently (in seconds) to save the hot onode set; 0 saves it on umount only"),
+
+    Option("bluestore_onode_warmup_extents", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_description("Also load the extent map shards of prefetched onodes"),
+
     Option("bluestore_cache_trim_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(.05)
     .set_description("How frequently we trim the bluestore cache"),
@@ -4096,6 +4237,81 @@ std::vector<Option> get_global_options() {
     .set_enum_allowed({"bitmap", "stupid"})
     .set_description("Allocator policy"),
 
+    Option("bluestore_defrag_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Seconds between online defragmentation passes (0 to disable)")
+    .set_long_description("Each pass walks a few objects and rewrites those whose data is spread over many more extents than necessary, using the normal transaction path.  Passes are skipped while free space fragmentation is below bluestore_defrag_min_fragmentation or client IO holds more than half of bluestore_throttle_bytes.")
+    .add_see_also("bluestore_defrag_min_fragmentation")
+    .add_see_also("bluestore_defrag_max_bytes"),
+
+    Option("bluestore_defrag_min_fragmentation", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.3)
+    .set_description("Only defragment when allocator fragmentation is at least this"),
+
+    Option("bluestore_defrag_max_bytes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64_M)
+    .set_description("Maximum bytes rewritten per defragmentation pass"),
+
+    Option("bluestore_defrag_scan_objects", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1024)
+    .set_description("Maximum objects examined per defragmentation pass"),
+
+    Option("bluestore_defrag_min_extents", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(8)
+    .set_description("Objects with fewer physical extents are never defragmented"),
+
+    Option("bluestore_defrag_extent_ratio", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(2)
+    .set_description("Defragment objects with this many times more extents than ideal"),
+
+    Option("bluestore_inline_data_max", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Store objects up to this size inline in the onode")
+    .set_long_description("Objects no larger than this are kept in the onode key in the key/value store instead of in allocated blobs, which avoids allocation and device IO for tiny objects.  An object is moved to blobs when it grows past this size.  0 disables.  Setting this to a nonzero value raises the store's on-disk compat version on the next mount, because older releases would silently misread inline onodes; such a store can no longer be mounted by an older release, even if this is set back to 0."),
+
+    Option("bluestore_fast_tier_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Size of the fast tier at the start of the main device")
+    .set_long_description("If nonzero, the first bluestore_fast_tier_size bytes of the main block device are treated as a faster tier (e.g., an LV whose leading extents live on flash) with their own allocator.  Small and hot objects are placed there and cold objects are migrated out in the background.")
+    .add_see_also("bluestore_fast_tier_max_object_size")
+    .add_see_also("bluestore_fast_tier_min_free_ratio"),
+
+    Option("bluestore_fast_tier_max_object_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_description("Largest object placed in or promoted to the fast tier"),
+
+    Option("bluestore_fast_tier_min_free_ratio", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.1)
+    .set_description("Stop placing new data in the fast tier below this free ratio")
+    .set_long_description("Cold objects are demoted while the fast tier free ratio is below twice this value."),
+
+    Option("bluestore_fast_tier_promote_hits", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .set_description("Onode cache hits before an object is queued for promotion"),
+
+    Option("bluestore_fast_tier_migrate_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_description("Seconds between tier migration passes"),
+
+    Option("bluestore_fast_tier_migrate_batch", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(32)
+    .set_description("Maximum objects migrated per pass"),
+
+    Option("bluestore_fast_tier_queue_max", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1024)
+    .set_description("Maximum queued promotions (and demotions)"),
+
+    Option("bluestore_bitmap_allocator_shards", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Number of per-cpu reservation shards in front of the bitmap allocator (0 to disable)")
+    .set_long_description("Each shard reserves free space from the bitmap in bulk and hands it out under its own lock, so that concurrent allocations do not all contend on the bitmap lock.")
+    .add_see_also("bluestore_bitmap_allocator_shard_reserve"),
+
+    Option("bluestore_bitmap_allocator_shard_reserve", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4_M)
+    .set_description("Bytes a bitmap allocator shard reserves at a time"),
+
     Option("bluestore_freelist_blocks_per_key", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(128)
     .set_description("Block (and bits) per database key"),
@@ -4121,8 +4337,10 @@ std::vector<Option> get_global_options() {
     .set_description("Enable use of rocksdb column families for bluestore metadata"),
 
     Option("bluestore_rocksdb_cfs", Option::TYPE_STR, Option::LEVEL_DEV)
-    .set_default("M= P= L=")
-    .set_description("List of whitespace-separate key/value pairs where key is CF name and value is CF options"),
+    .set_default("O(3,0-13)=bloom_bits=10 M(3,0-8)=bloom_bits=0 P= L=compaction_style=kCompactionStyleUniversal X= b= B=")
+    .set_description("List of whitespace-separate key/value pairs where key is CF name and value is CF options")
+    .set_long_description("A CF name may be written as name(n) or name(n,l-h) to spread that prefix over n hash-sharded column families, hashing key bytes [l, h) (the whole key by default).  Besides rocksdb column family options, the value accepts block_cache_share=<fraction of rocksdb_cache_size> for a dedicated block cache and bloom_bits=<n> (0 disables the bloom filter).  The shard layout is fixed when the db is created; use ceph-bluestore-tool reshard to change it.")
+    .add_see_also("bluestore_rocksdb_cf"),
 
     Option("bluestore_fsck_on_mount", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(false)
@@ -4148,10 +4366,25 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description("Run deep fsck after mkfs"),
 
+    Option("bluestore_fsck_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_description("Number of threads checking onodes during fsck/repair")
+    .set_long_description("One thread walks the object keyspace and hands onodes to this many workers; 1 checks every onode in the walking thread."),
+
+    Option("bluestore_fsck_progress_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(10)
+    .set_description("Seconds between fsck/repair progress reports (0 to disable)"),
+
     Option("bluestore_sync_submit_transaction", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(false)
     .set_description("Try to submit metadata transaction to rocksdb in queuing thread context"),
 
+    Option("bluestore_kv_sync_lanes", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_min(1)
+    .set_description("Number of parallel kv commit pipelines")
+    .set_long_description("Each collection (PG) is pinned to one lane, so that transactions on a collection still commit in order, while separate lanes batch and sync their transactions to the key/value store in parallel.  Lane 0 also handles deferred write cleanup.  The default of 1 keeps the single kv_sync_thread."),
+
     Option("bluestore_throttle_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
     .set_default(64_M)
     .set_flag(Option::FLAG_RUNTIME)
@@ -4193,6 +4426,22 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Default bluestore_deferred_batch_ops for non-rotational (solid state) media"),
 
+    Option("bluestore_deferred_elevator_hdd", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Submit deferred writes from all sequencers as one offset-sorted pass on rotational media")
+    .set_long_description("Pending deferred batches of every OpSequencer are merged, sorted by disk offset and adjacent extents are coalesced into single IOs, instead of flushing each sequencer's batch separately."),
+
+    Option("bluestore_deferred_elevator_ssd", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Submit deferred writes from all sequencers as one offset-sorted pass on non-rotational media"),
+
+    Option("bluestore_deferred_idle_flush_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Flush queued deferred writes after this many seconds without commits or client writes in flight (0 to disable)"),
+
     Option("bluestore_nid_prealloc", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(1024)
     .set_description("Number of unique object ids to preallocate at a time"),
@@ -16,6 +16,8 @@
 #define _CEPH_INCLUDE_MEMPOOL_H
 
 #include <cstddef>
+#include <cstdint>
+#include <new>
 #include <map>
 #include <unordered_map>
 #include <set>
@@ -246,12 +248,15 @@ public:
 
   void adjust_count(ssize_t items, ssize_t bytes);
 
-  shard_t* pick_a_shard() {
+  static size_t pick_a_shard_int() {
     // Dirt cheap, see:
     //   http://fossies.org/dox/glibc-2.24/pthread__self_8c_source.html
     size_t me = (size_t)pthread_self();
-    size_t i = (me >> 3) & ((1 << num_shard_bits) - 1);
-    return &shard[i];
+    return (me >> 3) & ((1 << num_shard_bits) - 1);
+  }
+
+  shard_t* pick_a_shard() {
+    return &shard[pick_a_shard_int()];
   }
 
   type_t *get_type(const std::type_info& ti, size_t size) {
@@ -386,6 +391,248 @@ public:
 };
 
 
+// Slab allocator for objects that are allocated and freed one at a
+// time (e.g., cache metadata).  Objects are carved out of power-of-two
+// sized, self-aligned slabs so that the owning slab can be found from
+// the object address.  Freed slots are recycled before a new slab is
+// requested from the heap, so a steady allocate/free churn does not
+// touch malloc.  Each slab is owned by one of num_shards shards (picked
+// by the allocating thread); only that shard's lock is taken.
+//
+// Pool accounting is per object, exactly as pool_allocator does it, so
+// the slab slack is not charged to the pool; see get_stats() for that.
+
+struct slab_stats_t {
+  size_t slabs = 0;      ///< slabs currently held
+  size_t bytes = 0;      ///< bytes currently held in slabs
+  size_t items = 0;      ///< live objects
+  size_t refills = 0;    ///< slabs allocated from the heap
+  size_t releases = 0;   ///< slabs returned to the heap
+
+  slab_stats_t& operator+=(const slab_stats_t& o) {
+    slabs += o.slabs;
+    bytes += o.bytes;
+    items += o.items;
+    refills += o.refills;
+    releases += o.releases;
+    return *this;
+  }
+};
+
+template<pool_index_t pool_ix, typename T, size_t min_slab_items = 64>
+class pool_slab_allocator {
+  struct slab_shard_t;
+
+  struct slab_t {
+    slab_shard_t *shard;
+    slab_t *prev = nullptr;    ///< in shard->avail
+    slab_t *next = nullptr;
+    void *free_list = nullptr; ///< recycled slots
+    size_t carved = 0;         ///< slots handed out at least once
+    size_t used = 0;           ///< live slots
+    explicit slab_t(slab_shard_t *s) : shard(s) {}
+  };
+
+  struct slab_shard_t {
+    std::mutex lock;
+    slab_t *avail = nullptr;   ///< slabs with at least one free slot
+    size_t num_empty = 0;      ///< slabs in avail with no live slots
+    std::atomic<size_t> slabs = {0};
+    std::atomic<size_t> items = {0};
+    std::atomic<size_t> refills = {0};
+    std::atomic<size_t> releases = {0};
+  } __attribute__ ((aligned (128)));
+
+  static constexpr size_t align_up(size_t v, size_t a) {
+    return (v + a - 1) / a * a;
+  }
+  static constexpr size_t pow2_up(size_t v) {
+    size_t r = 1;
+    while (r < v)
+      r <<= 1;
+    return r;
+  }
+
+  static constexpr size_t slot_align =
+    alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+  static constexpr size_t slot_size =
+    align_up(sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*),
+	     slot_align);
+  static constexpr size_t header_size = align_up(sizeof(slab_t), slot_align);
+  static constexpr size_t slab_bytes =
+    pow2_up(header_size + slot_size * min_slab_items);
+  static constexpr size_t slab_capacity =
+    (slab_bytes - header_size) / slot_size;
+
+  // keep at most this many empty slabs per shard before giving them
+  // back to the heap
+  static constexpr size_t max_empty_slabs = 4;
+
+  pool_t *pool;
+  type_t *type = nullptr;
+  slab_shard_t shards[num_shards];
+
+  static void _link(slab_shard_t *s, slab_t *slab) {
+    slab->prev = nullptr;
+    slab->next = s->avail;
+    if (s->avail)
+      s->avail->prev = slab;
+    s->avail = slab;
+  }
+  static void _unlink(slab_shard_t *s, slab_t *slab) {
+    if (slab->prev)
+      slab->prev->next = slab->next;
+    else
+      s->avail = slab->next;
+    if (slab->next)
+      slab->next->prev = slab->prev;
+    slab->prev = slab->next = nullptr;
+  }
+
+  slab_t *_new_slab(slab_shard_t *s) {
+    void *ptr;
+    int rc = ::posix_memalign(&ptr, slab_bytes, slab_bytes);
+    if (rc)
+      throw std::bad_alloc();
+    slab_t *slab = new (ptr) slab_t(s);
+    _link(s, slab);
+    ++s->num_empty;
+    ++s->slabs;
+    ++s->refills;
+    return slab;
+  }
+
+  void _account(ssize_t n) {
+    shard_t *shard = pool->pick_a_shard();
+    shard->bytes += n * (ssize_t)sizeof(T);
+    shard->items += n;
+    if (type) {
+      type->items += n;
+    }
+  }
+
+public:
+  pool_slab_allocator() {
+    pool = &get_pool(pool_ix);
+    type = pool->get_type(typeid(T), sizeof(T));
+  }
+  pool_slab_allocator(const pool_slab_allocator&) = delete;
+  pool_slab_allocator& operator=(const pool_slab_allocator&) = delete;
+
+  T* allocate() {
+    slab_shard_t *s = &shards[pool_t::pick_a_shard_int()];
+    std::lock_guard<std::mutex> l(s->lock);
+    slab_t *slab = s->avail;
+    if (!slab) {
+      slab = _new_slab(s);
+    }
+    void *r;
+    if (slab->free_list) {
+      r = slab->free_list;
+      slab->free_list = *reinterpret_cast<void**>(r);
+    } else {
+      assert(slab->carved < slab_capacity);
+      r = reinterpret_cast<char*>(slab) + header_size +
+	slot_size * slab->carved++;
+    }
+    if (slab->used++ == 0) {
+      --s->num_empty;
+    }
+    if (slab->used == slab_capacity) {
+      _unlink(s, slab);
+    }
+    ++s->items;
+    _account(1);
+    return reinterpret_cast<T*>(r);
+  }
+
+  void deallocate(T* p) {
+    _account(-1);
+    slab_t *slab = reinterpret_cast<slab_t*>(
+      reinterpret_cast<uintptr_t>(p) & ~(uintptr_t)(slab_bytes - 1));
+    slab_shard_t *s = slab->shard;
+    std::lock_guard<std::mutex> l(s->lock);
+    assert(slab->used > 0);
+    if (slab->used == slab_capacity) {
+      _link(s, slab);
+    }
+    *reinterpret_cast<void**>(p) = slab->free_list;
+    slab->free_list = p;
+    --s->items;
+    if (--slab->used == 0) {
+      if (s->num_empty >= max_empty_slabs) {
+	_unlink(s, slab);
+	slab->~slab_t();
+	::free(slab);
+	--s->slabs;
+	++s->releases;
+      } else {
+	++s->num_empty;
+      }
+    }
+  }
+
+  void get_stats(slab_stats_t *st) const {
+    *st = slab_stats_t();
+    for (auto& s : shards) {
+      st->slabs += s.slabs;
+      st->items += s.items;
+      st->refills += s.refills;
+      st->releases += s.releases;
+    }
+    st->bytes = st->slabs * slab_bytes;
+  }
+};
+
+// STL allocator that carves container nodes out of a
+// pool_slab_allocator.  It is meant for node based containers
+// (std::list and friends), which allocate one node at a time.  It is
+// stateless: each rebound node type shares one process wide slab
+// allocator, so nodes can be spliced between containers and freed from
+// any thread.
+
+template<pool_index_t pool_ix, typename T>
+class pool_slab_node_allocator {
+  static pool_slab_allocator<pool_ix, T>& slab() {
+    // never destroyed, so containers with static storage duration can
+    // still free their nodes at exit
+    static auto *s = new pool_slab_allocator<pool_ix, T>;
+    return *s;
+  }
+
+public:
+  typedef pool_slab_node_allocator<pool_ix, T> allocator_type;
+  typedef T value_type;
+  typedef value_type *pointer;
+  typedef const value_type * const_pointer;
+  typedef value_type& reference;
+  typedef const value_type& const_reference;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  template<typename U> struct rebind {
+    typedef pool_slab_node_allocator<pool_ix,U> other;
+  };
+
+  pool_slab_node_allocator() {}
+  template<typename U>
+  pool_slab_node_allocator(const pool_slab_node_allocator<pool_ix,U>&) {}
+
+  T* allocate(size_t n, void *p = nullptr) {
+    assert(n == 1);
+    return slab().allocate();
+  }
+
+  void deallocate(T* p, size_t n) {
+    assert(n == 1);
+    slab().deallocate(p);
+  }
+
+  bool operator==(const pool_slab_node_allocator&) const { return true; }
+  bool operator!=(const pool_slab_node_allocator&) const { return false; }
+};
+
+
 // Namespace mempool
 
 #define P(x)								\
@@ -394,6 +641,9 @@ public:
     template<typename v>						\
     using pool_allocator = mempool::pool_allocator<id,v>;		\
                                                                         \
+    template<typename v>						\
+    using slab_allocator = mempool::pool_slab_allocator<id,v>;		\
+                                                                        \
     using string = std::basic_string<char,std::char_traits<char>,       \
                                      pool_allocator<char>>;             \
                                                                         \
@@ -427,6 +677,9 @@ public:
     using list = std::list<v,pool_allocator<v>>;			\
                                                                         \
     template<typename v>						\
+    using slab_list = std::list<v,pool_slab_node_allocator<id,v>>;	\
+                                                                        \
+    template<typename v>						\
     using vector = std::vector<v,pool_allocator<v>>;			\
                                                                         \
     template<typename k, typename v,					\
@@ -527,4 +780,20 @@ bool operator!=(const std::vector<T, mempool::pool_allocator<pool_index, T>>& lh
     return mempool::pool::alloc_##factoryname.deallocate((obj*)p, 1);	\
   }
 
+// Same as MEMPOOL_DEFINE_OBJECT_FACTORY, but objects are carved from
+// per-shard slabs (see pool_slab_allocator) instead of coming straight
+// from the heap.  Use it for small, frequently churned objects.
+#define MEMPOOL_DEFINE_SLAB_OBJECT_FACTORY(obj,factoryname,pool)	\
+  namespace mempool {							\
+    namespace pool {							\
+      slab_allocator<obj> alloc_##factoryname;				\
+    }									\
+  }									\
+  void *obj::operator new(size_t size) {				\
+    return mempool::pool::alloc_##factoryname.allocate();		\
+  }									\
+  void obj::operator delete(void *p)  {					\
+    return mempool::pool::alloc_##factoryname.deallocate((obj*)p);	\
+  }
+
 #endif
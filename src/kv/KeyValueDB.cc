@@ -6,6 +6,8 @@
 #include "LevelDBStore.h"
 #endif
 #include "MemDB.h"
+#include "common/strtol.h"
+#include "include/str_map.h"
 #ifdef HAVE_LIBROCKSDB
 #include "RocksDBStore.h"
 #endif
@@ -65,3 +67,60 @@ int KeyValueDB::test_init(const string& type, const string& dir)
   }
   return -EINVAL;
 }
+
+int KeyValueDB::ColumnFamily::parse(const string &spec, const string &option,
+				    ColumnFamily *out)
+{
+  size_t paren = spec.find('(');
+  if (paren == string::npos) {
+    *out = ColumnFamily(spec, option);
+    return 0;
+  }
+  if (paren == 0 || spec.back() != ')')
+    return -EINVAL;
+  string name = spec.substr(0, paren);
+  string args = spec.substr(paren + 1, spec.size() - paren - 2);
+  string range;
+  size_t comma = args.find(',');
+  if (comma != string::npos) {
+    range = args.substr(comma + 1);
+    args.resize(comma);
+  }
+  string err;
+  long long shards = strict_strtoll(args.c_str(), 10, &err);
+  if (!err.empty() || shards < 1)
+    return -EINVAL;
+  uint32_t l = 0, h = UINT32_MAX;
+  if (!range.empty()) {
+    size_t dash = range.find('-');
+    if (dash == string::npos)
+      return -EINVAL;
+    long long ll = strict_strtoll(range.substr(0, dash).c_str(), 10, &err);
+    if (!err.empty() || ll < 0)
+      return -EINVAL;
+    l = ll;
+    if (dash + 1 < range.size()) {
+      long long hh = strict_strtoll(range.substr(dash + 1).c_str(), 10, &err);
+      if (!err.empty() || hh <= ll)
+	return -EINVAL;
+      h = hh;
+    }
+  }
+  *out = ColumnFamily(name, option, shards, l, h);
+  return 0;
+}
+
+int KeyValueDB::ColumnFamily::parse_list(const string &spec,
+					 vector<ColumnFamily> *out)
+{
+  map<string,string> cf_map;
+  get_str_map(spec, &cf_map, " \t");
+  for (auto& i : cf_map) {
+    ColumnFamily cf(i.first, i.second);
+    int r = parse(i.first, i.second, &cf);
+    if (r < 0)
+      return r;
+    out->push_back(cf);
+  }
+  return 0;
+}
@@ -31,8 +31,21 @@ public:
   struct ColumnFamily {
     string name;      //< name of this individual column family
     string option;    //< configure option string for this CF
+    unsigned shards = 1;       //< number of hash-sharded CFs backing name
+    uint32_t hash_l = 0;       //< first key byte fed to the shard hash
+    uint32_t hash_h = UINT32_MAX; //< one past the last key byte hashed
     ColumnFamily(const string &name, const string &option)
       : name(name), option(option) {}
+    ColumnFamily(const string &name, const string &option,
+		 unsigned shards, uint32_t hash_l, uint32_t hash_h)
+      : name(name), option(option), shards(shards),
+	hash_l(hash_l), hash_h(hash_h) {}
+
+    /// parse "name", "name(shards)" or "name(shards,l-h)"
+    static int parse(const string &spec, const string &option,
+		     ColumnFamily *out);
+    /// parse a whitespace-separated list of name[(shards[,l-h])]=option
+    static int parse_list(const string &spec, vector<ColumnFamily> *out);
   };
 
   class TransactionImpl {
@@ -166,6 +179,11 @@ public:
   /// Try to repair K/V database. leveldb and rocksdb require that database must be not opened.
   virtual int repair(std::ostream &out) { return 0; }
 
+  /// Rewrite K/V database into a new column family layout.  The database must not be opened.
+  virtual int reshard(const vector<ColumnFamily>& cfs, std::ostream &out) {
+    return -EOPNOTSUPP;
+  }
+
   virtual Transaction get_transaction() = 0;
   virtual int submit_transaction(Transaction) = 0;
   virtual int submit_transaction_sync(Transaction t) {
@@ -198,6 +216,13 @@ public:
 		  bufferlist *value) {
     return get(prefix, string(key, keylen), value);
   }
+  /// like get(), but the value may reference memory the db keeps pinned
+  /// (e.g. a cache block) rather than a private copy.  Such values must be
+  /// released before the db is closed.
+  virtual int get_pinned(const std::string &prefix, const std::string &key,
+			 bufferlist *value) {
+    return get(prefix, key, value);
+  }
 
   // This superclass is used both by kv iterators *and* by the ObjectMap
   // omap iterator.  The class hiearchies are unfortunatley tied together
@@ -234,6 +259,11 @@ public:
   };
   typedef std::shared_ptr< IteratorImpl > Iterator;
 
+  typedef uint32_t IteratorOpts;
+  /// value()s may reference memory the db keeps pinned instead of copies;
+  /// as with get_pinned(), they must be released before the db is closed.
+  static const IteratorOpts ITERATOR_PIN_VALUES = 1 << 0;
+
   // This is the low-level iterator implemented by the underlying KV store.
   class WholeSpaceIteratorImpl {
   public:
@@ -273,6 +303,7 @@ private:
   int64_t cache_bytes[PriorityCache::Priority::LAST+1] = { 0 };
   double cache_ratio = 0;
 
+protected:
   // This class filters a WholeSpaceIterator by a prefix.
   class PrefixIteratorImpl : public IteratorImpl {
     const std::string prefix;
@@ -339,7 +370,8 @@ private:
 public:
 
   virtual WholeSpaceIterator get_wholespace_iterator() = 0;
-  virtual Iterator get_iterator(const std::string &prefix) {
+  virtual Iterator get_iterator(const std::string &prefix,
+			       IteratorOpts opts = 0) {
     return std::make_shared<PrefixIteratorImpl>(
       prefix,
       get_wholespace_iterator());
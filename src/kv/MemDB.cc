@@ -51,9 +51,12 @@ static string make_key(const string &prefix, const string &value)
   return out;
 }
 
-void MemDB::_encode(mdb_iter_t iter, bufferlist &bl)
+void MemDB::_encode(const string &prefix, mdb_iter_t iter, bufferlist &bl)
 {
-  encode(iter->first, bl);
+  /*
+   * The on-disk format keeps the flat prefix + KEY_DELIM + key layout.
+   */
+  encode(make_key(prefix, iter->first), bl);
   encode(iter->second, bl);
 }
 
@@ -65,7 +68,7 @@ std::string MemDB::_get_data_fn()
 
 void MemDB::_save()
 {
-  std::lock_guard<std::mutex> l(m_lock);
+  std::unique_lock<std::shared_mutex> l(m_lock);
   dout(10) << __func__ << " Saving MemDB to file: "<< _get_data_fn().c_str() << dendl;
   int mode = 0644;
   int fd = TEMP_FAILURE_RETRY(::open(_get_data_fn().c_str(),
@@ -77,11 +80,11 @@ void MemDB::_save()
     return;
   }
   bufferlist bl;
-  mdb_iter_t iter = m_map.begin();
-  while (iter != m_map.end()) {
-    dout(10) << __func__ << " Key:"<< iter->first << dendl;
-    _encode(iter, bl);
-    ++iter;
+  for (auto& p : m_map) {
+    for (mdb_iter_t iter = p.second.begin(); iter != p.second.end(); ++iter) {
+      dout(10) << __func__ << " Key:"<< p.first << " " << iter->first << dendl;
+      _encode(p.first, iter, bl);
+    }
   }
   bl.write_fd(fd);
 
@@ -90,7 +93,7 @@ void MemDB::_save()
 
 int MemDB::_load()
 {
-  std::lock_guard<std::mutex> l(m_lock);
+  std::unique_lock<std::shared_mutex> l(m_lock);
   dout(10) << __func__ << " Reading MemDB from file: "<< _get_data_fn().c_str() << dendl;
   /*
    * Open file and read it in single shot.
@@ -123,7 +126,9 @@ int MemDB::_load()
     bytes_done += ::decode_file(fd, datap);
 
     dout(10) << __func__ << " Key:"<< key << dendl;
-    m_map[key] = datap;
+    string prefix, k;
+    split_key(key, &prefix, &k);
+    m_map[prefix][k] = datap;
     m_total_bytes += datap.length();
   }
   VOID_TEMP_FAILURE_RETRY(::close(fd));
@@ -200,19 +205,20 @@ int MemDB::submit_transaction(KeyValueDB::Transaction t)
   MDBTransactionImpl* mt =  static_cast<MDBTransactionImpl*>(t.get());
 
   dtrace << __func__ << " " << mt->get_ops().size() << dendl;
+  std::unique_lock<std::shared_mutex> l(m_lock);
   for(auto& op : mt->get_ops()) {
     if(op.first == MDBTransactionImpl::WRITE) {
-      ms_op_t set_op = op.second;
-      _setkey(set_op);
+      _setkey(op.second);
     } else if (op.first == MDBTransactionImpl::MERGE) {
-      ms_op_t merge_op = op.second;
-      _merge(merge_op);
+      _merge(op.second);
     } else {
-      ms_op_t rm_op = op.second;
       assert(op.first == MDBTransactionImpl::DELETE);
-      _rmkey(rm_op);
+      _rmkey(op.second);
     }
   }
+  if (!mt->get_ops().empty()) {
+    iterator_seq_no++;
+  }
 
   return 0;
 }
@@ -278,44 +284,49 @@ void MemDB::MDBTransactionImpl::merge(
   return;
 }
 
-int MemDB::_setkey(ms_op_t &op)
+/*
+ * Caller holds m_lock exclusive.
+ */
+int MemDB::_setkey(const ms_op_t &op)
 {
-  std::lock_guard<std::mutex> l(m_lock);
-  std::string key = make_key(op.first.first, op.first.second);
   bufferlist bl = op.second;
 
   m_total_bytes += bl.length();
 
-  bufferlist bl_old;
-  if (_get(op.first.first, op.first.second, &bl_old)) {
-    /*
-     * delete and free existing key.
-     */
-    assert(m_total_bytes >= bl_old.length());
-    m_total_bytes -= bl_old.length();
-    m_map.erase(key);
-  }
-
-  m_map[key] = bufferptr((char *) bl.c_str(), bl.length());
-  iterator_seq_no++;
+  bufferptr &v = m_map[op.first.first][op.first.second];
+  /*
+   * Replacing the bufferptr drops our ref on the old value; readers that
+   * already got it keep theirs.
+   */
+  assert(m_total_bytes >= v.length());
+  m_total_bytes -= v.length();
+  v = bufferptr((char *) bl.c_str(), bl.length());
   return 0;
 }
 
-int MemDB::_rmkey(ms_op_t &op)
+/*
+ * Caller holds m_lock exclusive.
+ */
+int MemDB::_rmkey(const ms_op_t &op)
 {
-  std::lock_guard<std::mutex> l(m_lock);
-  std::string key = make_key(op.first.first, op.first.second);
-
-  bufferlist bl_old;
-  if (_get(op.first.first, op.first.second, &bl_old)) {
-    assert(m_total_bytes >= bl_old.length());
-    m_total_bytes -= bl_old.length();
+  auto p = m_map.find(op.first.first);
+  if (p == m_map.end()) {
+    return 0;
+  }
+  mdb_iter_t iter = p->second.find(op.first.second);
+  if (iter == p->second.end()) {
+    return 0;
   }
-  iterator_seq_no++;
+  assert(m_total_bytes >= iter->second.length());
+  m_total_bytes -= iter->second.length();
   /*
    * Erase will call the destructor for bufferptr.
    */
-  return m_map.erase(key);
+  p->second.erase(iter);
+  if (p->second.empty()) {
+    m_map.erase(p);
+  }
+  return 1;
 }
 
 std::shared_ptr<KeyValueDB::MergeOperator> MemDB::_find_merge_op(const std::string &prefix)
@@ -331,11 +342,12 @@ std::shared_ptr<KeyValueDB::MergeOperator> MemDB::_find_merge_op(const std::stri
 }
 
 
-int MemDB::_merge(ms_op_t &op)
+/*
+ * Caller holds m_lock exclusive.
+ */
+int MemDB::_merge(const ms_op_t &op)
 {
-  std::lock_guard<std::mutex> l(m_lock);
-  std::string prefix = op.first.first;
-  std::string key = make_key(op.first.first, op.first.second);
+  const std::string &prefix = op.first.first;
   bufferlist bl = op.second;
   int64_t bytes_adjusted = bl.length();
 
@@ -348,50 +360,62 @@ int MemDB::_merge(ms_op_t &op)
   /*
    * call the merge operator with value and non value
    */
-  bufferlist bl_old;
-  if (_get(op.first.first, op.first.second, &bl_old) == false) {
-    std::string new_val;
+  auto r = m_map[prefix].insert(std::make_pair(op.first.second, bufferptr()));
+  bufferptr &v = r.first->second;
+  std::string new_val;
+  if (r.second) {
     /*
      * Merge non existent.
      */
     mop->merge_nonexistent(bl.c_str(), bl.length(), &new_val);
-    m_map[key] = bufferptr(new_val.c_str(), new_val.length());
   } else {
     /*
      * Merge existing.
      */
-    std::string new_val;
-    mop->merge(bl_old.c_str(), bl_old.length(), bl.c_str(), bl.length(), &new_val);
-    m_map[key] = bufferptr(new_val.c_str(), new_val.length());
-    bytes_adjusted -= bl_old.length();
-    bl_old.clear();
+    mop->merge(v.c_str(), v.length(), bl.c_str(), bl.length(), &new_val);
+    bytes_adjusted -= v.length();
   }
+  v = bufferptr(new_val.c_str(), new_val.length());
 
   assert((int64_t)m_total_bytes + bytes_adjusted >= 0);
   m_total_bytes += bytes_adjusted;
-  iterator_seq_no++;
   return 0;
 }
 
 /*
- * Caller take btree lock.
+ * Caller holds m_lock, shared or exclusive.
  */
-bool MemDB::_get(const string &prefix, const string &k, bufferlist *out)
+bufferptr *MemDB::_find(const string &prefix, const string &k)
 {
-  string key = make_key(prefix, k);
+  auto p = m_map.find(prefix);
+  if (p == m_map.end()) {
+    return nullptr;
+  }
+  mdb_iter_t iter = p->second.find(k);
+  if (iter == p->second.end()) {
+    return nullptr;
+  }
+  return &iter->second;
+}
 
-  mdb_iter_t iter = m_map.find(key);
-  if (iter == m_map.end()) {
+/*
+ * Caller holds m_lock, shared or exclusive.  Stored values are never
+ * modified in place (a write replaces the bufferptr), so the reader
+ * shares the buffer instead of copying it.
+ */
+bool MemDB::_get(const string &prefix, const string &k, bufferlist *out)
+{
+  bufferptr *v = _find(prefix, k);
+  if (!v) {
     return false;
   }
-
-  out->push_back((m_map[key].clone()));
+  out->push_back(*v);
   return true;
 }
 
 bool MemDB::_get_locked(const string &prefix, const string &k, bufferlist *out)
 {
-  std::lock_guard<std::mutex> l(m_lock);
+  std::shared_lock<std::shared_mutex> l(m_lock);
   return _get(prefix, k, out);
 }
 
@@ -408,133 +432,187 @@ int MemDB::get(const string &prefix, const std::string& key,
 int MemDB::get(const string &prefix, const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
+  std::shared_lock<std::shared_mutex> l(m_lock);
+  auto p = m_map.find(prefix);
+  if (p == m_map.end()) {
+    return 0;
+  }
   for (const auto& i : keys) {
-    bufferlist bl;
-    if (_get_locked(prefix, i, &bl))
+    mdb_iter_t iter = p->second.find(i);
+    if (iter != p->second.end()) {
+      bufferlist bl;
+      bl.push_back(iter->second);
       out->insert(make_pair(i, bl));
+    }
   }
 
   return 0;
 }
 
+/*
+ * The iterator only holds m_map_lock_p while it moves.  Any committed
+ * transaction invalidates the btree iterators (and may drop a prefix from
+ * the outer map), so each step first checks the sequence number and, if
+ * it moved, re-seeks from the saved current key.  The helpers below
+ * expect the lock to be held.
+ */
 void MemDB::MDBWholeSpaceIteratorImpl::fill_current()
 {
-  bufferlist bl;
-  bl.append(m_iter->second.clone());
-  m_key_value = std::make_pair(m_iter->first, bl);
+  m_prefix = m_prefix_iter->first;
+  m_key = m_iter->first;
+  m_value.clear();
+  m_value.push_back(m_iter->second);
+  m_valid = true;
+  this_seq_no = *global_seq_no;
 }
 
-bool MemDB::MDBWholeSpaceIteratorImpl::valid()
+void
+MemDB::MDBWholeSpaceIteratorImpl::free_last()
+{
+  m_valid = false;
+  m_prefix.clear();
+  m_key.clear();
+  m_value.clear();
+}
+
+bool MemDB::MDBWholeSpaceIteratorImpl::_seek(const std::string &prefix,
+    const std::string &k, bool after)
 {
-  if (m_key_value.first.empty()) {
+  m_prefix_iter = m_map_p->lower_bound(prefix);
+  if (m_prefix_iter == m_map_p->end()) {
     return false;
   }
+  if (m_prefix_iter->first == prefix) {
+    m_iter = after ? m_prefix_iter->second.upper_bound(k) :
+      m_prefix_iter->second.lower_bound(k);
+    if (m_iter == m_prefix_iter->second.end()) {
+      ++m_prefix_iter;
+      if (m_prefix_iter == m_map_p->end()) {
+        return false;
+      }
+      m_iter = m_prefix_iter->second.begin();
+    }
+  } else {
+    m_iter = m_prefix_iter->second.begin();
+  }
   return true;
 }
 
-bool MemDB::MDBWholeSpaceIteratorImpl::iterator_validate() {
+/*
+ * Last key whose prefix sorts <= the given one; everything when empty.
+ */
+bool MemDB::MDBWholeSpaceIteratorImpl::_seek_last(const std::string &prefix)
+{
+  if (prefix.empty()) {
+    m_prefix_iter = m_map_p->end();
+  } else {
+    m_prefix_iter = m_map_p->upper_bound(prefix);
+  }
+  if (m_prefix_iter == m_map_p->begin()) {
+    return false;
+  }
+  --m_prefix_iter;
+  m_iter = m_prefix_iter->second.end();
+  --m_iter;
+  return true;
+}
 
-  if (this_seq_no != *global_seq_no) {
-    auto key = m_key_value.first;
-    assert(!key.empty());
-
-    bool restart_iter = false;
-    if (!m_using_btree) {
-      /*
-       * Map is modified and marker key does not exists, 
-       * restart the iterator from next key.
-       */
-      if (m_map_p->find(key) == m_map_p->end()) {
-        restart_iter = true;
-      }
-    } else {
-      restart_iter = true;
+bool MemDB::MDBWholeSpaceIteratorImpl::_step_next()
+{
+  ++m_iter;
+  if (m_iter == m_prefix_iter->second.end()) {
+    ++m_prefix_iter;
+    if (m_prefix_iter == m_map_p->end()) {
+      return false;
     }
+    m_iter = m_prefix_iter->second.begin();
+  }
+  return true;
+}
 
-    if (restart_iter) {
-      m_iter = m_map_p->lower_bound(key);
-      if (m_iter == m_map_p->end()) {
-        return false;
-      }
+bool MemDB::MDBWholeSpaceIteratorImpl::_step_prev()
+{
+  if (m_iter == m_prefix_iter->second.begin()) {
+    if (m_prefix_iter == m_map_p->begin()) {
+      return false;
     }
-
-    /*
-     * This iter is valid now.
-     */
-    this_seq_no = *global_seq_no;
+    --m_prefix_iter;
+    m_iter = m_prefix_iter->second.end();
   }
-
+  --m_iter;
   return true;
 }
 
-void
-MemDB::MDBWholeSpaceIteratorImpl::free_last()
+bool MemDB::MDBWholeSpaceIteratorImpl::valid()
 {
-  m_key_value.first.clear();
-  m_key_value.second.clear();
+  return m_valid;
 }
 
 string MemDB::MDBWholeSpaceIteratorImpl::key()
 {
-  dtrace << __func__ << " " << m_key_value.first << dendl;
-  string prefix, key;
-  split_key(m_key_value.first, &prefix, &key);
-  return key;
+  dtrace << __func__ << " " << m_key << dendl;
+  return m_key;
 }
 
 pair<string,string> MemDB::MDBWholeSpaceIteratorImpl::raw_key()
 {
-  string prefix, key;
-  split_key(m_key_value.first, &prefix, &key);
-  return make_pair(prefix, key);
+  return make_pair(m_prefix, m_key);
 }
 
 bool MemDB::MDBWholeSpaceIteratorImpl::raw_key_is_prefixed(
     const string &prefix)
 {
-  string p, k;
-  split_key(m_key_value.first, &p, &k);
-  return (p == prefix);
+  return (m_prefix == prefix);
 }
 
 bufferlist MemDB::MDBWholeSpaceIteratorImpl::value()
 {
-  dtrace << __func__ << " " << m_key_value << dendl;
-  return m_key_value.second;
+  dtrace << __func__ << " " << m_prefix << " " << m_key << dendl;
+  return m_value;
 }
 
 int MemDB::MDBWholeSpaceIteratorImpl::next()
 {
-  std::lock_guard<std::mutex> l(*m_map_lock_p);
-  if (!iterator_validate()) {
-    free_last();
+  std::shared_lock<std::shared_mutex> l(*m_map_lock_p);
+  if (!m_valid) {
     return -1;
   }
-  free_last();
-  ++m_iter;
-  if (m_iter != m_map_p->end()) {
-    fill_current();
-    return 0;
+  bool found;
+  if (this_seq_no != *global_seq_no) {
+    found = _seek(m_prefix, m_key, true);
   } else {
+    found = _step_next();
+  }
+  free_last();
+  if (!found) {
     return -1;
   }
+  fill_current();
+  return 0;
 }
 
 int MemDB::MDBWholeSpaceIteratorImpl:: prev()
 {
-  std::lock_guard<std::mutex> l(*m_map_lock_p);
-  if (!iterator_validate()) {
-    free_last();
+  std::shared_lock<std::shared_mutex> l(*m_map_lock_p);
+  if (!m_valid) {
     return -1;
   }
-  free_last();
-  if (m_iter != m_map_p->begin()) {
-    --m_iter;
-    fill_current();
-    return 0;
+  bool found;
+  if (this_seq_no != *global_seq_no) {
+    if (_seek(m_prefix, m_key, false)) {
+      found = _step_prev();
+    } else {
+      found = _seek_last(std::string());
+    }
   } else {
+    found = _step_prev();
+  }
+  free_last();
+  if (!found) {
     return -1;
   }
+  fill_current();
+  return 0;
 }
 
 /*
@@ -542,15 +620,9 @@ int MemDB::MDBWholeSpaceIteratorImpl:: prev()
  */
 int MemDB::MDBWholeSpaceIteratorImpl::seek_to_first(const std::string &k)
 {
-  std::lock_guard<std::mutex> l(*m_map_lock_p);
+  std::shared_lock<std::shared_mutex> l(*m_map_lock_p);
   free_last();
-  if (k.empty()) {
-    m_iter = m_map_p->begin();
-  } else {
-    m_iter = m_map_p->lower_bound(k);
-  }
-  
-  if (m_iter == m_map_p->end()) {
+  if (!_seek(k, std::string(), false)) {
     return -1;
   }
   fill_current();
@@ -559,16 +631,9 @@ int MemDB::MDBWholeSpaceIteratorImpl::seek_to_first(const std::string &k)
 
 int MemDB::MDBWholeSpaceIteratorImpl::seek_to_last(const std::string &k)
 {
-  std::lock_guard<std::mutex> l(*m_map_lock_p);
+  std::shared_lock<std::shared_mutex> l(*m_map_lock_p);
   free_last();
-  if (k.empty()) {
-    m_iter = m_map_p->end();
-    --m_iter;
-  } else {
-    m_iter = m_map_p->lower_bound(k);
-  }
-
-  if (m_iter == m_map_p->end()) {
+  if (!_seek_last(k)) {
     return -1;
   }
   fill_current();
@@ -583,27 +648,25 @@ MemDB::MDBWholeSpaceIteratorImpl::~MDBWholeSpaceIteratorImpl()
 int MemDB::MDBWholeSpaceIteratorImpl::upper_bound(const std::string &prefix,
     const std::string &after) {
 
-  std::lock_guard<std::mutex> l(*m_map_lock_p);
+  std::shared_lock<std::shared_mutex> l(*m_map_lock_p);
 
   dtrace << "upper_bound " << prefix.c_str() << after.c_str() << dendl;
-  string k = make_key(prefix, after);
-  m_iter = m_map_p->upper_bound(k);
-  if (m_iter != m_map_p->end()) {
-    fill_current();
-    return 0;
+  free_last();
+  if (!_seek(prefix, after, true)) {
+    return -1;
   }
-  return -1;
+  fill_current();
+  return 0;
 }
 
 int MemDB::MDBWholeSpaceIteratorImpl::lower_bound(const std::string &prefix,
     const std::string &to) {
-  std::lock_guard<std::mutex> l(*m_map_lock_p);
+  std::shared_lock<std::shared_mutex> l(*m_map_lock_p);
   dtrace << "lower_bound " << prefix.c_str() << to.c_str() << dendl;
-  string k = make_key(prefix, to);
-  m_iter = m_map_p->lower_bound(k);
-  if (m_iter != m_map_p->end()) {
-    fill_current();
-    return 0;
+  free_last();
+  if (!_seek(prefix, to, false)) {
+    return -1;
   }
-  return -1;
+  fill_current();
+  return 0;
 }
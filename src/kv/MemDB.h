@@ -14,6 +14,7 @@
 #include <map>
 #include <string>
 #include <memory>
+#include <shared_mutex>
 #include <boost/scoped_ptr.hpp>
 #include "include/encoding.h"
 #include "include/btree_map.h"
@@ -26,15 +27,29 @@ using std::string;
 class MemDB : public KeyValueDB
 {
   typedef std::pair<std::pair<std::string, std::string>, bufferlist> ms_op_t;
-  std::mutex m_lock;
+
+  /*
+   * Readers (get, iterator steps) take m_lock shared; a transaction is
+   * applied as a whole under the exclusive lock, so readers never see a
+   * half-applied transaction and do not serialize against each other.
+   */
+  std::shared_mutex m_lock;
   uint64_t m_total_bytes;
   uint64_t m_allocated_bytes;
 
-  typedef std::map<std::string, bufferptr> mdb_map_t;
+  /*
+   * Keys are stored in one btree per prefix, so the prefix is kept once
+   * instead of in front of every key and lookups only compare the key
+   * part.  Iterating the outer map in order and each btree in order
+   * yields the same ordering as the flat prefix + KEY_DELIM + key space.
+   * A prefix with no keys left is dropped from the outer map.
+   */
+  typedef btree::btree_map<std::string, bufferptr> mdb_map_t;
   typedef mdb_map_t::iterator mdb_iter_t;
-  bool m_using_btree;
+  typedef std::map<std::string, mdb_map_t> mdb_prefix_map_t;
+  typedef mdb_prefix_map_t::iterator mdb_prefix_iter_t;
 
-  mdb_map_t m_map;
+  mdb_prefix_map_t m_map;
 
   CephContext *m_cct;
   void* m_priv;
@@ -44,17 +59,18 @@ class MemDB : public KeyValueDB
   int transaction_rollback(KeyValueDB::Transaction t);
   int _open(ostream &out);
   void close() override;
+  bufferptr *_find(const string &prefix, const string &k);
   bool _get(const string &prefix, const string &k, bufferlist *out);
   bool _get_locked(const string &prefix, const string &k, bufferlist *out);
   std::string _get_data_fn();
-  void _encode(mdb_iter_t iter, bufferlist &bl);
+  void _encode(const string &prefix, mdb_iter_t iter, bufferlist &bl);
   void _save();
   int _load();
   uint64_t iterator_seq_no;
 
 public:
   MemDB(CephContext *c, const string &path, void *p) :
-    m_total_bytes(0), m_allocated_bytes(0), m_using_btree(false),
+    m_total_bytes(0), m_allocated_bytes(0),
     m_cct(c), m_priv(p), m_db_path(path), iterator_seq_no(1)
   {
     //Nothing as of now
@@ -109,10 +125,9 @@ private:
   /*
    * Transaction states.
    */
-  int _merge(const std::string &k, bufferptr &bl);
-  int _merge(ms_op_t &op);
-  int _setkey(ms_op_t &op);
-  int _rmkey(ms_op_t &op);
+  int _merge(const ms_op_t &op);
+  int _setkey(const ms_op_t &op);
+  int _rmkey(const ms_op_t &op);
 
 public:
 
@@ -141,23 +156,31 @@ public:
 
   class MDBWholeSpaceIteratorImpl : public KeyValueDB::WholeSpaceIteratorImpl {
 
+      mdb_prefix_iter_t m_prefix_iter;
       mdb_iter_t m_iter;
-      std::pair<string, bufferlist> m_key_value;
-      mdb_map_t *m_map_p;
-      std::mutex *m_map_lock_p;
+      std::string m_prefix;
+      std::string m_key;
+      bufferlist m_value;
+      bool m_valid = false;
+      mdb_prefix_map_t *m_map_p;
+      std::shared_mutex *m_map_lock_p;
       uint64_t *global_seq_no;
       uint64_t this_seq_no;
-      bool m_using_btree;
+
+      bool _seek(const std::string &prefix, const std::string &k, bool after);
+      bool _seek_last(const std::string &prefix);
+      bool _step_next();
+      bool _step_prev();
 
   public:
-    MDBWholeSpaceIteratorImpl(mdb_map_t *btree_p, std::mutex *btree_lock_p,
-                              uint64_t *iterator_seq_no, bool using_btree) {
-      m_map_p = btree_p;
-      m_map_lock_p = btree_lock_p;
-      std::lock_guard<std::mutex> l(*m_map_lock_p);
+    MDBWholeSpaceIteratorImpl(mdb_prefix_map_t *map_p,
+                              std::shared_mutex *map_lock_p,
+                              uint64_t *iterator_seq_no) {
+      m_map_p = map_p;
+      m_map_lock_p = map_lock_p;
+      std::shared_lock<std::shared_mutex> l(*m_map_lock_p);
       global_seq_no = iterator_seq_no;
       this_seq_no = *iterator_seq_no;
-      m_using_btree = using_btree;
     }
 
     void fill_current();
@@ -173,7 +196,6 @@ public:
     int upper_bound(const std::string &prefix, const std::string &after) override;
     int lower_bound(const std::string &prefix, const std::string &to) override;
     bool valid() override;
-    bool iterator_validate();
 
     int next() override;
     int prev() override;
@@ -187,12 +209,12 @@ public:
   };
 
   uint64_t get_estimated_size(std::map<std::string,uint64_t> &extra) override {
-      std::lock_guard<std::mutex> l(m_lock);
+      std::shared_lock<std::shared_mutex> l(m_lock);
       return m_allocated_bytes;
   };
 
   int get_statfs(struct store_statfs_t *buf) override {
-    std::lock_guard<std::mutex> l(m_lock);
+    std::shared_lock<std::shared_mutex> l(m_lock);
     buf->reset();
     buf->total = m_total_bytes;
     buf->allocated = m_allocated_bytes;
@@ -202,7 +224,7 @@ public:
 
   WholeSpaceIterator get_wholespace_iterator() override {
     return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
-      new MDBWholeSpaceIteratorImpl(&m_map, &m_lock, &iterator_seq_no, m_using_btree));
+      new MDBWholeSpaceIteratorImpl(&m_map, &m_lock, &iterator_seq_no));
   }
 };
 
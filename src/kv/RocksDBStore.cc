@@ -22,6 +22,9 @@ using std::string;
 #include "common/perf_counters.h"
 #include "common/debug.h"
 #include "common/PriorityCache.h"
+#include "common/deleter.h"
+#include "include/ceph_hash.h"
+#include "common/strtol.h"
 #include "include/str_list.h"
 #include "include/stringify.h"
 #include "include/str_map.h"
@@ -77,6 +80,9 @@ public:
     for (auto& p : store.cf_handles) {
       names.erase(p.first);
     }
+    for (auto& p : store.cf_shards) {
+      names.erase(p.first);
+    }
     for (auto& p : names) {
       store.assoc_name += '.';
       store.assoc_name += p.first;
@@ -310,6 +316,175 @@ int RocksDBStore::install_cf_mergeop(
   return 0;
 }
 
+// name of the CF backing shard idx of a column family spec
+static string shard_cf_name(const KeyValueDB::ColumnFamily& cf, unsigned idx)
+{
+  if (cf.shards <= 1)
+    return cf.name;
+  return cf.name + "-" + stringify(idx);
+}
+
+// CF names ending in -<n> are shards of the prefix before the dash
+static string cf_base_name(const string& n, unsigned *idx = nullptr)
+{
+  size_t dash = n.rfind('-');
+  if (dash == string::npos || dash == 0 || dash + 1 == n.size())
+    return n;
+  unsigned v = 0;
+  for (size_t i = dash + 1; i < n.size(); ++i) {
+    if (n[i] < '0' || n[i] > '9')
+      return n;
+    v = v * 10 + (n[i] - '0');
+  }
+  if (idx)
+    *idx = v;
+  return n.substr(0, dash);
+}
+
+int RocksDBStore::build_cf_options(
+  const rocksdb::Options& opt,
+  const ColumnFamily& cf,
+  rocksdb::ColumnFamilyOptions *cf_opt)
+{
+  // copy default CF settings, block cache, merge operators as
+  // the base for new CF
+  *cf_opt = rocksdb::ColumnFamilyOptions(opt);
+
+  // pull out the table options we handle ourselves; everything else is
+  // passed to rocksdb.  only split on ';' outside of {} so nested option
+  // groups survive.
+  string rocks_opts;
+  double cache_share = 0;
+  int64_t bloom_bits = -1;
+  int depth = 0;
+  size_t start = 0;
+  for (size_t i = 0; i <= cf.option.size(); ++i) {
+    if (i < cf.option.size()) {
+      char c = cf.option[i];
+      if (c == '{')
+	++depth;
+      else if (c == '}')
+	--depth;
+      if (c != ';' || depth > 0)
+	continue;
+    }
+    string item = cf.option.substr(start, i - start);
+    start = i + 1;
+    size_t eq = item.find('=');
+    string k = item.substr(0, eq);
+    string err;
+    if (k == "block_cache_share" && eq != string::npos) {
+      cache_share = strict_strtod(item.substr(eq + 1).c_str(), &err);
+    } else if (k == "bloom_bits" && eq != string::npos) {
+      bloom_bits = strict_strtoll(item.substr(eq + 1).c_str(), 10, &err);
+    } else if (!item.empty()) {
+      if (!rocks_opts.empty())
+	rocks_opts += ';';
+      rocks_opts += item;
+    }
+    if (!err.empty() || cache_share < 0 || cache_share > 1) {
+      derr << __func__ << " invalid option '" << item << "' for CF "
+	   << cf.name << dendl;
+      return -EINVAL;
+    }
+  }
+
+  // user input options will override the base options
+  rocksdb::Status status = rocksdb::GetColumnFamilyOptionsFromString(
+    *cf_opt, rocks_opts, cf_opt);
+  if (!status.ok()) {
+    derr << __func__ << " invalid db column family options for CF '"
+	 << cf.name << "': " << cf.option << dendl;
+    return -EINVAL;
+  }
+
+  if (cache_share > 0 || bloom_bits >= 0) {
+    rocksdb::BlockBasedTableOptions cf_bbt_opts = bbt_opts;
+    if (cache_share > 0) {
+      // a dedicated cache, so a hot prefix can't evict everyone else's
+      // blocks; it is not resized by the cache autotuner.
+      uint64_t size = cache_size * cache_share;
+      cf_bbt_opts.block_cache = rocksdb::NewLRUCache(
+	size, g_conf->rocksdb_cache_shard_bits);
+      dout(10) << __func__ << " CF " << cf.name << " block_cache size "
+	       << byte_u_t(size) << dendl;
+    }
+    if (bloom_bits > 0) {
+      cf_bbt_opts.filter_policy.reset(
+	rocksdb::NewBloomFilterPolicy(bloom_bits));
+    } else if (bloom_bits == 0) {
+      cf_bbt_opts.filter_policy.reset();
+    }
+    cf_opt->table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(cf_bbt_opts));
+  }
+  install_cf_mergeop(cf.name, cf_opt);
+  return 0;
+}
+
+int RocksDBStore::read_sharding(string *def, bool *resharding)
+{
+  rocksdb::Env *e = env ? env : rocksdb::Env::Default();
+  string data;
+  def->clear();
+  *resharding = false;
+  rocksdb::Status status = rocksdb::ReadFileToString(e, sharding_file(), &data);
+  if (status.IsNotFound())
+    return 0;
+  if (!status.ok()) {
+    derr << __func__ << " failed to read " << sharding_file() << ": "
+	 << status.ToString() << dendl;
+    return -EIO;
+  }
+  list<string> tokens;
+  get_str_list(data, " \t\n", tokens);
+  for (auto& t : tokens) {
+    if (t == "resharding") {
+      *resharding = true;
+      continue;
+    }
+    if (!def->empty())
+      *def += ' ';
+    *def += t;
+  }
+  return 0;
+}
+
+int RocksDBStore::write_sharding(const vector<ColumnFamily>& cfs,
+				 bool resharding)
+{
+  rocksdb::Env *e = env ? env : rocksdb::Env::Default();
+  string data;
+  if (resharding)
+    data = "resharding\n";
+  for (auto& p : cfs) {
+    if (p.shards <= 1)
+      continue;
+    data += p.name + "(" + stringify(p.shards) + "," + stringify(p.hash_l) +
+      "-" + (p.hash_h == UINT32_MAX ? string() : stringify(p.hash_h)) + ")\n";
+  }
+  rocksdb::Status status = rocksdb::WriteStringToFile(
+    e, data, sharding_file(), true);
+  if (!status.ok()) {
+    derr << __func__ << " failed to write " << sharding_file() << ": "
+	 << status.ToString() << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+rocksdb::ColumnFamilyHandle *RocksDBStore::get_cf_handle(
+  const std::string& prefix, const char *key, size_t keylen)
+{
+  auto shards = get_cf_shards(prefix);
+  if (!shards)
+    return get_cf_handle(prefix);
+  size_t l = std::min<size_t>(shards->hash_l, keylen);
+  size_t h = std::min<size_t>(shards->hash_h, keylen);
+  uint32_t hash = ceph_str_hash_rjenkins(key + l, h - l);
+  return shards->handles[hash % shards->handles.size()];
+}
+
 int RocksDBStore::create_and_open(ostream &out,
 				  const vector<ColumnFamily>& cfs)
 {
@@ -471,31 +646,63 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
     // create and open column families
     if (cfs) {
       for (auto& p : *cfs) {
-	// copy default CF settings, block cache, merge operators as
-	// the base for new CF
-	rocksdb::ColumnFamilyOptions cf_opt(opt);
-	// user input options will override the base options
-	status = rocksdb::GetColumnFamilyOptionsFromString(
-	  cf_opt, p.option, &cf_opt);
-	if (!status.ok()) {
-	  derr << __func__ << " invalid db column family option string for CF: "
-	       << p.name << dendl;
-	  return -EINVAL;
-	}
-	install_cf_mergeop(p.name, &cf_opt);
-	rocksdb::ColumnFamilyHandle *cf;
-	status = db->CreateColumnFamily(cf_opt, p.name, &cf);
-	if (!status.ok()) {
-	  derr << __func__ << " Failed to create rocksdb column family: "
-	       << p.name << dendl;
-	  return -EINVAL;
+	rocksdb::ColumnFamilyOptions cf_opt;
+	r = build_cf_options(opt, p, &cf_opt);
+	if (r < 0)
+	  return r;
+	for (unsigned i = 0; i < p.shards; ++i) {
+	  string name = shard_cf_name(p, i);
+	  rocksdb::ColumnFamilyHandle *cf;
+	  status = db->CreateColumnFamily(cf_opt, name, &cf);
+	  if (!status.ok()) {
+	    derr << __func__ << " Failed to create rocksdb column family: "
+		 << name << dendl;
+	    return -EINVAL;
+	  }
+	  // store the new CF handle
+	  if (p.shards > 1) {
+	    auto& sh = cf_shards[p.name];
+	    sh.hash_l = p.hash_l;
+	    sh.hash_h = p.hash_h;
+	    sh.handles.push_back(cf);
+	  } else {
+	    add_column_family(p.name, static_cast<void*>(cf));
+	  }
 	}
-	// store the new CF handle
-	add_column_family(p.name, static_cast<void*>(cf));
+      }
+      if (!cf_shards.empty()) {
+	r = write_sharding(*cfs, false);
+	if (r < 0)
+	  return r;
       }
     }
     default_cf = db->DefaultColumnFamily();
   } else {
+    // the shard layout is fixed at creation (or by reshard); only the
+    // options come from cfs.
+    string sharding;
+    bool resharding = false;
+    r = read_sharding(&sharding, &resharding);
+    if (r < 0)
+      return r;
+    if (resharding) {
+      derr << __func__ << " an interrupted reshard was found; rerun reshard"
+	   << " before opening the db" << dendl;
+      return -EBUSY;
+    }
+    map<string, ColumnFamily> sharded;
+    list<string> specs;
+    get_str_list(sharding, " \t\n", specs);
+    for (auto& i : specs) {
+      ColumnFamily cf("", "");
+      if (ColumnFamily::parse(i, "", &cf) < 0) {
+	derr << __func__ << " invalid sharding '" << i << "' in "
+	     << sharding_file() << dendl;
+	return -EIO;
+      }
+      sharded.emplace(cf.name, cf);
+    }
+
     std::vector<string> existing_cfs;
     status = rocksdb::DB::ListColumnFamilies(
       rocksdb::DBOptions(opt),
@@ -514,33 +721,30 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
       // we cannot change column families for a created database.  so, map
       // what options we are given to whatever cf's already exist.
       std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+      std::vector<string> bases;
       for (auto& n : existing_cfs) {
-	// copy default CF settings, block cache, merge operators as
-	// the base for new CF
+	string base = cf_base_name(n);
+	if (!sharded.count(base))
+	  base = n;
+	bases.push_back(base);
 	rocksdb::ColumnFamilyOptions cf_opt(opt);
 	bool found = false;
-	if (cfs) {
+	if (cfs && n != rocksdb::kDefaultColumnFamilyName) {
 	  for (auto& i : *cfs) {
-	    if (i.name == n) {
+	    if (i.name == base) {
 	      found = true;
-	      status = rocksdb::GetColumnFamilyOptionsFromString(
-		cf_opt, i.option, &cf_opt);
-	      if (!status.ok()) {
-		derr << __func__ << " invalid db column family options for CF '"
-		     << i.name << "': " << i.option << dendl;
-		return -EINVAL;
-	      }
+	      r = build_cf_options(opt, i, &cf_opt);
+	      if (r < 0)
+		return r;
 	    }
 	  }
 	}
-	if (n != rocksdb::kDefaultColumnFamilyName) {
-	  install_cf_mergeop(n, &cf_opt);
-	}
-	column_families.push_back(rocksdb::ColumnFamilyDescriptor(n, cf_opt));
 	if (!found && n != rocksdb::kDefaultColumnFamilyName) {
+	  install_cf_mergeop(base, &cf_opt);
 	  dout(1) << __func__ << " column family '" << n
 		  << "' exists but not expected" << dendl;
 	}
+	column_families.push_back(rocksdb::ColumnFamilyDescriptor(n, cf_opt));
       }
       std::vector<rocksdb::ColumnFamilyHandle*> handles;
       status = rocksdb::DB::Open(rocksdb::DBOptions(opt),
@@ -553,14 +757,39 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
 	if (existing_cfs[i] == rocksdb::kDefaultColumnFamilyName) {
 	  default_cf = handles[i];
 	  must_close_default_cf = true;
+	} else if (bases[i] != existing_cfs[i]) {
+	  unsigned idx = 0;
+	  cf_base_name(existing_cfs[i], &idx);
+	  auto& spec = sharded.at(bases[i]);
+	  auto& sh = cf_shards[bases[i]];
+	  sh.hash_l = spec.hash_l;
+	  sh.hash_h = spec.hash_h;
+	  sh.handles.resize(spec.shards);
+	  if (idx >= spec.shards) {
+	    derr << __func__ << " unexpected column family "
+		 << existing_cfs[i] << dendl;
+	    return -EIO;
+	  }
+	  sh.handles[idx] = handles[i];
 	} else {
 	  add_column_family(existing_cfs[i], static_cast<void*>(handles[i]));
 	}
       }
+      for (auto& p : cf_shards) {
+	for (unsigned i = 0; i < p.second.handles.size(); ++i) {
+	  if (!p.second.handles[i]) {
+	    derr << __func__ << " missing column family " << p.first << "-"
+		 << i << dendl;
+	    return -EIO;
+	  }
+	}
+      }
     }
   }
   assert(default_cf != nullptr);
-  
+  zero_copy_min_bytes = cct->_conf->get_val<uint64_t>(
+    "rocksdb_zero_copy_min_bytes");
+
   PerfCountersBuilder plb(g_ceph_context, "rocksdb", l_rocksdb_first, l_rocksdb_last);
   plb.add_u64_counter(l_rocksdb_gets, "get", "Gets");
   plb.add_u64_counter(l_rocksdb_txns, "submit_transaction", "Submit transactions");
@@ -577,6 +806,10 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
   plb.add_time_avg(l_rocksdb_write_delay_time, "rocksdb_write_delay_time", "Rocksdb write delay time");
   plb.add_time_avg(l_rocksdb_write_pre_and_post_process_time, 
       "rocksdb_write_pre_and_post_time", "total time spent on writing a record, excluding write process");
+  plb.add_u64_counter(l_rocksdb_zero_copy_reads, "zero_copy_reads",
+		      "Values handed out referencing pinned db memory");
+  plb.add_u64_counter(l_rocksdb_zero_copy_bytes, "zero_copy_bytes",
+		      "Bytes handed out referencing pinned db memory");
   logger = plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 
@@ -605,22 +838,35 @@ RocksDBStore::~RocksDBStore()
   delete logger;
 
   // Ensure db is destroyed before dependent db_cache and filterpolicy
+  close_cf_handles();
+  delete db;
+  db = nullptr;
+
+  if (priv) {
+    delete static_cast<rocksdb::Env*>(priv);
+  }
+}
+
+void RocksDBStore::close_cf_handles()
+{
   for (auto& p : cf_handles) {
     db->DestroyColumnFamilyHandle(
       static_cast<rocksdb::ColumnFamilyHandle*>(p.second));
     p.second = nullptr;
   }
+  cf_handles.clear();
+  for (auto& p : cf_shards) {
+    for (auto h : p.second.handles) {
+      if (h)
+	db->DestroyColumnFamilyHandle(h);
+    }
+  }
+  cf_shards.clear();
   if (must_close_default_cf) {
     db->DestroyColumnFamilyHandle(default_cf);
     must_close_default_cf = false;
   }
   default_cf = nullptr;
-  delete db;
-  db = nullptr;
-
-  if (priv) {
-    delete static_cast<rocksdb::Env*>(priv);
-  }
 }
 
 void RocksDBStore::close()
@@ -658,6 +904,192 @@ int RocksDBStore::repair(std::ostream &out)
   }
 }
 
+int RocksDBStore::reshard(const vector<ColumnFamily>& new_cfs, ostream &out)
+{
+  // If you fail here, it's because you can't do this on an open database
+  assert(db == nullptr);
+  rocksdb::Options opt;
+  int r = load_rocksdb_options(false, opt);
+  if (r) {
+    out << "load rocksdb options failed" << std::endl;
+    return r;
+  }
+
+  // open every existing CF, whatever its layout.  the iterators below
+  // need the merge operators to return fully merged values.
+  std::vector<string> existing_cfs;
+  rocksdb::Status status = rocksdb::DB::ListColumnFamilies(
+    rocksdb::DBOptions(opt), path, &existing_cfs);
+  if (!status.ok()) {
+    out << "failed to list column families: " << status.ToString()
+	<< std::endl;
+    return -EIO;
+  }
+  // use the configured options for CFs the layout still knows about,
+  // so e.g. a universal compaction CF is not reopened as leveled.
+  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+  for (auto& n : existing_cfs) {
+    rocksdb::ColumnFamilyOptions cf_opt(opt);
+    if (n != rocksdb::kDefaultColumnFamilyName) {
+      string base = cf_base_name(n);
+      bool found = false;
+      for (auto& i : new_cfs) {
+	if (i.name == base || i.name == n) {
+	  found = true;
+	  r = build_cf_options(opt, i, &cf_opt);
+	  if (r < 0) {
+	    out << "invalid options for column family " << i.name << std::endl;
+	    return r;
+	  }
+	  install_cf_mergeop(base, &cf_opt);
+	  break;
+	}
+      }
+      if (!found) {
+	install_cf_mergeop(base, &cf_opt);
+      }
+    }
+    column_families.push_back(rocksdb::ColumnFamilyDescriptor(n, cf_opt));
+  }
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  status = rocksdb::DB::Open(rocksdb::DBOptions(opt), path, column_families,
+			     &handles, &db);
+  if (!status.ok()) {
+    out << "failed to open db: " << status.ToString() << std::endl;
+    db = nullptr;
+    return -EIO;
+  }
+
+  // a crash from here on leaves the marker behind, and a normal open will
+  // refuse the db until reshard is run again.  both passes only copy
+  // before they delete, so rerunning always converges.
+  r = write_sharding(new_cfs, true);
+  if (r < 0)
+    goto out;
+
+  {
+    const uint64_t batch_bytes =
+      g_conf->get_val<uint64_t>("rocksdb_reshard_batch_bytes");
+    rocksdb::WriteOptions wopt;
+    rocksdb::WriteBatch bat;
+    auto flush = [&](bool force) {
+      if (bat.GetDataSize() < batch_bytes && !force)
+	return rocksdb::Status::OK();
+      wopt.sync = force;
+      auto s = db->Write(wopt, &bat);
+      bat.Clear();
+      return s;
+    };
+
+    for (unsigned i = 0; i < existing_cfs.size(); ++i) {
+      if (existing_cfs[i] == rocksdb::kDefaultColumnFamilyName) {
+	default_cf = handles[i];
+	must_close_default_cf = true;
+      }
+    }
+    assert(default_cf != nullptr);
+
+    // pass 1: fold all CFs back into the default CF
+    for (unsigned i = 0; i < existing_cfs.size(); ++i) {
+      if (handles[i] == default_cf)
+	continue;
+      string base = cf_base_name(existing_cfs[i]);
+      uint64_t n = 0;
+      rocksdb::Iterator *it = db->NewIterator(rocksdb::ReadOptions(),
+					      handles[i]);
+      for (it->SeekToFirst(); it->Valid() && status.ok(); it->Next(), ++n) {
+	bat.Put(default_cf, combine_strings(base, it->key().ToString()),
+		it->value());
+	status = flush(false);
+      }
+      if (status.ok())
+	status = it->status();
+      delete it;
+      if (status.ok())
+	status = flush(true);
+      if (status.ok())
+	status = db->DropColumnFamily(handles[i]);
+      db->DestroyColumnFamilyHandle(handles[i]);
+      handles[i] = nullptr;
+      if (!status.ok()) {
+	out << "failed to fold column family " << existing_cfs[i] << ": "
+	    << status.ToString() << std::endl;
+	r = -EIO;
+	goto out;
+      }
+      out << "moved " << n << " keys from column family " << existing_cfs[i]
+	  << " to default" << std::endl;
+    }
+
+    // pass 2: create the new CFs and move their prefixes out of default
+    for (auto& p : new_cfs) {
+      rocksdb::ColumnFamilyOptions cf_opt;
+      r = build_cf_options(opt, p, &cf_opt);
+      if (r < 0)
+	goto out;
+      for (unsigned i = 0; i < p.shards; ++i) {
+	string name = shard_cf_name(p, i);
+	rocksdb::ColumnFamilyHandle *cf;
+	status = db->CreateColumnFamily(cf_opt, name, &cf);
+	if (!status.ok()) {
+	  out << "failed to create column family " << name << ": "
+	      << status.ToString() << std::endl;
+	  r = -EIO;
+	  goto out;
+	}
+	if (p.shards > 1) {
+	  auto& sh = cf_shards[p.name];
+	  sh.hash_l = p.hash_l;
+	  sh.hash_h = p.hash_h;
+	  sh.handles.push_back(cf);
+	} else {
+	  add_column_family(p.name, static_cast<void*>(cf));
+	}
+      }
+      string start = combine_strings(p.name, string());
+      string end = past_prefix(p.name);
+      uint64_t n = 0;
+      rocksdb::Iterator *it = db->NewIterator(rocksdb::ReadOptions(),
+					      default_cf);
+      for (it->Seek(start);
+	   it->Valid() && it->key().compare(end) < 0 && status.ok();
+	   it->Next(), ++n) {
+	string key;
+	split_key(it->key(), nullptr, &key);
+	bat.Put(get_cf_handle(p.name, key), key, it->value());
+	bat.Delete(default_cf, it->key());
+	status = flush(false);
+      }
+      if (status.ok())
+	status = it->status();
+      delete it;
+      if (status.ok())
+	status = flush(true);
+      if (!status.ok()) {
+	out << "failed to move prefix " << p.name << ": "
+	    << status.ToString() << std::endl;
+	r = -EIO;
+	goto out;
+      }
+      out << "moved " << n << " keys with prefix " << p.name << " into "
+	  << p.shards << " column famil" << (p.shards > 1 ? "ies" : "y")
+	  << std::endl;
+    }
+  }
+
+  r = write_sharding(new_cfs, false);
+
+ out:
+  for (auto h : handles) {
+    if (h && h != default_cf)
+      db->DestroyColumnFamilyHandle(h);
+  }
+  close_cf_handles();
+  delete db;
+  db = nullptr;
+  return r;
+}
+
 void RocksDBStore::split_stats(const std::string &s, char delim, std::vector<std::string> &elems) {
     std::stringstream ss;
     ss.str(s);
@@ -833,7 +1265,7 @@ void RocksDBStore::RocksDBTransactionImpl::set(
   const string &k,
   const bufferlist &to_set_bl)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k);
   if (cf) {
     put_bat(bat, cf, k, to_set_bl);
   } else {
@@ -847,7 +1279,7 @@ void RocksDBStore::RocksDBTransactionImpl::set(
   const char *k, size_t keylen,
   const bufferlist &to_set_bl)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k, keylen);
   if (cf) {
     string key(k, keylen);  // fixme?
     put_bat(bat, cf, key, to_set_bl);
@@ -861,7 +1293,7 @@ void RocksDBStore::RocksDBTransactionImpl::set(
 void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 					         const string &k)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k);
   if (cf) {
     bat.Delete(cf, rocksdb::Slice(k));
   } else {
@@ -873,7 +1305,7 @@ void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 					         const char *k,
 						 size_t keylen)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k, keylen);
   if (cf) {
     bat.Delete(cf, rocksdb::Slice(k, keylen));
   } else {
@@ -886,7 +1318,7 @@ void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 void RocksDBStore::RocksDBTransactionImpl::rm_single_key(const string &prefix,
 					                 const string &k)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k);
   if (cf) {
     bat.SingleDelete(cf, k);
   } else {
@@ -897,16 +1329,24 @@ void RocksDBStore::RocksDBTransactionImpl::rm_single_key(const string &prefix,
 void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
 {
   auto cf = db->get_cf_handle(prefix);
-  if (cf) {
+  auto shards = db->get_cf_shards(prefix);
+  if (cf || shards) {
     if (db->enable_rmrange) {
       string endprefix("\xff\xff\xff\xff");  // FIXME: this is cheating...
-      bat.DeleteRange(cf, string(), endprefix);
+      if (shards) {
+	for (auto h : shards->handles) {
+	  bat.DeleteRange(h, string(), endprefix);
+	}
+      } else {
+	bat.DeleteRange(cf, string(), endprefix);
+      }
     } else {
       auto it = db->get_iterator(prefix);
       for (it->seek_to_first();
 	   it->valid();
 	   it->next()) {
-	bat.Delete(cf, rocksdb::Slice(it->key()));
+	string k = it->key();
+	bat.Delete(db->get_cf_handle(prefix, k), rocksdb::Slice(k));
       }
     }
   } else {
@@ -932,17 +1372,25 @@ void RocksDBStore::RocksDBTransactionImpl::rm_range_keys(const string &prefix,
                                                          const string &end)
 {
   auto cf = db->get_cf_handle(prefix);
-  if (cf) {
+  auto shards = db->get_cf_shards(prefix);
+  if (cf || shards) {
     if (db->enable_rmrange) {
-      bat.DeleteRange(cf, rocksdb::Slice(start), rocksdb::Slice(end));
+      if (shards) {
+	for (auto h : shards->handles) {
+	  bat.DeleteRange(h, rocksdb::Slice(start), rocksdb::Slice(end));
+	}
+      } else {
+	bat.DeleteRange(cf, rocksdb::Slice(start), rocksdb::Slice(end));
+      }
     } else {
       auto it = db->get_iterator(prefix);
       it->lower_bound(start);
       while (it->valid()) {
-	if (it->key() >= end) {
+	string k = it->key();
+	if (k >= end) {
 	  break;
 	}
-	bat.Delete(cf, rocksdb::Slice(it->key()));
+	bat.Delete(db->get_cf_handle(prefix, k), rocksdb::Slice(k));
 	it->next();
       }
     }
@@ -972,7 +1420,7 @@ void RocksDBStore::RocksDBTransactionImpl::merge(
   const string &k,
   const bufferlist &to_set_bl)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k);
   if (cf) {
     // bufferlist::c_str() is non-constant, so we can't call c_str()
     if (to_set_bl.is_contiguous() && to_set_bl.length() > 0) {
@@ -1013,12 +1461,11 @@ int RocksDBStore::get(
     std::map<string, bufferlist> *out)
 {
   utime_t start = ceph_clock_now();
-  auto cf = get_cf_handle(prefix);
-  if (cf) {
+  if (get_cf_handle(prefix) || get_cf_shards(prefix)) {
     for (auto& key : keys) {
       std::string value;
       auto status = db->Get(rocksdb::ReadOptions(),
-			    cf,
+			    get_cf_handle(prefix, key),
 			    rocksdb::Slice(key),
 			    &value);
       if (status.ok()) {
@@ -1058,7 +1505,7 @@ int RocksDBStore::get(
   int r = 0;
   string value;
   rocksdb::Status s;
-  auto cf = get_cf_handle(prefix);
+  auto cf = get_cf_handle(prefix, key);
   if (cf) {
     s = db->Get(rocksdb::ReadOptions(),
 		cf,
@@ -1095,7 +1542,7 @@ int RocksDBStore::get(
   int r = 0;
   string value;
   rocksdb::Status s;
-  auto cf = get_cf_handle(prefix);
+  auto cf = get_cf_handle(prefix, key, keylen);
   if (cf) {
     s = db->Get(rocksdb::ReadOptions(),
 		cf,
@@ -1122,6 +1569,58 @@ int RocksDBStore::get(
   return r;
 }
 
+int RocksDBStore::get_pinned(
+  const string &prefix,
+  const string &key,
+  bufferlist *out)
+{
+  assert(out && (out->length() == 0));
+  utime_t start = ceph_clock_now();
+  int r = 0;
+  // the slice either pins the cache block holding the value or owns a
+  // private copy; both stay valid for as long as the slice does.
+  auto value = std::make_shared<rocksdb::PinnableSlice>();
+  rocksdb::Status s;
+  auto cf = get_cf_handle(prefix, key);
+  if (cf) {
+    s = db->Get(rocksdb::ReadOptions(),
+		cf,
+		rocksdb::Slice(key),
+		value.get());
+  } else {
+    string k = combine_strings(prefix, key);
+    s = db->Get(rocksdb::ReadOptions(),
+		default_cf,
+		rocksdb::Slice(k),
+		value.get());
+  }
+  if (s.ok()) {
+    out->append(make_pinned_ptr(*value, value));
+  } else if (s.IsNotFound()) {
+    r = -ENOENT;
+  } else {
+    ceph_abort_msg(cct, s.ToString());
+  }
+  utime_t lat = ceph_clock_now() - start;
+  logger->inc(l_rocksdb_gets);
+  logger->tinc(l_rocksdb_get_latency, lat);
+  return r;
+}
+
+bufferptr RocksDBStore::make_pinned_ptr(
+  const rocksdb::Slice& val,
+  const std::shared_ptr<void>& owner)
+{
+  if (val.size() < zero_copy_min_bytes) {
+    return bufferptr(val.data(), val.size());
+  }
+  logger->inc(l_rocksdb_zero_copy_reads);
+  logger->inc(l_rocksdb_zero_copy_bytes, val.size());
+  return bufferptr(buffer::claim_buffer(
+    val.size(), const_cast<char*>(val.data()),
+    make_deleter([owner] {})));
+}
+
 int RocksDBStore::split_key(rocksdb::Slice in, string *prefix, string *key)
 {
   size_t prefix_len = 0;
@@ -1153,6 +1652,11 @@ void RocksDBStore::compact()
       static_cast<rocksdb::ColumnFamilyHandle*>(cf.second),
       nullptr, nullptr);
   }
+  for (auto& p : cf_shards) {
+    for (auto h : p.second.handles) {
+      db->CompactRange(options, h, nullptr, nullptr);
+    }
+  }
 }
 
 
@@ -1174,6 +1678,15 @@ void RocksDBStore::compact_thread_entry()
       compact_queue_lock.Lock();
       continue;
     }
+    if (!compact_prefix_queue.empty()) {
+      string prefix = *compact_prefix_queue.begin();
+      compact_prefix_queue.erase(compact_prefix_queue.begin());
+      compact_queue_lock.Unlock();
+      logger->inc(l_rocksdb_compact_range);
+      compact_prefix(prefix);
+      compact_queue_lock.Lock();
+      continue;
+    }
     compact_queue_cond.Wait(compact_queue_lock);
   }
   compact_queue_lock.Unlock();
@@ -1218,6 +1731,22 @@ void RocksDBStore::compact_range_async(const string& start, const string& end)
     compact_thread.create("rstore_compact");
   }
 }
+void RocksDBStore::compact_prefix_async(const string& prefix)
+{
+  if (!get_cf_shards(prefix) && !get_cf_handle(prefix)) {
+    compact_range_async(prefix, past_prefix(prefix));
+    return;
+  }
+  // keys of a prefix in its own column families are not under prefix in
+  // the default CF; leave the CF lookup to compact_prefix()
+  Mutex::Locker l(compact_queue_lock);
+  compact_prefix_queue.insert(prefix);
+  compact_queue_cond.Signal();
+  if (!compact_thread.is_started()) {
+    compact_thread.create("rstore_compact");
+  }
+}
+
 bool RocksDBStore::check_omap_dir(string &omap_dir)
 {
   rocksdb::Options options;
@@ -1228,6 +1757,29 @@ bool RocksDBStore::check_omap_dir(string &omap_dir)
   db = nullptr;
   return status.ok();
 }
+void RocksDBStore::compact_prefix(const string& prefix)
+{
+  rocksdb::CompactRangeOptions options;
+  options.bottommost_level_compaction =
+    rocksdb::BottommostLevelCompaction::kForce;
+  // a prefix with its own column families holds nothing else there
+  if (auto shards = get_cf_shards(prefix)) {
+    for (auto cf : shards->handles) {
+      db->CompactRange(options, cf, nullptr, nullptr);
+    }
+    return;
+  }
+  if (auto cf = get_cf_handle(prefix)) {
+    db->CompactRange(options, cf, nullptr, nullptr);
+    return;
+  }
+  string start = prefix;
+  string end = past_prefix(prefix);
+  rocksdb::Slice cstart(start);
+  rocksdb::Slice cend(end);
+  db->CompactRange(options, &cstart, &cend);
+}
+
 void RocksDBStore::compact_range(const string& start, const string& end)
 {
   rocksdb::CompactRangeOptions options;
@@ -1315,18 +1867,27 @@ int64_t RocksDBStore::get_cache_capacity() {
   return bbt_opts.block_cache->GetCapacity();
 }
 
+RocksDBStore::RocksDBWholeSpaceIteratorImpl::RocksDBWholeSpaceIteratorImpl(
+  RocksDBStore *s, rocksdb::Iterator *iter)
+  : dbiter(iter), store(s), pinned_iter(iter)
+{
+}
 RocksDBStore::RocksDBWholeSpaceIteratorImpl::~RocksDBWholeSpaceIteratorImpl()
 {
-  delete dbiter;
+  // a pinned iterator lives on until the values handed out are released
+  if (!pinned_iter)
+    delete dbiter;
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_first()
 {
+  pin_ok = true;
   dbiter->SeekToFirst();
   assert(!dbiter->status().IsIOError());
   return dbiter->status().ok() ? 0 : -1;
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_first(const string &prefix)
 {
+  pin_ok = true;
   rocksdb::Slice slice_prefix(prefix);
   dbiter->Seek(slice_prefix);
   assert(!dbiter->status().IsIOError());
@@ -1334,12 +1895,14 @@ int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_first(const string &pre
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_last()
 {
+  pin_ok = false;
   dbiter->SeekToLast();
   assert(!dbiter->status().IsIOError());
   return dbiter->status().ok() ? 0 : -1;
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::seek_to_last(const string &prefix)
 {
+  pin_ok = false;
   string limit = past_prefix(prefix);
   rocksdb::Slice slice_limit(limit);
   dbiter->Seek(slice_limit);
@@ -1363,6 +1926,7 @@ int RocksDBStore::RocksDBWholeSpaceIteratorImpl::upper_bound(const string &prefi
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::lower_bound(const string &prefix, const string &to)
 {
+  pin_ok = true;
   string bound = combine_strings(prefix, to);
   rocksdb::Slice slice_bound(bound);
   dbiter->Seek(slice_bound);
@@ -1382,6 +1946,7 @@ int RocksDBStore::RocksDBWholeSpaceIteratorImpl::next()
 }
 int RocksDBStore::RocksDBWholeSpaceIteratorImpl::prev()
 {
+  pin_ok = false;
   if (valid()) {
     dbiter->Prev();
   }
@@ -1413,6 +1978,11 @@ bool RocksDBStore::RocksDBWholeSpaceIteratorImpl::raw_key_is_prefixed(const stri
 
 bufferlist RocksDBStore::RocksDBWholeSpaceIteratorImpl::value()
 {
+  if (pinned_iter && pin_ok) {
+    bufferlist bl;
+    bl.append(store->make_pinned_ptr(dbiter->value(), pinned_iter));
+    return bl;
+  }
   return to_bufferlist(dbiter->value());
 }
 
@@ -1429,6 +1999,9 @@ size_t RocksDBStore::RocksDBWholeSpaceIteratorImpl::value_size()
 bufferptr RocksDBStore::RocksDBWholeSpaceIteratorImpl::value_as_ptr()
 {
   rocksdb::Slice val = dbiter->value();
+  if (pinned_iter && pin_ok) {
+    return store->make_pinned_ptr(val, pinned_iter);
+  }
   return bufferptr(val.data(), val.size());
 }
 
@@ -1454,19 +2027,28 @@ class CFIteratorImpl : public KeyValueDB::IteratorImpl {
 protected:
   string prefix;
   rocksdb::Iterator *dbiter;
+  RocksDBStore *store = nullptr;
+  std::shared_ptr<rocksdb::Iterator> pinned_iter;
+  bool pin_ok = false;
 public:
   explicit CFIteratorImpl(const std::string& p,
 				 rocksdb::Iterator *iter)
     : prefix(p), dbiter(iter) { }
+  CFIteratorImpl(RocksDBStore *s, const std::string& p,
+		 rocksdb::Iterator *iter)
+    : prefix(p), dbiter(iter), store(s), pinned_iter(iter) { }
   ~CFIteratorImpl() {
-    delete dbiter;
+    if (!pinned_iter)
+      delete dbiter;
   }
 
   int seek_to_first() override {
+    pin_ok = true;
     dbiter->SeekToFirst();
     return dbiter->status().ok() ? 0 : -1;
   }
   int seek_to_last() override {
+    pin_ok = false;
     dbiter->SeekToLast();
     return dbiter->status().ok() ? 0 : -1;
   }
@@ -1478,6 +2060,7 @@ public:
     return dbiter->status().ok() ? 0 : -1;
   }
   int lower_bound(const string &to) override {
+    pin_ok = true;
     rocksdb::Slice slice_bound(to);
     dbiter->Seek(slice_bound);
     return dbiter->status().ok() ? 0 : -1;
@@ -1489,6 +2072,7 @@ public:
     return dbiter->status().ok() ? 0 : -1;
   }
   int prev(bool validate=true) override {
+    pin_ok = false;
     if (valid()) {
       dbiter->Prev();
     }
@@ -1504,10 +2088,18 @@ public:
     return make_pair(prefix, key());
   }
   bufferlist value() override {
+    if (pinned_iter && pin_ok) {
+      bufferlist bl;
+      bl.append(value_as_ptr());
+      return bl;
+    }
     return to_bufferlist(dbiter->value());
   }
   bufferptr value_as_ptr() override {
     rocksdb::Slice val = dbiter->value();
+    if (pinned_iter && pin_ok) {
+      return store->make_pinned_ptr(val, pinned_iter);
+    }
     return bufferptr(val.data(), val.size());
   }
   int status() override {
@@ -1515,14 +2107,226 @@ public:
   }
 };
 
-KeyValueDB::Iterator RocksDBStore::get_iterator(const std::string& prefix)
-{
+//
+// Presents the shards of a hash-sharded prefix as one ordered keyspace by
+// merging the per-shard iterators.  A key lives in exactly one shard, so
+// there are never duplicates to resolve.
+//
+class ShardMergeIteratorImpl : public KeyValueDB::IteratorImpl {
+  string prefix;
+  RocksDBStore *store;
+  const RocksDBStore::ShardedCF *shards;
+  std::vector<std::shared_ptr<rocksdb::Iterator>> iters;
+  std::shared_ptr<rocksdb::Iterator> cur;
+  bool forward = true;
+  bool pin;
+  bool pin_ok = false;
+
+  // When the hashed bytes lead the key, every key sharing them lives in
+  // one shard.  A seek to such a key then positions only that shard;
+  // the others are sought to the first key past that range only once
+  // iteration gets there (or turns around), so e.g. walking one
+  // object's omap costs one seek instead of one per shard.
+  std::shared_ptr<rocksdb::Iterator> lazy_owner;
+  string lazy_end;        ///< first key not sharing the hashed bytes
+  bool lazy_end_max = false;  ///< no such key: the others are exhausted
+
+  void materialize() {
+    if (!lazy_owner)
+      return;
+    for (auto& i : iters) {
+      if (i == lazy_owner)
+	continue;
+      if (lazy_end_max) {
+	i->SeekToLast();
+	if (i->Valid())
+	  i->Next();
+      } else {
+	i->Seek(lazy_end);
+      }
+    }
+    lazy_owner.reset();
+  }
+  void pick_first() {
+    if (lazy_owner) {
+      if (lazy_owner->Valid() &&
+	  (lazy_end_max || lazy_owner->key().compare(lazy_end) < 0)) {
+	cur = lazy_owner;
+	forward = true;
+	return;
+      }
+      materialize();
+    }
+    cur.reset();
+    for (auto& i : iters) {
+      if (i->Valid() && (!cur || i->key().compare(cur->key()) < 0))
+	cur = i;
+    }
+    forward = true;
+  }
+  void pick_last() {
+    cur.reset();
+    for (auto& i : iters) {
+      if (i->Valid() && (!cur || i->key().compare(cur->key()) > 0))
+	cur = i;
+    }
+    forward = false;
+  }
+public:
+  ShardMergeIteratorImpl(RocksDBStore *s, const std::string& p,
+			 const RocksDBStore::ShardedCF *shards,
+			 std::vector<rocksdb::Iterator*>&& its, bool pin)
+    : prefix(p), store(s), shards(shards), pin(pin) {
+    for (auto i : its)
+      iters.emplace_back(i);
+  }
+
+  int seek_to_first() override {
+    pin_ok = true;
+    lazy_owner.reset();
+    for (auto& i : iters)
+      i->SeekToFirst();
+    pick_first();
+    return status();
+  }
+  int seek_to_last() override {
+    pin_ok = false;
+    lazy_owner.reset();
+    for (auto& i : iters)
+      i->SeekToLast();
+    pick_last();
+    return status();
+  }
+  int upper_bound(const string &after) override {
+    lower_bound(after);
+    if (valid() && (key() == after)) {
+      next();
+    }
+    return status();
+  }
+  int lower_bound(const string &to) override {
+    pin_ok = true;
+    lazy_owner.reset();
+    rocksdb::Slice slice_bound(to);
+    if (shards->hash_l == 0 && to.size() >= shards->hash_h) {
+      uint32_t hash = ceph_str_hash_rjenkins(to.data(), shards->hash_h);
+      lazy_owner = iters[hash % iters.size()];
+      lazy_owner->Seek(slice_bound);
+      lazy_end = to.substr(0, shards->hash_h);
+      while (!lazy_end.empty() && (unsigned char)lazy_end.back() == 0xff)
+	lazy_end.pop_back();
+      lazy_end_max = lazy_end.empty();
+      if (!lazy_end_max)
+	lazy_end.back() = lazy_end.back() + 1;
+    } else {
+      for (auto& i : iters)
+	i->Seek(slice_bound);
+    }
+    pick_first();
+    return status();
+  }
+  int next(bool validate=true) override {
+    if (!valid())
+      return status();
+    if (!forward) {
+      // the other shards sit before the current key; move them past it
+      string k = cur->key().ToString();
+      for (auto& i : iters) {
+	if (i != cur)
+	  i->Seek(k);
+      }
+    }
+    cur->Next();
+    pick_first();
+    return status();
+  }
+  int prev(bool validate=true) override {
+    pin_ok = false;
+    if (!valid())
+      return status();
+    materialize();
+    if (forward) {
+      // the other shards sit after the current key; move them before it
+      string k = cur->key().ToString();
+      for (auto& i : iters) {
+	if (i == cur)
+	  continue;
+	i->Seek(k);
+	if (i->Valid())
+	  i->Prev();
+	else
+	  i->SeekToLast();
+      }
+    }
+    cur->Prev();
+    pick_last();
+    return status();
+  }
+  bool valid() override {
+    return cur && cur->Valid();
+  }
+  string key() override {
+    return cur->key().ToString();
+  }
+  std::pair<std::string, std::string> raw_key() override {
+    return make_pair(prefix, key());
+  }
+  bufferlist value() override {
+    if (pin && pin_ok) {
+      bufferlist bl;
+      bl.append(value_as_ptr());
+      return bl;
+    }
+    return to_bufferlist(cur->value());
+  }
+  bufferptr value_as_ptr() override {
+    rocksdb::Slice val = cur->value();
+    if (pin && pin_ok) {
+      return store->make_pinned_ptr(val, cur);
+    }
+    return bufferptr(val.data(), val.size());
+  }
+  int status() override {
+    for (auto& i : iters) {
+      if (!i->status().ok())
+	return -1;
+    }
+    return 0;
+  }
+};
+
+KeyValueDB::Iterator RocksDBStore::get_iterator(const std::string& prefix,
+						IteratorOpts opts)
+{
+  bool pin = opts & ITERATOR_PIN_VALUES;
+  rocksdb::ReadOptions ro;
+  // keep the blocks we read from pinned for the iterator's lifetime so the
+  // values can be handed out without copies
+  ro.pin_data = pin;
+  auto shards = get_cf_shards(prefix);
+  if (shards) {
+    // one call, so every shard iterator reads the same snapshot
+    std::vector<rocksdb::Iterator*> iters;
+    rocksdb::Status status = db->NewIterators(ro, shards->handles, &iters);
+    assert(status.ok());
+    return std::make_shared<ShardMergeIteratorImpl>(
+      this, prefix, shards, std::move(iters), pin);
+  }
   rocksdb::ColumnFamilyHandle *cf_handle =
     static_cast<rocksdb::ColumnFamilyHandle*>(get_cf_handle(prefix));
   if (cf_handle) {
+    if (pin) {
+      return std::make_shared<CFIteratorImpl>(
+	this, prefix, db->NewIterator(ro, cf_handle));
+    }
     return std::make_shared<CFIteratorImpl>(
       prefix,
-      db->NewIterator(rocksdb::ReadOptions(), cf_handle));
+      db->NewIterator(ro, cf_handle));
+  } else if (pin) {
+    return std::make_shared<PrefixIteratorImpl>(
+      prefix,
+      std::make_shared<RocksDBWholeSpaceIteratorImpl>(
+	this, db->NewIterator(ro, default_cf)));
   } else {
     return KeyValueDB::get_iterator(prefix);
   }
@@ -43,6 +43,8 @@ enum {
   l_rocksdb_write_memtable_time,
   l_rocksdb_write_delay_time,
   l_rocksdb_write_pre_and_post_process_time,
+  l_rocksdb_zero_copy_reads,
+  l_rocksdb_zero_copy_bytes,
   l_rocksdb_last,
 };
 
@@ -82,6 +84,7 @@ class RocksDBStore : public KeyValueDB {
 
   uint64_t cache_size = 0;
   bool set_cache_flag = false;
+  uint64_t zero_copy_min_bytes = 0;
 
   bool must_close_default_cf = false;
   rocksdb::ColumnFamilyHandle *default_cf = nullptr;
@@ -92,11 +95,31 @@ class RocksDBStore : public KeyValueDB {
   int do_open(ostream &out, bool create_if_missing,
 	      const vector<ColumnFamily>* cfs = nullptr);
   int load_rocksdb_options(bool create_if_missing, rocksdb::Options& opt);
+  int build_cf_options(const rocksdb::Options& opt, const ColumnFamily& cf,
+		       rocksdb::ColumnFamilyOptions *cf_opt);
+  void close_cf_handles();
+
+  /// column families backing a hash-sharded prefix
+  struct ShardedCF {
+    uint32_t hash_l = 0;           ///< first key byte fed to the hash
+    uint32_t hash_h = UINT32_MAX;  ///< one past the last key byte hashed
+    std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  };
+  std::unordered_map<string, ShardedCF> cf_shards;
+  friend class ShardMergeIteratorImpl;
+
+  /// persisted sharding definition, kept next to the db files
+  string sharding_file() const {
+    return path + "/sharding";
+  }
+  int read_sharding(string *def, bool *resharding);
+  int write_sharding(const vector<ColumnFamily>& cfs, bool resharding);
 
   // manage async compactions
   Mutex compact_queue_lock;
   Cond compact_queue_cond;
   list< pair<string,string> > compact_queue;
+  set<string> compact_prefix_queue;  ///< prefixes in their own CFs
   bool compact_queue_stop;
   class CompactThread : public Thread {
     RocksDBStore *db;
@@ -130,13 +153,10 @@ public:
   int ParseOptionsFromString(const string& opt_str, rocksdb::Options &opt);
   static int _test_init(const string& dir);
   int init(string options_str) override;
-  /// compact rocksdb for all keys with a given prefix
-  void compact_prefix(const string& prefix) override {
-    compact_range(prefix, past_prefix(prefix));
-  }
-  void compact_prefix_async(const string& prefix) override {
-    compact_range_async(prefix, past_prefix(prefix));
-  }
+  /// compact rocksdb for all keys with a given prefix, down to the
+  /// bottommost level so that pending merge operands are resolved
+  void compact_prefix(const string& prefix) override;
+  void compact_prefix_async(const string& prefix) override;
 
   void compact_range(const string& prefix, const string& start, const string& end) override {
     compact_range(combine_strings(prefix, start), combine_strings(prefix, end));
@@ -183,6 +203,20 @@ public:
     else
       return static_cast<rocksdb::ColumnFamilyHandle*>(iter->second);
   }
+  const ShardedCF *get_cf_shards(const std::string& prefix) const {
+    auto iter = cf_shards.find(prefix);
+    if (iter == cf_shards.end())
+      return nullptr;
+    return &iter->second;
+  }
+  /// CF holding key under prefix; nullptr means the default CF
+  rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix,
+					     const char *key, size_t keylen);
+  rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix,
+					     const std::string& key) {
+    return get_cf_handle(prefix, key.data(), key.size());
+  }
+  int reshard(const vector<ColumnFamily>& cfs, std::ostream &out) override;
   int repair(std::ostream &out) override;
   void split_stats(const std::string &s, char delim, std::vector<std::string> &elems);
   void get_statistics(Formatter *f) override;
@@ -349,15 +383,29 @@ public:
     const char *key,
     size_t keylen,
     bufferlist *out) override;
+  int get_pinned(
+    const string &prefix,
+    const string &key,
+    bufferlist *out) override;
+
+  /// wrap a value that owner keeps pinned; small values are just copied
+  bufferptr make_pinned_ptr(const rocksdb::Slice& val,
+			    const std::shared_ptr<void>& owner);
 
 
   class RocksDBWholeSpaceIteratorImpl :
     public KeyValueDB::WholeSpaceIteratorImpl {
   protected:
     rocksdb::Iterator *dbiter;
+    RocksDBStore *store = nullptr;
+    /// owns dbiter when values are handed out pinned
+    std::shared_ptr<rocksdb::Iterator> pinned_iter;
+    /// values are only pinned while walking forward from a seek
+    bool pin_ok = false;
   public:
     explicit RocksDBWholeSpaceIteratorImpl(rocksdb::Iterator *iter) :
       dbiter(iter) { }
+    RocksDBWholeSpaceIteratorImpl(RocksDBStore *s, rocksdb::Iterator *iter);
     //virtual ~RocksDBWholeSpaceIteratorImpl() { }
     ~RocksDBWholeSpaceIteratorImpl() override;
 
@@ -380,7 +428,8 @@ public:
     size_t value_size() override;
   };
 
-  Iterator get_iterator(const std::string& prefix) override;
+  Iterator get_iterator(const std::string& prefix,
+			IteratorOpts opts = 0) override;
 
   /// Utility
   static string combine_strings(const string &prefix, const string &value) {
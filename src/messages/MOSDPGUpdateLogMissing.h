@@ -29,7 +29,7 @@ public:
   spg_t pgid;
   shard_id_t from;
   ceph_tid_t rep_tid = 0;
-  mempool::osd_pglog::list<pg_log_entry_t> entries;
+  mempool::osd_pglog::slab_list<pg_log_entry_t> entries;
   // piggybacked osd/pg state
   eversion_t pg_trim_to; // primary->replica: trim to here
   eversion_t pg_roll_forward_to; // primary->replica: trim rollback info to here
@@ -53,7 +53,7 @@ public:
     : MOSDFastDispatchOp(MSG_OSD_PG_UPDATE_LOG_MISSING, HEAD_VERSION,
 			 COMPAT_VERSION) { }
   MOSDPGUpdateLogMissing(
-    const mempool::osd_pglog::list<pg_log_entry_t> &entries,
+    const mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
     spg_t pgid,
     shard_id_t from,
     epoch_t epoch,
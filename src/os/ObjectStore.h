@@ -1457,6 +1457,8 @@ public:
 
   virtual void get_db_statistics(Formatter *f) { }
   virtual void generate_db_histogram(Formatter *f) { }
+  virtual void generate_free_extent_histogram(Formatter *f) { }
+  virtual void dump_compression_stats(Formatter *f) { }
   virtual void flush_cache() { }
   virtual void dump_perf_counters(Formatter *f) {}
 
@@ -1655,6 +1657,27 @@ public:
      bufferlist& bl,
      uint32_t op_flags = 0) = 0;
 
+  /**
+   * is_cached -- check whether a read can be served from memory
+   *
+   * A hint only: it must not block or do any I/O, and the answer may be
+   * stale by the time the caller acts on it.  A zero len asks only
+   * about the object's metadata (existence, size, xattrs).
+   *
+   * @param cid collection for object
+   * @param oid oid of object
+   * @param offset location offset of first byte to be read
+   * @param len number of bytes to be read
+   * @returns true if a read of the range would not touch the device
+   */
+  virtual bool is_cached(
+    CollectionHandle &c,
+    const ghobject_t& oid,
+    uint64_t offset,
+    size_t len) {
+    return false;
+  }
+
   /**
    * fiemap -- get extent map of data of an object
    *
@@ -1847,6 +1870,21 @@ public:
     const ghobject_t &oid  ///< [in] object
     ) = 0;
 
+  /**
+   * Returns an object map iterator whose values may reference the
+   * store's own memory instead of copies.  Such values can hold cache
+   * blocks (and more) in memory until they are released, so use this
+   * only for short, bounded walks, e.g. to build a client reply.
+   *
+   * @return iterator, null on error
+   */
+  virtual ObjectMap::ObjectMapIterator get_omap_iterator_pinned(
+    CollectionHandle &c,   ///< [in] collection
+    const ghobject_t &oid  ///< [in] object
+    ) {
+    return get_omap_iterator(c, oid);
+  }
+
   virtual int flush_journal() { return -EOPNOTSUPP; }
 
   virtual int dump_journal(ostream& out) { return -EOPNOTSUPP; }
@@ -3,6 +3,11 @@
 
 #include "BitmapAllocator.h"
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <pthread.h>
+
 #define dout_context cct
 #define dout_subsys ceph_subsys_bluestore
 #undef dout_prefix
@@ -16,6 +21,81 @@ BitmapAllocator::BitmapAllocator(CephContext* _cct,
   ldout(cct, 10) << __func__ << " 0x" << std::hex << capacity << "/"
 		 << alloc_unit << std::dec << dendl;
   _init(capacity, alloc_unit, false);
+
+  num_shards = cct->_conf->get_val<uint64_t>(
+    "bluestore_bitmap_allocator_shards");
+  shard_reserve = p2roundup(cct->_conf->get_val<uint64_t>(
+    "bluestore_bitmap_allocator_shard_reserve"), uint64_t(alloc_unit));
+  if (num_shards && shard_reserve) {
+    shards.reset(new shard_t[num_shards]);
+  } else {
+    num_shards = 0;
+  }
+}
+
+BitmapAllocator::shard_t& BitmapAllocator::_pick_shard()
+{
+  size_t i;
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  if (cpu >= 0) {
+    i = cpu;
+  } else
+#endif
+  {
+    i = (size_t)pthread_self() >> 12;
+  }
+  return shards[i % num_shards];
+}
+
+int64_t BitmapAllocator::_allocate_from_shard(
+  shard_t& s,
+  uint64_t want_size, uint64_t max_alloc_size, PExtentVector *extents)
+{
+  std::lock_guard<std::mutex> l(s.lock);
+  if (s.reserved_bytes < want_size) {
+    uint64_t allocated = 0;
+    _allocate_l2(shard_reserve, get_min_alloc_size(), 0, 0,
+      &allocated, &s.reserved);
+    s.reserved_bytes += allocated;
+    reserved_total += allocated;
+    if (s.reserved_bytes < want_size) {
+      return 0;
+    }
+  }
+  uint64_t got = 0;
+  while (got < want_size) {
+    assert(!s.reserved.empty());
+    auto& e = s.reserved.back();
+    uint64_t l = std::min<uint64_t>(e.length, want_size - got);
+    if (max_alloc_size && l > max_alloc_size) {
+      l = max_alloc_size;
+    }
+    extents->emplace_back(e.offset, l);
+    e.offset += l;
+    e.length -= l;
+    if (e.length == 0) {
+      s.reserved.pop_back();
+    }
+    got += l;
+  }
+  s.reserved_bytes -= got;
+  reserved_total -= got;
+  return got;
+}
+
+void BitmapAllocator::_drain_shards()
+{
+  for (size_t i = 0; i < num_shards; ++i) {
+    shard_t& s = shards[i];
+    std::lock_guard<std::mutex> l(s.lock);
+    if (!s.reserved.empty()) {
+      _free_l2(s.reserved);
+      reserved_total -= s.reserved_bytes;
+      s.reserved.clear();
+      s.reserved_bytes = 0;
+    }
+  }
 }
 
 int64_t BitmapAllocator::allocate(
@@ -27,10 +107,27 @@ int64_t BitmapAllocator::allocate(
   ldout(cct, 10) << __func__ << std::hex << " 0x" << want_size
 		 << "/" << alloc_unit << "," << max_alloc_size << "," << hint
 		 << std::dec << dendl;
-    
-    
+
+  if (num_shards &&
+      hint == 0 &&
+      alloc_unit == get_min_alloc_size() &&
+      want_size <= shard_reserve) {
+    int64_t r = _allocate_from_shard(_pick_shard(), want_size, max_alloc_size,
+      extents);
+    if (r > 0) {
+      ldout(cct, 10) << __func__ << " from shard " << *extents << dendl;
+      return r;
+    }
+  }
+
   _allocate_l2(want_size, alloc_unit, max_alloc_size, hint,
     &allocated, extents);
+  if (allocated < want_size && reserved_total) {
+    // the rest may be sitting in shard reservations
+    _drain_shards();
+    _allocate_l2(want_size, alloc_unit, max_alloc_size, hint,
+      &allocated, extents);
+  }
   if (!allocated) {
     return -ENOSPC;
   }
@@ -71,6 +168,7 @@ void BitmapAllocator::init_rm_free(uint64_t offset, uint64_t length)
 {
   ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
 		 << std::dec << dendl;
+  _drain_shards();
   auto mas = get_min_alloc_size();
   uint64_t offs = round_up_to(offset, mas);
   uint64_t l = p2align(offset + length - offs, mas);
@@ -78,8 +176,21 @@ void BitmapAllocator::init_rm_free(uint64_t offset, uint64_t length)
   ldout(cct, 10) << __func__ << " done" << dendl;
 }
 
+void BitmapAllocator::dump(std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  _foreach_free(notify);
+  for (size_t i = 0; i < num_shards; ++i) {
+    shard_t& s = shards[i];
+    std::lock_guard<std::mutex> l(s.lock);
+    for (auto& e : s.reserved) {
+      notify(e.offset, e.length);
+    }
+  }
+}
+
 void BitmapAllocator::shutdown()
 {
   ldout(cct, 1) << __func__ << dendl;
+  _drain_shards();
   _shutdown();
 }
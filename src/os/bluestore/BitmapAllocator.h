@@ -4,6 +4,8 @@
 #ifndef CEPH_OS_BLUESTORE_BITMAPFASTALLOCATOR_H
 #define CEPH_OS_BLUESTORE_BITMAPFASTALLOCATOR_H
 
+#include <atomic>
+#include <memory>
 #include <mutex>
 
 #include "Allocator.h"
@@ -16,6 +18,28 @@ class BitmapAllocator : public Allocator,
   public AllocatorLevel02<AllocatorLevel01Loose> {
   CephContext* cct;
 
+  /*
+   * Optional per-cpu front end.  Each shard holds a small reservation of
+   * free space taken from the bitmap in bulk, so that most allocations
+   * only touch the (normally uncontended) shard lock and not the global
+   * one.  Reserved space still counts as free.
+   */
+  struct shard_t {
+    std::mutex lock;
+    interval_vector_t reserved;   ///< free extents owned by this shard
+    uint64_t reserved_bytes = 0;
+  } __attribute__ ((aligned (128)));
+
+  size_t num_shards = 0;
+  uint64_t shard_reserve = 0;     ///< bytes taken from the bitmap per refill
+  std::unique_ptr<shard_t[]> shards;
+  std::atomic<uint64_t> reserved_total = {0};
+
+  shard_t& _pick_shard();
+  int64_t _allocate_from_shard(shard_t& s,
+    uint64_t want_size, uint64_t max_alloc_size, PExtentVector *extents);
+  void _drain_shards();
+
 public:
   BitmapAllocator(CephContext* _cct, int64_t capacity, int64_t alloc_unit);
   ~BitmapAllocator() override
@@ -32,12 +56,13 @@ public:
 
   uint64_t get_free() override
   {
-    return get_available();
+    return get_available() + reserved_total;
   }
 
   void dump() override
   {
   }
+  void dump(std::function<void(uint64_t offset, uint64_t length)> notify) override;
   double get_fragmentation(uint64_t) override
   {
     return _get_fragmentation();
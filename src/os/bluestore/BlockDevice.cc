@@ -104,6 +104,8 @@ BlockDevice *BlockDevice::create(CephContext* cct, const string& path,
     if (addr != NULL) {
       if (is_pmem)
 	type = "pmem";
+      else if (cct->_conf->get_val<bool>("bdev_pmem_emulate"))
+	type = "pmem";
       else
 	dout(1) << path.c_str() << " isn't pmem file" << dendl;
       pmem_unmap(addr, map_len);
@@ -132,6 +132,9 @@ public:
     CephContext* cct, const std::string& path, aio_callback_t cb, void *cbpriv, aio_callback_t d_cb, void *d_cbpriv);
   virtual bool supported_bdev_label() { return true; }
   virtual bool is_rotational() { return rotational; }
+  /// true if write() is durable by the time it returns, so there is
+  /// nothing to gain from queueing aio or batching before flush()
+  virtual bool supports_direct_persist() { return false; }
 
   virtual void aio_submit(IOContext *ioc) = 0;
 
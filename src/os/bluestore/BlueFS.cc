@@ -7,6 +7,7 @@
 #include "common/debug.h"
 #include "common/errno.h"
 #include "common/perf_counters.h"
+#include "include/scope_guard.h"
 #include "BlockDevice.h"
 #include "Allocator.h"
 #include "include/assert.h"
@@ -115,6 +116,10 @@ void BlueFS::_init_logger()
   b.add_u64_counter(l_bluefs_bytes_written_sst, "bytes_written_sst",
 		    "Bytes written to SSTs", "sst",
 		    PerfCountersBuilder::PRIO_CRITICAL, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_log_flushes, "log_flushes",
+		    "Metadata log flushes");
+  b.add_u64_avg(l_bluefs_log_flush_batch, "log_flush_batch",
+		"Dirty files recorded per metadata log flush");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -1176,7 +1181,7 @@ void BlueFS::compact_log()
 {
   std::unique_lock<std::mutex> l(lock);
   if (cct->_conf->bluefs_compact_log_sync) {
-     _compact_log_sync();
+     _compact_log_sync(l);
   } else {
     _compact_log_async(l);
   }
@@ -1234,9 +1239,14 @@ void BlueFS::_compact_log_dump_metadata(bluefs_transaction_t *t)
   }
 }
 
-void BlueFS::_compact_log_sync()
+void BlueFS::_compact_log_sync(std::unique_lock<std::mutex>& l)
 {
   dout(10) << __func__ << dendl;
+  // we replace log_writer below; let pipelined log flushes drain first
+  while (!log_flushing.empty()) {
+    dout(10) << __func__ << " log is currently flushing, waiting" << dendl;
+    log_cond.wait(l);
+  }
   File *log_file = log_writer->file.get();
 
   // clear out log (be careful who calls us!!!)
@@ -1266,7 +1276,7 @@ void BlueFS::_compact_log_sync()
   log_file->fnode.size = bl.length();
   log_writer = _create_writer(log_file);
   log_writer->append(bl);
-  r = _flush(log_writer, true);
+  r = _flush(log_writer, true, l);
   assert(r == 0);
 #ifdef HAVE_LIBAIO
   if (!cct->_conf->bluefs_sync_write) {
@@ -1329,7 +1339,7 @@ void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
   // 0. wait for any racing flushes to complete.  (We do not want to block
   // in _flush_sync_log with jump_to set or else a racing thread might flush
   // our entries and our jump_to update won't be correct.)
-  while (log_flushing) {
+  while (!log_flushing.empty()) {
     dout(10) << __func__ << " log is currently flushing, waiting" << dendl;
     log_cond.wait(l);
   }
@@ -1378,7 +1388,7 @@ void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
   new_log_writer->append(bl);
 
   // 3. flush
-  r = _flush(new_log_writer, true);
+  r = _flush(new_log_writer, true, l);
   assert(r == 0);
 
   // 4. wait
@@ -1476,21 +1486,43 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
 				uint64_t want_seq,
 				uint64_t jump_to)
 {
-  while (log_flushing) {
-    dout(10) << __func__ << " want_seq " << want_seq
-	     << " log is currently flushing, waiting" << dendl;
-    assert(!jump_to);
-    log_cond.wait(l);
+  // want_seq == 0 means everything logged so far, including the
+  // pending log_t (if any).
+  if (!want_seq) {
+    want_seq = log_seq;
+    if (!log_t.empty() || dirty_files.count(log_seq + 1)) {
+      ++want_seq;
+    }
   }
-  if (want_seq && want_seq <= log_seq_stable) {
-    dout(10) << __func__ << " want_seq " << want_seq << " <= log_seq_stable "
-	     << log_seq_stable << ", done" << dendl;
-    assert(!jump_to);
-    return 0;
+  unsigned max_flushing = std::max<uint64_t>(
+    1, cct->_conf->get_val<uint64_t>("bluefs_log_flush_pipeline_depth"));
+  while (true) {
+    if (want_seq <= log_seq_stable) {
+      dout(10) << __func__ << " want_seq " << want_seq << " <= log_seq_stable "
+	       << log_seq_stable << ", done" << dendl;
+      assert(!jump_to);
+      return 0;
+    }
+    if (want_seq <= log_seq) {
+      // an earlier flush already carries our seq; wait for it to land
+      dout(10) << __func__ << " want_seq " << want_seq
+	       << " is being flushed, waiting" << dendl;
+      assert(!jump_to);
+      log_cond.wait(l);
+      continue;
+    }
+    if (log_flushing.size() >= max_flushing) {
+      dout(10) << __func__ << " want_seq " << want_seq
+	       << " log is currently flushing, waiting" << dendl;
+      assert(!jump_to);
+      log_cond.wait(l);
+      continue;
+    }
+    break;
   }
-  if (log_t.empty() && dirty_files.empty()) {
+  if (log_t.empty() && !dirty_files.count(log_seq + 1)) {
     dout(10) << __func__ << " want_seq " << want_seq
-	     << " " << log_t << " not dirty, dirty_files empty, no-op" << dendl;
+	     << " " << log_t << " not dirty, no dirty_files, no-op" << dendl;
     assert(!jump_to);
     return 0;
   }
@@ -1506,6 +1538,7 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
   auto lsi = dirty_files.find(seq);
   if (lsi != dirty_files.end()) {
     dout(20) << __func__ << " " << lsi->second.size() << " dirty_files" << dendl;
+    logger->inc(l_bluefs_log_flush_batch, lsi->second.size());
     for (auto &f : lsi->second) {
       dout(20) << __func__ << "   op_file_update " << f.fnode << dendl;
       log_t.op_file_update(f.fnode);
@@ -1546,10 +1579,26 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
 
   log_t.clear();
   log_t.seq = 0;  // just so debug output is less confusing
-  log_flushing = true;
-
-  int r = _flush(log_writer, true);
+  log_flushing.push_back(seq);
+  logger->inc(l_bluefs_log_flushes);
+
+  // Each in-flight flush submits into, and waits on, its own aio
+  // contexts; the log writer's own ones are put back once we have
+  // submitted.  Log records are padded to whole blocks, so flushes never
+  // rewrite each other's blocks.
+  std::array<IOContext*,MAX_BDEV> iocv;
+  iocv.fill(nullptr);
+  for (unsigned i = 0; i < MAX_BDEV; ++i) {
+    if (bdev[i]) {
+      iocv[i] = new IOContext(cct, NULL);
+    }
+  }
+  std::swap(iocv, log_writer->iocv);
+  int r = _flush(log_writer, true, l);
   assert(r == 0);
+  std::swap(iocv, log_writer->iocv);
+  std::array<bool, MAX_BDEV> flush_devs = log_writer->dirty_devs;
+  log_writer->dirty_devs.fill(false);
 
   if (jump_to) {
     dout(10) << __func__ << " jumping log offset from 0x" << std::hex
@@ -1558,9 +1607,30 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
     log_writer->file->fnode.size = jump_to;
   }
 
-  _flush_bdev_safely(log_writer);
+  // While we wait on the device another thread may encode and submit
+  // the next log records (up to bluefs_log_flush_pipeline_depth).
+  l.unlock();
+  for (auto p : iocv) {
+    if (p) {
+      p->aio_wait();
+    }
+  }
+  flush_bdev(flush_devs);
+  l.lock();
+  for (unsigned i = 0; i < MAX_BDEV; ++i) {
+    if (iocv[i]) {
+      bdev[i]->queue_reap_ioc(iocv[i]);
+    }
+  }
 
-  log_flushing = false;
+  // Flushes may land out of order; our records only count as stable
+  // once every earlier flush has landed too.
+  while (log_flushing.front() != seq) {
+    dout(20) << __func__ << " seq " << seq << " waiting for earlier flush "
+	     << log_flushing.front() << dendl;
+    log_cond.wait(l);
+  }
+  log_flushing.pop_front();
   log_cond.notify_all();
 
   // clean dirty files
@@ -1616,7 +1686,8 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
   return 0;
 }
 
-int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
+int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length,
+			 std::unique_lock<std::mutex>& l)
 {
   dout(10) << __func__ << " " << h << " pos 0x" << std::hex << h->pos
 	   << " 0x" << offset << "~" << length << std::dec
@@ -1710,6 +1781,19 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
   }
   dout(20) << __func__ << " file now " << h->file->fnode << dendl;
 
+  // Regular files only need the global lock for allocation and the
+  // dirty list; the extents we write to are stable while the caller
+  // holds the writer lock, so let other writers and log flushes proceed
+  // while we build and submit our IO.  The logs (ino 0 and 1) stay
+  // serialized.
+  if (h->file->fnode.ino > 1) {
+    l.unlock();
+  }
+  auto relock = make_scope_guard([&] {
+      if (!l.owns_lock())
+	l.lock();
+    });
+
   uint64_t x_off = 0;
   auto p = h->file->fnode.seek(offset, &x_off);
   assert(p != h->file->fnode.extents.end());
@@ -1792,12 +1876,16 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
 	t.append_zero(zlen);
       }
     }
-    if (cct->_conf->bluefs_sync_write) {
+    if (bdev[p->bdev]->supports_direct_persist()) {
+      // e.g. DAX pmem: durable once written, no aio or flush to wait for
+      bdev[p->bdev]->write(p->offset + x_off, t, buffered);
+    } else if (cct->_conf->bluefs_sync_write) {
       bdev[p->bdev]->write(p->offset + x_off, t, buffered);
+      h->dirty_devs[p->bdev] = true;
     } else {
       bdev[p->bdev]->aio_write(p->offset + x_off, t, h->iocv[p->bdev], buffered);
+      h->dirty_devs[p->bdev] = true;
     }
-    h->dirty_devs[p->bdev] = true;
     bloff += x_len;
     length -= x_len;
     ++p;
@@ -1844,7 +1932,7 @@ void BlueFS::wait_for_aio(FileWriter *h)
 }
 #endif
 
-int BlueFS::_flush(FileWriter *h, bool force)
+int BlueFS::_flush(FileWriter *h, bool force, std::unique_lock<std::mutex>& l)
 {
   h->buffer_appender.flush();
   uint64_t length = h->buffer.length();
@@ -1865,10 +1953,11 @@ int BlueFS::_flush(FileWriter *h, bool force)
            << std::hex << offset << "~" << length << std::dec
 	   << " to " << h->file->fnode << dendl;
   assert(h->pos <= h->file->fnode.size);
-  return _flush_range(h, offset, length);
+  return _flush_range(h, offset, length, l);
 }
 
-int BlueFS::_truncate(FileWriter *h, uint64_t offset)
+int BlueFS::_truncate(FileWriter *h, uint64_t offset,
+		      std::unique_lock<std::mutex>& l)
 {
   dout(10) << __func__ << " 0x" << std::hex << offset << std::dec
            << " file " << h->file->fnode << dendl;
@@ -1893,7 +1982,7 @@ int BlueFS::_truncate(FileWriter *h, uint64_t offset)
     assert(0 == "actually this shouldn't happen");
   }
   if (h->buffer.length()) {
-    int r = _flush(h, true);
+    int r = _flush(h, true, l);
     if (r < 0)
       return r;
   }
@@ -1912,7 +2001,7 @@ int BlueFS::_truncate(FileWriter *h, uint64_t offset)
 int BlueFS::_fsync(FileWriter *h, std::unique_lock<std::mutex>& l)
 {
   dout(10) << __func__ << " " << h << " " << h->file->fnode << dendl;
-  int r = _flush(h, true);
+  int r = _flush(h, true, l);
   if (r < 0)
      return r;
   uint64_t old_dirty_seq = h->file->dirty_seq;
@@ -2060,7 +2149,7 @@ void BlueFS::sync_metadata()
 
   if (_should_compact_log()) {
     if (cct->_conf->bluefs_compact_log_sync) {
-      _compact_log_sync();
+      _compact_log_sync(l);
     } else {
       _compact_log_async(l);
     }
@@ -35,6 +35,8 @@ enum {
   l_bluefs_files_written_sst,
   l_bluefs_bytes_written_wal,
   l_bluefs_bytes_written_sst,
+  l_bluefs_log_flushes,
+  l_bluefs_log_flush_batch,
   l_bluefs_last,
 };
 
@@ -124,7 +126,7 @@ public:
     bufferlist::page_aligned_appender buffer_appender;  //< for const char* only
     int writer_type = 0;    ///< WRITER_*
 
-    std::mutex lock;
+    std::mutex lock;        ///< serializes flush/fsync on this writer
     std::array<IOContext*,MAX_BDEV> iocv; ///< for each bdev
     std::array<bool, MAX_BDEV> dirty_devs;
 
@@ -235,7 +237,7 @@ private:
   uint64_t log_seq_stable = 0; ///< last stable/synced log seq
   FileWriter *log_writer = 0;  ///< writer for the log
   bluefs_transaction_t log_t;  ///< pending, unwritten log transaction
-  bool log_flushing = false;   ///< true while flushing the log
+  std::deque<uint64_t> log_flushing;  ///< seqs of log flushes in flight
   std::condition_variable log_cond;
 
   uint64_t new_log_jump_to = 0;
@@ -272,8 +274,9 @@ private:
 
   int _allocate(uint8_t bdev, uint64_t len,
 		bluefs_fnode_t* node);
-  int _flush_range(FileWriter *h, uint64_t offset, uint64_t length);
-  int _flush(FileWriter *h, bool force);
+  int _flush_range(FileWriter *h, uint64_t offset, uint64_t length,
+		   std::unique_lock<std::mutex>& l);
+  int _flush(FileWriter *h, bool force, std::unique_lock<std::mutex>& l);
   int _fsync(FileWriter *h, std::unique_lock<std::mutex>& l);
 
 #ifdef HAVE_LIBAIO
@@ -287,7 +290,7 @@ private:
   uint64_t _estimate_log_size();
   bool _should_compact_log();
   void _compact_log_dump_metadata(bluefs_transaction_t *t);
-  void _compact_log_sync();
+  void _compact_log_sync(std::unique_lock<std::mutex>& l);
   void _compact_log_async(std::unique_lock<std::mutex>& l);
 
   //void _aio_finish(void *priv);
@@ -297,7 +300,7 @@ private:
   void flush_bdev(std::array<bool, MAX_BDEV>& dirty_bdevs);  // this is safe to call without a lock
 
   int _preallocate(FileRef f, uint64_t off, uint64_t len);
-  int _truncate(FileWriter *h, uint64_t off);
+  int _truncate(FileWriter *h, uint64_t off, std::unique_lock<std::mutex>& l);
 
   int _read(
     FileReader *h,   ///< [in] read from here
@@ -372,7 +375,11 @@ public:
     bool random = false);
 
   void close_writer(FileWriter *h) {
+    // wait out any flush still running on the writer; nobody may use it
+    // after this, and we must not free a locked mutex
+    std::unique_lock<std::mutex> hl(h->lock);
     std::lock_guard<std::mutex> l(lock);
+    hl.unlock();
     _close_writer(h);
   }
 
@@ -413,15 +420,20 @@ public:
   // handler for discard event
   void handle_discard(unsigned dev, interval_set<uint64_t>& to_release);
 
+  // The per-writer lock is always taken before the global lock; data
+  // writes drop the global lock while their IO is submitted.
   void flush(FileWriter *h) {
-    std::lock_guard<std::mutex> l(lock);
-    _flush(h, false);
+    std::lock_guard<std::mutex> hl(h->lock);
+    std::unique_lock<std::mutex> l(lock);
+    _flush(h, false, l);
   }
   void flush_range(FileWriter *h, uint64_t offset, uint64_t length) {
-    std::lock_guard<std::mutex> l(lock);
-    _flush_range(h, offset, length);
+    std::lock_guard<std::mutex> hl(h->lock);
+    std::unique_lock<std::mutex> l(lock);
+    _flush_range(h, offset, length, l);
   }
   int fsync(FileWriter *h) {
+    std::lock_guard<std::mutex> hl(h->lock);
     std::unique_lock<std::mutex> l(lock);
     return _fsync(h, l);
   }
@@ -443,13 +455,16 @@ public:
     std::lock_guard<std::mutex> l(lock);
     _invalidate_cache(f, offset, len);
   }
-  int preallocate(FileRef f, uint64_t offset, uint64_t len) {
+  int preallocate(FileWriter *h, uint64_t offset, uint64_t len) {
+    // extends the extents a data flush may be writing to unlocked
+    std::lock_guard<std::mutex> hl(h->lock);
     std::lock_guard<std::mutex> l(lock);
-    return _preallocate(f, offset, len);
+    return _preallocate(h->file, offset, len);
   }
   int truncate(FileWriter *h, uint64_t offset) {
-    std::lock_guard<std::mutex> l(lock);
-    return _truncate(h, offset);
+    std::lock_guard<std::mutex> hl(h->lock);
+    std::unique_lock<std::mutex> l(lock);
+    return _truncate(h, offset, l);
   }
 
 };
@@ -273,7 +273,7 @@ class BlueRocksWritableFile : public rocksdb::WritableFile {
    * Pre-allocate space for a file.
    */
   rocksdb::Status Allocate(off_t offset, off_t len) {
-    int r = fs->preallocate(h->file, offset, len);
+    int r = fs->preallocate(h, offset, len);
     return err_to_status(r);
   }
 };
@@ -17,6 +17,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <boost/container/small_vector.hpp>
 
 #include "include/cpp-btree/btree_set.h"
 
@@ -48,12 +49,15 @@ MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::Onode, bluestore_onode,
 // bluestore_cache_other
 MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::Buffer, bluestore_buffer,
 			      bluestore_cache_other);
-MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::Extent, bluestore_extent,
-			      bluestore_cache_other);
-MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::Blob, bluestore_blob,
-			      bluestore_cache_other);
-MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::SharedBlob, bluestore_shared_blob,
-			      bluestore_cache_other);
+// Extent, Blob and SharedBlob are created on every onode/extent map
+// decode and dropped on every trim; carve them out of slabs so that
+// cache misses do not hit the general heap.
+MEMPOOL_DEFINE_SLAB_OBJECT_FACTORY(BlueStore::Extent, bluestore_extent,
+				   bluestore_cache_other);
+MEMPOOL_DEFINE_SLAB_OBJECT_FACTORY(BlueStore::Blob, bluestore_blob,
+				   bluestore_cache_other);
+MEMPOOL_DEFINE_SLAB_OBJECT_FACTORY(BlueStore::SharedBlob, bluestore_shared_blob,
+				   bluestore_cache_other);
 
 // bluestore_txc
 MEMPOOL_DEFINE_OBJECT_FACTORY(BlueStore::TransContext, bluestore_transcontext,
@@ -565,6 +569,106 @@ struct Int64ArrayMergeOperator : public KeyValueDB::MergeOperator {
   }
 };
 
+// Shared blob records are either a full bluestore_shared_blob_t (whose
+// encoding starts with a non-zero struct_v) or a refcount delta,
+// prefixed with a zero byte.  Deltas merge into a full record, or
+// concatenate when rocksdb merges two operands.
+//
+// This runs inside rocksdb (reads and compaction), where we must not
+// assert.  An operand that does not decode, or that drops a ref the
+// record does not have, is logged and skipped, leaving the record as it
+// was; fsck then reports the mismatched refs.
+struct SharedBlobMergeOperator : public KeyValueDB::MergeOperator {
+  CephContext *cct;
+
+  explicit SharedBlobMergeOperator(CephContext *cct) : cct(cct) {}
+
+  static bool is_delta(const char *data, size_t len) {
+    return len > 0 && data[0] == 0;
+  }
+  static void decode_delta(const char *data, size_t len,
+			   bluestore_shared_blob_delta_t *delta) {
+    if (!is_delta(data, len)) {
+      throw buffer::malformed_input("not a shared blob delta");
+    }
+    bufferlist bl;
+    bl.append(data + 1, len - 1);
+    auto p = bl.cbegin();
+    decode(*delta, p);
+  }
+  static void encode_delta(const bluestore_shared_blob_delta_t& delta,
+			   bufferlist& bl) {
+    bl.append((char)0);
+    encode(delta, bl);
+  }
+
+  void merge_nonexistent(
+    const char *rdata, size_t rlen, std::string *new_value) override {
+    bluestore_shared_blob_t sb(0);
+    bufferlist bl;
+    try {
+      bluestore_shared_blob_delta_t rd;
+      decode_delta(rdata, rlen, &rd);
+      if (rd.apply(&sb.ref_map) < 0) {
+	lderr(cct) << __func__ << " shared blob delta " << rd
+		   << " drops refs of a missing record, skipping" << dendl;
+	sb.ref_map.clear();
+      }
+    } catch (buffer::error& e) {
+      lderr(cct) << __func__ << " undecodable shared blob delta: " << e.what()
+		 << ", skipping" << dendl;
+    }
+    encode(sb, bl);
+    *new_value = bl.to_str();
+  }
+  void merge(
+    const char *ldata, size_t llen,
+    const char *rdata, size_t rlen,
+    std::string *new_value) override {
+    bluestore_shared_blob_delta_t rd;
+    try {
+      decode_delta(rdata, rlen, &rd);
+    } catch (buffer::error& e) {
+      lderr(cct) << __func__ << " undecodable shared blob delta: " << e.what()
+		 << ", skipping" << dendl;
+      new_value->assign(ldata, llen);
+      return;
+    }
+    bufferlist bl;
+    try {
+      if (is_delta(ldata, llen)) {
+	bluestore_shared_blob_delta_t ld;
+	decode_delta(ldata, llen, &ld);
+	ld.append(rd);
+	encode_delta(ld, bl);
+      } else {
+	bluestore_shared_blob_t sb(0);
+	bufferlist lbl;
+	lbl.append(ldata, llen);
+	auto p = lbl.cbegin();
+	decode(sb, p);
+	if (rd.apply(&sb.ref_map) < 0) {
+	  lderr(cct) << __func__ << " shared blob delta " << rd
+		     << " drops refs the record does not have, skipping"
+		     << dendl;
+	  new_value->assign(ldata, llen);
+	  return;
+	}
+	encode(sb, bl);
+      }
+    } catch (buffer::error& e) {
+      lderr(cct) << __func__ << " undecodable shared blob record: "
+		 << e.what() << ", skipping delta " << rd << dendl;
+      new_value->assign(ldata, llen);
+      return;
+    }
+    *new_value = bl.to_str();
+  }
+  string name() const override {
+    return "shared_blob_delta";
+  }
+};
+
 
 // Buffer
 
@@ -794,6 +898,20 @@ void BlueStore::Cache::trim_all()
   _trim(0, 0);
 }
 
+void BlueStore::Cache::dump_hot_onodes(
+  size_t max, vector<pair<coll_t,string>> *ls)
+{
+  std::lock_guard<std::recursive_mutex> l(lock);
+  _foreach_onode_mru([&](Onode& o) {
+      if (max == 0)
+	return false;
+      --max;
+      if (o.exists)
+	ls->emplace_back(o.c->cid, string(o.key.data(), o.key.size()));
+      return true;
+    });
+}
+
 // LRUCache
 #undef dout_prefix
 #define dout_prefix *_dout << "bluestore.LRUCache(" << this << ") "
@@ -866,6 +984,7 @@ void BlueStore::LRUCache::_trim(uint64_t onode_max, uint64_t buffer_max)
       assert(num == 1);
     }
     o->get();  // paranoia
+    o->c->store->_tier_note_evicted(o);
     o->c->onode_map.remove(o->oid);
     o->put();
     --num;
@@ -1164,6 +1283,7 @@ void BlueStore::TwoQCache::_trim(uint64_t onode_max, uint64_t buffer_max)
       assert(num == 1);
     }
     o->get();  // paranoia
+    o->c->store->_tier_note_evicted(o);
     o->c->onode_map.remove(o->oid);
     o->put();
     --num;
@@ -1488,6 +1608,7 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
       cache->_touch_onode(p->second);
       hit = true;
       o = p->second;
+      ++o->heat;
     }
   }
 
@@ -1957,7 +2078,9 @@ void BlueStore::ExtentMap::dup(BlueStore* b, TransContext* txc,
     } else { 
       // dup the blob
       const bluestore_blob_t& blob = e.blob->get_blob();
-      // make sure it is shared
+      // make sure it is shared; refs taken on a record that is
+      // already on disk can go out as a delta
+      bool as_delta = b->shared_blob_merge && blob.is_shared();
       if (!blob.is_shared()) {
         c->make_blob_shared(b->_assign_blobid(txc), e.blob);
 	if (!inject_21040 && !src_dirty) {
@@ -1981,9 +2104,15 @@ void BlueStore::ExtentMap::dup(BlueStore* b, TransContext* txc,
       for (auto p : blob.get_extents()) {
         if (p.is_valid()) {
           e.blob->shared_blob->get_ref(p.offset, p.length);
+	  if (as_delta) {
+	    txc->note_shared_blob_ref(e.blob->shared_blob,
+				      p.offset, p.length, 1);
+	  }
         }
       }
-      txc->write_shared_blob(e.blob->shared_blob);
+      if (!as_delta) {
+	txc->write_shared_blob(e.blob->shared_blob);
+      }
       dout(20) << __func__ << "    new " << *cb << dendl;
     }
 
@@ -2557,7 +2686,8 @@ unsigned BlueStore::ExtentMap::decode_some(bufferlist& bl)
 
   uint32_t num;
   denc_varint(num, p);
-  vector<BlobRef> blobs(num);
+  // most shards carry a handful of blobs; keep them off the heap
+  boost::container::small_vector<BlobRef, 32> blobs(num);
   uint64_t pos = 0;
   uint64_t prev_len = 0;
   unsigned n = 0;
@@ -3172,6 +3302,7 @@ BlueStore::Collection::Collection(BlueStore *store_, Cache *c, coll_t cid)
     if (p == store->zombie_osr_set.end()) {
       osr = new OpSequencer(store, cid);
       osr->shard = cid.hash_to_shard(store->m_finisher_num);
+      osr->kv_lane = cid.hash_to_shard(store->kv_sync_lane_num);
     } else {
       osr = p->second;
       store->zombie_osr_set.erase(p);
@@ -3187,6 +3318,15 @@ bool BlueStore::Collection::flush_commit(Context *c)
   return osr->flush_commit(c);
 }
 
+void BlueStore::Collection::compress_stats_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("attempted", attempted);
+  f->dump_unsigned("rejected", rejected);
+  f->dump_unsigned("skipped", skipped);
+  f->dump_unsigned("skipped_bytes", skipped_bytes);
+  f->dump_unsigned("cold", cold);
+}
+
 void BlueStore::Collection::flush()
 {
   osr->flush();
@@ -3323,6 +3463,8 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
     for (auto& i : on->onode.attrs) {
       i.second.reassign_to_mempool(mempool::mempool_bluestore_cache_other);
     }
+    on->onode.inline_data.reassign_to_mempool(
+      mempool::mempool_bluestore_cache_other);
 
     // initialize extent_map
     on->extent_map.decode_spanning_blobs(p);
@@ -3427,6 +3569,9 @@ void *BlueStore::MempoolThread::entry()
   caches.push_back(&data_cache);
 
   utime_t next_balance = ceph_clock_now();
+  utime_t next_warmup_save = ceph_clock_now();
+  next_warmup_save += store->cct->_conf->get_val<double>(
+    "bluestore_onode_warmup_save_interval");
   while (!stop) {
     _adjust_cache_settings();
 
@@ -3445,6 +3590,16 @@ void *BlueStore::MempoolThread::entry()
     _trim_shards(log_stats);
     store->_update_cache_logger();
 
+    double warmup_interval = store->cct->_conf->get_val<double>(
+      "bluestore_onode_warmup_save_interval");
+    if (warmup_interval > 0 &&
+	store->cct->_conf->get_val<bool>("bluestore_onode_warmup") &&
+	next_warmup_save < ceph_clock_now()) {
+      store->_save_onode_warmup();
+      next_warmup_save = ceph_clock_now();
+      next_warmup_save += warmup_interval;
+    }
+
     utime_t wait;
     wait += store->cct->_conf->bluestore_cache_trim_interval;
     cond.WaitInterval(lock, wait);
@@ -3734,7 +3889,7 @@ void BlueStore::handle_discard(interval_set<uint64_t>& to_release)
 {
   dout(10) << __func__ << dendl;
   assert(alloc);
-  alloc->release(to_release);
+  _alloc_release(to_release);
 }
 
 BlueStore::BlueStore(CephContext *cct, const string& path)
@@ -3747,7 +3902,10 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
     deferred_finisher(cct, "defered_finisher", "dfin"),
     kv_sync_thread(this),
     kv_finalize_thread(this),
-    mempool_thread(this)
+    mempool_thread(this),
+    onode_warmup_thread(this),
+    tier_thread(this),
+    defrag_thread(this)
 {
   _init_logger();
   cct->_conf->add_observer(this);
@@ -3768,7 +3926,10 @@ BlueStore::BlueStore(CephContext *cct,
     kv_finalize_thread(this),
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(ctz(_min_alloc_size)),
-    mempool_thread(this)
+    mempool_thread(this),
+    onode_warmup_thread(this),
+    tier_thread(this),
+    defrag_thread(this)
 {
   _init_logger();
   cct->_conf->add_observer(this);
@@ -3801,6 +3962,7 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_csum_type",
     "bluestore_compression_mode",
     "bluestore_compression_algorithm",
+    "bluestore_compression_algorithm_cold",
     "bluestore_compression_min_blob_size",
     "bluestore_compression_min_blob_size_ssd",
     "bluestore_compression_min_blob_size_hdd",
@@ -3808,6 +3970,8 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_compression_max_blob_size_ssd",
     "bluestore_compression_max_blob_size_hdd",
     "bluestore_compression_required_ratio",
+    "bluestore_compression_sample_size",
+    "bluestore_compression_sample_slop",
     "bluestore_max_alloc_size",
     "bluestore_prefer_deferred_size",
     "bluestore_prefer_deferred_size_hdd",
@@ -3815,6 +3979,8 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_deferred_batch_ops",
     "bluestore_deferred_batch_ops_hdd",
     "bluestore_deferred_batch_ops_ssd",
+    "bluestore_deferred_elevator_hdd",
+    "bluestore_deferred_elevator_ssd",
     "bluestore_throttle_bytes",
     "bluestore_throttle_deferred_bytes",
     "bluestore_throttle_cost_per_io_hdd",
@@ -3836,8 +4002,11 @@ void BlueStore::handle_conf_change(const struct md_config_t *conf,
   }
   if (changed.count("bluestore_compression_mode") ||
       changed.count("bluestore_compression_algorithm") ||
+      changed.count("bluestore_compression_algorithm_cold") ||
       changed.count("bluestore_compression_min_blob_size") ||
-      changed.count("bluestore_compression_max_blob_size")) {
+      changed.count("bluestore_compression_max_blob_size") ||
+      changed.count("bluestore_compression_sample_size") ||
+      changed.count("bluestore_compression_sample_slop")) {
     if (bdev) {
       _set_compression();
     }
@@ -3856,7 +4025,9 @@ void BlueStore::handle_conf_change(const struct md_config_t *conf,
       changed.count("bluestore_max_alloc_size") ||
       changed.count("bluestore_deferred_batch_ops") ||
       changed.count("bluestore_deferred_batch_ops_hdd") ||
-      changed.count("bluestore_deferred_batch_ops_ssd")) {
+      changed.count("bluestore_deferred_batch_ops_ssd") ||
+      changed.count("bluestore_deferred_elevator_hdd") ||
+      changed.count("bluestore_deferred_elevator_ssd")) {
     if (bdev) {
       // only after startup
       _set_alloc_sizes();
@@ -3894,6 +4065,24 @@ void BlueStore::_set_compression()
   }
 
   compressor = nullptr;
+  cold_compressor = nullptr;
+
+  // pools may still enable compression through their own
+  // compression_mode, so these apply regardless of the global mode
+  comp_sample_size =
+    cct->_conf->get_val<uint64_t>("bluestore_compression_sample_size");
+  comp_sample_slop =
+    cct->_conf->get_val<double>("bluestore_compression_sample_slop");
+
+  string cold_alg_name = cct->_conf->get_val<string>(
+    "bluestore_compression_algorithm_cold");
+  if (!cold_alg_name.empty()) {
+    cold_compressor = Compressor::create(cct, cold_alg_name);
+    if (!cold_compressor) {
+      derr << __func__ << " unable to initialize " << cold_alg_name
+	   << " cold compressor" << dendl;
+    }
+  }
 
   if (comp_mode == Compressor::COMP_NONE) {
     dout(10) << __func__ << " compression mode set to 'none', "
@@ -3931,11 +4120,14 @@ void BlueStore::_set_compression()
            << dendl;
     }
   }
- 
+
   dout(10) << __func__ << " mode " << Compressor::get_comp_mode_name(comp_mode)
 	   << " alg " << (compressor ? compressor->get_type_name() : "(none)")
+	   << " cold alg "
+	   << (cold_compressor ? cold_compressor->get_type_name() : "(none)")
 	   << " min_blob " << comp_min_blob_size
 	   << " max_blob " << comp_max_blob_size
+	   << " sample " << comp_sample_size
 	   << dendl;
 }
 
@@ -4131,12 +4323,25 @@ void BlueStore::_init_logger()
     "Sum for beneficial compress ops");
   b.add_u64_counter(l_bluestore_compress_rejected_count, "compress_rejected_count",
     "Sum for compress ops rejected due to low net gain of space");
+  b.add_u64_counter(l_bluestore_shared_blob_merges, "shared_blob_merges",
+    "Sum for shared blob refcount deltas written as merges");
+  b.add_u64_counter(l_bluestore_compress_skipped_count, "compress_skipped_count",
+    "Sum for compress ops avoided because a sample did not compress");
+  b.add_u64_counter(l_bluestore_compress_skipped_bytes, "compress_skipped_bytes",
+    "Sum for bytes written uncompressed without a full compress attempt",
+    NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_write_pad_bytes, "write_pad_bytes",
 		    "Sum for write-op padded bytes", NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_deferred_write_ops, "deferred_write_ops",
 		    "Sum for deferred write op");
   b.add_u64_counter(l_bluestore_deferred_write_bytes, "deferred_write_bytes",
 		    "Sum for deferred write bytes", "def", 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_deferred_elevator_passes,
+		    "deferred_elevator_passes",
+		    "Deferred submissions merging all sequencers' batches");
+  b.add_u64_counter(l_bluestore_deferred_idle_flushes,
+		    "deferred_idle_flushes",
+		    "Deferred write flushes triggered by an idle store");
   b.add_u64_counter(l_bluestore_write_penalty_read_ops, "write_penalty_read_ops",
 		    "Sum for write penalty read ops");
   b.add_u64(l_bluestore_allocated, "bluestore_allocated",
@@ -4173,6 +4378,15 @@ void BlueStore::_init_logger()
 	    "Sum for bytes of read hit in the cache", NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64(l_bluestore_buffer_miss_bytes, "bluestore_buffer_miss_bytes",
 	    "Sum for bytes of read missed in the cache", NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_slab_bytes, "bluestore_slab_bytes",
+	    "Bytes held in extent/blob/shared blob slabs", NULL, 0,
+	    unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_slab_items, "bluestore_slab_items",
+	    "Live extent/blob/shared blob objects in slabs");
+  b.add_u64_counter(l_bluestore_slab_refills, "bluestore_slab_refills",
+		    "Slabs allocated from the heap");
+  b.add_u64_counter(l_bluestore_slab_releases, "bluestore_slab_releases",
+		    "Slabs returned to the heap");
 
   b.add_u64_counter(l_bluestore_write_big, "bluestore_write_big",
 		    "Large aligned writes into fresh blobs");
@@ -4196,6 +4410,12 @@ void BlueStore::_init_logger()
 		    "cached) to fill out the block");
   b.add_u64_counter(l_bluestore_write_small_new, "bluestore_write_small_new",
 		    "Small write into new (sparse) blob");
+  b.add_u64_counter(l_bluestore_write_inline, "bluestore_write_inline",
+		    "Writes stored inline in the onode");
+  b.add_u64_counter(l_bluestore_write_inline_bytes,
+		    "bluestore_write_inline_bytes",
+		    "Sum for bytes stored inline in the onode",
+		    NULL, 0, unit_t(UNIT_BYTES));
 
   b.add_u64_counter(l_bluestore_txc, "bluestore_txc", "Transactions committed");
   b.add_u64_counter(l_bluestore_onode_reshard, "bluestore_onode_reshard",
@@ -4211,6 +4431,23 @@ void BlueStore::_init_logger()
                     "Read EIO errors propagated to high level callers");
   b.add_u64(l_bluestore_fragmentation, "bluestore_fragmentation_micros",
             "How fragmented bluestore free space is (free extents / max possible number of free extents) * 1000");
+  b.add_u64(l_bluestore_fast_tier_free, "bluestore_fast_tier_free",
+	    "Free space in the fast tier", NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_fast_tier_promoted,
+		    "bluestore_fast_tier_promoted",
+		    "Objects moved to the fast tier");
+  b.add_u64_counter(l_bluestore_fast_tier_demoted,
+		    "bluestore_fast_tier_demoted",
+		    "Objects moved to the slow tier");
+  b.add_u64_counter(l_bluestore_fast_tier_migrated_bytes,
+		    "bluestore_fast_tier_migrated_bytes",
+		    "Bytes rewritten by tier migration",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_defrag_objects, "bluestore_defrag_objects",
+		    "Objects rewritten by online defragmentation");
+  b.add_u64_counter(l_bluestore_defrag_bytes, "bluestore_defrag_bytes",
+		    "Bytes rewritten by online defragmentation",
+		    NULL, 0, unit_t(UNIT_BYTES));
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -4402,19 +4639,34 @@ void BlueStore::_set_alloc_sizes(void)
     deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops;
   } else {
     assert(bdev);
-    if (bdev->is_rotational()) {
+    if (bdev->supports_direct_persist()) {
+      // nothing to amortize; apply each deferred write as soon as it is
+      // committed so the staged copy can be released right away
+      deferred_batch_ops = 1;
+    } else if (bdev->is_rotational()) {
       deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops_hdd;
     } else {
       deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops_ssd;
     }
   }
 
+  if (bdev && bdev->supports_direct_persist()) {
+    deferred_elevator = false;
+  } else if (bdev && bdev->is_rotational()) {
+    deferred_elevator =
+      cct->_conf->get_val<bool>("bluestore_deferred_elevator_hdd");
+  } else {
+    deferred_elevator =
+      cct->_conf->get_val<bool>("bluestore_deferred_elevator_ssd");
+  }
+
   dout(10) << __func__ << " min_alloc_size 0x" << std::hex << min_alloc_size
 	   << std::dec << " order " << (int)min_alloc_size_order
 	   << " max_alloc_size 0x" << std::hex << max_alloc_size
 	   << " prefer_deferred_size 0x" << prefer_deferred_size
 	   << std::dec
 	   << " deferred_batch_ops " << deferred_batch_ops
+	   << " deferred_elevator " << deferred_elevator
 	   << dendl;
 }
 
@@ -4580,6 +4832,7 @@ void BlueStore::_close_fm()
 int BlueStore::_open_alloc()
 {
   assert(alloc == NULL);
+  assert(fast_alloc == NULL);
   assert(bdev->get_size());
   alloc = Allocator::create(cct, cct->_conf->bluestore_allocator,
                             bdev->get_size(),
@@ -4591,6 +4844,25 @@ int BlueStore::_open_alloc()
     return -EINVAL;
   }
 
+  fast_tier_size = p2align(cct->_conf->get_val<uint64_t>(
+			     "bluestore_fast_tier_size"),
+			   (uint64_t)min_alloc_size);
+  if (fast_tier_size >= bdev->get_size()) {
+    derr << __func__ << " bluestore_fast_tier_size 0x" << std::hex
+	 << fast_tier_size << " is not smaller than the device size 0x"
+	 << bdev->get_size() << std::dec << ", ignoring" << dendl;
+    fast_tier_size = 0;
+  }
+  if (fast_tier_size) {
+    fast_alloc = Allocator::create(cct, cct->_conf->bluestore_allocator,
+				   fast_tier_size,
+				   min_alloc_size);
+    assert(fast_alloc);
+    dout(1) << __func__ << " fast tier is 0x0~0x" << std::hex
+	    << fast_tier_size << std::dec << " ("
+	    << byte_u_t(fast_tier_size) << ")" << dendl;
+  }
+
   uint64_t num = 0, bytes = 0;
 
   dout(1) << __func__ << " opening allocation metadata" << dendl;
@@ -4598,7 +4870,7 @@ int BlueStore::_open_alloc()
   fm->enumerate_reset();
   uint64_t offset, length;
   while (fm->enumerate_next(&offset, &length)) {
-    alloc->init_add_free(offset, length);
+    _alloc_init_add_free(offset, length);
     ++num;
     bytes += length;
   }
@@ -4609,7 +4881,7 @@ int BlueStore::_open_alloc()
 
   // also mark bluefs space as allocated
   for (auto e = bluefs_extents.begin(); e != bluefs_extents.end(); ++e) {
-    alloc->init_rm_free(e.get_start(), e.get_len());
+    _alloc_init_rm_free(e.get_start(), e.get_len());
   }
   dout(10) << __func__ << " marked bluefs_extents 0x" << std::hex
 	   << bluefs_extents << std::dec << " as allocated" << dendl;
@@ -4626,6 +4898,107 @@ void BlueStore::_close_alloc()
   alloc->shutdown();
   delete alloc;
   alloc = NULL;
+
+  if (fast_alloc) {
+    fast_alloc->shutdown();
+    delete fast_alloc;
+    fast_alloc = NULL;
+  }
+  fast_tier_size = 0;
+}
+
+void BlueStore::_alloc_init_add_free(uint64_t offset, uint64_t length)
+{
+  if (offset < fast_tier_size) {
+    uint64_t l = std::min(length, fast_tier_size - offset);
+    fast_alloc->init_add_free(offset, l);
+    offset += l;
+    length -= l;
+  }
+  if (length) {
+    alloc->init_add_free(offset, length);
+  }
+}
+
+void BlueStore::_alloc_init_rm_free(uint64_t offset, uint64_t length)
+{
+  if (offset < fast_tier_size) {
+    uint64_t l = std::min(length, fast_tier_size - offset);
+    fast_alloc->init_rm_free(offset, l);
+    offset += l;
+    length -= l;
+  }
+  if (length) {
+    alloc->init_rm_free(offset, length);
+  }
+}
+
+void BlueStore::_alloc_release(const interval_set<uint64_t>& release_set)
+{
+  if (!fast_alloc) {
+    alloc->release(release_set);
+    return;
+  }
+  interval_set<uint64_t> fast, slow;
+  for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+    uint64_t offset = p.get_start();
+    uint64_t length = p.get_len();
+    if (offset < fast_tier_size) {
+      uint64_t l = std::min(length, fast_tier_size - offset);
+      fast.insert(offset, l);
+      offset += l;
+      length -= l;
+    }
+    if (length) {
+      slow.insert(offset, length);
+    }
+  }
+  if (!fast.empty()) {
+    fast_alloc->release(fast);
+  }
+  if (!slow.empty()) {
+    alloc->release(slow);
+  }
+}
+
+uint64_t BlueStore::_alloc_get_free()
+{
+  uint64_t free = alloc->get_free();
+  if (fast_alloc) {
+    free += fast_alloc->get_free();
+  }
+  return free;
+}
+
+double BlueStore::_fast_tier_free_ratio()
+{
+  if (!fast_alloc) {
+    return 0;
+  }
+  return (double)fast_alloc->get_free() / (double)fast_tier_size;
+}
+
+int64_t BlueStore::_alloc_data(uint64_t want, bool fast,
+			       PExtentVector *extents)
+{
+  if (fast && fast_alloc &&
+      _fast_tier_free_ratio() >
+        cct->_conf->get_val<double>("bluestore_fast_tier_min_free_ratio")) {
+    PExtentVector fast_extents;
+    int64_t got = fast_alloc->allocate(want, min_alloc_size, want,
+				       0, &fast_extents);
+    if (got == (int64_t)want) {
+      extents->insert(extents->end(), fast_extents.begin(),
+		      fast_extents.end());
+      return got;
+    }
+    dout(20) << __func__ << " fast tier short 0x" << std::hex << got
+	     << " < 0x" << want << std::dec << ", using slow tier" << dendl;
+    if (got > 0) {
+      fast_alloc->release(fast_extents);
+    }
+  }
+  return alloc->allocate(want, min_alloc_size, want, 0, extents);
 }
 
 int BlueStore::_open_fsid(bool create)
@@ -5040,19 +5413,24 @@ int BlueStore::_open_db(bool create, bool to_repair_db)
 
   FreelistManager::setup_merge_operators(db);
   db->set_merge_operator(PREFIX_STAT, merge_op);
+  db->set_merge_operator(PREFIX_SHARED_BLOB,
+			 std::make_shared<SharedBlobMergeOperator>(cct));
+  shared_blob_merge = cct->_conf->get_val<bool>("bluestore_shared_blob_merge");
   db->set_cache_size(cache_kv_ratio * cache_size);
 
   if (kv_backend == "rocksdb") {
     options = cct->_conf->bluestore_rocksdb_options;
 
-    map<string,string> cf_map;
-    cct->_conf->with_val<string>("bluestore_rocksdb_cfs",
-                                 get_str_map,
-                                 &cf_map,
-                                 " \t");
-    for (auto& i : cf_map) {
-      dout(10) << "column family " << i.first << ": " << i.second << dendl;
-      cfs.push_back(KeyValueDB::ColumnFamily(i.first, i.second));
+    r = KeyValueDB::ColumnFamily::parse_list(
+      cct->_conf->get_val<string>("bluestore_rocksdb_cfs"), &cfs);
+    if (r < 0) {
+      derr << __func__ << " invalid bluestore_rocksdb_cfs" << dendl;
+      _close_db();
+      return -EINVAL;
+    }
+    for (auto& i : cfs) {
+      dout(10) << "column family " << i.name << " (" << i.shards
+	       << " shards): " << i.option << dendl;
     }
   }
 
@@ -5167,7 +5545,7 @@ int BlueStore::_balance_bluefs_freespace(PExtentVector *extents)
   uint64_t bluefs_total = bluefs_usage[bluefs_shared_bdev].second;
   float bluefs_free_ratio = (float)bluefs_free / (float)bluefs_total;
 
-  uint64_t my_free = alloc->get_free();
+  uint64_t my_free = _alloc_get_free();
   uint64_t total = bdev->get_size();
   float my_free_ratio = (float)my_free / (float)total;
 
@@ -5570,7 +5948,9 @@ int BlueStore::mkfs()
       t->set(PREFIX_SUPER, "min_alloc_size", bl);
     }
 
-    ondisk_format = latest_ondisk_format;
+    // inline onodes are opted in to on mount; see
+    // _enable_inline_data_format()
+    ondisk_format = min_compat_ondisk_format;
     _prepare_ondisk_format_super(t);
     db->submit_transaction_sync(t);
   }
@@ -5700,6 +6080,14 @@ int BlueStore::_mount(bool kv_only, bool open_db)
   if (r < 0)
     goto out_db;
 
+  r = _enable_inline_data_format();
+  if (r < 0)
+    goto out_db;
+
+  r = _check_shared_blob_deltas();
+  if (r < 0)
+    goto out_db;
+
   r = _open_fm(false);
   if (r < 0)
     goto out_db;
@@ -5708,6 +6096,11 @@ int BlueStore::_mount(bool kv_only, bool open_db)
   if (r < 0)
     goto out_fm;
 
+  // sequencers are pinned to a kv sync lane when their collection is
+  // opened, so this must be settled first.
+  kv_sync_lane_num = std::max<uint64_t>(
+    1, cct->_conf->get_val<uint64_t>("bluestore_kv_sync_lanes"));
+
   r = _open_collections();
   if (r < 0)
     goto out_alloc;
@@ -5730,6 +6123,18 @@ int BlueStore::_mount(bool kv_only, bool open_db)
 
   mempool_thread.init();
 
+  _onode_warmup_start();
+
+  if (fast_alloc) {
+    tier_thread.init();
+  }
+  {
+    double interval = cct->_conf->get_val<double>("bluestore_defrag_interval");
+    if (interval > 0) {
+      defrag_thread.init(interval);
+    }
+  }
+
   mounted = true;
   return 0;
 
@@ -5757,6 +6162,16 @@ int BlueStore::umount()
   assert(_kv_only || mounted);
   dout(1) << __func__ << dendl;
 
+  _onode_warmup_stop();
+  if (defrag_thread.is_started()) {
+    defrag_thread.shutdown();
+  }
+  if (fast_alloc) {
+    tier_thread.shutdown();
+    std::lock_guard<std::mutex> l(tier_lock);
+    tier_promote_q.clear();
+    tier_demote_q.clear();
+  }
   _osr_drain_all();
 
   mounted = false;
@@ -5764,6 +6179,9 @@ int BlueStore::umount()
     mempool_thread.shutdown();
     dout(20) << __func__ << " stopping kv thread" << dendl;
     _kv_stop();
+    if (cct->_conf->get_val<bool>("bluestore_onode_warmup")) {
+      _save_onode_warmup();
+    }
     _flush_cache();
     dout(20) << __func__ << " closing" << dendl;
 
@@ -5853,6 +6271,352 @@ int BlueStore::_fsck_check_extents(
   return errors;
 }
 
+typedef btree::btree_set<
+  uint64_t,std::less<uint64_t>,
+  mempool::bluestore_fsck::pool_allocator<uint64_t>> fsck_uint64_btree_t;
+
+struct fsck_sb_info_t {
+  coll_t cid;
+  list<ghobject_t> oids;
+  BlueStore::SharedBlobRef sb;
+  bluestore_extent_ref_map_t ref_map;
+  bool compressed = false;
+  bool passed = false;
+  bool updated = false;
+};
+
+// State the object walk accumulates.  With bluestore_fsck_threads > 1
+// every worker has its own context and they are merged once all
+// workers are done.  used_blocks (and the repairer's trackers) are
+// shared under used_blocks_lock, and the nid and omap head sets under
+// used_ids_lock, so a duplicate is caught as the object is checked,
+// just as in a single-threaded walk.
+struct BlueStore::FSCK_ObjectCtx {
+  bool deep = false;
+  BlueStoreRepairer *repairer = nullptr;
+  mempool_dynamic_bitset *used_blocks = nullptr;
+  std::mutex *used_blocks_lock = nullptr;
+
+  int errors = 0;
+  uint64_t num_objects = 0;
+  uint64_t num_extents = 0;
+  uint64_t num_blobs = 0;
+  uint64_t num_spanning_blobs = 0;
+  uint64_t num_sharded_objects = 0;
+  uint64_t num_object_shards = 0;
+  store_statfs_t expected_statfs;
+  fsck_uint64_btree_t *used_nids = nullptr;
+  fsck_uint64_btree_t *used_omap_head = nullptr;
+  fsck_uint64_btree_t *used_pgmeta_omap_head = nullptr;
+  std::mutex *used_ids_lock = nullptr;
+  mempool::bluestore_fsck::map<uint64_t,fsck_sb_info_t> sb_info;
+
+  // read by the walking thread for progress reports
+  std::atomic<uint64_t> objects_done = {0};
+  std::atomic<uint64_t> bytes_done = {0};
+};
+
+struct fsck_item_t {
+  BlueStore::CollectionRef c;
+  ghobject_t oid;
+  mempool::bluestore_fsck::list<string> shard_keys;  ///< as found in the db
+};
+
+struct fsck_queue_t {
+  std::mutex lock;
+  std::condition_variable cond;
+  std::deque<vector<fsck_item_t>> batches;
+  size_t max_batches = 0;
+  bool done = false;
+
+  void push(vector<fsck_item_t>&& batch) {
+    std::unique_lock<std::mutex> l(lock);
+    while (batches.size() >= max_batches) {
+      cond.wait(l);
+    }
+    batches.emplace_back(std::move(batch));
+    cond.notify_all();
+  }
+  bool pop(vector<fsck_item_t> *batch) {
+    std::unique_lock<std::mutex> l(lock);
+    while (batches.empty() && !done) {
+      cond.wait(l);
+    }
+    if (batches.empty()) {
+      return false;
+    }
+    batch->swap(batches.front());
+    batches.pop_front();
+    cond.notify_all();
+    return true;
+  }
+  void finish() {
+    std::lock_guard<std::mutex> l(lock);
+    done = true;
+    cond.notify_all();
+  }
+};
+
+struct BlueStore::FSCK_Worker : public Thread {
+  BlueStore *store;
+  fsck_queue_t *queue;
+  FSCK_ObjectCtx ctx;
+
+  FSCK_Worker(BlueStore *s, fsck_queue_t *q) : store(s), queue(q) {}
+  void *entry() override {
+    vector<fsck_item_t> batch;
+    while (queue->pop(&batch)) {
+      for (auto& i : batch) {
+	store->_fsck_check_object(ctx, i.c, i.oid, i.shard_keys);
+      }
+      batch.clear();
+    }
+    return NULL;
+  }
+};
+
+void BlueStore::_fsck_check_object(
+  FSCK_ObjectCtx& ctx,
+  CollectionRef& c,
+  const ghobject_t& oid,
+  const mempool::bluestore_fsck::list<string>& shard_keys)
+{
+  int& errors = ctx.errors;
+  store_statfs_t& expected_statfs = ctx.expected_statfs;
+
+  dout(10) << __func__ << "  " << oid << dendl;
+  RWLock::RLocker l(c->lock);
+  OnodeRef o = c->get_onode(oid, false);
+  if (o->onode.nid) {
+    if (o->onode.nid > nid_max) {
+      derr << "fsck error: " << oid << " nid " << o->onode.nid
+	   << " > nid_max " << nid_max << dendl;
+      ++errors;
+    }
+    std::unique_lock<std::mutex> il;
+    if (ctx.used_ids_lock) {
+      il = std::unique_lock<std::mutex>(*ctx.used_ids_lock);
+    }
+    if (!ctx.used_nids->insert(o->onode.nid).second) {
+      derr << "fsck error: " << oid << " nid " << o->onode.nid
+	   << " already in use" << dendl;
+      ++errors;
+      return; // go for next object
+    }
+  }
+  ++ctx.num_objects;
+  ctx.num_spanning_blobs += o->extent_map.spanning_blob_map.size();
+  o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
+  _dump_onode(o);
+  // shards
+  if (!o->extent_map.shards.empty()) {
+    ++ctx.num_sharded_objects;
+    ctx.num_object_shards += o->extent_map.shards.size();
+  }
+  auto sk = shard_keys.begin();
+  for (auto& s : o->extent_map.shards) {
+    dout(20) << __func__ << "    shard " << *s.shard_info << dendl;
+    string expecting;
+    get_extent_shard_key(o->key, s.shard_info->offset, &expecting);
+    while (sk != shard_keys.end() && *sk < expecting) {
+      derr << "fsck error: " << oid << " stray shard key "
+	   << pretty_binary_string(*sk) << dendl;
+      ++errors;
+      ++sk;
+    }
+    if (sk != shard_keys.end() && *sk == expecting) {
+      ++sk;
+    } else {
+      derr << "fsck error: missing shard key "
+	   << pretty_binary_string(expecting) << dendl;
+      ++errors;
+    }
+    if (s.shard_info->offset >= o->onode.size) {
+      derr << "fsck error: " << oid << " shard 0x" << std::hex
+	   << s.shard_info->offset << " past EOF at 0x" << o->onode.size
+	   << std::dec << dendl;
+      ++errors;
+    }
+  }
+  for (; sk != shard_keys.end(); ++sk) {
+    derr << "fsck error: " << oid << " stray shard key "
+	 << pretty_binary_string(*sk) << dendl;
+    ++errors;
+  }
+  // lextents
+  map<BlobRef,bluestore_blob_t::unused_t> referenced;
+  uint64_t pos = 0;
+  mempool::bluestore_fsck::map<BlobRef,
+			       bluestore_blob_use_tracker_t> ref_map;
+  for (auto& l : o->extent_map.extent_map) {
+    dout(20) << __func__ << "    " << l << dendl;
+    if (l.logical_offset < pos) {
+      derr << "fsck error: " << oid << " lextent at 0x"
+	   << std::hex << l.logical_offset
+	   << " overlaps with the previous, which ends at 0x" << pos
+	   << std::dec << dendl;
+      ++errors;
+    }
+    if (o->extent_map.spans_shard(l.logical_offset, l.length)) {
+      derr << "fsck error: " << oid << " lextent at 0x"
+	   << std::hex << l.logical_offset << "~" << l.length
+	   << " spans a shard boundary"
+	   << std::dec << dendl;
+      ++errors;
+    }
+    pos = l.logical_offset + l.length;
+    expected_statfs.stored += l.length;
+    assert(l.blob);
+    const bluestore_blob_t& blob = l.blob->get_blob();
+
+    auto& ref = ref_map[l.blob];
+    if (ref.is_empty()) {
+      uint32_t min_release_size = blob.get_release_size(min_alloc_size);
+      uint32_t l = blob.get_logical_length();
+      ref.init(l, min_release_size);
+    }
+    ref.get(
+      l.blob_offset,
+      l.length);
+    ++ctx.num_extents;
+    if (blob.has_unused()) {
+      auto p = referenced.find(l.blob);
+      bluestore_blob_t::unused_t *pu;
+      if (p == referenced.end()) {
+	pu = &referenced[l.blob];
+      } else {
+	pu = &p->second;
+      }
+      uint64_t blob_len = blob.get_logical_length();
+      assert((blob_len % (sizeof(*pu)*8)) == 0);
+      assert(l.blob_offset + l.length <= blob_len);
+      uint64_t chunk_size = blob_len / (sizeof(*pu)*8);
+      uint64_t start = l.blob_offset / chunk_size;
+      uint64_t end =
+	round_up_to(l.blob_offset + l.length, chunk_size) / chunk_size;
+      for (auto i = start; i < end; ++i) {
+	(*pu) |= (1u << i);
+      }
+    }
+  }
+  for (auto &i : referenced) {
+    dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
+	     << std::dec << " for " << *i.first << dendl;
+    const bluestore_blob_t& blob = i.first->get_blob();
+    if (i.second & blob.unused) {
+      derr << "fsck error: " << oid << " blob claims unused 0x"
+	   << std::hex << blob.unused
+	   << " but extents reference 0x" << i.second << std::dec
+	   << " on blob " << *i.first << dendl;
+      ++errors;
+    }
+    if (blob.has_csum()) {
+      uint64_t blob_len = blob.get_logical_length();
+      uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused)*8);
+      unsigned csum_count = blob.get_csum_count();
+      unsigned csum_chunk_size = blob.get_csum_chunk_size();
+      for (unsigned p = 0; p < csum_count; ++p) {
+	unsigned pos = p * csum_chunk_size;
+	unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
+	unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
+	unsigned mask = 1u << firstbit;
+	for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
+	  mask |= 1u << b;
+	}
+	if ((blob.unused & mask) == mask) {
+	  // this csum chunk region is marked unused
+	  if (blob.get_csum_item(p) != 0) {
+	    derr << "fsck error: " << oid
+		 << " blob claims csum chunk 0x" << std::hex << pos
+		 << "~" << csum_chunk_size
+		 << " is unused (mask 0x" << mask << " of unused 0x"
+		 << blob.unused << ") but csum is non-zero 0x"
+		 << blob.get_csum_item(p) << std::dec << " on blob "
+		 << *i.first << dendl;
+	    ++errors;
+	  }
+	}
+      }
+    }
+  }
+  for (auto &i : ref_map) {
+    ++ctx.num_blobs;
+    const bluestore_blob_t& blob = i.first->get_blob();
+    bool equal = i.first->get_blob_use_tracker().equal(i.second);
+    if (!equal) {
+      derr << "fsck error: " << oid << " blob " << *i.first
+	   << " doesn't match expected ref_map " << i.second << dendl;
+      ++errors;
+    }
+    if (blob.is_compressed()) {
+      expected_statfs.compressed += blob.get_compressed_payload_length();
+      expected_statfs.compressed_original +=
+	i.first->get_referenced_bytes();
+    }
+    if (blob.is_shared()) {
+      if (i.first->shared_blob->get_sbid() > blobid_max) {
+	derr << "fsck error: " << oid << " blob " << blob
+	     << " sbid " << i.first->shared_blob->get_sbid() << " > blobid_max "
+	     << blobid_max << dendl;
+	++errors;
+      } else if (i.first->shared_blob->get_sbid() == 0) {
+	derr << "fsck error: " << oid << " blob " << blob
+	     << " marked as shared but has uninitialized sbid"
+	     << dendl;
+	++errors;
+      }
+      fsck_sb_info_t& sbi = ctx.sb_info[i.first->shared_blob->get_sbid()];
+      assert(sbi.cid == coll_t() || sbi.cid == c->cid);
+      sbi.cid = c->cid;
+      sbi.sb = i.first->shared_blob;
+      sbi.oids.push_back(oid);
+      sbi.compressed = blob.is_compressed();
+      for (auto e : blob.get_extents()) {
+	if (e.is_valid()) {
+	  sbi.ref_map.get(e.offset, e.length);
+	}
+      }
+    } else {
+      std::unique_lock<std::mutex> bl;
+      if (ctx.used_blocks_lock) {
+	bl = std::unique_lock<std::mutex>(*ctx.used_blocks_lock);
+      }
+      errors += _fsck_check_extents(c->cid, oid, blob.get_extents(),
+				    blob.is_compressed(),
+				    *ctx.used_blocks,
+				    fm->get_alloc_size(),
+				    ctx.repairer,
+				    expected_statfs);
+    }
+  }
+  if (ctx.deep) {
+    bufferlist bl;
+    int r = _do_read(c.get(), o, 0, o->onode.size, bl, 0);
+    if (r < 0) {
+      ++errors;
+      derr << "fsck error: " << oid << " error during read: "
+	   << cpp_strerror(r) << dendl;
+    }
+  }
+  // omap
+  if (o->onode.has_omap()) {
+    auto& m =
+      o->onode.is_pgmeta_omap() ? *ctx.used_pgmeta_omap_head :
+      *ctx.used_omap_head;
+    std::unique_lock<std::mutex> il;
+    if (ctx.used_ids_lock) {
+      il = std::unique_lock<std::mutex>(*ctx.used_ids_lock);
+    }
+    if (!m.insert(o->onode.nid).second) {
+      derr << "fsck error: " << oid << " omap_head " << o->onode.nid
+	   << " already in use" << dendl;
+      ++errors;
+    }
+  }
+  ctx.objects_done++;
+  ctx.bytes_done += o->onode.size;
+}
+
 /**
 An overview for currently implemented repair logics 
 performed in fsck in two stages: detection(+preparation) and commit.
@@ -5898,27 +6662,15 @@ int BlueStore::_fsck(bool deep, bool repair)
   int errors = 0;
   unsigned repaired = 0;
 
-  typedef btree::btree_set<
-    uint64_t,std::less<uint64_t>,
-    mempool::bluestore_fsck::pool_allocator<uint64_t>> uint64_t_btree_t;
-  uint64_t_btree_t used_nids;
-  uint64_t_btree_t used_omap_head;
-  uint64_t_btree_t used_pgmeta_omap_head;
-  uint64_t_btree_t used_sbids;
+  fsck_uint64_btree_t used_nids;
+  fsck_uint64_btree_t used_omap_head;
+  fsck_uint64_btree_t used_pgmeta_omap_head;
+  fsck_uint64_btree_t used_sbids;
 
   mempool_dynamic_bitset used_blocks;
   KeyValueDB::Iterator it;
   store_statfs_t expected_statfs, actual_statfs;
-  struct sb_info_t {
-    coll_t cid;
-    list<ghobject_t> oids;
-    SharedBlobRef sb;
-    bluestore_extent_ref_map_t ref_map;
-    bool compressed = false;
-    bool passed = false;
-    bool updated = false;
-  };
-  mempool::bluestore_fsck::map<uint64_t,sb_info_t> sb_info;
+  mempool::bluestore_fsck::map<uint64_t,fsck_sb_info_t> sb_info;
 
   uint64_t num_objects = 0;
   uint64_t num_extents = 0;
@@ -6018,299 +6770,206 @@ int BlueStore::_fsck(bool deep, bool repair)
   expected_statfs.available = actual_statfs.available;
 
   // walk PREFIX_OBJ
-  dout(1) << __func__ << " walking object keyspace" << dendl;
-  it = db->get_iterator(PREFIX_OBJ);
-  if (it) {
-    CollectionRef c;
-    spg_t pgid;
-    mempool::bluestore_fsck::list<string> expecting_shards;
-    for (it->lower_bound(string()); it->valid(); it->next()) {
-      if (g_conf->bluestore_debug_fsck_abort) {
-	goto out_scan;
-      }
-      dout(30) << __func__ << " key "
-               << pretty_binary_string(it->key()) << dendl;
-      if (is_extent_shard_key(it->key())) {
-	while (!expecting_shards.empty() &&
-	       expecting_shards.front() < it->key()) {
-	  derr << "fsck error: missing shard key "
-	       << pretty_binary_string(expecting_shards.front())
-	       << dendl;
-	  ++errors;
-	  expecting_shards.pop_front();
+  //
+  // This thread iterates the keys, resolves collections and groups each
+  // onode key with the extent shard keys that follow it; the onodes are
+  // then checked either inline or by bluestore_fsck_threads workers.
+  {
+    unsigned num_threads = std::max<uint64_t>(
+      1, cct->_conf->get_val<uint64_t>("bluestore_fsck_threads"));
+    double progress_interval =
+      cct->_conf->get_val<double>("bluestore_fsck_progress_interval");
+    const size_t batch_size = 64;
+    dout(1) << __func__ << " walking object keyspace with " << num_threads
+	    << " thread(s)" << dendl;
+
+    std::mutex used_blocks_lock, used_ids_lock;
+    fsck_queue_t queue;
+    queue.max_batches = num_threads * 4;
+    FSCK_ObjectCtx main_ctx;
+    vector<std::unique_ptr<FSCK_Worker>> workers;
+    vector<FSCK_ObjectCtx*> ctxs = { &main_ctx };
+    auto init_ctx = [&](FSCK_ObjectCtx& ctx) {
+      ctx.deep = deep;
+      ctx.repairer = repair ? &repairer : nullptr;
+      ctx.used_blocks = &used_blocks;
+      ctx.used_blocks_lock = num_threads > 1 ? &used_blocks_lock : nullptr;
+      ctx.used_nids = &used_nids;
+      ctx.used_omap_head = &used_omap_head;
+      ctx.used_pgmeta_omap_head = &used_pgmeta_omap_head;
+      ctx.used_ids_lock = num_threads > 1 ? &used_ids_lock : nullptr;
+    };
+    init_ctx(main_ctx);
+    if (num_threads > 1) {
+      for (unsigned i = 0; i < num_threads; ++i) {
+	workers.emplace_back(new FSCK_Worker(this, &queue));
+	init_ctx(workers.back()->ctx);
+	ctxs.push_back(&workers.back()->ctx);
+	workers.back()->create("bstore_fsck");
+      }
+    }
+
+    utime_t walk_start = ceph_clock_now();
+    utime_t next_progress = walk_start;
+    next_progress += progress_interval;
+    auto report_progress = [&]() {
+      uint64_t objects = 0, bytes = 0;
+      for (auto ctx : ctxs) {
+	objects += ctx->objects_done;
+	bytes += ctx->bytes_done;
+      }
+      double elapsed = ceph_clock_now() - walk_start;
+      if (fsck_progress_cb) {
+	fsck_progress_cb(objects, bytes, elapsed);
+      } else {
+	dout(1) << "fsck checked " << objects << " objects, "
+		<< byte_u_t(bytes) << " in " << elapsed << " seconds ("
+		<< (elapsed > 0 ? objects / elapsed : 0) << " objects/s, "
+		<< byte_u_t(elapsed > 0 ? (uint64_t)(bytes / elapsed) : 0) << "/s)"
+		<< dendl;
+      }
+    };
+
+    bool aborted = false;
+    it = db->get_iterator(PREFIX_OBJ);
+    if (it) {
+      CollectionRef c;
+      spg_t pgid;
+      string okey;     // onode key of cur
+      fsck_item_t cur;
+      bool have_cur = false;
+      vector<fsck_item_t> batch;
+      auto submit = [&]() {
+	if (!have_cur) {
+	  return;
 	}
-	if (!expecting_shards.empty() &&
-	    expecting_shards.front() == it->key()) {
-	  // all good
-	  expecting_shards.pop_front();
-	  continue;
+	if (workers.empty()) {
+	  _fsck_check_object(main_ctx, cur.c, cur.oid, cur.shard_keys);
+	} else {
+	  batch.emplace_back(std::move(cur));
+	  if (batch.size() >= batch_size) {
+	    queue.push(std::move(batch));
+	    batch.clear();
+	  }
 	}
-
-        uint32_t offset;
-        string okey;
-        get_key_extent_shard(it->key(), &okey, &offset);
-        derr << "fsck error: stray shard 0x" << std::hex << offset
-	     << std::dec << dendl;
-        if (expecting_shards.empty()) {
-          derr << "fsck error: " << pretty_binary_string(it->key())
-               << " is unexpected" << dendl;
-          ++errors;
-          continue;
-        }
-	while (expecting_shards.front() > it->key()) {
-	  derr << "fsck error:   saw " << pretty_binary_string(it->key())
-	       << dendl;
-	  derr << "fsck error:   exp "
-	       << pretty_binary_string(expecting_shards.front()) << dendl;
-	  ++errors;
-	  expecting_shards.pop_front();
-	  if (expecting_shards.empty()) {
-	    break;
-	  }
+	cur = fsck_item_t();
+	have_cur = false;
+      };
+      uint64_t nkeys = 0;
+      for (it->lower_bound(string()); it->valid(); it->next()) {
+	if (g_conf->bluestore_debug_fsck_abort) {
+	  aborted = true;
+	  break;
 	}
-	continue;
-      }
-
-      ghobject_t oid;
-      int r = get_key_object(it->key(), &oid);
-      if (r < 0) {
-        derr << "fsck error: bad object key "
-             << pretty_binary_string(it->key()) << dendl;
-	++errors;
-	continue;
-      }
-      if (!c ||
-	  oid.shard_id != pgid.shard ||
-	  oid.hobj.pool != (int64_t)pgid.pool() ||
-	  !c->contains(oid)) {
-	c = nullptr;
-	for (auto& p : coll_map) {
-	  if (p.second->contains(oid)) {
-	    c = p.second;
-	    break;
-	  }
+	dout(30) << __func__ << " key "
+		 << pretty_binary_string(it->key()) << dendl;
+	if (progress_interval > 0 && (++nkeys & 255) == 0 &&
+	    ceph_clock_now() >= next_progress) {
+	  report_progress();
+	  next_progress = ceph_clock_now();
+	  next_progress += progress_interval;
 	}
-	if (!c) {
-          derr << "fsck error: stray object " << oid
-               << " not owned by any collection" << dendl;
+	if (is_extent_shard_key(it->key())) {
+	  string shard_okey;
+	  uint32_t offset;
+	  get_key_extent_shard(it->key(), &shard_okey, &offset);
+	  if (have_cur && shard_okey == okey) {
+	    // checked against the onode's shard list later
+	    cur.shard_keys.push_back(it->key());
+	    continue;
+	  }
+	  derr << "fsck error: stray shard 0x" << std::hex << offset
+	       << std::dec << dendl;
+	  derr << "fsck error: " << pretty_binary_string(it->key())
+	       << " is unexpected" << dendl;
 	  ++errors;
 	  continue;
 	}
-	c->cid.is_pg(&pgid);
-	dout(20) << __func__ << "  collection " << c->cid << " " << c->cnode
-		 << dendl;
-      }
-
-      if (!expecting_shards.empty()) {
-	for (auto &k : expecting_shards) {
-	  derr << "fsck error: missing shard key "
-	       << pretty_binary_string(k) << dendl;
-	}
-	++errors;
-	expecting_shards.clear();
-      }
+	submit();
 
-      dout(10) << __func__ << "  " << oid << dendl;
-      RWLock::RLocker l(c->lock);
-      OnodeRef o = c->get_onode(oid, false);
-      if (o->onode.nid) {
-	if (o->onode.nid > nid_max) {
-	  derr << "fsck error: " << oid << " nid " << o->onode.nid
-	       << " > nid_max " << nid_max << dendl;
-	  ++errors;
-	}
-	if (used_nids.count(o->onode.nid)) {
-	  derr << "fsck error: " << oid << " nid " << o->onode.nid
-	       << " already in use" << dendl;
-	  ++errors;
-	  continue; // go for next object
-	}
-	used_nids.insert(o->onode.nid);
-      }
-      ++num_objects;
-      num_spanning_blobs += o->extent_map.spanning_blob_map.size();
-      o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
-      _dump_onode(o);
-      // shards
-      if (!o->extent_map.shards.empty()) {
-	++num_sharded_objects;
-	num_object_shards += o->extent_map.shards.size();
-      }
-      for (auto& s : o->extent_map.shards) {
-	dout(20) << __func__ << "    shard " << *s.shard_info << dendl;
-	expecting_shards.push_back(string());
-	get_extent_shard_key(o->key, s.shard_info->offset,
-			     &expecting_shards.back());
-	if (s.shard_info->offset >= o->onode.size) {
-	  derr << "fsck error: " << oid << " shard 0x" << std::hex
-	       << s.shard_info->offset << " past EOF at 0x" << o->onode.size
-	       << std::dec << dendl;
-	  ++errors;
-	}
-      }
-      // lextents
-      map<BlobRef,bluestore_blob_t::unused_t> referenced;
-      uint64_t pos = 0;
-      mempool::bluestore_fsck::map<BlobRef,
-				   bluestore_blob_use_tracker_t> ref_map;
-      for (auto& l : o->extent_map.extent_map) {
-	dout(20) << __func__ << "    " << l << dendl;
-	if (l.logical_offset < pos) {
-	  derr << "fsck error: " << oid << " lextent at 0x"
-	       << std::hex << l.logical_offset
-	       << " overlaps with the previous, which ends at 0x" << pos
-	       << std::dec << dendl;
-	  ++errors;
-	}
-	if (o->extent_map.spans_shard(l.logical_offset, l.length)) {
-	  derr << "fsck error: " << oid << " lextent at 0x"
-	       << std::hex << l.logical_offset << "~" << l.length
-	       << " spans a shard boundary"
-	       << std::dec << dendl;
-	  ++errors;
-	}
-	pos = l.logical_offset + l.length;
-	expected_statfs.stored += l.length;
-	assert(l.blob);
-	const bluestore_blob_t& blob = l.blob->get_blob();
-
-        auto& ref = ref_map[l.blob];
-        if (ref.is_empty()) {
-          uint32_t min_release_size = blob.get_release_size(min_alloc_size);
-          uint32_t l = blob.get_logical_length();
-          ref.init(l, min_release_size);
-        }
-	ref.get(
-	  l.blob_offset, 
-	  l.length);
-	++num_extents;
-	if (blob.has_unused()) {
-	  auto p = referenced.find(l.blob);
-	  bluestore_blob_t::unused_t *pu;
-	  if (p == referenced.end()) {
-	    pu = &referenced[l.blob];
-	  } else {
-	    pu = &p->second;
-	  }
-	  uint64_t blob_len = blob.get_logical_length();
-	  assert((blob_len % (sizeof(*pu)*8)) == 0);
-	  assert(l.blob_offset + l.length <= blob_len);
-	  uint64_t chunk_size = blob_len / (sizeof(*pu)*8);
-	  uint64_t start = l.blob_offset / chunk_size;
-	  uint64_t end =
-	    round_up_to(l.blob_offset + l.length, chunk_size) / chunk_size;
-	  for (auto i = start; i < end; ++i) {
-	    (*pu) |= (1u << i);
-	  }
-	}
-      }
-      for (auto &i : referenced) {
-	dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
-		 << std::dec << " for " << *i.first << dendl;
-	const bluestore_blob_t& blob = i.first->get_blob();
-	if (i.second & blob.unused) {
-	  derr << "fsck error: " << oid << " blob claims unused 0x"
-	       << std::hex << blob.unused
-	       << " but extents reference 0x" << i.second << std::dec
-	       << " on blob " << *i.first << dendl;
+	ghobject_t oid;
+	int r = get_key_object(it->key(), &oid);
+	if (r < 0) {
+	  derr << "fsck error: bad object key "
+	       << pretty_binary_string(it->key()) << dendl;
 	  ++errors;
+	  continue;
 	}
-	if (blob.has_csum()) {
-	  uint64_t blob_len = blob.get_logical_length();
-	  uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused)*8);
-	  unsigned csum_count = blob.get_csum_count();
-	  unsigned csum_chunk_size = blob.get_csum_chunk_size();
-	  for (unsigned p = 0; p < csum_count; ++p) {
-	    unsigned pos = p * csum_chunk_size;
-	    unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
-	    unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
-	    unsigned mask = 1u << firstbit;
-	    for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
-	      mask |= 1u << b;
-	    }
-	    if ((blob.unused & mask) == mask) {
-	      // this csum chunk region is marked unused
-	      if (blob.get_csum_item(p) != 0) {
-		derr << "fsck error: " << oid
-		     << " blob claims csum chunk 0x" << std::hex << pos
-		     << "~" << csum_chunk_size
-		     << " is unused (mask 0x" << mask << " of unused 0x"
-		     << blob.unused << ") but csum is non-zero 0x"
-		     << blob.get_csum_item(p) << std::dec << " on blob "
-		     << *i.first << dendl;
-		++errors;
-	      }
+	if (!c ||
+	    oid.shard_id != pgid.shard ||
+	    oid.hobj.pool != (int64_t)pgid.pool() ||
+	    !c->contains(oid)) {
+	  c = nullptr;
+	  for (auto& p : coll_map) {
+	    if (p.second->contains(oid)) {
+	      c = p.second;
+	      break;
 	    }
 	  }
-	}
-      }
-      for (auto &i : ref_map) {
-	++num_blobs;
-	const bluestore_blob_t& blob = i.first->get_blob();
-	bool equal = i.first->get_blob_use_tracker().equal(i.second);
-	if (!equal) {
-	  derr << "fsck error: " << oid << " blob " << *i.first
-	       << " doesn't match expected ref_map " << i.second << dendl;
-	  ++errors;
-	}
-	if (blob.is_compressed()) {
-	  expected_statfs.compressed += blob.get_compressed_payload_length();
-	  expected_statfs.compressed_original += 
-	    i.first->get_referenced_bytes();
-	}
-	if (blob.is_shared()) {
-	  if (i.first->shared_blob->get_sbid() > blobid_max) {
-	    derr << "fsck error: " << oid << " blob " << blob
-		 << " sbid " << i.first->shared_blob->get_sbid() << " > blobid_max "
-		 << blobid_max << dendl;
+	  if (!c) {
+	    derr << "fsck error: stray object " << oid
+		 << " not owned by any collection" << dendl;
 	    ++errors;
-	  } else if (i.first->shared_blob->get_sbid() == 0) {
-            derr << "fsck error: " << oid << " blob " << blob
-                 << " marked as shared but has uninitialized sbid"
-                 << dendl;
-            ++errors;
-          }
-	  sb_info_t& sbi = sb_info[i.first->shared_blob->get_sbid()];
-	  assert(sbi.cid == coll_t() || sbi.cid == c->cid);
-	  sbi.cid = c->cid;
-	  sbi.sb = i.first->shared_blob;
-	  sbi.oids.push_back(oid);
-	  sbi.compressed = blob.is_compressed();
-	  for (auto e : blob.get_extents()) {
-	    if (e.is_valid()) {
-	      sbi.ref_map.get(e.offset, e.length);
-	    }
+	    continue;
 	  }
-	} else {
-	  errors += _fsck_check_extents(c->cid, oid, blob.get_extents(),
-					blob.is_compressed(),
-					used_blocks,
-					fm->get_alloc_size(),
-					repair ? &repairer : nullptr,
-					expected_statfs);
-        }
-      }
-      if (deep) {
-	bufferlist bl;
-	int r = _do_read(c.get(), o, 0, o->onode.size, bl, 0);
-	if (r < 0) {
-	  ++errors;
-	  derr << "fsck error: " << oid << " error during read: "
-	       << cpp_strerror(r) << dendl;
+	  c->cid.is_pg(&pgid);
+	  dout(20) << __func__ << "  collection " << c->cid << " " << c->cnode
+		   << dendl;
+	}
+	okey = it->key();
+	cur.c = c;
+	cur.oid = oid;
+	have_cur = true;
+      }
+      if (!aborted) {
+	submit();
+	if (!batch.empty()) {
+	  queue.push(std::move(batch));
 	}
       }
-      // omap
-      if (o->onode.has_omap()) {
-	auto& m =
-	  o->onode.is_pgmeta_omap() ? used_pgmeta_omap_head : used_omap_head;
-	if (m.count(o->onode.nid)) {
-	  derr << "fsck error: " << oid << " omap_head " << o->onode.nid
-	       << " already in use" << dendl;
-	  ++errors;
-	} else {
-	  m.insert(o->onode.nid);
+    }
+    queue.finish();
+    for (auto& w : workers) {
+      w->join();
+    }
+    if (aborted) {
+      goto out_scan;
+    }
+    if (progress_interval > 0) {
+      report_progress();
+    }
+
+    // merge the per-thread results
+    for (auto ctx : ctxs) {
+      errors += ctx->errors;
+      num_objects += ctx->num_objects;
+      num_extents += ctx->num_extents;
+      num_blobs += ctx->num_blobs;
+      num_spanning_blobs += ctx->num_spanning_blobs;
+      num_sharded_objects += ctx->num_sharded_objects;
+      num_object_shards += ctx->num_object_shards;
+      expected_statfs.allocated += ctx->expected_statfs.allocated;
+      expected_statfs.stored += ctx->expected_statfs.stored;
+      expected_statfs.compressed += ctx->expected_statfs.compressed;
+      expected_statfs.compressed_allocated +=
+	ctx->expected_statfs.compressed_allocated;
+      expected_statfs.compressed_original +=
+	ctx->expected_statfs.compressed_original;
+      for (auto& p : ctx->sb_info) {
+	fsck_sb_info_t& sbi = sb_info[p.first];
+	fsck_sb_info_t& from = p.second;
+	assert(sbi.cid == coll_t() || sbi.cid == from.cid);
+	sbi.cid = from.cid;
+	sbi.sb = from.sb;
+	sbi.oids.splice(sbi.oids.end(), from.oids);
+	sbi.compressed = from.compressed;
+	for (auto& r : from.ref_map.ref_map) {
+	  for (unsigned i = 0; i < r.second.refs; ++i) {
+	    sbi.ref_map.get(r.first, r.second.length);
+	  }
 	}
       }
+      ctx->sb_info.clear();
     }
   }
 
@@ -6339,7 +6998,7 @@ int BlueStore::_fsck(bool deep, bool repair)
 	++errors;
       } else {
 	++num_shared_blobs;
-	sb_info_t& sbi = p->second;
+	fsck_sb_info_t& sbi = p->second;
 	bluestore_shared_blob_t shared_blob(sbid);
 	bufferlist bl = it->value();
 	auto blp = bl.cbegin();
@@ -6521,7 +7180,7 @@ int BlueStore::_fsck(bool deep, bool repair)
 
 	    auto sb_it = sb_info.find(b->shared_blob->get_sbid());
 	    assert(sb_it != sb_info.end());
-	    sb_info_t& sbi = sb_it->second;
+	    fsck_sb_info_t& sbi = sb_it->second;
 
 	    for (auto& r : sbi.ref_map.ref_map) {
 	      expected_statfs.allocated -= r.second.length;
@@ -6563,13 +7222,13 @@ int BlueStore::_fsck(bool deep, bool repair)
 		 << "~" << it.get_len() << std::dec << dendl;
 	fm->release(it.get_start(), it.get_len(), txn);
       }
-      alloc->release(to_release);
+      _alloc_release(to_release);
       to_release.clear();
     } // if (it) {
   } //if (repair && repairer.preprocess_misreference()) {
 
   for (auto &p : sb_info) {
-    sb_info_t& sbi = p.second;
+    fsck_sb_info_t& sbi = p.second;
     if (!sbi.passed) {
       derr << "fsck error: missing " << *sbi.sb << dendl;
       ++errors;
@@ -6938,7 +7597,7 @@ int BlueStore::statfs(struct store_statfs_t *buf)
 {
   buf->reset();
 
-  uint64_t bfree = alloc->get_free();
+  uint64_t bfree = _alloc_get_free();
   if (bluefs) {
     // part of our shared device is "free" according to BlueFS, but we
     // can't touch bluestore_bluefs_min of it.
@@ -7058,6 +7717,18 @@ void BlueStore::_update_cache_logger()
   logger->set(l_bluestore_blobs, num_blobs);
   logger->set(l_bluestore_buffers, num_buffers);
   logger->set(l_bluestore_buffer_bytes, num_buffer_bytes);
+
+  mempool::slab_stats_t slab, st;
+  mempool::bluestore_cache_other::alloc_bluestore_extent.get_stats(&st);
+  slab += st;
+  mempool::bluestore_cache_other::alloc_bluestore_blob.get_stats(&st);
+  slab += st;
+  mempool::bluestore_cache_other::alloc_bluestore_shared_blob.get_stats(&st);
+  slab += st;
+  logger->set(l_bluestore_slab_bytes, slab.bytes);
+  logger->set(l_bluestore_slab_items, slab.items);
+  logger->set(l_bluestore_slab_refills, slab.refills);
+  logger->set(l_bluestore_slab_releases, slab.releases);
 }
 
 // ---------------
@@ -7176,6 +7847,8 @@ int BlueStore::read(
     r = _do_read(c, o, offset, length, bl, op_flags);
     if (r == -EIO) {
       logger->inc(l_bluestore_read_eio);
+    } else if (r >= 0 && fast_alloc) {
+      _tier_maybe_promote(c, o);
     }
   }
 
@@ -7227,6 +7900,76 @@ struct region_t {
 typedef list<region_t> regions2read_t;
 typedef map<BlueStore::BlobRef, regions2read_t> blobs2read_t;
 
+bool BlueStore::is_cached(
+  CollectionHandle &c_,
+  const ghobject_t& oid,
+  uint64_t offset,
+  size_t length)
+{
+  Collection *c = static_cast<Collection *>(c_.get());
+  if (!c->exists)
+    return false;
+  // never wait for a writer on the caller's (messenger) thread
+  if (!c->lock.try_get_read())
+    return false;
+  bool r = _is_cached(c, oid, offset, length);
+  c->lock.unlock();
+  return r;
+}
+
+bool BlueStore::_is_cached(
+  Collection *c,
+  const ghobject_t& oid,
+  uint64_t offset,
+  size_t length)
+{
+  // only look at what is already in memory: no onode or shard faults
+  OnodeRef o = c->onode_map.lookup(oid);
+  if (!o || !o->exists)
+    return false;
+  if (length == 0 || offset >= o->onode.size || o->onode.is_inline())
+    return true;
+  if (offset + length > o->onode.size) {
+    length = o->onode.size - offset;
+  }
+
+  auto& em = o->extent_map;
+  if (!em.shards.empty()) {
+    int s = em.seek_shard(offset);
+    assert(s >= 0);
+    for (; s < (int)em.shards.size() &&
+	   em.shards[s].shard_info->offset < offset + length; ++s) {
+      if (!em.shards[s].loaded) {
+	return false;
+      }
+    }
+  }
+
+  uint64_t pos = offset;
+  uint64_t end = offset + length;
+  for (auto lp = em.seek_lextent(offset);
+       pos < end && lp != em.extent_map.end();
+       ++lp) {
+    if (lp->logical_offset >= end)
+      break;
+    if (pos < lp->logical_offset) {
+      pos = lp->logical_offset;  // hole; reads as zeros
+    }
+    unsigned b_off = pos - lp->logical_offset + lp->blob_offset;
+    unsigned b_len = std::min<uint64_t>(end, lp->logical_end()) - pos;
+    ready_regions_t cache_res;
+    interval_set<uint32_t> cache_interval;
+    lp->blob->shared_blob->bc.read(
+      lp->blob->shared_blob->get_cache(), b_off, b_len,
+      cache_res, cache_interval);
+    if (!cache_interval.contains(b_off, b_len)) {
+      return false;
+    }
+    pos += b_len;
+  }
+  return true;
+}
+
 int BlueStore::_do_read(
   Collection *c,
   OnodeRef o,
@@ -7264,6 +8007,11 @@ int BlueStore::_do_read(
     length = o->onode.size - offset;
   }
 
+  if (o->onode.is_inline()) {
+    bl.substr_of(o->onode.inline_data, offset, length);
+    return bl.length();
+  }
+
   auto start = mono_clock::now();
   o->extent_map.fault_range(db, offset, length);
   logger->tinc(l_bluestore_read_onode_meta_lat, mono_clock::now() - start);
@@ -7610,6 +8358,11 @@ int BlueStore::_fiemap(
       length = o->onode.size - offset;
     }
 
+    if (o->onode.is_inline()) {
+      destset.insert(offset, length);
+      goto out;
+    }
+
     o->extent_map.fault_range(db, offset, length);
     eend = o->extent_map.extent_map.end();
     ep = o->extent_map.seek_lextent(offset);
@@ -8095,7 +8848,7 @@ int BlueStore::omap_get_values(
       final_key.resize(9); // keep prefix
       final_key += *p;
       bufferlist val;
-      if (db->get(prefix, final_key, &val) >= 0) {
+      if (db->get_pinned(prefix, final_key, &val) >= 0) {
 	dout(30) << __func__ << "  got " << pretty_binary_string(final_key)
 		 << " -> " << *p << dendl;
 	out->insert(make_pair(*p, val));
@@ -8159,6 +8912,24 @@ ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator(
   CollectionHandle &c_,              ///< [in] collection
   const ghobject_t &oid  ///< [in] object
   )
+{
+  return _get_omap_iterator(c_, oid, false);
+}
+
+ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator_pinned(
+  CollectionHandle &c_,              ///< [in] collection
+  const ghobject_t &oid  ///< [in] object
+  )
+{
+  // values go back to the caller as references to the blocks the
+  // iterator pinned rather than as copies
+  return _get_omap_iterator(c_, oid, true);
+}
+
+ObjectMap::ObjectMapIterator BlueStore::_get_omap_iterator(
+  CollectionHandle &c_,
+  const ghobject_t &oid,
+  bool pin)
 {
   Collection *c = static_cast<Collection *>(c_.get());
   dout(10) << __func__ << " " << c->get_cid() << " " << oid << dendl;
@@ -8174,7 +8945,8 @@ ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator(
   o->flush();
   dout(10) << __func__ << " has_omap = " << (int)o->onode.has_omap() <<dendl;
   KeyValueDB::Iterator it = db->get_iterator(
-    o->onode.is_pgmeta_omap() ? PREFIX_PGMETA_OMAP : PREFIX_OMAP);
+    o->onode.is_pgmeta_omap() ? PREFIX_PGMETA_OMAP : PREFIX_OMAP,
+    pin ? KeyValueDB::ITERATOR_PIN_VALUES : 0);
   return ObjectMap::ObjectMapIterator(new OmapIteratorImpl(c, o, it));
 }
 
@@ -8186,15 +8958,22 @@ void BlueStore::_prepare_ondisk_format_super(KeyValueDB::Transaction& t)
   dout(10) << __func__ << " ondisk_format " << ondisk_format
 	   << " min_compat_ondisk_format " << min_compat_ondisk_format
 	   << dendl;
-  assert(ondisk_format == latest_ondisk_format);
+  assert(ondisk_format >= min_compat_ondisk_format);
+  assert(ondisk_format <= latest_ondisk_format);
   {
     bufferlist bl;
     encode(ondisk_format, bl);
     t->set(PREFIX_SUPER, "ondisk_format", bl);
   }
   {
+    // older releases would misread inline onodes, so once they may
+    // exist only releases that understand them can open the store.
+    int32_t compat = min_compat_ondisk_format;
+    if (ondisk_format >= inline_data_ondisk_format) {
+      compat = inline_data_ondisk_format;
+    }
     bufferlist bl;
-    encode(min_compat_ondisk_format, bl);
+    encode(compat, bl);
     t->set(PREFIX_SUPER, "min_compat_ondisk_format", bl);
   }
 }
@@ -8309,7 +9088,7 @@ int BlueStore::_open_super_meta()
 	 << latest_ondisk_format << dendl;
     return -EPERM;
   }
-  if (ondisk_format < latest_ondisk_format) {
+  if (ondisk_format < min_compat_ondisk_format) {
     int r = _upgrade_super();
     if (r < 0) {
       return r;
@@ -8349,7 +9128,7 @@ int BlueStore::_upgrade_super()
   dout(1) << __func__ << " from " << ondisk_format << ", latest "
 	  << latest_ondisk_format << dendl;
   assert(ondisk_format > 0);
-  assert(ondisk_format < latest_ondisk_format);
+  assert(ondisk_format < min_compat_ondisk_format);
 
   if (ondisk_format == 1) {
     // changes:
@@ -8385,6 +9164,618 @@ int BlueStore::_upgrade_super()
   return 0;
 }
 
+int BlueStore::_enable_inline_data_format()
+{
+  if (ondisk_format >= inline_data_ondisk_format ||
+      cct->_conf->get_val<uint64_t>("bluestore_inline_data_max") == 0) {
+    return 0;
+  }
+  dout(1) << __func__ << " from " << ondisk_format << " to "
+	  << inline_data_ondisk_format
+	  << "; older releases will no longer mount this store" << dendl;
+  KeyValueDB::Transaction t = db->get_transaction();
+  ondisk_format = inline_data_ondisk_format;
+  _prepare_ondisk_format_super(t);
+  int r = db->submit_transaction_sync(t);
+  assert(r == 0);
+  return 0;
+}
+
+// Shared blob deltas (bluestore_shared_blob_merge) are only readable
+// through SharedBlobMergeOperator, which older releases do not have.
+// Their presence is recorded in a super key; once the option is turned
+// off, the next mount compacts the shared blob prefix, which folds every
+// pending delta into a full record, and drops the key again.
+int BlueStore::_check_shared_blob_deltas()
+{
+  static const string key = "shared_blob_deltas";
+  bufferlist bl;
+  bool have_deltas = db->get(PREFIX_SUPER, key, &bl) >= 0;
+  if (shared_blob_merge == have_deltas) {
+    return 0;
+  }
+  KeyValueDB::Transaction t = db->get_transaction();
+  if (shared_blob_merge) {
+    dout(1) << __func__ << " enabling shared blob deltas" << dendl;
+    t->set(PREFIX_SUPER, key, bl);
+  } else {
+    dout(1) << __func__ << " folding shared blob deltas into full records"
+	    << dendl;
+    db->compact_prefix(PREFIX_SHARED_BLOB);
+    t->rmkey(PREFIX_SUPER, key);
+  }
+  int r = db->submit_transaction_sync(t);
+  assert(r == 0);
+  return 0;
+}
+
+// ---------------
+// onode cache warm-up
+//
+// The keys of the most recently used onodes are saved under
+// PREFIX_SUPER in chunks (onode_warmup.<n>), each holding one
+// collection id and a list of onode keys.  On mount they are loaded
+// back into the onode cache in the background so that a restarted OSD
+// does not have to fault its working set in one cache miss at a time.
+// The snapshot lives in the kv store rather than in $path because the
+// latter is commonly a tmpfs.
+
+static const string ONODE_WARMUP_KEY_PREFIX = "onode_warmup.";
+static const size_t ONODE_WARMUP_CHUNK_KEYS = 1024;
+
+static void get_onode_warmup_key(uint32_t n, string *key)
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%08x", n);
+  *key = ONODE_WARMUP_KEY_PREFIX + buf;
+}
+
+int BlueStore::_save_onode_warmup()
+{
+  uint64_t max = cct->_conf->get_val<uint64_t>("bluestore_onode_warmup_max");
+  auto start = mono_clock::now();
+  map<coll_t, vector<string>> hot;
+  size_t num = 0;
+  {
+    vector<pair<coll_t,string>> ls;
+    size_t per_shard = max / cache_shards.size() + 1;
+    for (auto i : cache_shards) {
+      i->dump_hot_onodes(per_shard, &ls);
+    }
+    for (auto& p : ls) {
+      hot[p.first].push_back(std::move(p.second));
+      ++num;
+    }
+  }
+
+  KeyValueDB::Transaction t = db->get_transaction();
+  {
+    KeyValueDB::Iterator it = db->get_iterator(PREFIX_SUPER);
+    for (it->lower_bound(ONODE_WARMUP_KEY_PREFIX);
+	 it->valid() &&
+	   it->key().compare(0, ONODE_WARMUP_KEY_PREFIX.size(),
+			     ONODE_WARMUP_KEY_PREFIX) == 0;
+	 it->next()) {
+      t->rmkey(PREFIX_SUPER, it->key());
+    }
+  }
+  uint32_t n = 0;
+  for (auto& p : hot) {
+    auto q = p.second.begin();
+    while (q != p.second.end()) {
+      auto e = q + std::min<size_t>(ONODE_WARMUP_CHUNK_KEYS,
+				    p.second.end() - q);
+      vector<string> keys(q, e);
+      bufferlist bl;
+      encode(p.first, bl);
+      encode(keys, bl);
+      string key;
+      get_onode_warmup_key(n++, &key);
+      t->set(PREFIX_SUPER, key, bl);
+      q = e;
+    }
+  }
+  int r = db->submit_transaction(t);
+  dout(10) << __func__ << " saved " << num << " onode keys in " << n
+	   << " chunks in " << (mono_clock::now() - start) << dendl;
+  return r;
+}
+
+void BlueStore::_onode_warmup()
+{
+  bool extents = cct->_conf->get_val<bool>("bluestore_onode_warmup_extents");
+  uint64_t max = cct->_conf->get_val<uint64_t>("bluestore_onode_warmup_max");
+  auto start = mono_clock::now();
+  uint64_t num = 0, missing = 0;
+
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_SUPER);
+  for (it->lower_bound(ONODE_WARMUP_KEY_PREFIX);
+       it->valid() &&
+	 it->key().compare(0, ONODE_WARMUP_KEY_PREFIX.size(),
+			   ONODE_WARMUP_KEY_PREFIX) == 0 &&
+	 num < max &&
+	 !onode_warmup_stop;
+       it->next()) {
+    coll_t cid;
+    vector<string> keys;
+    bufferlist bl = it->value();
+    auto p = bl.cbegin();
+    try {
+      decode(cid, p);
+      decode(keys, p);
+    } catch (buffer::error& e) {
+      derr << __func__ << " failed to decode " << it->key()
+	   << ", ignoring" << dendl;
+      continue;
+    }
+    CollectionRef c = _get_collection(cid);
+    if (!c) {
+      missing += keys.size();
+      continue;
+    }
+    for (auto& key : keys) {
+      if (onode_warmup_stop || num >= max) {
+	break;
+      }
+      // take the lock per onode so that we never hold up writers for long
+      RWLock::RLocker l(c->lock);
+      ghobject_t oid;
+      if (get_key_object(key, &oid) < 0 ||
+	  !c->contains(oid)) {
+	++missing;
+	continue;
+      }
+      OnodeRef o = c->get_onode(oid, false);
+      if (!o || !o->exists) {
+	++missing;
+	continue;
+      }
+      if (extents) {
+	o->extent_map.fault_range(db, 0, o->onode.size);
+      }
+      ++num;
+    }
+  }
+  dout(1) << __func__ << " loaded " << num << " onodes ("
+	  << missing << " stale) in " << (mono_clock::now() - start)
+	  << dendl;
+}
+
+void BlueStore::_onode_warmup_start()
+{
+  if (!cct->_conf->get_val<bool>("bluestore_onode_warmup")) {
+    return;
+  }
+  onode_warmup_stop = false;
+  onode_warmup_thread.create("bstore_warmup");
+}
+
+void BlueStore::_onode_warmup_stop()
+{
+  if (onode_warmup_thread.is_started()) {
+    onode_warmup_stop = true;
+    onode_warmup_thread.join();
+    onode_warmup_stop = false;
+  }
+}
+
+// ---------------
+// fast/slow tiering
+
+bool BlueStore::_fast_tier_wanted(OnodeRef& o, uint32_t fadvise_flags,
+				  uint64_t end)
+{
+  if (!fast_alloc) {
+    return false;
+  }
+  if (fadvise_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+		       CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) {
+    return false;
+  }
+  if (fadvise_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) {
+    return true;
+  }
+  return std::max<uint64_t>(end, o->onode.size) <=
+    cct->_conf->get_val<uint64_t>("bluestore_fast_tier_max_object_size");
+}
+
+void BlueStore::_tier_maybe_promote(Collection *c, OnodeRef& o)
+{
+  // caller holds c->lock
+  if (o->heat < cct->_conf->get_val<uint64_t>(
+	"bluestore_fast_tier_promote_hits") ||
+      o->onode.size == 0 ||
+      o->onode.size > cct->_conf->get_val<uint64_t>(
+	"bluestore_fast_tier_max_object_size")) {
+    return;
+  }
+  o->heat = 0;
+  bool slow = false;
+  for (auto& e : o->extent_map.extent_map) {
+    for (auto& p : e.blob->get_blob().get_extents()) {
+      if (p.is_valid() && p.offset >= fast_tier_size) {
+	slow = true;
+	break;
+      }
+    }
+    if (slow) {
+      break;
+    }
+  }
+  if (!slow) {
+    return;
+  }
+  std::lock_guard<std::mutex> l(tier_lock);
+  if (tier_promote_q.size() < cct->_conf->get_val<uint64_t>(
+	"bluestore_fast_tier_queue_max")) {
+    dout(20) << __func__ << " " << c->cid << " " << o->oid << dendl;
+    tier_promote_q.emplace_back(c->cid, o->oid);
+  }
+}
+
+void BlueStore::_tier_note_evicted(Onode *o)
+{
+  // caller holds the cache shard lock; the onode is only referenced by
+  // the onode map at this point.
+  if (!fast_alloc || !o->exists) {
+    return;
+  }
+  bool fast = false;
+  for (auto& e : o->extent_map.extent_map) {
+    for (auto& p : e.blob->get_blob().get_extents()) {
+      if (p.is_valid() && p.offset < fast_tier_size) {
+	fast = true;
+	break;
+      }
+    }
+    if (fast) {
+      break;
+    }
+  }
+  if (!fast) {
+    return;
+  }
+  std::lock_guard<std::mutex> l(tier_lock);
+  if (tier_demote_q.size() < cct->_conf->get_val<uint64_t>(
+	"bluestore_fast_tier_queue_max")) {
+    tier_demote_q.emplace_back(o->c->cid, o->oid);
+  }
+}
+
+void *BlueStore::TierThread::entry()
+{
+  Mutex::Locker l(lock);
+  while (!stop) {
+    lock.Unlock();
+    store->_tier_migrate_some();
+    lock.Lock();
+    if (stop) {
+      break;
+    }
+    utime_t wait;
+    wait.set_from_double(store->cct->_conf->get_val<double>(
+      "bluestore_fast_tier_migrate_interval"));
+    cond.WaitInterval(lock, wait);
+  }
+  stop = false;
+  return NULL;
+}
+
+void BlueStore::_tier_migrate_some()
+{
+  double min_free = cct->_conf->get_val<double>(
+    "bluestore_fast_tier_min_free_ratio");
+  uint64_t batch = cct->_conf->get_val<uint64_t>(
+    "bluestore_fast_tier_migrate_batch");
+  for (uint64_t i = 0; i < batch; ++i) {
+    pair<coll_t,ghobject_t> item;
+    bool promote;
+    {
+      // demote cold objects first when the fast tier is getting full,
+      // then use whatever room is left for hot ones.
+      std::lock_guard<std::mutex> l(tier_lock);
+      double free_ratio = _fast_tier_free_ratio();
+      if (free_ratio < min_free * 2 && !tier_demote_q.empty()) {
+	item = tier_demote_q.front();
+	tier_demote_q.pop_front();
+	promote = false;
+      } else if (free_ratio > min_free && !tier_promote_q.empty()) {
+	item = tier_promote_q.front();
+	tier_promote_q.pop_front();
+	promote = true;
+      } else {
+	break;
+      }
+    }
+    int r = _tier_migrate(item.first, item.second, promote);
+    dout(20) << __func__ << " " << (promote ? "promote " : "demote ")
+	     << item.first << " " << item.second << " = " << r << dendl;
+  }
+  logger->set(l_bluestore_fast_tier_free, fast_alloc->get_free());
+}
+
+int BlueStore::_tier_migrate(const coll_t& cid, const ghobject_t& oid,
+			     bool promote)
+{
+  CollectionRef c = _get_collection(cid);
+  if (!c) {
+    return -ENOENT;
+  }
+  uint64_t promote_hits = cct->_conf->get_val<uint64_t>(
+    "bluestore_fast_tier_promote_hits");
+  uint64_t bytes = 0;
+  int r = _rewrite_object(
+    c, oid,
+    promote ? CEPH_OSD_OP_FLAG_FADVISE_WILLNEED :
+      CEPH_OSD_OP_FLAG_FADVISE_DONTNEED,
+    [&](OnodeRef& o) {
+      if (!promote && o->heat >= promote_hits) {
+	return false;  // hot again
+      }
+      bool in_fast = false, in_slow = false;
+      for (auto& e : o->extent_map.extent_map) {
+	for (auto& p : e.blob->get_blob().get_extents()) {
+	  if (!p.is_valid()) {
+	    continue;
+	  }
+	  if (p.offset < fast_tier_size) {
+	    in_fast = true;
+	  } else {
+	    in_slow = true;
+	  }
+	}
+      }
+      return promote ? in_slow : in_fast;
+    },
+    &bytes);
+  if (r == 0 && bytes) {
+    logger->inc(promote ? l_bluestore_fast_tier_promoted :
+		l_bluestore_fast_tier_demoted);
+    logger->inc(l_bluestore_fast_tier_migrated_bytes, bytes);
+  }
+  return r;
+}
+
+// ---------------
+// online defragmentation
+
+void *BlueStore::DefragThread::entry()
+{
+  Mutex::Locker l(lock);
+  while (!stop) {
+    lock.Unlock();
+    store->_defrag_some();
+    lock.Lock();
+    if (stop) {
+      break;
+    }
+    utime_t wait;
+    wait.set_from_double(interval);
+    cond.WaitInterval(lock, wait);
+  }
+  stop = false;
+  return NULL;
+}
+
+bool BlueStore::_defrag_wanted(OnodeRef& o)
+{
+  // count the physical extents backing the object, against the number
+  // we would need if every blob were max_blob_size and contiguous
+  uint64_t pextents = 0, bytes = 0;
+  set<const Blob*> seen;
+  for (auto& e : o->extent_map.extent_map) {
+    if (!seen.insert(e.blob.get()).second) {
+      continue;
+    }
+    for (auto& p : e.blob->get_blob().get_extents()) {
+      if (p.is_valid()) {
+	++pextents;
+	bytes += p.length;
+      }
+    }
+  }
+  uint64_t ideal = std::max<uint64_t>(1, p2roundup(bytes, max_blob_size.load()) /
+				      max_blob_size);
+  return pextents >= cct->_conf->get_val<uint64_t>(
+    "bluestore_defrag_min_extents") &&
+    pextents >= ideal * cct->_conf->get_val<double>(
+      "bluestore_defrag_extent_ratio");
+}
+
+void BlueStore::_defrag_some()
+{
+  double frag = alloc->get_fragmentation(min_alloc_size);
+  if (frag < cct->_conf->get_val<double>("bluestore_defrag_min_fragmentation")) {
+    dout(20) << __func__ << " fragmentation " << frag << ", nothing to do"
+	     << dendl;
+    return;
+  }
+  uint64_t max_bytes = cct->_conf->get_val<uint64_t>(
+    "bluestore_defrag_max_bytes");
+  uint64_t scan_max = cct->_conf->get_val<uint64_t>(
+    "bluestore_defrag_scan_objects");
+  uint64_t scanned = 0, objects = 0, bytes = 0;
+  while (scanned < scan_max && bytes < max_bytes) {
+    // stay out of the way of client io
+    if (throttle_bytes.get_current() > throttle_bytes.get_max() / 2) {
+      dout(20) << __func__ << " client io in flight, backing off" << dendl;
+      break;
+    }
+
+    CollectionRef c;
+    {
+      RWLock::RLocker l(coll_lock);
+      if (coll_map.empty()) {
+	return;
+      }
+      auto p = coll_map.find(defrag_cid);
+      if (p == coll_map.end() || defrag_next.is_max()) {
+	// move on to the next collection, in coll_t order
+	const coll_t *next = nullptr;
+	const coll_t *first = nullptr;
+	for (auto& i : coll_map) {
+	  if (!first || i.first < *first) {
+	    first = &i.first;
+	  }
+	  if (defrag_cid < i.first && (!next || i.first < *next)) {
+	    next = &i.first;
+	  }
+	}
+	defrag_cid = next ? *next : *first;
+	defrag_next = ghobject_t();
+	p = coll_map.find(defrag_cid);
+      }
+      c = p->second;
+    }
+
+    vector<ghobject_t> ls;
+    ghobject_t next;
+    int r;
+    {
+      RWLock::RLocker l(c->lock);
+      r = _collection_list(c.get(), defrag_next, ghobject_t::get_max(),
+			   std::min<uint64_t>(scan_max - scanned, 64), &ls,
+			   &next);
+    }
+    if (r < 0) {
+      defrag_next = ghobject_t::get_max();
+      continue;
+    }
+    defrag_next = next;
+    if (ls.empty()) {
+      ++scanned;  // don't spin on empty collections
+    }
+    for (auto& oid : ls) {
+      if (bytes >= max_bytes) {
+	defrag_next = oid;  // resume here next pass
+	break;
+      }
+      ++scanned;
+      uint64_t b = 0;
+      r = _rewrite_object(c, oid, 0,
+			  [&](OnodeRef& o) {
+			    // don't let one big object blow the budget
+			    return o->onode.size <= max_bytes - bytes &&
+			      _defrag_wanted(o);
+			  },
+			  &b);
+      if (r == 0 && b) {
+	dout(20) << __func__ << " rewrote " << c->cid << " " << oid
+		 << " 0x" << std::hex << b << std::dec << dendl;
+	++objects;
+	bytes += b;
+      }
+    }
+  }
+  if (objects) {
+    dout(10) << __func__ << " rewrote " << objects << " objects, "
+	     << byte_u_t(bytes) << ", fragmentation was " << frag << dendl;
+    logger->inc(l_bluestore_defrag_objects, objects);
+    logger->inc(l_bluestore_defrag_bytes, bytes);
+  }
+}
+
+int BlueStore::_rewrite_object(
+  CollectionRef& c,
+  const ghobject_t& oid,
+  uint32_t fadvise_flags,
+  std::function<bool(OnodeRef&)> wanted,
+  uint64_t *bytes)
+{
+  TransContext *txc = nullptr;
+  // submit like queue_transactions does: our txc takes its place in the
+  // sequencer and is fully prepared before the next client txc can
+  // create itself, so the two commit in the order they changed the onode
+  std::unique_lock<std::mutex> sl(c->osr->submit_lock);
+  {
+    RWLock::WLocker l(c->lock);
+    OnodeRef o = c->get_onode(oid, false);
+    if (!o || !o->exists) {
+      return -ENOENT;
+    }
+    if (o->onode.is_inline()) {
+      return 0;
+    }
+    uint64_t size = o->onode.size;
+    o->extent_map.fault_range(db, 0, size);
+
+    interval_set<uint64_t> ranges;
+    for (auto& e : o->extent_map.extent_map) {
+      if (e.blob->get_blob().is_shared()) {
+	return -EBUSY;  // leave clones where they are
+      }
+      ranges.insert(e.logical_offset, e.length);
+    }
+    if (ranges.empty() || !wanted(o)) {
+      return 0;
+    }
+    // the old extents are not released until we commit
+    if (_alloc_get_free() < ranges.size()) {
+      return -ENOSPC;
+    }
+
+    map<uint64_t,bufferlist> data;
+    for (auto p = ranges.begin(); p != ranges.end(); ++p) {
+      int r = _do_read(c.get(), o, p.get_start(), p.get_len(),
+		       data[p.get_start()]);
+      if (r < 0) {
+	derr << __func__ << " " << c->cid << " " << oid << " read 0x"
+	     << std::hex << p.get_start() << "~" << p.get_len() << std::dec
+	     << " failed: " << cpp_strerror(r) << dendl;
+	return r;
+      }
+    }
+
+    txc = _txc_create(c.get(), c->osr.get(), nullptr);
+    _do_truncate(txc, c, o, 0);
+    for (auto& p : data) {
+      int r = _do_write(txc, c, o, p.first, p.second.length(), p.second,
+			fadvise_flags);
+      if (r < 0) {
+	derr << __func__ << " " << c->cid << " " << oid << " write failed: "
+	     << cpp_strerror(r) << dendl;
+	assert(0 == "unexpected error");
+      }
+      txc->bytes += p.second.length();
+    }
+    _do_truncate(txc, c, o, size);
+    txc->write_onode(o);
+    o->heat = 0;
+  }
+  *bytes = txc->bytes;
+
+  _txc_calc_cost(txc);
+  _txc_write_nodes(txc, txc->t);
+  if (txc->deferred_txn) {
+    txc->deferred_txn->seq = ++deferred_seq;
+    bufferlist bl;
+    encode(*txc->deferred_txn, bl);
+    string key;
+    get_deferred_key(txc->deferred_txn->seq, &key);
+    txc->t->set(PREFIX_DEFERRED, key, bl);
+  }
+  _txc_finalize_kv(txc, txc->t);
+  sl.unlock();
+
+  throttle_bytes.get(txc->cost);
+  if (txc->deferred_txn) {
+    if (!throttle_deferred_bytes.get_or_fail(txc->cost)) {
+      ++deferred_aggressive;
+      deferred_try_submit();
+      {
+	std::lock_guard<std::mutex> l(kv_lock);
+	kv_cond.notify_one();
+      }
+      throttle_deferred_bytes.get(txc->cost);
+      --deferred_aggressive;
+    }
+  }
+
+  logger->inc(l_bluestore_txc);
+  _txc_state_proc(txc);
+  return 0;
+}
+
 void BlueStore::_assign_nid(TransContext *txc, OnodeRef o)
 {
   if (o->onode.nid) {
@@ -8513,7 +9904,19 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	  _txc_applied_kv(txc);
 	}
       }
-      {
+      if (txc->osr->kv_lane) {
+	KVSyncLane *lane = kv_sync_lanes[txc->osr->kv_lane - 1];
+	std::lock_guard<std::mutex> l(lane->lock);
+	lane->queue.push_back(txc);
+	lane->cond.notify_one();
+	if (txc->state != TransContext::STATE_KV_SUBMITTED) {
+	  lane->queue_unsubmitted.push_back(txc);
+	  ++txc->osr->kv_committing_serially;
+	}
+	if (txc->had_ios)
+	  lane->ios++;
+	lane->throttle_costs += txc->cost;
+      } else {
 	std::lock_guard<std::mutex> l(kv_lock);
 	kv_queue.push_back(txc);
 	kv_cond.notify_one();
@@ -8640,6 +10043,29 @@ void BlueStore::_txc_write_nodes(TransContext *txc, KeyValueDB::Transaction t)
       t->set(PREFIX_SHARED_BLOB, key, bl);
     }
   }
+  for (auto& p : txc->shared_blob_deltas) {
+    auto& sb = p.first;
+    if (txc->shared_blobs.count(sb) || p.second.empty()) {
+      continue;  // the full record above covers it
+    }
+    string key;
+    auto sbid = sb->get_sbid();
+    get_shared_blob_key(sbid, &key);
+    if (sb->persistent->empty()) {
+      dout(20) << __func__ << " shared_blob 0x"
+               << std::hex << sbid << std::dec
+	       << " is empty" << dendl;
+      t->rmkey(PREFIX_SHARED_BLOB, key);
+    } else {
+      bufferlist bl;
+      SharedBlobMergeOperator::encode_delta(p.second, bl);
+      dout(20) << __func__ << " shared_blob 0x"
+               << std::hex << sbid << std::dec
+	       << " merge " << p.second << " is " << *sb << dendl;
+      t->merge(PREFIX_SHARED_BLOB, key, bl);
+      logger->inc(l_bluestore_shared_blob_merges);
+    }
+  }
 }
 
 void BlueStore::BSPerfTracker::update_from_perfcounters(
@@ -8828,7 +10254,7 @@ void BlueStore::_txc_release_alloc(TransContext *txc)
     }
     dout(10) << __func__ << "(sync) " << txc << " " << std::hex
              << txc->released << std::dec << dendl;
-    alloc->release(txc->released);
+    _alloc_release(txc->released);
   }
 
 out:
@@ -8962,9 +10388,61 @@ void BlueStore::_kv_start()
     f->start();
   }
   kv_sync_thread.create("bstore_kv_sync");
+  _kv_start_lanes();
   kv_finalize_thread.create("bstore_kv_final");
 }
 
+void BlueStore::_kv_start_lanes()
+{
+  if (kv_sync_lane_num <= 1) {
+    return;
+  }
+  dout(10) << __func__ << " " << kv_sync_lane_num << " lanes" << dendl;
+  for (unsigned i = 0; i < kv_sync_lane_num; ++i) {
+    PerfCountersBuilder b(cct, "bluestore-kv-lane-" + stringify(i),
+			  l_bluestore_kv_lane_first, l_bluestore_kv_lane_last);
+    b.add_time_avg(l_bluestore_kv_lane_flush_lat, "kv_flush_lat",
+		   "Average kv lane flush latency");
+    b.add_time_avg(l_bluestore_kv_lane_commit_lat, "kv_commit_lat",
+		   "Average kv lane commit latency");
+    b.add_time_avg(l_bluestore_kv_lane_lat, "kv_lat",
+		   "Average kv lane sync latency");
+    b.add_u64_counter(l_bluestore_kv_lane_txc, "kv_txc",
+		      "Transactions committed through this lane");
+    PerfCounters *l = b.create_perf_counters();
+    cct->get_perfcounters_collection()->add(l);
+    kv_lane_loggers.push_back(l);
+  }
+  for (unsigned i = 1; i < kv_sync_lane_num; ++i) {
+    KVSyncLane *lane = new KVSyncLane(this, i);
+    kv_sync_lanes.push_back(lane);
+    lane->thread.create("bstore_kv_lane");
+  }
+}
+
+void BlueStore::_kv_stop_lanes()
+{
+  for (auto lane : kv_sync_lanes) {
+    {
+      std::unique_lock<std::mutex> l(lane->lock);
+      while (!lane->started) {
+	lane->cond.wait(l);
+      }
+      lane->stop = true;
+      lane->cond.notify_all();
+    }
+    lane->thread.join();
+    assert(lane->queue.empty());
+    delete lane;
+  }
+  kv_sync_lanes.clear();
+  for (auto l : kv_lane_loggers) {
+    cct->get_perfcounters_collection()->remove(l);
+    delete l;
+  }
+  kv_lane_loggers.clear();
+}
+
 void BlueStore::_kv_stop()
 {
   dout(10) << __func__ << dendl;
@@ -8976,6 +10454,10 @@ void BlueStore::_kv_stop()
     kv_stop = true;
     kv_cond.notify_all();
   }
+  // join every committer before telling finalize to stop, so nothing
+  // is handed to it after it exits
+  kv_sync_thread.join();
+  _kv_stop_lanes();
   {
     std::unique_lock<std::mutex> l(kv_finalize_lock);
     while (!kv_finalize_started) {
@@ -8984,7 +10466,6 @@ void BlueStore::_kv_stop()
     kv_finalize_stop = true;
     kv_finalize_cond.notify_all();
   }
-  kv_sync_thread.join();
   kv_finalize_thread.join();
   assert(removed_collections.empty());
   {
@@ -9083,58 +10564,17 @@ void BlueStore::_kv_sync_thread()
 			       deferred_done.end());
 	deferred_done.clear();
       }
-      auto after_flush = mono_clock::now();
-
-      // we will use one final transaction to force a sync
-      KeyValueDB::Transaction synct = db->get_transaction();
-
-      // increase {nid,blobid}_max?  note that this covers both the
-      // case where we are approaching the max and the case we passed
-      // it.  in either case, we increase the max in the earlier txn
-      // we submit.
-      uint64_t new_nid_max = 0, new_blobid_max = 0;
-      if (nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
-	KeyValueDB::Transaction t =
-	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
-	new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
-	bufferlist bl;
-	encode(new_nid_max, bl);
-	t->set(PREFIX_SUPER, "nid_max", bl);
-	dout(10) << __func__ << " new_nid_max " << new_nid_max << dendl;
-      }
-      if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
-	KeyValueDB::Transaction t =
-	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
-	new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
-	bufferlist bl;
-	encode(new_blobid_max, bl);
-	t->set(PREFIX_SUPER, "blobid_max", bl);
-	dout(10) << __func__ << " new_blobid_max " << new_blobid_max << dendl;
-      }
-
-      for (auto txc : kv_committing) {
-	if (txc->state == TransContext::STATE_KV_QUEUED) {
-	  txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
-	  int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction(txc->t);
-	  assert(r == 0);
-	  _txc_applied_kv(txc);
-	  --txc->osr->kv_committing_serially;
-	  txc->state = TransContext::STATE_KV_SUBMITTED;
-	  if (txc->osr->kv_submitted_waiters) {
-	    std::lock_guard<std::mutex> l(txc->osr->qlock);
-	    if (txc->osr->_is_all_kv_submitted()) {
-	      txc->osr->qcond.notify_all();
-	    }
-	  }
-
-	} else {
-	  assert(txc->state == TransContext::STATE_KV_SUBMITTED);
-	  txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
-	}
-	if (txc->had_ios) {
-	  --txc->osr->txc_with_unstable_io;
-	}
-      }
+      auto after_flush = mono_clock::now();
+
+      // we will use one final transaction to force a sync
+      KeyValueDB::Transaction synct = db->get_transaction();
+
+      uint64_t new_nid_max = 0, new_blobid_max = 0;
+      std::unique_lock<std::mutex> ids_lock(kv_ids_lock, std::defer_lock);
+      _kv_prealloc_ids(kv_submitting.empty() ? synct : kv_submitting.front()->t,
+		       ids_lock, &new_nid_max, &new_blobid_max);
+
+      _kv_submit_committing(kv_committing);
 
       // release throttle *before* we commit.  this allows new ops
       // to be prepared and enter pipeline while we are waiting on
@@ -9178,51 +10618,31 @@ void BlueStore::_kv_sync_thread()
       int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction_sync(synct);
       assert(r == 0);
 
-      {
-	std::unique_lock<std::mutex> m(kv_finalize_lock);
-	if (kv_committing_to_finalize.empty()) {
-	  kv_committing_to_finalize.swap(kv_committing);
-	} else {
-	  kv_committing_to_finalize.insert(
-	      kv_committing_to_finalize.end(),
-	      kv_committing.begin(),
-	      kv_committing.end());
-	  kv_committing.clear();
-	}
-	if (deferred_stable_to_finalize.empty()) {
-	  deferred_stable_to_finalize.swap(deferred_stable);
-	} else {
-	  deferred_stable_to_finalize.insert(
-	      deferred_stable_to_finalize.end(),
-	      deferred_stable.begin(),
-	      deferred_stable.end());
-	  deferred_stable.clear();
-	}
-	kv_finalize_cond.notify_one();
-      }
-
-      if (new_nid_max) {
-	nid_max = new_nid_max;
-	dout(10) << __func__ << " nid_max now " << nid_max << dendl;
-      }
-      if (new_blobid_max) {
-	blobid_max = new_blobid_max;
-	dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
-      }
+      size_t num_committed = kv_committing.size();
+      size_t num_cleaned = deferred_stable.size();
+      _kv_queue_finalize(kv_committing, deferred_stable);
+      _kv_commit_ids(ids_lock, new_nid_max, new_blobid_max);
 
       {
 	auto finish = mono_clock::now();
 	ceph::timespan dur_flush = after_flush - start;
 	ceph::timespan dur_kv = finish - after_flush;
 	ceph::timespan dur = finish - start;
-	dout(20) << __func__ << " committed " << kv_committing.size()
-	  << " cleaned " << deferred_stable.size()
+	dout(20) << __func__ << " committed " << num_committed
+	  << " cleaned " << num_cleaned
 	  << " in " << dur
 	  << " (" << dur_flush << " flush + " << dur_kv << " kv commit)"
 	  << dendl;
 	logger->tinc(l_bluestore_kv_flush_lat, dur_flush);
 	logger->tinc(l_bluestore_kv_commit_lat, dur_kv);
 	logger->tinc(l_bluestore_kv_lat, dur);
+	if (!kv_lane_loggers.empty()) {
+	  PerfCounters *ll = kv_lane_loggers[0];
+	  ll->tinc(l_bluestore_kv_lane_flush_lat, dur_flush);
+	  ll->tinc(l_bluestore_kv_lane_commit_lat, dur_kv);
+	  ll->tinc(l_bluestore_kv_lane_lat, dur);
+	  ll->inc(l_bluestore_kv_lane_txc, num_committed);
+	}
       }
 
       if (bluefs) {
@@ -9232,7 +10652,7 @@ void BlueStore::_kv_sync_thread()
 	if (!bluefs_extents_reclaiming.empty()) {
 	  dout(0) << __func__ << " releasing old bluefs 0x" << std::hex
 		   << bluefs_extents_reclaiming << std::dec << dendl;
-	  alloc->release(bluefs_extents_reclaiming);
+	  _alloc_release(bluefs_extents_reclaiming);
 	  bluefs_extents_reclaiming.clear();
 	}
       }
@@ -9247,6 +10667,202 @@ void BlueStore::_kv_sync_thread()
   kv_sync_started = false;
 }
 
+void BlueStore::_kv_sync_lane_thread(KVSyncLane *lane)
+{
+  dout(10) << __func__ << " lane " << lane->id << " start" << dendl;
+  PerfCounters *ll = kv_lane_loggers[lane->id];
+  deque<TransContext*> kv_committing;
+  deque<DeferredBatch*> no_deferred;
+  std::unique_lock<std::mutex> l(lane->lock);
+  assert(!lane->started);
+  lane->started = true;
+  lane->cond.notify_all();
+  while (true) {
+    assert(kv_committing.empty());
+    if (lane->queue.empty()) {
+      if (lane->stop)
+	break;
+      dout(20) << __func__ << " lane " << lane->id << " sleep" << dendl;
+      lane->cond.wait(l);
+      dout(20) << __func__ << " lane " << lane->id << " wake" << dendl;
+    } else {
+      deque<TransContext*> kv_submitting;
+      dout(20) << __func__ << " lane " << lane->id
+	       << " committing " << lane->queue.size()
+	       << " submitting " << lane->queue_unsubmitted.size()
+	       << dendl;
+      kv_committing.swap(lane->queue);
+      kv_submitting.swap(lane->queue_unsubmitted);
+      uint64_t aios = lane->ios;
+      uint64_t costs = lane->throttle_costs;
+      lane->ios = 0;
+      lane->throttle_costs = 0;
+      l.unlock();
+
+      auto start = mono_clock::now();
+
+      // new data must be stable before the metadata pointing at it.
+      // deferred ios are not our business; lane 0 takes care of them.
+      if (aios) {
+	bdev->flush();
+      }
+      auto after_flush = mono_clock::now();
+
+      KeyValueDB::Transaction synct = db->get_transaction();
+
+      uint64_t new_nid_max = 0, new_blobid_max = 0;
+      std::unique_lock<std::mutex> ids_lock(kv_ids_lock, std::defer_lock);
+      _kv_prealloc_ids(kv_submitting.empty() ? synct : kv_submitting.front()->t,
+		       ids_lock, &new_nid_max, &new_blobid_max);
+
+      _kv_submit_committing(kv_committing);
+
+      // see _kv_sync_thread
+      throttle_bytes.put(costs);
+
+      int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction_sync(synct);
+      assert(r == 0);
+
+      size_t num_committed = kv_committing.size();
+      _kv_queue_finalize(kv_committing, no_deferred);
+      _kv_commit_ids(ids_lock, new_nid_max, new_blobid_max);
+
+      {
+	auto finish = mono_clock::now();
+	ceph::timespan dur_flush = after_flush - start;
+	ceph::timespan dur_kv = finish - after_flush;
+	ceph::timespan dur = finish - start;
+	dout(20) << __func__ << " lane " << lane->id
+		 << " committed " << num_committed
+		 << " in " << dur
+		 << " (" << dur_flush << " flush + " << dur_kv << " kv commit)"
+		 << dendl;
+	logger->tinc(l_bluestore_kv_flush_lat, dur_flush);
+	logger->tinc(l_bluestore_kv_commit_lat, dur_kv);
+	logger->tinc(l_bluestore_kv_lat, dur);
+	ll->tinc(l_bluestore_kv_lane_flush_lat, dur_flush);
+	ll->tinc(l_bluestore_kv_lane_commit_lat, dur_kv);
+	ll->tinc(l_bluestore_kv_lane_lat, dur);
+	ll->inc(l_bluestore_kv_lane_txc, num_committed);
+      }
+
+      l.lock();
+    }
+  }
+  dout(10) << __func__ << " lane " << lane->id << " finish" << dendl;
+  lane->started = false;
+}
+
+void BlueStore::_kv_prealloc_ids(
+  KeyValueDB::Transaction t,
+  std::unique_lock<std::mutex>& ids_lock,
+  uint64_t *new_nid_max,
+  uint64_t *new_blobid_max)
+{
+  // increase {nid,blobid}_max?  note that this covers both the
+  // case where we are approaching the max and the case we passed
+  // it.  in either case, we increase the max in the earlier txn
+  // we submit.
+  //
+  // with several kv sync lanes we hold kv_ids_lock until the new max
+  // has committed (see _kv_commit_ids) so that the persisted values
+  // only ever move forward.
+  if (nid_last + cct->_conf->bluestore_nid_prealloc/2 <= nid_max &&
+      blobid_last + cct->_conf->bluestore_blobid_prealloc/2 <= blobid_max) {
+    return;
+  }
+  ids_lock.lock();
+  if (nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
+    *new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
+    bufferlist bl;
+    encode(*new_nid_max, bl);
+    t->set(PREFIX_SUPER, "nid_max", bl);
+    dout(10) << __func__ << " new_nid_max " << *new_nid_max << dendl;
+  }
+  if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
+    *new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
+    bufferlist bl;
+    encode(*new_blobid_max, bl);
+    t->set(PREFIX_SUPER, "blobid_max", bl);
+    dout(10) << __func__ << " new_blobid_max " << *new_blobid_max << dendl;
+  }
+  if (!*new_nid_max && !*new_blobid_max) {
+    // another lane beat us to it
+    ids_lock.unlock();
+  }
+}
+
+void BlueStore::_kv_commit_ids(
+  std::unique_lock<std::mutex>& ids_lock,
+  uint64_t new_nid_max,
+  uint64_t new_blobid_max)
+{
+  if (new_nid_max) {
+    nid_max = new_nid_max;
+    dout(10) << __func__ << " nid_max now " << nid_max << dendl;
+  }
+  if (new_blobid_max) {
+    blobid_max = new_blobid_max;
+    dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
+  }
+  if (ids_lock.owns_lock()) {
+    ids_lock.unlock();
+  }
+}
+
+void BlueStore::_kv_submit_committing(deque<TransContext*>& kv_committing)
+{
+  for (auto txc : kv_committing) {
+    if (txc->state == TransContext::STATE_KV_QUEUED) {
+      txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
+      int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction(txc->t);
+      assert(r == 0);
+      _txc_applied_kv(txc);
+      --txc->osr->kv_committing_serially;
+      txc->state = TransContext::STATE_KV_SUBMITTED;
+      if (txc->osr->kv_submitted_waiters) {
+	std::lock_guard<std::mutex> l(txc->osr->qlock);
+	if (txc->osr->_is_all_kv_submitted()) {
+	  txc->osr->qcond.notify_all();
+	}
+      }
+
+    } else {
+      assert(txc->state == TransContext::STATE_KV_SUBMITTED);
+      txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
+    }
+    if (txc->had_ios) {
+      --txc->osr->txc_with_unstable_io;
+    }
+  }
+}
+
+void BlueStore::_kv_queue_finalize(
+  deque<TransContext*>& kv_committing,
+  deque<DeferredBatch*>& deferred_stable)
+{
+  std::unique_lock<std::mutex> m(kv_finalize_lock);
+  if (kv_committing_to_finalize.empty()) {
+    kv_committing_to_finalize.swap(kv_committing);
+  } else {
+    kv_committing_to_finalize.insert(
+	kv_committing_to_finalize.end(),
+	kv_committing.begin(),
+	kv_committing.end());
+    kv_committing.clear();
+  }
+  if (deferred_stable_to_finalize.empty()) {
+    deferred_stable_to_finalize.swap(deferred_stable);
+  } else {
+    deferred_stable_to_finalize.insert(
+	deferred_stable_to_finalize.end(),
+	deferred_stable.begin(),
+	deferred_stable.end());
+    deferred_stable.clear();
+  }
+  kv_finalize_cond.notify_one();
+}
+
 void BlueStore::_kv_finalize_thread()
 {
   deque<TransContext*> kv_committed;
@@ -9264,7 +10880,21 @@ void BlueStore::_kv_finalize_thread()
       if (kv_finalize_stop)
 	break;
       dout(20) << __func__ << " sleep" << dendl;
-      kv_finalize_cond.wait(l);
+      double idle_flush = cct->_conf->get_val<double>(
+	"bluestore_deferred_idle_flush_interval");
+      if (idle_flush > 0) {
+	if (kv_finalize_cond.wait_for(l, make_timespan(idle_flush)) ==
+	    std::cv_status::timeout &&
+	    kv_committing_to_finalize.empty() &&
+	    deferred_stable_to_finalize.empty() &&
+	    !kv_finalize_stop) {
+	  l.unlock();
+	  _deferred_idle_flush();
+	  l.lock();
+	}
+      } else {
+	kv_finalize_cond.wait(l);
+      }
       dout(20) << __func__ << " wake" << dendl;
     } else {
       kv_committed.swap(kv_committing_to_finalize);
@@ -9354,6 +10984,11 @@ void BlueStore::deferred_try_submit()
   dout(20) << __func__ << " " << deferred_queue.size() << " osrs, "
 	   << deferred_queue_size << " txcs" << dendl;
   std::lock_guard<std::mutex> l(deferred_lock);
+  if (deferred_elevator) {
+    _deferred_submit_elevator_unlock();
+    deferred_lock.lock();
+    return;
+  }
   vector<OpSequencerRef> osrs;
   osrs.reserve(deferred_queue.size());
   for (auto& osr : deferred_queue) {
@@ -9431,6 +11066,111 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
   bdev->aio_submit(&b->ioc);
 }
 
+// Take the pending batch of every osr that has nothing running and
+// write them out as one pass: the ios of all batches are sorted by disk
+// offset and adjacent extents are coalesced, so a spinning disk sees a
+// single sweep instead of one per sequencer.  Batches from different
+// osrs never overlap: a block is only reallocated after the deferred
+// writes of the txc that released it have completed.
+void BlueStore::_deferred_submit_elevator_unlock()
+{
+  DeferredElevatorPass *pass = nullptr;
+  for (auto& osr : deferred_queue) {
+    if (!osr.deferred_pending || osr.deferred_running) {
+      continue;
+    }
+    if (!pass) {
+      pass = new DeferredElevatorPass(cct);
+    }
+    auto b = osr.deferred_pending;
+    deferred_queue_size -= b->seq_bytes.size();
+    assert(deferred_queue_size >= 0);
+    osr.deferred_running = b;
+    osr.deferred_pending = nullptr;
+    pass->osrs.push_back(&osr);
+  }
+  deferred_lock.unlock();
+  if (!pass) {
+    dout(20) << __func__ << " nothing pending" << dendl;
+    return;
+  }
+
+  map<uint64_t,DeferredBatch::deferred_io*> ios;
+  for (auto osr : pass->osrs) {
+    auto b = osr->deferred_running;
+    for (auto& txc : b->txcs) {
+      txc.log_state_latency(logger, l_bluestore_state_deferred_queued_lat);
+    }
+    for (auto& i : b->iomap) {
+      bool inserted = ios.insert(make_pair(i.first, &i.second)).second;
+      assert(inserted);
+    }
+  }
+  dout(10) << __func__ << " " << pass->osrs.size() << " osrs, "
+	   << ios.size() << " ios" << dendl;
+  logger->inc(l_bluestore_deferred_elevator_passes);
+
+  uint64_t start = 0, pos = 0;
+  bufferlist bl;
+  auto i = ios.begin();
+  while (true) {
+    if (i == ios.end() || i->first != pos) {
+      if (bl.length()) {
+	dout(20) << __func__ << " write 0x" << std::hex
+		 << start << "~" << bl.length() << std::dec << dendl;
+	if (!g_conf->bluestore_debug_omit_block_device_write) {
+	  logger->inc(l_bluestore_deferred_write_ops);
+	  logger->inc(l_bluestore_deferred_write_bytes, bl.length());
+	  int r = bdev->aio_write(start, bl, &pass->ioc, false);
+	  assert(r == 0);
+	}
+      }
+      if (i == ios.end()) {
+	break;
+      }
+      pos = i->first;
+      bl.clear();
+    }
+    dout(20) << __func__ << "   seq " << i->second->seq << " 0x"
+	     << std::hex << pos << "~" << i->second->bl.length() << std::dec
+	     << dendl;
+    if (!bl.length()) {
+      start = pos;
+    }
+    pos += i->second->bl.length();
+    bl.claim_append(i->second->bl);
+    ++i;
+  }
+
+  if (pass->ioc.has_pending_aios()) {
+    bdev->aio_submit(&pass->ioc);
+  } else {
+    // nothing hit the device; complete right away
+    pass->aio_finish(this);
+  }
+}
+
+// Called by the finalize thread after it has been idle for
+// bluestore_deferred_idle_flush_interval: with no client writes in
+// flight the disk is ours, so push out whatever deferred io is queued
+// rather than waiting for the batch thresholds.
+void BlueStore::_deferred_idle_flush()
+{
+  {
+    std::lock_guard<std::mutex> l(deferred_lock);
+    if (!deferred_queue_size) {
+      return;
+    }
+  }
+  if (throttle_bytes.get_current()) {
+    dout(20) << __func__ << " client io in flight, not idle" << dendl;
+    return;
+  }
+  dout(10) << __func__ << dendl;
+  logger->inc(l_bluestore_deferred_idle_flushes);
+  deferred_try_submit();
+}
+
 struct C_DeferredTrySubmit : public Context {
   BlueStore *store;
   C_DeferredTrySubmit(BlueStore *s) : store(s) {}
@@ -9562,6 +11302,7 @@ int BlueStore::queue_transactions(
   dout(10) << __func__ << " ch " << c << " " << c->cid << dendl;
 
   // prepare
+  std::unique_lock<std::mutex> sl(osr->submit_lock);
   TransContext *txc = _txc_create(static_cast<Collection*>(ch.get()), osr,
 				  &on_commit);
 
@@ -9584,6 +11325,7 @@ int BlueStore::queue_transactions(
   }
 
   _txc_finalize_kv(txc, txc->t);
+  sl.unlock();
   if (handle)
     handle->suspend_tp_timeout();
 
@@ -10530,6 +12272,32 @@ void BlueStore::_do_write_big(
   }
 }
 
+// Trial-compress a few evenly spaced windows of a blob and return the
+// compressed/raw ratio of the sample, or 0 if the blob is too small
+// for a sample to be worth it.
+static double _sample_compress_ratio(
+  CompressorRef& c,
+  const bufferlist& bl,
+  uint64_t sample_size)
+{
+  const unsigned windows = 4;
+  uint64_t len = bl.length();
+  if (!sample_size || len < sample_size * windows) {
+    return 0;
+  }
+  uint64_t w = sample_size / windows;
+  uint64_t stride = len / windows;
+  bufferlist sample;
+  for (unsigned i = 0; i < windows; ++i) {
+    bl.copy(i * stride + (stride - w) / 2, w, sample);
+  }
+  bufferlist t;
+  if (c->compress(sample, t) < 0 || !sample.length()) {
+    return 0;
+  }
+  return (double)t.length() / sample.length();
+}
+
 int BlueStore::_do_alloc_write(
   TransContext *txc,
   CollectionRef coll,
@@ -10545,22 +12313,32 @@ int BlueStore::_do_alloc_write(
 
   CompressorRef c;
   double crr = 0;
+  bool cold = false;
   if (wctx->compress) {
-    c = select_option(
-      "compression_algorithm",
-      compressor,
-      [&]() {
-        string val;
-        if (coll->pool_opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &val)) {
-          CompressorRef cp = compressor;
-          if (!cp || cp->get_type_name() != val) {
-            cp = Compressor::create(cct, val);
-          }
-          return boost::optional<CompressorRef>(cp);
-        }
-        return boost::optional<CompressorRef>();
-      }
-    );
+    // cold data gets its own (denser) algorithm unless the pool
+    // explicitly asks for one
+    CompressorRef cc = cold_compressor;
+    if (wctx->compress_cold && cc &&
+	!coll->pool_opts.is_set(pool_opts_t::COMPRESSION_ALGORITHM)) {
+      c = cc;
+      cold = true;
+    } else {
+      c = select_option(
+	"compression_algorithm",
+	compressor,
+	[&]() {
+	  string val;
+	  if (coll->pool_opts.get(pool_opts_t::COMPRESSION_ALGORITHM, &val)) {
+	    CompressorRef cp = compressor;
+	    if (!cp || cp->get_type_name() != val) {
+	      cp = Compressor::create(cct, val);
+	    }
+	    return boost::optional<CompressorRef>(cp);
+	  }
+	  return boost::optional<CompressorRef>();
+	}
+      );
+    }
 
     crr = select_option(
       "compression_required_ratio",
@@ -10592,6 +12370,8 @@ int BlueStore::_do_alloc_write(
   // compress (as needed) and calc needed space
   uint64_t need = 0;
   auto max_bsize = std::max(wctx->target_blob_size, min_alloc_size);
+  uint64_t sample_size = comp_sample_size;
+  double sample_slop = comp_sample_slop;
   for (auto& wi : wctx->writes) {
     if (c && wi.blob_length > min_alloc_size) {
       auto start = mono_clock::now();
@@ -10600,10 +12380,31 @@ int BlueStore::_do_alloc_write(
       assert(wi.b_off == 0);
       assert(wi.blob_length == wi.bl.length());
 
+      // don't pay for compressing the whole blob if a sample of it
+      // won't compress
+      double sample_ratio = _sample_compress_ratio(c, wi.bl, sample_size);
+      if (sample_ratio > crr + sample_slop) {
+	dout(20) << __func__ << std::hex << "  0x" << wi.blob_length
+		 << " sample compressed with " << c->get_type()
+		 << " to ratio " << sample_ratio
+		 << ", leaving uncompressed"
+		 << std::dec << dendl;
+	logger->inc(l_bluestore_compress_skipped_count);
+	logger->inc(l_bluestore_compress_skipped_bytes, wi.blob_length);
+	++coll->compress_stats.skipped;
+	coll->compress_stats.skipped_bytes += wi.blob_length;
+	need += wi.blob_length;
+	continue;
+      }
+
       // FIXME: memory alignment here is bad
       bufferlist t;
       int r = c->compress(wi.bl, t);
       assert(r == 0);
+      ++coll->compress_stats.attempted;
+      if (cold) {
+	++coll->compress_stats.cold;
+      }
 
       bluestore_compression_header_t chdr;
       chdr.type = c->get_type();
@@ -10639,6 +12440,7 @@ int BlueStore::_do_alloc_write(
 		 << ", leaving uncompressed"
 		 << std::dec << dendl;
 	logger->inc(l_bluestore_compress_rejected_count);
+	++coll->compress_stats.rejected;
 	need += wi.blob_length;
       }
       logger->tinc(l_bluestore_compress_lat,
@@ -10650,9 +12452,7 @@ int BlueStore::_do_alloc_write(
   PExtentVector prealloc;
   prealloc.reserve(2 * wctx->writes.size());;
   int prealloc_left = 0;
-  prealloc_left = alloc->allocate(
-    need, min_alloc_size, need,
-    0, &prealloc);
+  prealloc_left = _alloc_data(need, wctx->fast_tier, &prealloc);
   if (prealloc_left  < 0) {
     derr << __func__ << " failed to allocate 0x" << std::hex << need << std::dec
 	 << dendl;
@@ -10824,6 +12624,9 @@ void BlueStore::_wctx_finish(
 	  b->shared_blob->put_ref(
 	    e.offset, e.length, &final,
 	    unshare_ptr);
+	  if (shared_blob_merge) {
+	    txc->note_shared_blob_ref(b->shared_blob, e.offset, e.length, -1);
+	  }
 	}
 	if (unshare) {
 	  assert(maybe_unshared_blobs);
@@ -10831,7 +12634,9 @@ void BlueStore::_wctx_finish(
 	}
 	dout(20) << __func__ << "  shared_blob release " << final
 		 << " from " << *b->shared_blob << dendl;
-	txc->write_shared_blob(b->shared_blob);
+	if (!shared_blob_merge) {
+	  txc->write_shared_blob(b->shared_blob);
+	}
 	r.clear();
 	r.swap(final);
       }
@@ -10952,6 +12757,7 @@ void BlueStore::_choose_write_options(
       (alloc_hints & CEPH_OSD_ALLOC_HINT_FLAG_RANDOM_WRITE) == 0) {
 
     dout(20) << __func__ << " will prefer large blob and csum sizes" << dendl;
+    wctx->compress_cold = true;
 
     if (o->onode.expected_write_size) {
       wctx->csum_order = std::max(min_alloc_size_order,
@@ -11053,6 +12859,69 @@ int BlueStore::_do_gc(
   return 0;
 }
 
+bool BlueStore::_can_inline(OnodeRef& o)
+{
+  // only empty objects start out inline
+  return o->onode.size == 0 &&
+    o->onode.extent_map_shards.empty() &&
+    o->extent_map.extent_map.empty() &&
+    o->extent_map.spanning_blob_map.empty() &&
+    ondisk_format >= inline_data_ondisk_format &&
+    cct->_conf->get_val<uint64_t>("bluestore_inline_data_max") > 0;
+}
+
+void BlueStore::_do_write_inline(
+  TransContext *txc,
+  OnodeRef& o,
+  uint64_t offset,
+  uint64_t length,
+  bufferlist& bl)
+{
+  dout(20) << __func__ << " " << o->oid
+	   << " 0x" << std::hex << offset << "~" << length
+	   << " - have 0x" << o->onode.size << std::dec << dendl;
+  bufferlist& old = o->onode.inline_data;
+  assert(old.length() == o->onode.size);
+  bufferlist n;
+  if (offset <= old.length()) {
+    n.substr_of(old, 0, offset);
+  } else {
+    n = old;
+    n.append_zero(offset - old.length());
+  }
+  bufferlist t;
+  t.substr_of(bl, 0, length);
+  n.claim_append(t);
+  if (offset + length < old.length()) {
+    t.substr_of(old, offset + length, old.length() - offset - length);
+    n.claim_append(t);
+  }
+  // copy, so that we do not pin the caller's (message) buffers
+  n.rebuild();
+  n.reassign_to_mempool(mempool::mempool_bluestore_cache_other);
+  old.swap(n);
+  o->onode.size = old.length();
+  o->onode.set_flag(bluestore_onode_t::FLAG_INLINE_DATA);
+  txc->write_onode(o);
+  logger->inc(l_bluestore_write_inline);
+  logger->inc(l_bluestore_write_inline_bytes, length);
+}
+
+int BlueStore::_do_inline_to_blobs(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef& o)
+{
+  dout(20) << __func__ << " " << o->oid << " 0x" << std::hex
+	   << o->onode.size << std::dec << dendl;
+  bufferlist bl;
+  bl.swap(o->onode.inline_data);
+  o->onode.clear_flag(bluestore_onode_t::FLAG_INLINE_DATA);
+  // size stays as is, so this is an ordinary write into a hole and
+  // does not come back here.
+  return _do_write(txc, c, o, 0, bl.length(), bl, 0);
+}
+
 int BlueStore::_do_write(
   TransContext *txc,
   CollectionRef& c,
@@ -11080,6 +12949,20 @@ int BlueStore::_do_write(
 
   uint64_t end = offset + length;
 
+  if (o->onode.is_inline() || _can_inline(o)) {
+    if (std::max(end, o->onode.size) <= cct->_conf->get_val<uint64_t>(
+	  "bluestore_inline_data_max")) {
+      _do_write_inline(txc, o, offset, length, bl);
+      return 0;
+    }
+    if (o->onode.is_inline()) {
+      r = _do_inline_to_blobs(txc, c, o);
+      if (r < 0) {
+	return r;
+      }
+    }
+  }
+
   GarbageCollector gc(c->store->cct);
   int64_t benefit;
   auto dirty_start = offset;
@@ -11087,6 +12970,7 @@ int BlueStore::_do_write(
 
   WriteContext wctx;
   _choose_write_options(c, o, fadvise_flags, &wctx);
+  wctx.fast_tier = _fast_tier_wanted(o, fadvise_flags, end);
   o->extent_map.fault_range(db, offset, length);
   _do_write_data(txc, c, o, offset, length, bl, &wctx);
   r = _do_alloc_write(txc, c, o, &wctx);
@@ -11190,6 +13074,20 @@ int BlueStore::_do_zero(TransContext *txc,
 
   _dump_onode(o);
 
+  if (o->onode.is_inline() && length > 0) {
+    if (std::max<uint64_t>(offset + length, o->onode.size) <=
+	cct->_conf->get_val<uint64_t>("bluestore_inline_data_max")) {
+      bufferlist zeros;
+      zeros.append_zero(length);
+      _do_write_inline(txc, o, offset, length, zeros);
+      return 0;
+    }
+    r = _do_inline_to_blobs(txc, c, o);
+    if (r < 0) {
+      return r;
+    }
+  }
+
   WriteContext wctx;
   o->extent_map.fault_range(db, offset, length);
   o->extent_map.punch_hole(c, offset, length, &wctx.old_extents);
@@ -11221,6 +13119,28 @@ void BlueStore::_do_truncate(
   if (offset == o->onode.size)
     return;
 
+  if (o->onode.is_inline()) {
+    if (offset < o->onode.size) {
+      bufferlist t;
+      t.substr_of(o->onode.inline_data, 0, offset);
+      o->onode.inline_data.swap(t);
+      if (offset == 0) {
+	o->onode.clear_flag(bluestore_onode_t::FLAG_INLINE_DATA);
+      }
+      o->onode.size = offset;
+      txc->write_onode(o);
+      return;
+    }
+    if (offset <= cct->_conf->get_val<uint64_t>("bluestore_inline_data_max")) {
+      o->onode.inline_data.append_zero(offset - o->onode.size);
+      o->onode.size = offset;
+      txc->write_onode(o);
+      return;
+    }
+    int r = _do_inline_to_blobs(txc, c, o);
+    assert(r == 0);
+  }
+
   if (offset < o->onode.size) {
     WriteContext wctx;
     uint64_t length = o->onode.size - offset;
@@ -11756,6 +13676,15 @@ int BlueStore::_do_clone_range(
 	   << newo->oid
 	   << " 0x" << std::hex << srcoff << "~" << length << " -> "
 	   << " 0x" << dstoff << "~" << length << std::dec << dendl;
+  if (oldo->onode.is_inline() || newo->onode.is_inline()) {
+    // no blobs to share; just copy the data
+    bufferlist bl;
+    int r = _do_read(c.get(), oldo, srcoff, length, bl, 0);
+    if (r < 0)
+      return r;
+    return _do_write(txc, c, newo, dstoff, bl.length(), bl, 0);
+  }
+
   oldo->extent_map.fault_range(db, srcoff, length);
   newo->extent_map.fault_range(db, dstoff, length);
   _dump_onode(oldo);
@@ -12196,6 +14125,72 @@ void BlueStore::generate_db_histogram(Formatter *f)
 
 }
 
+void BlueStore::generate_free_extent_histogram(Formatter *f)
+{
+  // bucket free extents by size, in powers of two of min_alloc_size
+  auto dump_alloc = [&](const char *name, Allocator *a) {
+    vector<uint64_t> count, bytes;
+    uint64_t num = 0, total = 0;
+    a->dump([&](uint64_t offset, uint64_t length) {
+	size_t bucket = 0;
+	for (uint64_t l = length / min_alloc_size; l > 1; l >>= 1) {
+	  ++bucket;
+	}
+	if (bucket >= count.size()) {
+	  count.resize(bucket + 1);
+	  bytes.resize(bucket + 1);
+	}
+	++count[bucket];
+	bytes[bucket] += length;
+	++num;
+	total += length;
+      });
+    f->open_object_section(name);
+    f->dump_unsigned("free_extents", num);
+    f->dump_unsigned("free_bytes", total);
+    f->dump_float("fragmentation", a->get_fragmentation(min_alloc_size));
+    f->open_array_section("histogram");
+    for (size_t i = 0; i < count.size(); ++i) {
+      if (!count[i]) {
+	continue;
+      }
+      f->open_object_section("bucket");
+      f->dump_unsigned("min_length", (uint64_t)min_alloc_size << i);
+      f->dump_unsigned("count", count[i]);
+      f->dump_unsigned("bytes", bytes[i]);
+      f->close_section();
+    }
+    f->close_section();
+    f->close_section();
+  };
+
+  f->open_object_section("free_extent_histogram");
+  if (alloc) {
+    dump_alloc("block", alloc);
+  }
+  if (fast_alloc) {
+    dump_alloc("fast_tier", fast_alloc);
+  }
+  f->close_section();
+}
+
+void BlueStore::dump_compression_stats(Formatter *f)
+{
+  f->open_array_section("compression_stats");
+  RWLock::RLocker l(coll_lock);
+  for (auto& p : coll_map) {
+    auto& cs = p.second->compress_stats;
+    if (!cs.attempted && !cs.skipped) {
+      continue;
+    }
+    f->open_object_section("collection");
+    f->dump_stream("cid") << p.first;
+    cs.dump(f);
+    f->close_section();
+  }
+  f->close_section();
+}
+
 void BlueStore::_flush_cache()
 {
   dout(10) << __func__ << dendl;
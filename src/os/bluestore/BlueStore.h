@@ -85,9 +85,14 @@ enum {
   l_bluestore_csum_lat,
   l_bluestore_compress_success_count,
   l_bluestore_compress_rejected_count,
+  l_bluestore_compress_skipped_count,
+  l_bluestore_compress_skipped_bytes,
+  l_bluestore_shared_blob_merges,
   l_bluestore_write_pad_bytes,
   l_bluestore_deferred_write_ops,
   l_bluestore_deferred_write_bytes,
+  l_bluestore_deferred_elevator_passes,
+  l_bluestore_deferred_idle_flushes,
   l_bluestore_write_penalty_read_ops,
   l_bluestore_allocated,
   l_bluestore_stored,
@@ -105,6 +110,10 @@ enum {
   l_bluestore_buffer_bytes,
   l_bluestore_buffer_hit_bytes,
   l_bluestore_buffer_miss_bytes,
+  l_bluestore_slab_bytes,
+  l_bluestore_slab_items,
+  l_bluestore_slab_refills,
+  l_bluestore_slab_releases,
   l_bluestore_write_big,
   l_bluestore_write_big_bytes,
   l_bluestore_write_big_blobs,
@@ -114,6 +123,8 @@ enum {
   l_bluestore_write_small_deferred,
   l_bluestore_write_small_pre_read,
   l_bluestore_write_small_new,
+  l_bluestore_write_inline,
+  l_bluestore_write_inline_bytes,
   l_bluestore_txc,
   l_bluestore_onode_reshard,
   l_bluestore_blob_split,
@@ -121,9 +132,25 @@ enum {
   l_bluestore_gc_merged,
   l_bluestore_read_eio,
   l_bluestore_fragmentation,
+  l_bluestore_fast_tier_free,
+  l_bluestore_fast_tier_promoted,
+  l_bluestore_fast_tier_demoted,
+  l_bluestore_fast_tier_migrated_bytes,
+  l_bluestore_defrag_objects,
+  l_bluestore_defrag_bytes,
   l_bluestore_last
 };
 
+// per kv sync lane counters (bluestore_kv_sync_lanes > 1)
+enum {
+  l_bluestore_kv_lane_first = 732530,
+  l_bluestore_kv_lane_flush_lat,
+  l_bluestore_kv_lane_commit_lat,
+  l_bluestore_kv_lane_lat,
+  l_bluestore_kv_lane_txc,
+  l_bluestore_kv_lane_last
+};
+
 class BlueStore : public ObjectStore,
 		  public md_config_obs_t {
   // -----------------------------------------------------
@@ -1033,6 +1060,9 @@ public:
     std::mutex flush_lock;  ///< protect flush_txns
     std::condition_variable flush_cond;   ///< wait here for uncommitted txns
 
+    /// cache hits since the last tier migration decision
+    std::atomic<uint32_t> heat = {0};
+
     Onode(Collection *c, const ghobject_t& o,
 	  const mempool::bluestore_cache_other::string& k)
       : nref(0),
@@ -1082,6 +1112,12 @@ public:
     virtual uint64_t _get_num_onodes() = 0;
     virtual uint64_t _get_buffer_bytes() = 0;
 
+    /// visit onodes most recently used first, until f returns false
+    virtual void _foreach_onode_mru(std::function<bool(Onode&)> f) = 0;
+
+    /// append up to max (cid, onode key) pairs, most recently used first
+    void dump_hot_onodes(size_t max, vector<pair<coll_t,string>> *ls);
+
     void add_extent() {
       ++num_extents;
     }
@@ -1156,6 +1192,12 @@ public:
       onode_lru.erase(q);
     }
     void _touch_onode(OnodeRef& o) override;
+    void _foreach_onode_mru(std::function<bool(Onode&)> f) override {
+      for (auto& o : onode_lru) {
+	if (!f(o))
+	  break;
+      }
+    }
 
     uint64_t _get_buffer_bytes() override {
       return buffer_size;
@@ -1261,6 +1303,12 @@ public:
       onode_lru.erase(q);
     }
     void _touch_onode(OnodeRef& o) override;
+    void _foreach_onode_mru(std::function<bool(Onode&)> f) override {
+      for (auto& o : onode_lru) {
+	if (!f(o))
+	  break;
+      }
+    }
 
     uint64_t _get_buffer_bytes() override {
       return buffer_bytes;
@@ -1360,6 +1408,17 @@ public:
     //pool options
     pool_opts_t pool_opts;
 
+    /// compression outcomes for blobs written to this collection
+    struct compress_stats_t {
+      std::atomic<uint64_t> attempted = {0};     ///< full compress calls
+      std::atomic<uint64_t> rejected = {0};      ///< ... that missed the ratio
+      std::atomic<uint64_t> skipped = {0};       ///< avoided by sampling
+      std::atomic<uint64_t> skipped_bytes = {0}; ///< bytes not compressed
+      std::atomic<uint64_t> cold = {0};          ///< used the cold algorithm
+
+      void dump(Formatter *f) const;
+    } compress_stats;
+
     OnodeRef get_onode(const ghobject_t& oid, bool create);
 
     // the terminology is confusing here, sorry!
@@ -1565,6 +1624,8 @@ public:
     set<OnodeRef> onodes;     ///< these need to be updated/written
     set<OnodeRef> modified_objects;  ///< objects we modified (and need a ref)
     set<SharedBlobRef> shared_blobs;  ///< these need to be updated/written
+    /// ref changes to shared blobs already on disk, written as kv merges
+    map<SharedBlobRef,bluestore_shared_blob_delta_t> shared_blob_deltas;
     set<SharedBlobRef> shared_blobs_written; ///< update these on io completion
 
     KeyValueDB::Transaction t; ///< then we will commit this
@@ -1608,8 +1669,13 @@ public:
     void write_shared_blob(SharedBlobRef &sb) {
       shared_blobs.insert(sb);
     }
+    void note_shared_blob_ref(SharedBlobRef &sb,
+			      uint64_t offset, uint32_t length, int32_t refs) {
+      shared_blob_deltas[sb].add(offset, length, refs);
+    }
     void unshare_blob(SharedBlob *sb) {
       shared_blobs.erase(sb);
+      shared_blob_deltas.erase(sb);
     }
 
     /// note we logically modified object (when onode itself is unmodified)
@@ -1662,8 +1728,26 @@ public:
     }
   };
 
+  /// running batches of several sequencers, written as one elevator pass
+  struct DeferredElevatorPass final : public AioContext {
+    vector<OpSequencer*> osrs;
+    IOContext ioc;
+
+    DeferredElevatorPass(CephContext *cct) : ioc(cct, this) {}
+
+    void aio_finish(BlueStore *store) override {
+      for (auto osr : osrs) {
+	store->_deferred_aio_finish(osr);
+      }
+      delete this;
+    }
+  };
+
   class OpSequencer : public RefCountedObject {
   public:
+    /// held while a txc is created and prepared, so that q order matches
+    /// the order in which txcs modified onodes (see _rewrite_object)
+    std::mutex submit_lock;
     std::mutex qlock;
     std::condition_variable qcond;
     typedef boost::intrusive::list<
@@ -1683,6 +1767,7 @@ public:
     coll_t cid;
 
     size_t shard;
+    unsigned kv_lane = 0;  ///< kv sync lane our txcs commit through
 
     uint64_t last_seq = 0;
 
@@ -1784,6 +1869,35 @@ public:
     }
   };
 
+  /// An additional kv commit pipeline.  Each OpSequencer is pinned to
+  /// a single lane, so per-sequencer ordering is preserved while the
+  /// lanes batch and sync their transactions in parallel.  Lane 0 is
+  /// the regular _kv_sync_thread, which remains responsible for deferred
+  /// io cleanup and bluefs balancing; extra lanes only commit txcs.
+  struct KVSyncLane {
+    BlueStore *store;
+    unsigned id;
+    std::mutex lock;
+    std::condition_variable cond;
+    bool started = false;
+    bool stop = false;
+    deque<TransContext*> queue;             ///< ready, already submitted
+    deque<TransContext*> queue_unsubmitted; ///< ready, need submit by lane
+    uint64_t ios = 0;
+    uint64_t throttle_costs = 0;
+
+    struct LaneThread : public Thread {
+      KVSyncLane *lane;
+      explicit LaneThread(KVSyncLane *l) : lane(l) {}
+      void *entry() override {
+	lane->store->_kv_sync_lane_thread(lane);
+	return NULL;
+      }
+    } thread;
+
+    KVSyncLane(BlueStore *s, unsigned i) : store(s), id(i), thread(this) {}
+  };
+
   struct DBHistogram {
     struct value_dist {
       uint64_t count;
@@ -1821,6 +1935,9 @@ private:
   std::string freelist_type;
   FreelistManager *fm = nullptr;
   Allocator *alloc = nullptr;
+  /// the first fast_tier_size bytes of the main device are a fast tier
+  uint64_t fast_tier_size = 0;
+  Allocator *fast_alloc = nullptr;  ///< allocator for [0, fast_tier_size)
   uuid_d fsid;
   int path_fd = -1;  ///< open handle to $path
   int fsid_fd = -1;  ///< open handle (locked) to $path/fsid
@@ -1875,6 +1992,11 @@ private:
   deque<TransContext*> kv_committing_to_finalize;   ///< pending finalization
   deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
 
+  unsigned kv_sync_lane_num = 1;       ///< lane 0 is kv_sync_thread
+  vector<KVSyncLane*> kv_sync_lanes;   ///< lanes [1, kv_sync_lane_num)
+  vector<PerfCounters*> kv_lane_loggers; ///< per lane, if more than one
+  std::mutex kv_ids_lock;  ///< serialize persisting {nid,blobid}_max
+
   PerfCounters *logger = nullptr;
 
   list<CollectionRef> removed_collections;
@@ -1902,6 +2024,9 @@ private:
   ///< number threshold for forced deferred writes
   std::atomic<int> deferred_batch_ops = {0};
 
+  ///< submit deferred batches of all osrs as one sorted pass
+  std::atomic<bool> deferred_elevator = {false};
+
   ///< size threshold for forced deferred writes
   std::atomic<uint64_t> prefer_deferred_size = {0};
 
@@ -1911,10 +2036,14 @@ private:
   std::atomic<Compressor::CompressionMode> comp_mode =
     {Compressor::COMP_NONE}; ///< compression mode
   CompressorRef compressor;
+  CompressorRef cold_compressor;  ///< for immutable, sequentially read data
   std::atomic<uint64_t> comp_min_blob_size = {0};
   std::atomic<uint64_t> comp_max_blob_size = {0};
+  std::atomic<uint64_t> comp_sample_size = {0};  ///< 0 = always compress
+  std::atomic<double> comp_sample_slop = {0};
 
   std::atomic<uint64_t> max_blob_size = {0};  ///< maximum blob size
+  bool shared_blob_merge = false;  ///< write shared blob ref deltas as merges
 
   uint64_t kv_ios = 0;
   uint64_t kv_throttle_costs = 0;
@@ -2066,6 +2195,70 @@ private:
                             PriorityCache::Priority pri);
   } mempool_thread;
 
+  struct OnodeWarmupThread : public Thread {
+    BlueStore *store;
+    explicit OnodeWarmupThread(BlueStore *s) : store(s) {}
+    void *entry() override {
+      store->_onode_warmup();
+      return NULL;
+    }
+  } onode_warmup_thread;
+  std::atomic_bool onode_warmup_stop = {false};
+
+  struct TierThread : public Thread {
+    BlueStore *store;
+    Cond cond;
+    Mutex lock;
+    bool stop = false;
+    explicit TierThread(BlueStore *s)
+      : store(s),
+	lock("BlueStore::TierThread::lock") {}
+    void *entry() override;
+    void init() {
+      assert(stop == false);
+      create("bstore_tier");
+    }
+    void shutdown() {
+      lock.Lock();
+      stop = true;
+      cond.Signal();
+      lock.Unlock();
+      join();
+    }
+  } tier_thread;
+
+  std::mutex tier_lock;  ///< protects tier_promote_q, tier_demote_q
+  std::deque<pair<coll_t,ghobject_t>> tier_promote_q;
+  std::deque<pair<coll_t,ghobject_t>> tier_demote_q;
+
+  struct DefragThread : public Thread {
+    BlueStore *store;
+    Cond cond;
+    Mutex lock;
+    bool stop = false;
+    double interval = 0;  ///< seconds between passes
+    explicit DefragThread(BlueStore *s)
+      : store(s),
+	lock("BlueStore::DefragThread::lock") {}
+    void *entry() override;
+    void init(double i) {
+      assert(stop == false);
+      interval = i;
+      create("bstore_defrag");
+    }
+    void shutdown() {
+      lock.Lock();
+      stop = true;
+      cond.Signal();
+      lock.Unlock();
+      join();
+    }
+  } defrag_thread;
+
+  // defrag scan position; only used by defrag_thread
+  coll_t defrag_cid;
+  ghobject_t defrag_next;
+
   // --------------------------------------------------------
   // private methods
 
@@ -2095,6 +2288,17 @@ private:
   void _close_fm();
   int _open_alloc();
   void _close_alloc();
+
+  // fast/slow tier allocation
+  Allocator *_get_alloc(uint64_t offset) {
+    return offset < fast_tier_size ? fast_alloc : alloc;
+  }
+  void _alloc_init_add_free(uint64_t offset, uint64_t length);
+  void _alloc_init_rm_free(uint64_t offset, uint64_t length);
+  void _alloc_release(const interval_set<uint64_t>& release_set);
+  uint64_t _alloc_get_free();
+  double _fast_tier_free_ratio();
+  int64_t _alloc_data(uint64_t want, bool fast, PExtentVector *extents);
   int _open_collections(int *errors=0);
   void _close_collections();
 
@@ -2124,6 +2328,30 @@ private:
   void _reap_collections();
   void _update_cache_logger();
 
+  // onode cache warm-up across restarts
+  int _save_onode_warmup();
+  void _onode_warmup();
+  void _onode_warmup_start();
+  void _onode_warmup_stop();
+
+  // hot/cold migration between the fast and slow tiers
+  bool _fast_tier_wanted(OnodeRef& o, uint32_t fadvise_flags, uint64_t end);
+  void _tier_maybe_promote(Collection *c, OnodeRef& o);
+  void _tier_note_evicted(Onode *o);
+  void _tier_migrate_some();
+  int _tier_migrate(const coll_t& cid, const ghobject_t& oid, bool promote);
+
+  // online defragmentation
+  void _defrag_some();
+  bool _defrag_wanted(OnodeRef& o);
+
+  /// rewrite an object's data into new extents in a txc of its own
+  int _rewrite_object(CollectionRef& c,
+		      const ghobject_t& oid,
+		      uint32_t fadvise_flags,
+		      std::function<bool(OnodeRef&)> wanted,
+		      uint64_t *bytes);
+
   void _assign_nid(TransContext *txc, OnodeRef o);
   uint64_t _assign_blobid(TransContext *txc);
 
@@ -2158,7 +2386,18 @@ private:
   void _kv_start();
   void _kv_stop();
   void _kv_sync_thread();
+  void _kv_sync_lane_thread(KVSyncLane *lane);
   void _kv_finalize_thread();
+  void _kv_start_lanes();
+  void _kv_stop_lanes();
+  void _kv_prealloc_ids(KeyValueDB::Transaction t,
+			std::unique_lock<std::mutex>& ids_lock,
+			uint64_t *new_nid_max, uint64_t *new_blobid_max);
+  void _kv_commit_ids(std::unique_lock<std::mutex>& ids_lock,
+		      uint64_t new_nid_max, uint64_t new_blobid_max);
+  void _kv_submit_committing(deque<TransContext*>& kv_committing);
+  void _kv_queue_finalize(deque<TransContext*>& kv_committing,
+			  deque<DeferredBatch*>& deferred_stable);
 
   bluestore_deferred_op_t *_get_deferred_op(TransContext *txc, OnodeRef o);
   void _deferred_queue(TransContext *txc);
@@ -2166,6 +2405,8 @@ public:
   void deferred_try_submit();
 private:
   void _deferred_submit_unlock(OpSequencer *osr);
+  void _deferred_submit_elevator_unlock();
+  void _deferred_idle_flush();
   void _deferred_aio_finish(OpSequencer *osr);
   int _deferred_replay();
 
@@ -2185,6 +2426,14 @@ private:
     BlueStoreRepairer* repairer,
     store_statfs_t& expected_statfs);
 
+  struct FSCK_ObjectCtx;
+  struct FSCK_Worker;
+  void _fsck_check_object(
+    FSCK_ObjectCtx& ctx,
+    CollectionRef& c,
+    const ghobject_t& oid,
+    const mempool::bluestore_fsck::list<string>& shard_keys);
+
   void _buffer_cache_write(
     TransContext *txc,
     BlobRef b,
@@ -2218,14 +2467,17 @@ private:
 
   // -- ondisk version ---
 public:
-  const int32_t latest_ondisk_format = 2;        ///< our version
+  const int32_t latest_ondisk_format = 3;        ///< our version
   const int32_t min_readable_ondisk_format = 1;  ///< what we can read
   const int32_t min_compat_ondisk_format = 2;    ///< who can read us
+  const int32_t inline_data_ondisk_format = 3;   ///< onodes may be inline
 
 private:
   int32_t ondisk_format = 0;  ///< value detected on mount
 
   int _upgrade_super();  ///< upgrade (called during open_super)
+  int _enable_inline_data_format();  ///< opt in to inline onodes (mount)
+  int _check_shared_blob_deltas();  ///< fold deltas if merges were disabled
   void _prepare_ondisk_format_super(KeyValueDB::Transaction& t);
 
   // --- public interface ---
@@ -2291,6 +2543,14 @@ public:
   }
   int _fsck(bool deep, bool repair);
 
+  /// fsck/repair progress: objects and logical bytes walked so far, and
+  /// seconds since the object walk started
+  typedef std::function<void(uint64_t, uint64_t, double)> fsck_progress_fn_t;
+  void set_fsck_progress_callback(fsck_progress_fn_t f) {
+    fsck_progress_cb = f;
+  }
+  fsck_progress_fn_t fsck_progress_cb;
+
   void set_cache_shards(unsigned num) override;
 
   int validate_hobject_key(const hobject_t &obj) const override {
@@ -2307,6 +2567,8 @@ public:
 
   void get_db_statistics(Formatter *f) override;
   void generate_db_histogram(Formatter *f) override;
+  void generate_free_extent_histogram(Formatter *f) override;
+  void dump_compression_stats(Formatter *f) override;
   void _flush_cache();
   void flush_cache() override;
   void dump_perf_counters(Formatter *f) override {
@@ -2336,6 +2598,16 @@ public:
     size_t len,
     bufferlist& bl,
     uint32_t op_flags = 0) override;
+  bool is_cached(
+    CollectionHandle &c,
+    const ghobject_t& oid,
+    uint64_t offset,
+    size_t len) override;
+  bool _is_cached(
+    Collection *c,
+    const ghobject_t& oid,
+    uint64_t offset,
+    size_t len);  ///< with c->lock held for read
   int _do_read(
     Collection *c,
     OnodeRef o,
@@ -2417,6 +2689,14 @@ public:
     CollectionHandle &c,   ///< [in] collection
     const ghobject_t &oid  ///< [in] object
     ) override;
+  ObjectMap::ObjectMapIterator get_omap_iterator_pinned(
+    CollectionHandle &c,   ///< [in] collection
+    const ghobject_t &oid  ///< [in] object
+    ) override;
+private:
+  ObjectMap::ObjectMapIterator _get_omap_iterator(
+    CollectionHandle &c, const ghobject_t &oid, bool pin);
+public:
 
   void set_fsid(uuid_d u) override {
     fsid = u;
@@ -2527,8 +2807,10 @@ private:
   struct WriteContext {
     bool buffered = false;          ///< buffered write
     bool compress = false;          ///< compressed write
+    bool compress_cold = false;     ///< data is hinted cold (write once)
     uint64_t target_blob_size = 0;  ///< target (max) blob size
     unsigned csum_order = 0;        ///< target checksum chunk order
+    bool fast_tier = false;         ///< prefer the fast tier allocator
 
     old_extent_map_t old_extents;   ///< must deref these blobs
 
@@ -2577,6 +2859,7 @@ private:
       compress = other.compress;
       target_blob_size = other.target_blob_size;
       csum_order = other.csum_order;
+      fast_tier = other.fast_tier;
     }
     void write(
       uint64_t loffs,
@@ -2654,6 +2937,14 @@ private:
              uint64_t *dirty_start,
              uint64_t *dirty_end);
 
+  bool _can_inline(OnodeRef& o);
+  void _do_write_inline(TransContext *txc,
+			OnodeRef& o,
+			uint64_t offset, uint64_t length,
+			bufferlist& bl);
+  int _do_inline_to_blobs(TransContext *txc,
+			  CollectionRef& c,
+			  OnodeRef& o);
   int _do_write(TransContext *txc,
 		CollectionRef &c,
 		OnodeRef o,
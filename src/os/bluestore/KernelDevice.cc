@@ -38,7 +38,6 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, ai
     fd_buffered(-1),
     aio(false), dio(false),
     debug_lock("KernelDevice::debug_lock"),
-    aio_queue(cct->_conf->bdev_aio_max_queue_depth),
     discard_callback(d_cb),
     discard_callback_priv(d_cbpriv),
     aio_stop(false),
@@ -223,6 +222,10 @@ int KernelDevice::collect_metadata(const string& prefix, map<string,string> *pm)
   (*pm)[prefix + "size"] = stringify(get_size());
   (*pm)[prefix + "block_size"] = stringify(get_block_size());
   (*pm)[prefix + "driver"] = "KernelDevice";
+  if (io_queue) {
+    (*pm)[prefix + "aio_backend"] =
+      dynamic_cast<ioring_queue_t*>(io_queue.get()) ? "io_uring" : "libaio";
+  }
   if (rotational) {
     (*pm)[prefix + "type"] = "hdd";
   } else {
@@ -349,15 +352,40 @@ int KernelDevice::_aio_start()
 {
   if (aio) {
     dout(10) << __func__ << dendl;
-    int r = aio_queue.init();
-    if (r < 0) {
-      if (r == -EAGAIN) {
-	derr << __func__ << " io_setup(2) failed with EAGAIN; "
-	     << "try increasing /proc/sys/fs/aio-max-nr" << dendl;
+    unsigned iodepth = cct->_conf->bdev_aio_max_queue_depth;
+    std::vector<int> fds = {fd_direct, fd_buffered};
+    int r;
+    if (cct->_conf->get_val<bool>("bdev_ioring")) {
+      if (ioring_queue_t::supported()) {
+	io_queue = std::make_unique<ioring_queue_t>(
+	  iodepth,
+	  cct->_conf->get_val<bool>("bdev_ioring_sqthread_poll"));
+	r = io_queue->init(fds);
+	if (r < 0) {
+	  derr << __func__ << " io_uring_queue_init failed: "
+	       << cpp_strerror(r) << ", falling back to libaio" << dendl;
+	  io_queue.reset();
+	} else {
+	  dout(1) << __func__ << " using io_uring" << dendl;
+	}
       } else {
-	derr << __func__ << " io_setup(2) failed: " << cpp_strerror(r) << dendl;
+	derr << __func__ << " io_uring not supported by this build or kernel,"
+	     << " falling back to libaio" << dendl;
+      }
+    }
+    if (!io_queue) {
+      io_queue = std::make_unique<aio_queue_t>(iodepth);
+      r = io_queue->init(fds);
+      if (r < 0) {
+	if (r == -EAGAIN) {
+	  derr << __func__ << " io_setup(2) failed with EAGAIN; "
+	       << "try increasing /proc/sys/fs/aio-max-nr" << dendl;
+	} else {
+	  derr << __func__ << " io_setup(2) failed: " << cpp_strerror(r) << dendl;
+	}
+	io_queue.reset();
+	return r;
       }
-      return r;
     }
     aio_thread.create("bstore_aio");
   }
@@ -371,7 +399,8 @@ void KernelDevice::_aio_stop()
     aio_stop = true;
     aio_thread.join();
     aio_stop = false;
-    aio_queue.shutdown();
+    io_queue->shutdown();
+    io_queue.reset();
   }
 }
 
@@ -426,7 +455,7 @@ void KernelDevice::_aio_thread()
     dout(40) << __func__ << " polling" << dendl;
     int max = cct->_conf->bdev_aio_reap_max;
     aio_t *aio[max];
-    int r = aio_queue.get_next_completed(cct->_conf->bdev_aio_poll_ms,
+    int r = io_queue->get_next_completed(cct->_conf->bdev_aio_poll_ms,
 					 aio, max);
     if (r < 0) {
       derr << __func__ << " got " << cpp_strerror(r) << dendl;
@@ -658,7 +687,7 @@ void KernelDevice::aio_submit(IOContext *ioc)
 
   void *priv = static_cast<void*>(ioc);
   int r, retries = 0;
-  r = aio_queue.submit_batch(ioc->running_aios.begin(), e, 
+  r = io_queue->submit_batch(ioc->running_aios.begin(), e,
 			     pending, priv, &retries);
   
   if (retries)
@@ -26,6 +26,7 @@
 #include <chrono>
 #include <functional>
 #include <map>
+#include <set>
 #include <thread>
 
 #include <spdk/nvme.h>
@@ -40,13 +41,22 @@
 #include "common/io_priority.h"
 
 #include "NVMEDevice.h"
+#include "ThreadQueueCache.h"
 
 #define dout_context g_ceph_context
 #define dout_subsys ceph_subsys_bdev
 #undef dout_prefix
 #define dout_prefix *_dout << "bdev(" << sn << ") "
 
-thread_local SharedDriverQueueData *queue_t;
+// Each thread that submits IO (in the OSD, each op shard worker) gets its
+// own queue pair per device and polls its completions inline, so no IO is
+// handed between threads.  A thread's queue pairs are keyed by the open
+// sequence of their device, so a thread can use several devices at once
+// and never reuses a queue pair from an earlier open.
+static std::atomic<uint64_t> nvme_open_seq = {0};
+static std::mutex nvme_open_lock;
+static std::set<uint64_t> nvme_open_seqs;  ///< devices currently open
+static thread_local ThreadQueueCache<SharedDriverQueueData> thread_queues;
 
 static constexpr uint16_t data_buffer_default_num = 1024;
 
@@ -65,6 +75,11 @@ enum {
   l_bluestore_nvmedevice_queue_ops,
   l_bluestore_nvmedevice_polling_lat,
   l_bluestore_nvmedevice_buffer_alloc_failed,
+  l_bluestore_nvmedevice_submitted_ops,
+  l_bluestore_nvmedevice_completed_ops,
+  l_bluestore_nvmedevice_polls,
+  l_bluestore_nvmedevice_empty_polls,
+  l_bluestore_nvmedevice_backoff_sleeps,
   l_bluestore_nvmedevice_last
 };
 
@@ -134,12 +149,16 @@ class SharedDriverQueueData {
   spdk_nvme_ctrlr *ctrlr;
   spdk_nvme_ns *ns;
   std::string sn;
+  unsigned id;
   uint64_t block_size;
   uint32_t sector_size;
   uint32_t max_queue_depth;
   struct spdk_nvme_qpair *qpair;
-  bool reap_io = false;
+  uint32_t max_io_completion;
+  uint64_t max_sleep_us;     ///< backoff ceiling; 0 = spin, never sleep
+  uint64_t busy_polls;       ///< empty polls before backing off
   int alloc_buf_from_pool(Task *t, bool write);
+  void poll_completions(uint64_t *empty_polls, uint64_t *sleep_us);
 
   public:
     uint32_t current_queue_depth = 0;
@@ -148,13 +167,18 @@ class SharedDriverQueueData {
     PerfCounters *logger = nullptr;
     void _aio_handle(Task *t, IOContext *ioc);
 
-    SharedDriverQueueData(NVMEDevice *bdev, SharedDriverData *driver)
+    SharedDriverQueueData(NVMEDevice *bdev, SharedDriverData *driver,
+                          unsigned id)
       : bdev(bdev),
-        driver(driver) {
+        driver(driver),
+        id(id) {
     ctrlr = driver->ctrlr;
     ns = driver->ns;
     block_size = driver->block_size;
     sector_size = driver->sector_size;
+    max_io_completion = (uint32_t)g_conf->get_val<uint64_t>("bluestore_spdk_max_io_completion");
+    max_sleep_us = g_conf->get_val<uint64_t>("bluestore_spdk_io_sleep");
+    busy_polls = g_conf->get_val<uint64_t>("bluestore_spdk_poll_busy_loops");
 
     struct spdk_nvme_io_qpair_opts opts = {};
     spdk_nvme_ctrlr_get_default_io_qpair_opts(ctrlr, &opts, sizeof(opts));
@@ -174,7 +198,7 @@ class SharedDriverQueueData {
       data_buf_mempool.push_back(b);
     }
 
-    PerfCountersBuilder b(g_ceph_context, string("NVMEDevice-AIOThread-"+stringify(this)),
+    PerfCountersBuilder b(g_ceph_context, string("NVMEDevice-qpair-"+stringify(id)),
                           l_bluestore_nvmedevice_first, l_bluestore_nvmedevice_last);
     b.add_time_avg(l_bluestore_nvmedevice_write_lat, "write_lat", "Average write completing latency");
     b.add_time_avg(l_bluestore_nvmedevice_read_lat, "read_lat", "Average read completing latency");
@@ -185,11 +209,14 @@ class SharedDriverQueueData {
     b.add_time_avg(l_bluestore_nvmedevice_read_queue_lat, "read_queue_lat", "Average queue read request latency");
     b.add_time_avg(l_bluestore_nvmedevice_flush_queue_lat, "flush_queue_lat", "Average queue flush request latency");
     b.add_u64_counter(l_bluestore_nvmedevice_buffer_alloc_failed, "buffer_alloc_failed", "Alloc data buffer failed count");
+    b.add_u64_counter(l_bluestore_nvmedevice_submitted_ops, "submitted_ops", "Commands submitted on this queue pair");
+    b.add_u64_counter(l_bluestore_nvmedevice_completed_ops, "completed_ops", "Completions reaped on this queue pair");
+    b.add_u64_counter(l_bluestore_nvmedevice_polls, "polls", "Completion polls");
+    b.add_u64_counter(l_bluestore_nvmedevice_empty_polls, "empty_polls", "Completion polls that found nothing");
+    b.add_u64_counter(l_bluestore_nvmedevice_backoff_sleeps, "backoff_sleeps", "Sleeps taken while backing off an idle queue pair");
     logger = b.create_perf_counters();
     g_ceph_context->get_perfcounters_collection()->add(logger);
     bdev->queue_number++;
-    if (bdev->queue_number.load() == 1)
-      reap_io = true;
   }
 
   ~SharedDriverQueueData() {
@@ -353,14 +380,39 @@ int SharedDriverQueueData::alloc_buf_from_pool(Task *t, bool write)
   return 0;
 }
 
+/*
+ * Reap completions without interrupts.  An idle queue pair is spun on for
+ * busy_polls empty polls, then polled with a sleep that doubles from 1us
+ * up to max_sleep_us; any completion resets the backoff.
+ */
+void SharedDriverQueueData::poll_completions(uint64_t *empty_polls,
+                                             uint64_t *sleep_us)
+{
+  int r = spdk_nvme_qpair_process_completions(qpair, max_io_completion);
+  logger->inc(l_bluestore_nvmedevice_polls);
+  if (r < 0) {
+    ceph_abort();
+  } else if (r > 0) {
+    logger->inc(l_bluestore_nvmedevice_completed_ops, r);
+    *empty_polls = 0;
+    *sleep_us = 1;
+  } else {
+    logger->inc(l_bluestore_nvmedevice_empty_polls);
+    if (max_sleep_us && ++*empty_polls > busy_polls) {
+      logger->inc(l_bluestore_nvmedevice_backoff_sleeps);
+      usleep(*sleep_us);
+      *sleep_us = std::min(*sleep_us * 2, max_sleep_us);
+    }
+  }
+}
+
 void SharedDriverQueueData::_aio_handle(Task *t, IOContext *ioc)
 {
   dout(20) << __func__ << " start" << dendl;
 
   int r = 0;
   uint64_t lba_off, lba_count;
-  uint32_t max_io_completion = (uint32_t)g_conf->get_val<uint64_t>("bluestore_spdk_max_io_completion");
-  uint64_t io_sleep_in_us = g_conf->get_val<uint64_t>("bluestore_spdk_io_sleep");
+  uint64_t empty_polls = 0, sleep_us = 1;
 
   ceph::coarse_real_clock::time_point cur, start
     = ceph::coarse_real_clock::now();
@@ -368,12 +420,7 @@ void SharedDriverQueueData::_aio_handle(Task *t, IOContext *ioc)
  again:
     dout(40) << __func__ << " polling" << dendl;
     if (current_queue_depth) {
-      r = spdk_nvme_qpair_process_completions(qpair, max_io_completion);
-      if (r < 0) {
-        ceph_abort();
-      } else if (r == 0) {
-        usleep(io_sleep_in_us);
-      }
+      poll_completions(&empty_polls, &sleep_us);
     }
 
     for (; t; t = t->next) {
@@ -452,6 +499,8 @@ void SharedDriverQueueData::_aio_handle(Task *t, IOContext *ioc)
         }
       }
       current_queue_depth++;
+      logger->inc(l_bluestore_nvmedevice_submitted_ops);
+      logger->set(l_bluestore_nvmedevice_queue_ops, current_queue_depth);
     }
     cur = ceph::coarse_real_clock::now();
     auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(cur - start);
@@ -459,8 +508,8 @@ void SharedDriverQueueData::_aio_handle(Task *t, IOContext *ioc)
     start = ceph::coarse_real_clock::now();
   }
 
-  if (reap_io)
-    bdev->reap_ioc();
+  // any queue may reap; reap_ioc() is cheap when nothing is queued
+  bdev->reap_ioc();
   dout(20) << __func__ << " end" << dendl;
 }
 
@@ -677,6 +726,7 @@ void io_complete(void *t, const struct spdk_nvme_cpl *completion)
   assert(queue != NULL);
   assert(ctx != NULL);
   --queue->current_queue_depth;
+  queue->logger->set(l_bluestore_nvmedevice_queue_ops, queue->current_queue_depth);
   auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(
       ceph::coarse_real_clock::now() - task->start);
   if (task->command == IOCommand::WRITE_COMMAND) {
@@ -773,6 +823,11 @@ int NVMEDevice::open(const string& p)
   }
 
   driver->register_device(this);
+  open_seq = ++nvme_open_seq;
+  {
+    std::lock_guard<std::mutex> l(nvme_open_lock);
+    nvme_open_seqs.insert(open_seq);
+  }
   block_size = driver->get_block_size();
   size = driver->get_size();
   name = serial_number;
@@ -795,8 +850,17 @@ void NVMEDevice::close()
 {
   dout(1) << __func__ << dendl;
 
-  delete queue_t;
-  queue_t = nullptr;
+  {
+    std::lock_guard<std::mutex> l(queue_lock);
+    for (auto q : queues)
+      delete q;
+    queues.clear();
+  }
+  {
+    std::lock_guard<std::mutex> l(nvme_open_lock);
+    nvme_open_seqs.erase(open_seq);
+  }
+  open_seq = 0;
   name.clear();
   driver->remove_device(this);
 
@@ -821,6 +885,25 @@ int NVMEDevice::flush()
   return 0;
 }
 
+SharedDriverQueueData *NVMEDevice::get_thread_queue()
+{
+  SharedDriverQueueData *q = thread_queues.get(open_seq);
+  if (!q) {
+    std::lock_guard<std::mutex> l(queue_lock);
+    q = new SharedDriverQueueData(this, driver, queues.size());
+    queues.push_back(q);
+    {
+      std::lock_guard<std::mutex> ol(nvme_open_lock);
+      thread_queues.add(open_seq, q, [](uint64_t seq) {
+	  return nvme_open_seqs.count(seq) > 0;
+	});
+    }
+    dout(10) << __func__ << " new queue pair " << queues.size() - 1
+             << " for thread " << std::this_thread::get_id() << dendl;
+  }
+  return q;
+}
+
 void NVMEDevice::aio_submit(IOContext *ioc)
 {
   dout(20) << __func__ << " ioc " << ioc << " pending "
@@ -834,9 +917,7 @@ void NVMEDevice::aio_submit(IOContext *ioc)
     assert(ioc->num_pending.load() == 0);  // we should be only thread doing this
     // Only need to push the first entry
     ioc->nvme_task_first = ioc->nvme_task_last = nullptr;
-    if (!queue_t)
-	queue_t = new SharedDriverQueueData(this, driver);
-    queue_t->_aio_handle(t, ioc);
+    get_thread_queue()->_aio_handle(t, ioc);
   }
 }
 
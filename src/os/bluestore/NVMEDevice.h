@@ -49,6 +49,12 @@ class NVMEDevice : public BlockDevice {
   SharedDriverData *driver;
   string name;
 
+  std::mutex queue_lock;
+  std::vector<SharedDriverQueueData*> queues; ///< one per submitting thread
+  uint64_t open_seq = 0;
+
+  SharedDriverQueueData *get_thread_queue();
+
  public:
   std::atomic_int queue_number = {0};
   SharedDriverData *get_driver() { return driver; }
@@ -84,12 +84,21 @@ int PMEMDevice::open(const string& p)
   }
 
   size_t map_len;
-  addr = (char *)pmem_map_file(path.c_str(), 0, PMEM_FILE_EXCL, O_RDWR, &map_len, NULL);
+  int pmem;
+  // on a DAX file system libpmem maps with MAP_SYNC, so cache flushes
+  // alone persist data; anything else (e.g. a regular file standing in
+  // for pmem) gets a plain shared mapping and needs msync
+  addr = (char *)pmem_map_file(path.c_str(), 0, PMEM_FILE_EXCL, O_RDWR, &map_len, &pmem);
   if (addr == NULL) {
     derr << __func__ << " pmem_map_file failed: " << pmem_errormsg() << dendl;
     goto out_fail;
   }
   size = map_len;
+  is_pmem = pmem;
+  if (!is_pmem) {
+    dout(0) << __func__ << " " << path << " is not persistent memory;"
+	    << " emulating with msync" << dendl;
+  }
 
   // Operate as though the block size is 4 KB.  The backing file
   // blksize doesn't strictly matter except that some file systems may
@@ -107,6 +116,7 @@ int PMEMDevice::open(const string& p)
     << " (" << byte_u_t(size) << ")"
     << " block_size " << block_size
     << " (" << byte_u_t(block_size) << ")"
+    << " pmem " << is_pmem
     << dendl;
   return 0;
 
@@ -143,6 +153,7 @@ int PMEMDevice::collect_metadata(const string& prefix, map<string,string> *pm) c
   (*pm)[prefix + "block_size"] = stringify(get_block_size());
   (*pm)[prefix + "driver"] = "PMEMDevice";
   (*pm)[prefix + "type"] = "ssd";
+  (*pm)[prefix + "pmem"] = stringify((int)is_pmem);
 
   struct stat st;
   int r = ::fstat(fd, &st);
@@ -227,15 +238,38 @@ int PMEMDevice::write(uint64_t off, bufferlist& bl, bool buffered)
     return 0;
   }
 
+  return _persist_copy(off, bl);
+}
+
+/*
+ * Copy bl into the mapping and make it durable before returning.  On real
+ * pmem each fragment is copied with non-temporal stores / cache line
+ * write-backs and a single drain (sfence) covers the whole bufferlist;
+ * an emulated mapping is msync'ed once over the written range.
+ */
+int PMEMDevice::_persist_copy(uint64_t off, bufferlist& bl)
+{
+  uint64_t len = bl.length();
   bufferlist::iterator p = bl.begin();
-  uint32_t off1 = off;
+  uint64_t off1 = off;
   while (len) {
     const char *data;
     uint32_t l = p.get_ptr_and_advance(len, &data);
-    pmem_memcpy_persist(addr + off1, data, l);
+    if (is_pmem)
+      pmem_memcpy_nodrain(addr + off1, data, l);
+    else
+      memcpy(addr + off1, data, l);
     len -= l;
     off1 += l;
   }
+  if (is_pmem) {
+    pmem_drain();
+  } else if (pmem_msync(addr + off, bl.length()) < 0) {
+    int r = -errno;
+    derr << __func__ << " msync " << off << "~" << bl.length() << " got "
+	 << cpp_strerror(r) << dendl;
+    return r;
+  }
   return 0;
 }
 
@@ -28,16 +28,19 @@ class PMEMDevice : public BlockDevice {
   int fd;
   char *addr; //the address of mmap
   std::string path;
+  bool is_pmem = false; ///< DAX mapping; false for an emulated (file) map
 
   Mutex debug_lock;
   interval_set<uint64_t> debug_inflight;
 
   std::atomic_int injecting_crash;
   int _lock();
+  int _persist_copy(uint64_t off, bufferlist& bl);
 
 public:
   PMEMDevice(CephContext *cct, aio_callback_t cb, void *cbpriv);
 
+  bool supports_direct_persist() override { return true; }
 
   void aio_submit(IOContext *ioc) override;
 
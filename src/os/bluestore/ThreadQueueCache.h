@@ -0,0 +1,60 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+#ifndef CEPH_OS_BLUESTORE_THREADQUEUECACHE_H
+#define CEPH_OS_BLUESTORE_THREADQUEUECACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * A thread's cached per-device queues.
+ *
+ * Meant to be kept thread_local.  Entries are keyed by a sequence number
+ * that a device takes on every open and that is never reused, so one
+ * thread can submit to several open devices, and an entry for a device
+ * that has since been closed never matches again.  Such entries are
+ * dropped the next time a queue is added.  The cache does not own the
+ * queues; the device frees them when it is closed.
+ */
+template <typename T>
+class ThreadQueueCache {
+  std::vector<std::pair<uint64_t, T*>> entries;  ///< (open seq, queue)
+
+public:
+  T *get(uint64_t seq) const {
+    for (auto& e : entries) {
+      if (e.first == seq)
+	return e.second;
+    }
+    return nullptr;
+  }
+
+  /// cache q for seq, forgetting queues of devices live(seq) says are gone
+  template <typename Live>
+  void add(uint64_t seq, T *q, Live&& live) {
+    entries.erase(
+      std::remove_if(entries.begin(), entries.end(),
+		     [&](const std::pair<uint64_t, T*>& e) {
+		       return !live(e.first);
+		     }),
+      entries.end());
+    entries.emplace_back(seq, q);
+  }
+
+  size_t size() const {
+    return entries.size();
+  }
+};
+
+#endif
@@ -195,6 +195,8 @@ int main(int argc, char **argv)
   string key, value;
   int log_level = 30;
   bool fsck_deep = false;
+  unsigned fsck_threads = 0;
+  string sharding;
   po::options_description po_options("Options");
   po_options.add_options()
     ("help,h", "produce help message")
@@ -204,12 +206,14 @@ int main(int argc, char **argv)
     ("log-level", po::value<int>(&log_level), "log level (30=most, 20=lots, 10=some, 1=little)")
     ("dev", po::value<vector<string>>(&devs), "device(s)")
     ("deep", po::value<bool>(&fsck_deep), "deep fsck (read all data)")
+    ("threads", po::value<unsigned>(&fsck_threads), "fsck/repair worker threads (default: bluestore_fsck_threads)")
     ("key,k", po::value<string>(&key), "label metadata key name")
     ("value,v", po::value<string>(&value), "label metadata value")
+    ("sharding", po::value<string>(&sharding), "new column family layout for reshard (default: bluestore_rocksdb_cfs)")
     ;
   po::options_description po_positional("Positional options");
   po_positional.add_options()
-    ("command", po::value<string>(&action), "fsck, repair, bluefs-export, bluefs-bdev-sizes, bluefs-bdev-expand, show-label, set-label-key, rm-label-key, prime-osd-dir, bluefs-log-dump")
+    ("command", po::value<string>(&action), "fsck, repair, bluefs-export, bluefs-bdev-sizes, bluefs-bdev-expand, show-label, set-label-key, rm-label-key, prime-osd-dir, bluefs-log-dump, reshard")
     ;
   po::options_description po_all("All options");
   po_all.add(po_options).add(po_positional);
@@ -239,7 +243,7 @@ int main(int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
-  if (action == "fsck" || action == "repair") {
+  if (action == "fsck" || action == "repair" || action == "reshard") {
     if (path.empty()) {
       cerr << "must specify bluestore path" << std::endl;
       exit(EXIT_FAILURE);
@@ -323,7 +327,21 @@ int main(int argc, char **argv)
   if (action == "fsck" ||
       action == "repair") {
     validate_path(cct.get(), path, false);
+    if (fsck_threads) {
+      cct->_conf->set_val("bluestore_fsck_threads", stringify(fsck_threads));
+      cct->_conf->apply_changes(NULL);
+    }
     BlueStore bluestore(cct.get(), path);
+    bluestore.set_fsck_progress_callback(
+      [](uint64_t objects, uint64_t bytes, double elapsed) {
+	cout << "checked " << objects << " objects, " << byte_u_t(bytes)
+	     << " in " << elapsed << "s";
+	if (elapsed > 0) {
+	  cout << " (" << (uint64_t)(objects / elapsed) << " objects/s, "
+	       << byte_u_t(bytes / elapsed) << "/s)";
+	}
+	cout << std::endl;
+      });
     int r;
     if (action == "fsck") {
       r = bluestore.fsck(fsck_deep);
@@ -622,6 +640,31 @@ int main(int argc, char **argv)
     delete fs;
   } else if (action == "bluefs-log-dump") {
     log_dump(cct.get(), path, devs);
+  } else if (action == "reshard") {
+    validate_path(cct.get(), path, false);
+    if (sharding.empty()) {
+      sharding = cct->_conf->get_val<string>("bluestore_rocksdb_cfs");
+    }
+    vector<KeyValueDB::ColumnFamily> cfs;
+    int r = KeyValueDB::ColumnFamily::parse_list(sharding, &cfs);
+    if (r < 0) {
+      cerr << "invalid sharding '" << sharding << "'" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    BlueStore bluestore(cct.get(), path);
+    KeyValueDB *db;
+    r = bluestore.start_kv_only(&db, false);
+    if (r < 0) {
+      cerr << "failed to open bluestore: " << cpp_strerror(r) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    r = db->reshard(cfs, cout);
+    bluestore.umount();
+    if (r < 0) {
+      cerr << "reshard failed: " << cpp_strerror(r) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    cout << action << " success" << std::endl;
   } else {
     cerr << "unrecognized action " << action << std::endl;
     return 1;
@@ -1020,6 +1020,77 @@ ostream& operator<<(ostream& out, const bluestore_shared_blob_t& sb)
   return out;
 }
 
+// bluestore_shared_blob_delta_t
+
+void bluestore_shared_blob_delta_t::add(
+  uint64_t offset, uint32_t length, int32_t refs)
+{
+  // only fold into the last record; reordering puts ahead of gets on
+  // overlapping ranges could drop a ref that doesn't exist yet
+  if (!records.empty() &&
+      records.back().offset == offset &&
+      records.back().length == length) {
+    records.back().refs += refs;
+    if (records.back().refs == 0) {
+      records.pop_back();
+    }
+    return;
+  }
+  records.emplace_back(offset, length, refs);
+}
+
+int bluestore_shared_blob_delta_t::apply(
+  bluestore_extent_ref_map_t *ref_map) const
+{
+  for (auto& r : records) {
+    for (int32_t i = 0; i < r.refs; ++i) {
+      ref_map->get(r.offset, r.length);
+    }
+    for (int32_t i = 0; i > r.refs; --i) {
+      if (!ref_map->contains(r.offset, r.length)) {
+	return -ENOENT;
+      }
+      ref_map->put(r.offset, r.length, nullptr, nullptr);
+    }
+  }
+  return 0;
+}
+
+void bluestore_shared_blob_delta_t::dump(Formatter *f) const
+{
+  f->open_array_section("records");
+  for (auto& r : records) {
+    f->open_object_section("record");
+    f->dump_unsigned("offset", r.offset);
+    f->dump_unsigned("length", r.length);
+    f->dump_int("refs", r.refs);
+    f->close_section();
+  }
+  f->close_section();
+}
+
+void bluestore_shared_blob_delta_t::generate_test_instances(
+  list<bluestore_shared_blob_delta_t*>& ls)
+{
+  ls.push_back(new bluestore_shared_blob_delta_t);
+  ls.push_back(new bluestore_shared_blob_delta_t);
+  ls.back()->add(0x10000, 0x10000, 2);
+  ls.back()->add(0x20000, 0x1000, -1);
+}
+
+ostream& operator<<(ostream& out, const bluestore_shared_blob_delta_t& o)
+{
+  out << "delta(" << std::hex;
+  for (auto p = o.records.begin(); p != o.records.end(); ++p) {
+    if (p != o.records.begin()) {
+      out << ",";
+    }
+    out << "0x" << p->offset << "~" << p->length << std::dec
+	<< (p->refs > 0 ? "+" : "") << p->refs << std::hex;
+  }
+  return out << std::dec << ")";
+}
+
 // bluestore_onode_t
 
 void bluestore_onode_t::shard_info::dump(Formatter *f) const
@@ -1055,11 +1126,17 @@ void bluestore_onode_t::dump(Formatter *f) const
   f->dump_unsigned("expected_object_size", expected_object_size);
   f->dump_unsigned("expected_write_size", expected_write_size);
   f->dump_unsigned("alloc_hint_flags", alloc_hint_flags);
+  f->dump_unsigned("inline_data_len", inline_data.length());
 }
 
 void bluestore_onode_t::generate_test_instances(list<bluestore_onode_t*>& o)
 {
   o.push_back(new bluestore_onode_t());
+  o.push_back(new bluestore_onode_t());
+  o.back()->nid = 2;
+  o.back()->size = 5;
+  o.back()->set_flag(FLAG_INLINE_DATA);
+  o.back()->inline_data.append("hello");
   // FIXME
 }
 
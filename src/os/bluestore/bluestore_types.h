@@ -878,6 +878,55 @@ WRITE_CLASS_DENC(bluestore_shared_blob_t)
 
 ostream& operator<<(ostream& out, const bluestore_shared_blob_t& o);
 
+/// shared blob: refcount changes, applied to a shared_blob_t by kv merge
+struct bluestore_shared_blob_delta_t {
+  struct record_t {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    int32_t refs = 0;  ///< refs taken (> 0) or dropped (< 0)
+
+    record_t() {}
+    record_t(uint64_t o, uint32_t l, int32_t r)
+      : offset(o), length(l), refs(r) {}
+
+    DENC(bluestore_shared_blob_delta_t::record_t, v, p) {
+      denc_varint_lowz(v.offset, p);
+      denc_varint_lowz(v.length, p);
+      denc_signed_varint(v.refs, p);
+    }
+  };
+
+  /// in order: a put may only be applied after the get it pairs with
+  vector<record_t> records;
+
+  bool empty() const {
+    return records.empty();
+  }
+  void add(uint64_t offset, uint32_t length, int32_t refs);
+  void append(const bluestore_shared_blob_delta_t& other) {
+    for (auto& r : other.records) {
+      add(r.offset, r.length, r.refs);
+    }
+  }
+  /// apply to ref_map; -ENOENT (with ref_map partly updated) if a put
+  /// would drop a ref that is not there
+  int apply(bluestore_extent_ref_map_t *ref_map) const;
+
+  DENC(bluestore_shared_blob_delta_t, v, p) {
+    DENC_START(1, 1, p);
+    denc(v.records, p);
+    DENC_FINISH(p);
+  }
+
+  void dump(Formatter *f) const;
+  static void generate_test_instances(
+    list<bluestore_shared_blob_delta_t*>& ls);
+};
+WRITE_CLASS_DENC(bluestore_shared_blob_delta_t::record_t)
+WRITE_CLASS_DENC(bluestore_shared_blob_delta_t)
+
+ostream& operator<<(ostream& out, const bluestore_shared_blob_delta_t& o);
+
 /// onode: per-object metadata
 struct bluestore_onode_t {
   uint64_t nid = 0;                    ///< numeric id (locally unique)
@@ -901,9 +950,12 @@ struct bluestore_onode_t {
 
   uint8_t flags = 0;
 
+  bufferlist inline_data;  ///< object data, if FLAG_INLINE_DATA
+
   enum {
     FLAG_OMAP = 1,       ///< object may have omap data
     FLAG_PGMETA_OMAP = 2,  ///< omap data is in meta omap prefix
+    FLAG_INLINE_DATA = 4,  ///< data is in inline_data, not in blobs
   };
 
   string get_flags_string() const {
@@ -911,6 +963,11 @@ struct bluestore_onode_t {
     if (flags & FLAG_OMAP) {
       s = "omap";
     }
+    if (flags & FLAG_INLINE_DATA) {
+      if (s.length())
+	s += '+';
+      s += "inline";
+    }
     return s;
   }
 
@@ -941,8 +998,14 @@ struct bluestore_onode_t {
     clear_flag(FLAG_OMAP);
   }
 
+  bool is_inline() const {
+    return has_flag(FLAG_INLINE_DATA);
+  }
+
   DENC(bluestore_onode_t, v, p) {
-    DENC_START(1, 1, p);
+    // only inline onodes need v2; everything else stays readable by
+    // releases that predate it.
+    DENC_START(v.is_inline() ? 2 : 1, v.is_inline() ? 2 : 1, p);
     denc_varint(v.nid, p);
     denc_varint(v.size, p);
     denc(v.attrs, p);
@@ -951,6 +1014,9 @@ struct bluestore_onode_t {
     denc_varint(v.expected_object_size, p);
     denc_varint(v.expected_write_size, p);
     denc_varint(v.alloc_hint_flags, p);
+    if (struct_v >= 2) {
+      denc(v.inline_data, p);
+    }
     DENC_FINISH(p);
   }
   void dump(Formatter *f) const;
@@ -464,6 +464,52 @@ public:
     }
     return res * l0_granularity;
   }
+
+  /// call notify(offset, length) for each run of free entries in l0
+  /// slots [*pos, *pos + max_slots), advancing *pos.  A run still open
+  /// at the end is carried in *run_start/*run_len into the next call.
+  /// Returns true once the whole bitmap has been walked.
+  template <typename Func>
+  bool foreach_free(Func notify, size_t *pos, size_t max_slots,
+		    uint64_t *run_start, uint64_t *run_len) const
+  {
+    auto flush = [&]() {
+      if (*run_len) {
+	notify(*run_start * l0_granularity, *run_len * l0_granularity);
+	*run_len = 0;
+      }
+    };
+    size_t end = std::min<size_t>(l0.size(), *pos + max_slots);
+    for (size_t idx = *pos; idx < end; ++idx) {
+      slot_t v = l0[idx];
+      uint64_t base = idx * CHILD_PER_SLOT_L0;
+      if (v == all_slot_set) {
+	if (!*run_len) {
+	  *run_start = base;
+	}
+	*run_len += CHILD_PER_SLOT_L0;
+      } else if (v == all_slot_clear) {
+	flush();
+      } else {
+	for (size_t bit = 0; bit < bits_per_slot; ++bit) {
+	  if (v & (slot_t(1) << bit)) {
+	    if (!*run_len) {
+	      *run_start = base + bit;
+	    }
+	    ++*run_len;
+	  } else {
+	    flush();
+	  }
+	}
+      }
+    }
+    *pos = end;
+    if (end < l0.size()) {
+      return false;
+    }
+    flush();
+    return true;
+  }
 };
 
 class AllocatorLevel01Compact : public AllocatorLevel01
@@ -748,6 +794,18 @@ protected:
     std::lock_guard<std::mutex> l(lock);
     return l1.get_fragmentation();
   }
+  template <typename Func>
+  void _foreach_free(Func notify) {
+    // walk the bitmap a chunk at a time, dropping the lock in between, so
+    // a scan of a large device does not stall allocations
+    size_t pos = 0;
+    uint64_t run_start = 0, run_len = 0;
+    bool done = false;
+    while (!done) {
+      std::lock_guard<std::mutex> l(lock);
+      done = l1.foreach_free(notify, &pos, 4096, &run_start, &run_len);
+    }
+  }
 };
 
 #endif
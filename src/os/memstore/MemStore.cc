@@ -387,7 +387,7 @@ int MemStore::getattrs(CollectionHandle &c_, const ghobject_t& oid,
   if (!o)
     return -ENOENT;
   std::lock_guard<std::mutex> lock(o->xattr_mutex);
-  aset = o->xattr;
+  aset = map<string,bufferptr>(o->xattr.begin(), o->xattr.end());
   return 0;
 }
 
@@ -470,7 +470,7 @@ int MemStore::omap_get(
     return -ENOENT;
   std::lock_guard<std::mutex> lock(o->omap_mutex);
   *header = o->omap_header;
-  *out = o->omap;
+  *out = map<string,bufferlist>(o->omap.begin(), o->omap.end());
   return 0;
 }
 
@@ -503,10 +503,8 @@ int MemStore::omap_get_keys(
   if (!o)
     return -ENOENT;
   std::lock_guard<std::mutex> lock(o->omap_mutex);
-  for (map<string,bufferlist>::iterator p = o->omap.begin();
-       p != o->omap.end();
-       ++p)
-    keys->insert(p->first);
+  for (auto p = o->omap.begin(); p != o->omap.end(); ++p)
+    keys->insert(keys->end(), p->first);
   return 0;
 }
 
@@ -526,7 +524,7 @@ int MemStore::omap_get_values(
   for (set<string>::const_iterator p = keys.begin();
        p != keys.end();
        ++p) {
-    map<string,bufferlist>::iterator q = o->omap.find(*p);
+    auto q = o->omap.find(*p);
     if (q != o->omap.end())
       out->insert(*q);
   }
@@ -549,7 +547,7 @@ int MemStore::omap_check_keys(
   for (set<string>::const_iterator p = keys.begin();
        p != keys.end();
        ++p) {
-    map<string,bufferlist>::iterator q = o->omap.find(*p);
+    auto q = o->omap.find(*p);
     if (q != o->omap.end())
       out->insert(*p);
   }
@@ -559,41 +557,69 @@ int MemStore::omap_check_keys(
 class MemStore::OmapIteratorImpl : public ObjectMap::ObjectMapIteratorImpl {
   CollectionRef c;
   ObjectRef o;
-  map<string,bufferlist>::iterator it;
+  omap_map_t::iterator it;
+  // omap is a flat_map, so any insert or erase invalidates it; remember
+  // where we were and find it again if o->omap_gen moved
+  uint64_t gen;
+  string cur;
+
+  // caller holds o->omap_mutex
+  void _set(omap_map_t::iterator i) {
+    it = i;
+    gen = o->omap_gen;
+    if (it != o->omap.end())
+      cur = it->first;
+  }
+  bool _revalidate() {
+    if (gen == o->omap_gen)
+      return true;
+    bool at_end = it == o->omap.end();
+    _set(at_end ? o->omap.end() : o->omap.lower_bound(cur));
+    return at_end || (it != o->omap.end() && it->first == cur);
+  }
+
 public:
   OmapIteratorImpl(CollectionRef c, ObjectRef o)
-    : c(c), o(o), it(o->omap.begin()) {}
+    : c(c), o(o) {
+    std::lock_guard<std::mutex> lock(o->omap_mutex);
+    _set(o->omap.begin());
+  }
 
   int seek_to_first() override {
     std::lock_guard<std::mutex> lock(o->omap_mutex);
-    it = o->omap.begin();
+    _set(o->omap.begin());
     return 0;
   }
   int upper_bound(const string &after) override {
     std::lock_guard<std::mutex> lock(o->omap_mutex);
-    it = o->omap.upper_bound(after);
+    _set(o->omap.upper_bound(after));
     return 0;
   }
   int lower_bound(const string &to) override {
     std::lock_guard<std::mutex> lock(o->omap_mutex);
-    it = o->omap.lower_bound(to);
+    _set(o->omap.lower_bound(to));
     return 0;
   }
   bool valid() override {
     std::lock_guard<std::mutex> lock(o->omap_mutex);
+    _revalidate();
     return it != o->omap.end();
   }
   int next(bool validate=true) override {
     std::lock_guard<std::mutex> lock(o->omap_mutex);
-    ++it;
+    // if our key went away we are already sitting on its successor
+    if (_revalidate())
+      _set(std::next(it));
     return 0;
   }
   string key() override {
     std::lock_guard<std::mutex> lock(o->omap_mutex);
+    _revalidate();
     return it->first;
   }
   bufferlist value() override {
     std::lock_guard<std::mutex> lock(o->omap_mutex);
+    _revalidate();
     return it->second;
   }
   int status() override {
@@ -1067,12 +1093,10 @@ int MemStore::_remove(const coll_t& cid, const ghobject_t& oid)
     return -ENOENT;
   RWLock::WLocker l(c->lock);
 
-  auto i = c->object_hash.find(oid);
-  if (i == c->object_hash.end())
+  ObjectRef o = c->_remove_object(oid);
+  if (!o)
     return -ENOENT;
-  used_bytes -= i->second->get_size();
-  c->object_hash.erase(i);
-  c->object_map.erase(oid);
+  used_bytes -= o->get_size();
 
   return 0;
 }
@@ -1153,6 +1177,7 @@ int MemStore::_clone(const coll_t& cid, const ghobject_t& oldoid,
 
   no->omap_header = oo->omap_header;
   no->omap = oo->omap;
+  ++no->omap_gen;
   no->xattr = oo->xattr;
   return 0;
 }
@@ -1197,6 +1222,7 @@ int MemStore::_omap_clear(const coll_t& cid, const ghobject_t &oid)
     return -ENOENT;
   std::lock_guard<std::mutex> lock(o->omap_mutex);
   o->omap.clear();
+  ++o->omap_gen;
   o->omap_header.clear();
   return 0;
 }
@@ -1216,11 +1242,18 @@ int MemStore::_omap_setkeys(const coll_t& cid, const ghobject_t &oid,
   auto p = aset_bl.cbegin();
   __u32 num;
   decode(num, p);
+  // keys arrive sorted, so each insert starts its search where the
+  // previous one landed
+  auto hint = o->omap.end();
   while (num--) {
     string key;
     decode(key, p);
-    decode(o->omap[key], p);
+    hint = o->omap.emplace_hint(hint, std::move(key), bufferlist());
+    hint->second.clear();
+    decode(hint->second, p);
+    ++hint;
   }
+  ++o->omap_gen;
   return 0;
 }
 
@@ -1244,6 +1277,7 @@ int MemStore::_omap_rmkeys(const coll_t& cid, const ghobject_t &oid,
     decode(key, p);
     o->omap.erase(key);
   }
+  ++o->omap_gen;
   return 0;
 }
 
@@ -1260,9 +1294,10 @@ int MemStore::_omap_rmkeyrange(const coll_t& cid, const ghobject_t &oid,
   if (!o)
     return -ENOENT;
   std::lock_guard<std::mutex> lock(o->omap_mutex);
-  map<string,bufferlist>::iterator p = o->omap.lower_bound(first);
-  map<string,bufferlist>::iterator e = o->omap.lower_bound(last);
+  auto p = o->omap.lower_bound(first);
+  auto e = o->omap.lower_bound(last);
   o->omap.erase(p, e);
+  ++o->omap_gen;
   return 0;
 }
 
@@ -1327,13 +1362,12 @@ int MemStore::_collection_add(const coll_t& cid, const coll_t& ocid, const ghobj
   RWLock::WLocker l1(std::min(&(*c), &(*oc))->lock);
   RWLock::WLocker l2(std::max(&(*c), &(*oc))->lock);
 
-  if (c->object_hash.count(oid))
+  if (c->_has_object(oid))
     return -EEXIST;
-  if (oc->object_hash.count(oid) == 0)
+  ObjectRef o = oc->get_object(oid);
+  if (!o)
     return -ENOENT;
-  ObjectRef o = oc->object_hash[oid];
-  c->object_map[oid] = o;
-  c->object_hash[oid] = o;
+  c->_insert_object(oid, o);
   return 0;
 }
 
@@ -1354,17 +1388,14 @@ int MemStore::_collection_move_rename(const coll_t& oldcid, const ghobject_t& ol
   c->lock.get_write();
 
   int r = -EEXIST;
-  if (c->object_hash.count(oid))
+  if (c->_has_object(oid))
     goto out;
   r = -ENOENT;
-  if (oc->object_hash.count(oldoid) == 0)
-    goto out;
   {
-    ObjectRef o = oc->object_hash[oldoid];
-    c->object_map[oid] = o;
-    c->object_hash[oid] = o;
-    oc->object_map.erase(oldoid);
-    oc->object_hash.erase(oldoid);
+    ObjectRef o = oc->_remove_object(oldoid);
+    if (!o)
+      goto out;
+    c->_insert_object(oid, o);
   }
   r = 0;
  out:
@@ -1390,10 +1421,9 @@ int MemStore::_split_collection(const coll_t& cid, uint32_t bits, uint32_t match
   while (p != sc->object_map.end()) {
     if (p->first.match(bits, match)) {
       dout(20) << " moving " << p->first << dendl;
-      dc->object_map.insert(make_pair(p->first, p->second));
-      dc->object_hash.insert(make_pair(p->first, p->second));
-      sc->object_hash.erase(p->first);
-      sc->object_map.erase(p++);
+      ghobject_t oid = p->first;
+      ++p;
+      dc->_insert_object(oid, sc->_remove_object(oid));
     } else {
       ++p;
     }
@@ -1515,7 +1545,8 @@ struct MemStore::PageSetObject : public Object {
   static thread_local PageSet::page_vector tls_pages;
 #endif
 
-  explicit PageSetObject(size_t page_size) : data(page_size), data_len(0) {}
+  PageSetObject(size_t page_size, bool huge_pages)
+    : data(page_size, huge_pages), data_len(0) {}
 
   size_t get_size() const override { return data_len; }
 
@@ -1742,6 +1773,6 @@ int MemStore::PageSetObject::truncate(uint64_t size)
 
 MemStore::ObjectRef MemStore::Collection::create_object() const {
   if (use_page_set)
-    return new PageSetObject(cct->_conf->memstore_page_size);
+    return new PageSetObject(cct->_conf->memstore_page_size, use_huge_pages);
   return new BufferlistObject();
 }
@@ -17,6 +17,8 @@
 #define CEPH_MEMSTORE_H
 
 #include <mutex>
+#include <shared_mutex>
+#include <boost/container/flat_map.hpp>
 #include <boost/intrusive_ptr.hpp>
 
 #include "include/unordered_map.h"
@@ -29,12 +31,19 @@
 
 class MemStore : public ObjectStore {
 public:
+  // sorted vectors: objects usually carry a handful of xattrs and omap
+  // keys that are mostly appended in order, so lookups and iteration stay
+  // within a few cache lines instead of chasing tree nodes
+  typedef boost::container::flat_map<string,bufferptr> xattr_map_t;
+  typedef boost::container::flat_map<string,bufferlist> omap_map_t;
+
   struct Object : public RefCountedObject {
     std::mutex xattr_mutex;
     std::mutex omap_mutex;
-    map<string,bufferptr> xattr;
+    xattr_map_t xattr;
     bufferlist omap_header;
-    map<string,bufferlist> omap;
+    omap_map_t omap;
+    uint64_t omap_gen = 0; ///< bumped on omap changes; invalidates iterators
 
     typedef boost::intrusive_ptr<Object> Ref;
     friend void intrusive_ptr_add_ref(Object *o) { o->get(); }
@@ -69,7 +78,7 @@ public:
       f->dump_int("omap_header_len", omap_header.length());
 
       f->open_array_section("xattrs");
-      for (map<string,bufferptr>::const_iterator p = xattr.begin();
+      for (xattr_map_t::const_iterator p = xattr.begin();
 	   p != xattr.end();
 	   ++p) {
 	f->open_object_section("xattr");
@@ -80,7 +89,7 @@ public:
       f->close_section();
 
       f->open_array_section("omap");
-      for (map<string,bufferlist>::const_iterator p = omap.begin();
+      for (omap_map_t::const_iterator p = omap.begin();
 	   p != omap.end();
 	   ++p) {
 	f->open_object_section("pair");
@@ -98,13 +107,29 @@ public:
     int bits = 0;
     CephContext *cct;
     bool use_page_set;
-    ceph::unordered_map<ghobject_t, ObjectRef> object_hash;  ///< for lookup
+    bool use_huge_pages;
     map<ghobject_t, ObjectRef> object_map;        ///< for iteration
     map<string,bufferptr> xattr;
-    RWLock lock;   ///< for object_{map,hash}
+    RWLock lock;   ///< for object_map, and held for write across any
+                   ///  change to object_shards
     bool exists;
     std::mutex sequencer_mutex;
 
+    // The lookup table is striped by object hash so that concurrent
+    // get_object() calls on different objects take different locks
+    // instead of all sharing the collection lock.  A shard lock is only
+    // ever taken after (or without) the collection lock.
+    static const unsigned OBJECT_SHARDS = 16;
+    struct alignas(64) ObjectShard {
+      std::shared_mutex lock;
+      ceph::unordered_map<ghobject_t, ObjectRef> object_hash;
+    };
+    ObjectShard object_shards[OBJECT_SHARDS];
+
+    ObjectShard &get_shard(const ghobject_t &oid) {
+      return object_shards[std::hash<ghobject_t>()(oid) % OBJECT_SHARDS];
+    }
+
     typedef boost::intrusive_ptr<Collection> Ref;
     friend void intrusive_ptr_add_ref(Collection *c) { c->get(); }
     friend void intrusive_ptr_release(Collection *c) { c->put(); }
@@ -117,21 +142,56 @@ public:
     // level.
 
     ObjectRef get_object(ghobject_t oid) {
-      RWLock::RLocker l(lock);
-      auto o = object_hash.find(oid);
-      if (o == object_hash.end())
+      ObjectShard &s = get_shard(oid);
+      std::shared_lock<std::shared_mutex> l(s.lock);
+      auto o = s.object_hash.find(oid);
+      if (o == s.object_hash.end())
 	return ObjectRef();
       return o->second;
     }
 
     ObjectRef get_or_create_object(ghobject_t oid) {
+      ObjectRef o = get_object(oid);
+      if (o)
+	return o;
       RWLock::WLocker l(lock);
-      auto result = object_hash.emplace(oid, ObjectRef());
+      ObjectShard &s = get_shard(oid);
+      std::lock_guard<std::shared_mutex> sl(s.lock);
+      auto result = s.object_hash.emplace(oid, ObjectRef());
       if (result.second)
         object_map[oid] = result.first->second = create_object();
       return result.first->second;
     }
 
+    // these expect lock held for write
+    bool _has_object(const ghobject_t &oid) {
+      ObjectShard &s = get_shard(oid);
+      std::shared_lock<std::shared_mutex> l(s.lock);
+      return s.object_hash.count(oid);
+    }
+    void _insert_object(const ghobject_t &oid, ObjectRef o) {
+      ObjectShard &s = get_shard(oid);
+      {
+	std::lock_guard<std::shared_mutex> l(s.lock);
+	s.object_hash[oid] = o;
+      }
+      object_map[oid] = o;
+    }
+    ObjectRef _remove_object(const ghobject_t &oid) {
+      ObjectShard &s = get_shard(oid);
+      ObjectRef o;
+      {
+	std::lock_guard<std::shared_mutex> l(s.lock);
+	auto i = s.object_hash.find(oid);
+	if (i == s.object_hash.end())
+	  return ObjectRef();
+	o = i->second;
+	s.object_hash.erase(i);
+      }
+      object_map.erase(oid);
+      return o;
+    }
+
     void encode(bufferlist& bl) const {
       ENCODE_START(1, 1, bl);
       encode(xattr, bl);
@@ -157,8 +217,7 @@ public:
 	decode(k, p);
 	auto o = create_object();
 	o->decode(p);
-	object_map.insert(make_pair(k, o));
-	object_hash.insert(make_pair(k, o));
+	_insert_object(k, o);
       }
       DECODE_FINISH(p);
     }
@@ -184,6 +243,7 @@ public:
       : CollectionImpl(c),
 	cct(cct),
 	use_page_set(cct->_conf->memstore_page_set),
+	use_huge_pages(cct->_conf->get_val<bool>("memstore_page_set_huge_pages")),
         lock("MemStore::Collection::lock", true, false),
 	exists(true) {}
   };
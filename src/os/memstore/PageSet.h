@@ -18,17 +18,138 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <map>
 #include <mutex>
+#include <new>
 #include <vector>
+#include <sys/mman.h>
 #include <boost/intrusive/avl_set.hpp>
 #include <boost/intrusive_ptr.hpp>
 
 #include "include/encoding.h"
 
+// Hands out fixed-size page buffers carved from 2MB chunks.  Chunks are
+// backed by huge pages where the kernel has them reserved, and otherwise
+// aligned and advised for transparent huge pages, so a large PageSet
+// costs few TLB entries and no malloc per page.  Chunks are never given
+// back; freed slots go on per-shard free lists for reuse.
+class PageArena {
+  static constexpr size_t CHUNK_SIZE = 2 << 20;
+  static constexpr unsigned SHARDS = 8;
+
+  struct alignas(64) Shard {
+    std::mutex lock;
+    void *free = nullptr; // linked through the first word of each slot
+  };
+
+  const size_t slot_size;
+  Shard shards[SHARDS];
+  std::atomic<uint64_t> chunk_bytes = {0};
+
+  static unsigned this_shard() {
+    static std::atomic<unsigned> next = {0};
+    static thread_local unsigned shard = next++ % SHARDS;
+    return shard;
+  }
+
+  static void push(Shard &s, void *slot) {
+    *reinterpret_cast<void**>(slot) = s.free;
+    s.free = slot;
+  }
+
+  static char *map_chunk(size_t len) {
+#ifdef MAP_HUGETLB
+    void *p = ::mmap(nullptr, len, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+      return static_cast<char*>(p);
+#endif
+    // no reserved huge pages; map extra so the chunk can start on a huge
+    // page boundary, which transparent huge pages need
+    const size_t span = len + CHUNK_SIZE;
+    void *q = ::mmap(nullptr, span, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (q == MAP_FAILED)
+      throw std::bad_alloc();
+    const uintptr_t base = reinterpret_cast<uintptr_t>(q);
+    const uintptr_t start = (base + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+    if (start > base)
+      ::munmap(q, start - base);
+    if (base + span > start + len)
+      ::munmap(reinterpret_cast<void*>(start + len), base + span - start - len);
+#ifdef MADV_HUGEPAGE
+    ::madvise(reinterpret_cast<void*>(start), len, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<char*>(start);
+  }
+
+  // called with s.lock held
+  void refill(Shard &s) {
+    // take whatever another shard has cached before mapping more memory
+    for (auto &o : shards) {
+      if (&o == &s || !o.lock.try_lock())
+        continue;
+      void *list = o.free;
+      o.free = nullptr;
+      o.lock.unlock();
+      if (list) {
+        s.free = list;
+        return;
+      }
+    }
+    const size_t len = (slot_size + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+    char *chunk = map_chunk(len);
+    chunk_bytes += len;
+    for (size_t off = 0; off + slot_size <= len; off += slot_size)
+      push(s, chunk + off);
+  }
+
+ public:
+  explicit PageArena(size_t size)
+    : slot_size((size + alignof(std::max_align_t) - 1) &
+                ~(alignof(std::max_align_t) - 1)) {}
+
+  // copy disabled
+  PageArena(const PageArena&) = delete;
+  const PageArena& operator=(const PageArena&) = delete;
+
+  size_t get_slot_size() const { return slot_size; }
+  uint64_t get_chunk_bytes() const { return chunk_bytes; }
+
+  char *alloc() {
+    Shard &s = shards[this_shard()];
+    std::lock_guard<std::mutex> lock(s.lock);
+    if (!s.free)
+      refill(s);
+    void *slot = s.free;
+    s.free = *reinterpret_cast<void**>(slot);
+    return static_cast<char*>(slot);
+  }
+  void free(char *slot) {
+    Shard &s = shards[this_shard()];
+    std::lock_guard<std::mutex> lock(s.lock);
+    push(s, slot);
+  }
+
+  // one arena per buffer size, shared by every PageSet and never freed,
+  // since pages may outlive the PageSet that allocated them
+  static PageArena *get(size_t size) {
+    static std::mutex lock;
+    static std::map<size_t, PageArena*> arenas;
+    std::lock_guard<std::mutex> l(lock);
+    auto &arena = arenas[size];
+    if (!arena)
+      arena = new PageArena(size);
+    return arena;
+  }
+};
+
 struct Page {
   char *const data;
   boost::intrusive::avl_set_member_hook<> hook;
   uint64_t offset;
+  PageArena *const arena; // nullptr if data came from new[]
 
   // avoid RefCountedObject because it has a virtual destructor
   std::atomic<uint16_t> nrefs;
@@ -62,14 +183,23 @@ struct Page {
     decode(offset, p);
   }
 
-  static Ref create(size_t page_size, uint64_t offset = 0) {
-    // ensure proper alignment of the Page
+  // ensure proper alignment of the Page
+  static size_t data_size(size_t page_size) {
     const auto align = alignof(Page);
-    page_size = (page_size + align - 1) & ~(align - 1);
+    return (page_size + align - 1) & ~(align - 1);
+  }
+  // size of the single buffer holding a Page and its data
+  static size_t buffer_size(size_t page_size) {
+    return data_size(page_size) + sizeof(Page);
+  }
+
+  static Ref create(size_t page_size, uint64_t offset = 0,
+                    PageArena *arena = nullptr) {
+    page_size = data_size(page_size);
     // allocate the Page and its data in a single buffer
-    auto buffer = new char[page_size + sizeof(Page)];
+    auto buffer = arena ? arena->alloc() : new char[page_size + sizeof(Page)];
     // place the Page structure at the end of the buffer
-    return new (buffer + page_size) Page(buffer, offset);
+    return new (buffer + page_size) Page(buffer, offset, arena);
   }
 
   // copy disabled
@@ -77,10 +207,15 @@ struct Page {
   const Page& operator=(const Page&) = delete;
 
  private: // private constructor, use create() instead
-  Page(char *data, uint64_t offset) : data(data), offset(offset), nrefs(1) {}
+  Page(char *data, uint64_t offset, PageArena *arena)
+    : data(data), offset(offset), arena(arena), nrefs(1) {}
 
   static void operator delete(void *p) {
-    delete[] reinterpret_cast<Page*>(p)->data;
+    auto page = reinterpret_cast<Page*>(p);
+    if (page->arena)
+      page->arena->free(page->data);
+    else
+      delete[] page->data;
   }
 };
 
@@ -102,6 +237,7 @@ class PageSet {
 
   page_set pages;
   uint64_t page_size;
+  PageArena *arena;
 
   typedef std::mutex lock_type;
   lock_type mutex;
@@ -129,9 +265,15 @@ class PageSet {
   }
 
  public:
-  explicit PageSet(size_t page_size) : page_size(page_size) {}
+  // with huge_pages, page buffers come from the shared PageArena for
+  // this page size instead of new[]
+  explicit PageSet(size_t page_size, bool huge_pages = false)
+    : page_size(page_size),
+      arena(huge_pages ? PageArena::get(Page::buffer_size(page_size)) :
+            nullptr) {}
   PageSet(PageSet &&rhs)
-    : pages(std::move(rhs.pages)), page_size(rhs.page_size) {}
+    : pages(std::move(rhs.pages)), page_size(rhs.page_size),
+      arena(rhs.arena) {}
   ~PageSet() {
     free_pages(pages.begin(), pages.end());
   }
@@ -141,6 +283,7 @@ class PageSet {
   const PageSet& operator=(const PageSet&) = delete;
 
   bool empty() const { return pages.empty(); }
+  bool uses_huge_pages() const { return arena != nullptr; }
   size_t size() const { return pages.size(); }
   size_t get_page_size() const { return page_size; }
 
@@ -161,7 +304,7 @@ class PageSet {
       typename page_set::insert_commit_data commit;
       auto insert = pages.insert_check(cur, page_offset, page_cmp(), commit);
       if (insert.second) {
-        auto page = Page::create(page_size, page_offset);
+        auto page = Page::create(page_size, page_offset, arena);
         cur = pages.insert_commit(*page, commit);
 
         // assume that the caller will write to the range [offset,length),
@@ -218,11 +361,13 @@ class PageSet {
     using ceph::decode;
     assert(empty());
     decode(page_size, p);
+    if (arena)
+      arena = PageArena::get(Page::buffer_size(page_size));
     unsigned count;
     decode(count, p);
     auto cur = pages.end();
     for (unsigned i = 0; i < count; i++) {
-      auto page = Page::create(page_size);
+      auto page = Page::create(page_size, 0, arena);
       page->decode(p, page_size);
       cur = pages.insert_before(cur, *page);
     }
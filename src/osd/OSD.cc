@@ -20,10 +20,15 @@
 #include <iostream>
 
 #include <unistd.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include <signal.h>
 #include <boost/scoped_ptr.hpp>
 
+#ifdef HAVE_SCHED
+#include <sched.h>
+#endif
+
 #ifdef HAVE_SYS_PARAM_H
 #include <sys/param.h>
 #endif
@@ -175,6 +180,49 @@ static ostream& _prefix(std::ostream* _dout, int whoami, epoch_t epoch) {
   return *_dout << "osd." << whoami << " " << epoch << " ";
 }
 
+// parse a sysfs cpu list, e.g. "0-3,8-11"
+static void parse_cpu_list(const string& s, vector<int> *cpus)
+{
+  for (auto& range : get_str_list(s, ",")) {
+    int first, last;
+    auto dash = range.find('-');
+    if (dash == string::npos) {
+      first = last = atoi(range.c_str());
+    } else {
+      first = atoi(range.substr(0, dash).c_str());
+      last = atoi(range.substr(dash + 1).c_str());
+    }
+    for (int i = first; i <= last; ++i) {
+      cpus->push_back(i);
+    }
+  }
+}
+
+// numa node -> cpus, as exported by sysfs; empty if unavailable
+static void get_numa_nodes(map<int,vector<int>> *nodes)
+{
+  const char *base = "/sys/devices/system/node";
+  DIR *dir = ::opendir(base);
+  if (!dir)
+    return;
+  struct dirent *de;
+  while ((de = ::readdir(dir)) != nullptr) {
+    if (strncmp(de->d_name, "node", 4) != 0 ||
+	!isdigit(de->d_name[4]))
+      continue;
+    std::ifstream f(string(base) + "/" + de->d_name + "/cpulist");
+    string line;
+    if (!std::getline(f, line))
+      continue;
+    vector<int> cpus;
+    parse_cpu_list(line, &cpus);
+    if (!cpus.empty()) {
+      (*nodes)[atoi(de->d_name + 4)] = std::move(cpus);
+    }
+  }
+  ::closedir(dir);
+}
+
 //Initial features in new superblock.
 //Features here are also automatically upgraded
 CompatSet OSD::get_osd_initial_compat_set() {
@@ -205,6 +253,7 @@ CompatSet OSD::get_osd_compat_set() {
   CompatSet compat =  get_osd_initial_compat_set();
   //Any features here can be set in code, but not in initial superblock
   compat.incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_SHARDS);
+  compat.incompat.insert(CEPH_OSD_FEATURE_INCOMPAT_PGLOG_PACKS);
   return compat;
 }
 
@@ -294,6 +343,9 @@ OSDService::~OSDService()
     delete f;
     f = NULL;
   }
+  for (auto f : backfill_scan_finishers) {
+    delete f;
+  }
 }
 
 
@@ -384,6 +436,32 @@ void OSDService::shutdown_reserver()
   reserver_finisher.stop();
 }
 
+bool OSDService::queue_backfill_scan(spg_t pgid, Context *c)
+{
+  Mutex::Locker l(backfill_scan_lock);
+  if (backfill_scan_stopped || backfill_scan_finishers.empty()) {
+    delete c;
+    return false;
+  }
+  backfill_scan_finishers[
+    pgid.hash_to_shard(backfill_scan_finishers.size())]->queue(c);
+  return true;
+}
+
+void OSDService::shutdown_backfill_scan()
+{
+  {
+    Mutex::Locker l(backfill_scan_lock);
+    backfill_scan_stopped = true;
+  }
+  // scans in flight hold pg refs and queue recovery contexts; let them
+  // land in the op queue before it is drained
+  for (auto f : backfill_scan_finishers) {
+    f->wait_for_empty();
+    f->stop();
+  }
+}
+
 void OSDService::shutdown()
 {
   {
@@ -409,6 +487,13 @@ void OSDService::shutdown()
 void OSDService::init()
 {
   reserver_finisher.start();
+  for (uint32_t i = 0; i < osd->num_shards; i++) {
+    ostringstream str;
+    str << "backfill_scan-" << i;
+    Finisher *fin = new Finisher(cct, str.str(), "fn_bf_scan");
+    fin->start();
+    backfill_scan_finishers.push_back(fin);
+  }
   for (auto f : objecter_finishers) {
     f->start();
   }
@@ -1917,6 +2002,7 @@ OSD::OSD(CephContext *cct_, ObjectStore *store_,
   test_ops_hook(NULL),
   op_queue(get_io_queue()),
   op_prio_cutoff(get_io_prio_cut()),
+  op_shard_steal_min_depth(get_op_shard_steal_min_depth()),
   op_shardedwq(
     this,
     cct->_conf->osd_op_thread_timeout,
@@ -1960,10 +2046,26 @@ OSD::OSD(CephContext *cct_, ObjectStore *store_,
       op_queue);
     shards.push_back(one_shard);
   }
+  if (cct->_conf->get_val<bool>("osd_op_shard_numa_affinity")) {
+    map<int,vector<int>> nodes;
+    get_numa_nodes(&nodes);
+    if (nodes.size() > 1) {
+      auto p = nodes.begin();
+      for (auto shard : shards) {
+	shard->numa_node = p->first;
+	shard->numa_cpus = p->second;
+	if (++p == nodes.end())
+	  p = nodes.begin();
+      }
+    }
+  }
 }
 
 OSD::~OSD()
 {
+  for (auto& p : inline_op_hbs) {
+    cct->get_heartbeat_map()->remove_worker(p.second);
+  }
   while (!shards.empty()) {
     delete shards.back();
     shards.pop_back();
@@ -2212,6 +2314,10 @@ will start to track new ops received afterwards.";
     service.dumps_scrub(f);
   } else if (admin_command == "calc_objectstore_db_histogram") {
     store->generate_db_histogram(f);
+  } else if (admin_command == "calc_objectstore_free_extent_histogram") {
+    store->generate_free_extent_histogram(f);
+  } else if (admin_command == "dump_objectstore_compression_stats") {
+    store->dump_compression_stats(f);
   } else if (admin_command == "flush_store_cache") {
     store->flush_cache();
   } else if (admin_command == "dump_pgstate_history") {
@@ -2352,6 +2458,17 @@ int OSD::get_num_op_shards()
     return cct->_conf->osd_op_num_shards_ssd;
 }
 
+unsigned OSD::get_op_shard_steal_min_depth()
+{
+  auto min_depth = cct->_conf->get_val<uint64_t>("osd_op_shard_steal_min_depth");
+  if (min_depth)
+    return min_depth;
+  if (store_is_rotational)
+    return cct->_conf->get_val<uint64_t>("osd_op_shard_steal_min_depth_hdd");
+  else
+    return cct->_conf->get_val<uint64_t>("osd_op_shard_steal_min_depth_ssd");
+}
+
 int OSD::get_num_op_threads()
 {
   if (cct->_conf->osd_op_num_threads_per_shard)
@@ -2524,6 +2641,22 @@ int OSD::init()
       goto out;
   }
 
+  // pgs write packed logs as soon as they are loaded, so the feature
+  // must be on disk before any of them is
+  if (cct->_conf->get_val<uint64_t>("osd_pg_log_pack_entries") > 0 &&
+      !superblock.compat_features.incompat.contains(
+	CEPH_OSD_FEATURE_INCOMPAT_PGLOG_PACKS)) {
+    dout(0) << __func__ << " enabling on-disk packed pg log compat feature"
+	    << dendl;
+    superblock.compat_features.incompat.insert(
+      CEPH_OSD_FEATURE_INCOMPAT_PGLOG_PACKS);
+    ObjectStore::Transaction t;
+    write_superblock(t);
+    r = store->queue_transaction(service.meta_ch, std::move(t));
+    if (r < 0)
+      goto out;
+  }
+
   // make sure snap mapper object exists
   if (!store->exists(service.meta_ch, OSD::make_snapmapper_oid())) {
     dout(10) << "init creating/touching snapmapper object" << dendl;
@@ -2599,6 +2732,13 @@ int OSD::init()
   service.publish_superblock(superblock);
   service.max_oldest_map = superblock.oldest_map;
 
+  {
+    static std::atomic<uint64_t> last_instance = {0};
+    inline_op_hb_instance = ++last_instance;
+  }
+  inline_read_max_bytes = cct->_conf->get_val<uint64_t>(
+    "osd_inline_read_max_bytes");
+  inline_reads = cct->_conf->get_val<bool>("osd_inline_reads");
   osd_op_tp.start();
   command_tp.start();
 
@@ -2793,6 +2933,18 @@ void OSD::final_init()
                                      "Generate key value histogram of kvdb(rocksdb) which used by bluestore");
   assert(r == 0);
 
+  r = admin_socket->register_command("calc_objectstore_free_extent_histogram",
+                                     "calc_objectstore_free_extent_histogram",
+                                     asok_hook,
+                                     "Generate free extent size histogram of the objectstore allocator");
+  assert(r == 0);
+
+  r = admin_socket->register_command("dump_objectstore_compression_stats",
+                                     "dump_objectstore_compression_stats",
+                                     asok_hook,
+                                     "print per-collection compression statistics of the objectstore");
+  assert(r == 0);
+
   r = admin_socket->register_command("flush_store_cache",
                                      "flush_store_cache",
                                      asok_hook,
@@ -3042,6 +3194,9 @@ void OSD::create_logger()
     "Latency of IO before calling queue(before really queue into ShardedOpWq)"); // client io before queue op_wq latency
   osd_plb.add_time_avg(l_osd_op_before_dequeue_op_lat, "op_before_dequeue_op_lat",
     "Latency of IO before calling dequeue_op(already dequeued and get PG lock)"); // client io before dequeue_op latency
+  osd_plb.add_u64_counter(
+    l_osd_op_inline, "op_inline",
+    "Client reads run on the messenger thread, bypassing the op queue");
 
   osd_plb.add_u64_counter(
     l_osd_sop, "subop", "Suboperations");
@@ -3266,6 +3421,7 @@ int OSD::shutdown()
   mgrc.shutdown();
 
   service.start_shutdown();
+  service.shutdown_backfill_scan();
 
   // stop sending work to pgs.  this just prevents any new work in _process
   // from racing with on_shutdown and potentially entering the pg after.
@@ -6467,6 +6623,11 @@ void OSD::ms_fast_dispatch(Message *m)
 
   if (m->get_connection()->has_features(CEPH_FEATUREMASK_RESEND_ON_SPLIT) ||
       m->get_type() != CEPH_MSG_OSD_OP) {
+    if (m->get_type() == CEPH_MSG_OSD_OP &&
+	inline_reads &&
+	try_inline_op(static_cast<MOSDFastDispatchOp*>(m)->get_spg(), op)) {
+      return;
+    }
     // queue it directly
     enqueue_op(
       static_cast<MOSDFastDispatchOp*>(m)->get_spg(),
@@ -8812,6 +8973,69 @@ void OSD::enqueue_op(spg_t pg, OpRequestRef& op, epoch_t epoch)
       epoch));
 }
 
+heartbeat_handle_d *OSD::get_inline_op_hb()
+{
+  // each messenger thread gets its own handle: a shared one would be
+  // re-armed by one thread while another is stuck, and disarmed by
+  // whichever finishes first.  the map only exists so ~OSD can remove
+  // them; tag the per-thread copy with this OSD instance.
+  static thread_local pair<uint64_t, heartbeat_handle_d*> cached;
+  if (cached.first == inline_op_hb_instance)
+    return cached.second;
+  pthread_t self = pthread_self();
+  Mutex::Locker l(inline_op_hb_lock);
+  auto& hb = inline_op_hbs[self];
+  if (!hb) {
+    hb = cct->get_heartbeat_map()->add_worker("OSD::inline_op", self);
+  }
+  cached = make_pair(inline_op_hb_instance, hb);
+  return hb;
+}
+
+bool OSD::try_inline_op(spg_t pgid, OpRequestRef& op)
+{
+  auto sdata = shards[pgid.hash_to_shard(num_shards)];
+  PGRef pg;
+  {
+    Mutex::Locker l(sdata->shard_lock);
+    // anything queued or in flight ahead of us on this shard may be an
+    // earlier op from the same client; never jump it.
+    if (sdata->queue_depth > 0)
+      return false;
+    auto p = sdata->pg_slots.find(pgid);
+    if (p == sdata->pg_slots.end())
+      return false;
+    OSDShardPGSlot *slot = p->second.get();
+    if (!slot->pg ||
+	!slot->to_process.empty() ||
+	!slot->waiting.empty() ||
+	!slot->waiting_peering.empty() ||
+	slot->waiting_for_split ||
+	slot->num_running ||
+	op->sent_epoch > sdata->shard_osdmap->get_epoch())
+      return false;
+    // a worker holding the pg lock means an op for this pg is running
+    if (!slot->pg->try_lock())
+      return false;
+    pg = slot->pg;
+  }
+  if (!pg->can_run_inline(op, inline_read_max_bytes)) {
+    pg->unlock();
+    return false;
+  }
+  dout(15) << __func__ << " " << op << " " << *(op->get_req()) << dendl;
+  logger->inc(l_osd_op_inline);
+  op->mark_queued_for_pg();
+  ThreadPool::TPHandle tp_handle(cct, get_inline_op_hb(),
+				 op_shardedwq.timeout_interval,
+				 op_shardedwq.suicide_interval);
+  tp_handle.reset_tp_timeout();
+  dequeue_op(pg, op, tp_handle);
+  pg->unlock();
+  tp_handle.suspend_tp_timeout();
+  return true;
+}
+
 void OSD::enqueue_peering_evt(spg_t pgid, PGPeeringEventRef evt)
 {
   dout(15) << __func__ << " " << pgid << " " << evt->get_desc() << dendl;
@@ -8971,6 +9195,8 @@ const char** OSD::get_tracked_conf_keys() const
     "osd_client_message_cap",
     "osd_heartbeat_min_size",
     "osd_heartbeat_interval",
+    "osd_inline_reads",
+    "osd_inline_read_max_bytes",
     NULL
   };
   return KEYS;
@@ -9024,6 +9250,13 @@ void OSD::handle_conf_change(const struct md_config_t *conf,
       changed.count("fsid")) {
     update_log_config();
   }
+  if (changed.count("osd_inline_read_max_bytes")) {
+    inline_read_max_bytes = conf->get_val<uint64_t>(
+      "osd_inline_read_max_bytes");
+  }
+  if (changed.count("osd_inline_reads")) {
+    inline_reads = conf->get_val<bool>("osd_inline_reads");
+  }
   if (changed.count("osd_pg_epoch_max_lag_factor")) {
     m_osd_pg_epoch_max_lag_factor = conf->get_val<double>(
       "osd_pg_epoch_max_lag_factor");
@@ -9302,6 +9535,79 @@ int OSD::init_op_flags(OpRequestRef& op)
 #undef dout_prefix
 #define dout_prefix *_dout << "osd." << osd->get_nodeid() << ":" << shard_id << "." << __func__ << " "
 
+OSDShard::~OSDShard()
+{
+  InboxItem *p = inbox.exchange(nullptr);
+  while (p) {
+    InboxItem *next = p->next;
+    delete p;
+    p = next;
+  }
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+}
+
+void OSDShard::_create_logger()
+{
+  PerfCountersBuilder b(cct, string("osd_shard.") + stringify(shard_id),
+			l_osd_shard_first, l_osd_shard_last);
+  b.add_u64(l_osd_shard_queue_depth, "queue_depth",
+	    "Items queued on this shard", "qd",
+	    PerfCountersBuilder::PRIO_INTERESTING);
+  b.add_u64_counter(l_osd_shard_enqueued, "enqueued", "Items enqueued");
+  b.add_u64_counter(l_osd_shard_dequeued, "dequeued",
+		    "Items dequeued, by any shard's threads");
+  b.add_u64_counter(l_osd_shard_stolen, "stolen",
+		    "Items run by threads of other shards");
+  b.add_u64_counter(l_osd_shard_steals, "steals",
+		    "Items this shard's threads ran for other shards");
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+}
+
+void OSDShard::enqueue_inbox(OpQueueItem&& item)
+{
+  // count it first so a racing drain never sees the depth underflow
+  logger->set(l_osd_shard_queue_depth, ++queue_depth);
+  logger->inc(l_osd_shard_enqueued);
+  InboxItem *i = new InboxItem(std::move(item));
+  i->next = inbox.load(std::memory_order_relaxed);
+  while (!inbox.compare_exchange_weak(i->next, i,
+				      std::memory_order_release,
+				      std::memory_order_relaxed))
+    ;
+}
+
+void OSDShard::_drain_inbox(unsigned cutoff)
+{
+  assert(shard_lock.is_locked_by_me());
+  InboxItem *p = inbox.exchange(nullptr, std::memory_order_acquire);
+  if (!p)
+    return;
+  // the inbox is newest-first; flip it so pqueue sees submission order
+  InboxItem *fifo = nullptr;
+  while (p) {
+    InboxItem *next = p->next;
+    p->next = fifo;
+    fifo = p;
+    p = next;
+  }
+  while (fifo) {
+    OpQueueItem& item = fifo->item;
+    unsigned priority = item.get_priority();
+    unsigned cost = item.get_cost();
+    if (priority >= cutoff)
+      pqueue->enqueue_strict(
+	item.get_owner(), priority, std::move(item));
+    else
+      pqueue->enqueue(
+	item.get_owner(), priority, cost, std::move(item));
+    InboxItem *next = fifo->next;
+    delete fifo;
+    fifo = next;
+  }
+}
+
 void OSDShard::_attach_pg(OSDShardPGSlot *slot, PG *pg)
 {
   dout(10) << pg->pg_id << " " << pg << dendl;
@@ -9632,22 +9938,104 @@ void OSD::ShardedOpWQ::_add_slot_waiter(
 #undef dout_prefix
 #define dout_prefix *_dout << "osd." << osd->whoami << " op_wq(" << shard_index << ") "
 
+static int bind_to_cpus(const vector<int>& cpus)
+{
+#ifdef HAVE_SCHED
+  if (cpus.empty())
+    return 0;
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (auto cpu : cpus) {
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &cpuset);
+  }
+  if (sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0)
+    return -errno;
+#endif
+  return 0;
+}
+
+OSDShard *OSD::ShardedOpWQ::_pick_steal_victim(uint32_t our_shard)
+{
+  unsigned min_depth = osd->op_shard_steal_min_depth;
+  if (!min_depth || osd->num_shards < 2)
+    return nullptr;
+  int our_node = osd->shards[our_shard]->numa_node;
+  OSDShard *victim = nullptr;
+  unsigned victim_depth = 0;
+  for (auto shard : osd->shards) {
+    if (shard->shard_id == our_shard)
+      continue;
+    unsigned depth = shard->queue_depth.load(std::memory_order_relaxed);
+    // helping a shard on another node drags its pgs' memory across the
+    // interconnect; only do it for a shard twice as backed up.
+    if (shard->numa_node != our_node)
+      depth /= 2;
+    if (depth >= min_depth && depth > victim_depth) {
+      victim = shard;
+      victim_depth = depth;
+    }
+  }
+  return victim;
+}
+
 void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
 {
   uint32_t shard_index = thread_index % osd->num_shards;
   auto& sdata = osd->shards[shard_index];
   assert(sdata);
+
+  static thread_local bool numa_bound = false;
+  if (!numa_bound) {
+    numa_bound = true;
+    int r = bind_to_cpus(sdata->numa_cpus);
+    if (r < 0) {
+      derr << __func__ << " failed to bind to numa node " << sdata->numa_node
+	   << ": " << cpp_strerror(r) << dendl;
+    }
+  }
+
   // peek at spg_t
   sdata->shard_lock.Lock();
+  sdata->_drain_inbox(osd->op_prio_cutoff);
+  if (sdata->pqueue->empty()) {
+    // nothing of our own; help out a backed-up shard if there is one.
+    // never hold two shard_locks at once.
+    OSDShard *victim = _pick_steal_victim(shard_index);
+    if (victim) {
+      sdata->shard_lock.Unlock();
+      victim->shard_lock.Lock();
+      victim->_drain_inbox(osd->op_prio_cutoff);
+      if (!victim->pqueue->empty()) {
+	dout(20) << __func__ << " helping shard " << victim->shard_id
+		 << " depth " << victim->queue_depth << dendl;
+	sdata->logger->inc(l_osd_shard_steals);
+	victim->logger->inc(l_osd_shard_stolen);
+	_process_next(victim, hb);
+	return;
+      }
+      victim->shard_lock.Unlock();
+      sdata->shard_lock.Lock();
+      sdata->_drain_inbox(osd->op_prio_cutoff);
+    }
+  }
   if (sdata->pqueue->empty()) {
     sdata->sdata_wait_lock.Lock();
     if (!sdata->stop_waiting) {
       dout(20) << __func__ << " empty q, waiting" << dendl;
       osd->cct->get_heartbeat_map()->clear_timeout(hb);
       sdata->shard_lock.Unlock();
-      sdata->sdata_cond.Wait(sdata->sdata_wait_lock);
+      // _enqueue counts the item in queue_depth before pushing it to the
+      // inbox without shard_lock, then signals under sdata_wait_lock, so
+      // this check cannot miss a wakeup.  queue_depth also covers items a
+      // stealer drained from our inbox into pqueue after we dropped
+      // shard_lock; the inbox alone would not show those.
+      if (sdata->queue_depth == 0) {
+	sdata->sdata_cond.Wait(sdata->sdata_wait_lock);
+      }
       sdata->sdata_wait_lock.Unlock();
       sdata->shard_lock.Lock();
+      sdata->_drain_inbox(osd->op_prio_cutoff);
       if (sdata->pqueue->empty()) {
 	sdata->shard_lock.Unlock();
 	return;
@@ -9661,7 +10049,15 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       return;
     }
   }
+  _process_next(sdata, hb);
+}
+
+void OSD::ShardedOpWQ::_process_next(OSDShard *sdata, heartbeat_handle_d *hb)
+{
+  uint32_t shard_index = sdata->shard_id;
   OpQueueItem item = sdata->pqueue->dequeue();
+  sdata->logger->set(l_osd_shard_queue_depth, --sdata->queue_depth);
+  sdata->logger->inc(l_osd_shard_dequeued);
   if (osd->is_stopping()) {
     sdata->shard_lock.Unlock();
     return;    // OSD shutdown, discard.
@@ -9888,23 +10284,35 @@ void OSD::ShardedOpWQ::_enqueue(OpQueueItem&& item) {
 
   OSDShard* sdata = osd->shards[shard_index];
   assert (NULL != sdata);
-  unsigned priority = item.get_priority();
-  unsigned cost = item.get_cost();
-  sdata->shard_lock.Lock();
 
   dout(20) << __func__ << " " << item << dendl;
-  if (priority >= osd->op_prio_cutoff)
-    sdata->pqueue->enqueue_strict(
-      item.get_owner(), priority, std::move(item));
-  else
-    sdata->pqueue->enqueue(
-      item.get_owner(), priority, cost, std::move(item));
-  sdata->shard_lock.Unlock();
+  sdata->enqueue_inbox(std::move(item));
 
   sdata->sdata_wait_lock.Lock();
   sdata->sdata_cond.SignalOne();
   sdata->sdata_wait_lock.Unlock();
 
+  // if this shard is backing up, wake an idle thread elsewhere (on the
+  // same numa node if possible) so it can come and help.
+  unsigned min_depth = osd->op_shard_steal_min_depth;
+  if (min_depth && sdata->queue_depth >= min_depth) {
+    OSDShard *helper = nullptr;
+    for (auto shard : osd->shards) {
+      if (shard == sdata ||
+	  shard->queue_depth.load(std::memory_order_relaxed) > 0)
+	continue;
+      if (!helper ||
+	  (helper->numa_node != sdata->numa_node &&
+	   shard->numa_node == sdata->numa_node)) {
+	helper = shard;
+      }
+    }
+    if (helper) {
+      helper->sdata_wait_lock.Lock();
+      helper->sdata_cond.SignalOne();
+      helper->sdata_wait_lock.Unlock();
+    }
+  }
 }
 
 void OSD::ShardedOpWQ::_enqueue_front(OpQueueItem&& item)
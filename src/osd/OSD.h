@@ -103,6 +103,7 @@ enum {
 
   l_osd_op_before_queue_op_lat,
   l_osd_op_before_dequeue_op_lat,
+  l_osd_op_inline,
 
   l_osd_sop,
   l_osd_sop_inb,
@@ -225,6 +226,17 @@ enum {
   rs_last,
 };
 
+// OSDShard perf counters
+enum {
+  l_osd_shard_first = 30000,
+  l_osd_shard_queue_depth,
+  l_osd_shard_enqueued,
+  l_osd_shard_dequeued,
+  l_osd_shard_stolen,
+  l_osd_shard_steals,
+  l_osd_shard_last,
+};
+
 class Messenger;
 class Message;
 class MonClient;
@@ -713,6 +725,17 @@ public:
   AsyncReserver<spg_t> local_reserver;
   AsyncReserver<spg_t> remote_reserver;
 
+  // -- backfill_scan --
+private:
+  /// run backfill prefetch scans off the pg lock, one per op shard
+  vector<Finisher*> backfill_scan_finishers;
+  Mutex backfill_scan_lock{"OSDService::backfill_scan_lock"};
+  bool backfill_scan_stopped = false;
+public:
+  /// queue c on pgid's scan finisher; false (and c deleted) once shut down
+  bool queue_backfill_scan(spg_t pgid, Context *c);
+  void shutdown_backfill_scan();
+
   // -- pg_temp --
 private:
   Mutex pg_temp_lock;
@@ -1147,11 +1170,37 @@ struct OSDShard {
   /// priority queue
   std::unique_ptr<OpQueue<OpQueueItem, uint64_t>> pqueue;
 
+  /// lock-free MPSC stack of newly enqueued items; whoever holds
+  /// shard_lock drains it, oldest first, into pqueue.  this keeps fast
+  /// dispatch threads off shard_lock.
+  struct InboxItem {
+    OpQueueItem item;
+    InboxItem *next = nullptr;
+    explicit InboxItem(OpQueueItem&& i) : item(std::move(i)) {}
+  };
+  std::atomic<InboxItem*> inbox = {nullptr};
+
+  /// items in inbox + pqueue; read without shard_lock by idle threads
+  /// of other shards looking for work to steal
+  std::atomic<unsigned> queue_depth = {0};
+
+  int numa_node = -1;       ///< node our threads are bound to, if any
+  std::vector<int> numa_cpus; ///< cpus of numa_node
+
+  PerfCounters *logger = nullptr;
+
   bool stop_waiting = false;
 
+  void enqueue_inbox(OpQueueItem&& item);
+  bool inbox_empty() const {
+    return inbox.load(std::memory_order_acquire) == nullptr;
+  }
+  void _drain_inbox(unsigned cutoff);
+
   void _enqueue_front(OpQueueItem&& item, unsigned cutoff) {
     unsigned priority = item.get_priority();
     unsigned cost = item.get_cost();
+    ++queue_depth;
     if (priority >= cutoff)
       pqueue->enqueue_strict_front(
 	item.get_owner(),
@@ -1215,7 +1264,12 @@ struct OSDShard {
     } else if (opqueue == io_queue::mclock_client) {
       pqueue = std::make_unique<ceph::mClockClientQueue>(cct);
     }
+    _create_logger();
   }
+  ~OSDShard();
+
+private:
+  void _create_logger();
 };
 
 class OSD : public Dispatcher,
@@ -1637,6 +1691,8 @@ private:
   const io_queue op_queue;
 public:
   const unsigned int op_prio_cutoff;
+  /// min depth of another shard's queue before idle threads help it
+  const unsigned int op_shard_steal_min_depth;
 protected:
 
   /*
@@ -1686,6 +1742,12 @@ protected:
     /// try to do some work
     void _process(uint32_t thread_index, heartbeat_handle_d *hb) override;
 
+    /// run the next item of a shard; called with its shard_lock held
+    void _process_next(OSDShard *sdata, heartbeat_handle_d *hb);
+
+    /// pick a backed-up shard for an idle thread of our_shard to help
+    OSDShard *_pick_steal_victim(uint32_t our_shard);
+
     /// enqueue a new item
     void _enqueue(OpQueueItem&& item) override;
 
@@ -1722,6 +1784,7 @@ protected:
 	assert(NULL != sdata);
 
 	sdata->shard_lock.Lock();
+	sdata->_drain_inbox(osd->op_prio_cutoff);
 	f->open_object_section(queue_name);
 	sdata->pqueue->dump(f);
 	f->close_section();
@@ -1734,12 +1797,22 @@ protected:
       auto &&sdata = osd->shards[shard_index];
       assert(sdata);
       Mutex::Locker l(sdata->shard_lock);
-      return sdata->pqueue->empty();
+      return sdata->pqueue->empty() && sdata->inbox_empty();
     }
   } op_shardedwq;
 
 
   void enqueue_op(spg_t pg, OpRequestRef& op, epoch_t epoch);
+  /// run a cached read on the calling (messenger) thread; false if it
+  /// must be queued instead
+  bool try_inline_op(spg_t pgid, OpRequestRef& op);
+  /// heartbeat handle of the calling messenger thread, for inline ops
+  heartbeat_handle_d *get_inline_op_hb();
+  std::atomic<bool> inline_reads = {false};  ///< osd_inline_reads
+  std::atomic<uint64_t> inline_read_max_bytes = {0};
+  Mutex inline_op_hb_lock{"OSD::inline_op_hb_lock"};
+  map<pthread_t, heartbeat_handle_d*> inline_op_hbs;  ///< for cleanup
+  uint64_t inline_op_hb_instance = 0;  ///< tags per-thread cached handles
   void dequeue_op(
     PGRef pg, OpRequestRef op,
     ThreadPool::TPHandle &handle);
@@ -2204,6 +2277,7 @@ private:
 
   int get_num_op_shards();
   int get_num_op_threads();
+  unsigned get_op_shard_steal_min_depth();
 
   float get_osd_recovery_sleep();
 
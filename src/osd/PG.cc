@@ -383,6 +383,16 @@ void PG::lock(bool no_lockdep) const
   dout(30) << "lock" << dendl;
 }
 
+bool PG::try_lock() const
+{
+  if (!_lock.TryLock())
+    return false;
+  assert(!dirty_info);
+  assert(!dirty_big_info);
+  dout(30) << "try_lock" << dendl;
+  return true;
+}
+
 std::ostream& PG::gen_prefix(std::ostream& out) const
 {
   OSDMapRef mapref = osdmap_ref;
@@ -5575,7 +5585,7 @@ void PG::share_pg_info()
 }
 
 bool PG::append_log_entries_update_missing(
-  const mempool::osd_pglog::list<pg_log_entry_t> &entries,
+  const mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
   ObjectStore::Transaction &t, boost::optional<eversion_t> trim_to,
   boost::optional<eversion_t> roll_forward_to)
 {
@@ -5618,7 +5628,7 @@ bool PG::append_log_entries_update_missing(
 
 
 void PG::merge_new_log_entries(
-  const mempool::osd_pglog::list<pg_log_entry_t> &entries,
+  const mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
   ObjectStore::Transaction &t,
   boost::optional<eversion_t> trim_to,
   boost::optional<eversion_t> roll_forward_to)
@@ -281,6 +281,7 @@ public:
     handle.reset_tp_timeout();
   }
   void lock(bool no_lockdep = false) const;
+  bool try_lock() const;
   void unlock() const {
     //generic_dout(0) << this << " " << info.pgid << " unlock" << dendl;
     assert(!dirty_info);
@@ -457,6 +458,9 @@ public:
     OpRequestRef& op,
     ThreadPool::TPHandle &handle
   ) = 0;
+  /// true if op is a read of at most max_bytes that do_request can
+  /// finish without blocking; called with the pg lock held
+  virtual bool can_run_inline(OpRequestRef& op, uint64_t max_bytes) = 0;
 
   virtual void snap_trimmer(epoch_t epoch_queued) = 0;
   virtual int do_command(
@@ -2910,7 +2914,7 @@ protected:
 
 
   bool append_log_entries_update_missing(
-    const mempool::osd_pglog::list<pg_log_entry_t> &entries,
+    const mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
     ObjectStore::Transaction &t,
     boost::optional<eversion_t> trim_to,
     boost::optional<eversion_t> roll_forward_to);
@@ -2920,7 +2924,7 @@ protected:
    * acting_recovery_backfill logs and missings (also missing_loc)
    */
   void merge_new_log_entries(
-    const mempool::osd_pglog::list<pg_log_entry_t> &entries,
+    const mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
     ObjectStore::Transaction &t,
     boost::optional<eversion_t> trim_to,
     boost::optional<eversion_t> roll_forward_to);
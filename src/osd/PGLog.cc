@@ -413,7 +413,7 @@ void PGLog::merge_log(pg_info_t &oinfo, pg_log_t &olog, pg_shard_t fromosd,
     }
     log.roll_forward_to(log.head, rollbacker);
 
-    mempool::osd_pglog::list<pg_log_entry_t> new_entries;
+    mempool::osd_pglog::slab_list<pg_log_entry_t> new_entries;
     new_entries.splice(new_entries.end(), olog.log, from, to);
     append_log_entries_update_missing(
       info.last_backfill,
@@ -601,6 +601,7 @@ void PGLog::write_log_and_missing(
       dirty_from_dups,
       write_from_dups,
       &rebuilt_missing_with_deletes,
+      pack_entries,
       (pg_log_debug ? &log_keys_debug : nullptr));
     undirty();
   } else {
@@ -615,14 +616,15 @@ void PGLog::write_log_and_missing_wo_missing(
     pg_log_t &log,
     const coll_t& coll, const ghobject_t &log_oid,
     map<eversion_t, hobject_t> &divergent_priors,
-    bool require_rollback
+    bool require_rollback,
+    unsigned pack_entries
     )
 {
   _write_log_and_missing_wo_missing(
     t, km, log, coll, log_oid,
     divergent_priors, eversion_t::max(), eversion_t(), eversion_t(),
     true, true, require_rollback,
-    eversion_t::max(), eversion_t(), eversion_t(), nullptr);
+    eversion_t::max(), eversion_t(), eversion_t(), pack_entries, nullptr);
 }
 
 // static
@@ -634,7 +636,8 @@ void PGLog::write_log_and_missing(
     const ghobject_t &log_oid,
     const pg_missing_tracker_t &missing,
     bool require_rollback,
-    bool *rebuilt_missing_with_deletes)
+    bool *rebuilt_missing_with_deletes,
+    unsigned pack_entries)
 {
   _write_log_and_missing(
     t, km, log, coll, log_oid,
@@ -648,74 +651,192 @@ void PGLog::write_log_and_missing(
     eversion_t::max(),
     eversion_t(),
     eversion_t(),
-    rebuilt_missing_with_deletes, nullptr);
+    rebuilt_missing_with_deletes, pack_entries, nullptr);
 }
 
 // static
-void PGLog::_write_log_and_missing_wo_missing(
+void PGLog::_write_log_entries(
   ObjectStore::Transaction& t,
-  map<string,bufferlist> *km,
+  map<string,bufferlist>* km,
   pg_log_t &log,
   const coll_t& coll, const ghobject_t &log_oid,
-  map<eversion_t, hobject_t> &divergent_priors,
   eversion_t dirty_to,
   eversion_t dirty_from,
   eversion_t writeout_from,
-  bool dirty_divergent_priors,
-  bool touch_log,
-  bool require_rollback,
-  eversion_t dirty_to_dups,
-  eversion_t dirty_from_dups,
-  eversion_t write_from_dups,
-  set<string> *log_keys_debug
-  )
+  const set<eversion_t> &trimmed,
+  set<string> *to_remove,
+  unsigned pack_entries,
+  set<string> *log_keys_debug)
 {
-  // dout(10) << "write_log_and_missing, clearing up to " << dirty_to << dendl;
-  if (touch_log)
-    t.touch(coll, log_oid);
+  // log_keys_debug tracks the logical entry keys in either layout
   if (dirty_to != eversion_t()) {
-    t.omap_rmkeyrange(
-      coll, log_oid,
-      eversion_t().get_key_name(), dirty_to.get_key_name());
+    if (!pack_entries || dirty_to == eversion_t::max()) {
+      // also drops a legacy layout left behind on conversion
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	eversion_t().get_key_name(), dirty_to.get_key_name());
+    }
     clear_up_to(log_keys_debug, dirty_to.get_key_name());
   }
   if (dirty_to != eversion_t::max() && dirty_from != eversion_t::max()) {
-    // dout(10) << "write_log_and_missing, clearing from " << dirty_from << dendl;
-    t.omap_rmkeyrange(
-      coll, log_oid,
-      dirty_from.get_key_name(), eversion_t::max().get_key_name());
+    if (!pack_entries) {
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	dirty_from.get_key_name(), eversion_t::max().get_key_name());
+    }
     clear_after(log_keys_debug, dirty_from.get_key_name());
   }
 
+  list<pg_log_entry_t*> dirty;
   for (list<pg_log_entry_t>::iterator p = log.log.begin();
        p != log.log.end() && p->version <= dirty_to;
        ++p) {
-    bufferlist bl(sizeof(*p) * 2);
-    p->encode_with_checksum(bl);
-    (*km)[p->get_key_name()].claim(bl);
+    dirty.push_back(&*p);
   }
-
   for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
        p != log.log.rend() &&
 	 (p->version >= dirty_from || p->version >= writeout_from) &&
-	 p->version >= dirty_to;
+	 p->version > dirty_to;
        ++p) {
-    bufferlist bl(sizeof(*p) * 2);
-    p->encode_with_checksum(bl);
-    (*km)[p->get_key_name()].claim(bl);
+    dirty.push_back(&*p);
   }
 
   if (log_keys_debug) {
-    for (map<string, bufferlist>::iterator i = (*km).begin();
-	 i != (*km).end();
-	 ++i) {
-      if (i->first[0] == '_')
-	continue;
-      assert(!log_keys_debug->count(i->first));
-      log_keys_debug->insert(i->first);
+    for (auto e : dirty) {
+      assert(!log_keys_debug->count(e->get_key_name()));
+      log_keys_debug->insert(e->get_key_name());
+    }
+  }
+
+  if (!pack_entries) {
+    if (dirty_to == eversion_t::max()) {
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	get_pack_key(0), get_pack_key(std::numeric_limits<uint64_t>::max()));
     }
+    for (auto e : dirty) {
+      bufferlist bl(sizeof(*e) * 2);
+      e->encode_with_checksum(bl);
+      (*km)[e->get_key_name()].claim(bl);
+    }
+    return;
   }
 
+  // Pack n holds the entries with version.version in
+  // [n * pack_entries, (n+1) * pack_entries).  A pack is rewritten in
+  // full whenever one of its entries changes, trading some rewritten
+  // bytes for far fewer omap keys and tombstones.
+  set<uint64_t> dirty_packs;
+  if (dirty_to == eversion_t::max()) {
+    t.omap_rmkeyrange(
+      coll, log_oid,
+      get_pack_key(0), get_pack_key(std::numeric_limits<uint64_t>::max()));
+  } else {
+    if (dirty_to != eversion_t()) {
+      uint64_t n = dirty_to.version / pack_entries;
+      t.omap_rmkeyrange(coll, log_oid, get_pack_key(0), get_pack_key(n));
+      dirty_packs.insert(n);
+    }
+    if (dirty_from != eversion_t::max()) {
+      uint64_t n = dirty_from.version / pack_entries;
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	get_pack_key(n + 1),
+	get_pack_key(std::numeric_limits<uint64_t>::max()));
+      dirty_packs.insert(n);
+    }
+  }
+  for (auto e : dirty) {
+    dirty_packs.insert(e->version.version / pack_entries);
+  }
+  for (auto& v : trimmed) {
+    // a pack still holding live entries keeps its trimmed ones until
+    // it is next rewritten; the reader skips them by log_tail
+    uint64_t n = v.version / pack_entries;
+    if (log.log.empty() ||
+	log.log.front().version.version / pack_entries > n) {
+      to_remove->insert(get_pack_key(n));
+    }
+  }
+  if (dirty_packs.empty())
+    return;
+
+  map<uint64_t, list<const pg_log_entry_t*>> packs;
+  for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
+       p != log.log.rend() &&
+	 p->version.version / pack_entries >= *dirty_packs.begin();
+       ++p) {
+    uint64_t n = p->version.version / pack_entries;
+    if (dirty_packs.count(n))
+      packs[n].push_front(&*p);
+  }
+  for (auto n : dirty_packs) {
+    auto i = packs.find(n);
+    if (i == packs.end()) {
+      to_remove->insert(get_pack_key(n));
+      continue;
+    }
+    bufferlist bl;
+    ENCODE_START(1, 1, bl);
+    encode((__u32)pack_entries, bl);
+    encode((__u32)i->second.size(), bl);
+    for (auto e : i->second) {
+      e->encode_with_checksum(bl);
+    }
+    ENCODE_FINISH(bl);
+    (*km)[get_pack_key(n)].claim(bl);
+  }
+}
+
+// static
+void PGLog::decode_pack(
+  bufferlist::const_iterator &bp,
+  __u32 *packed_by,
+  list<pg_log_entry_t> *entries)
+{
+  DECODE_START(1, bp);
+  __u32 count;
+  decode(*packed_by, bp);
+  decode(count, bp);
+  for (__u32 i = 0; i < count; ++i) {
+    entries->emplace_back();
+    entries->back().decode_with_checksum(bp);
+  }
+  DECODE_FINISH(bp);
+}
+
+// static
+void PGLog::_write_log_and_missing_wo_missing(
+  ObjectStore::Transaction& t,
+  map<string,bufferlist> *km,
+  pg_log_t &log,
+  const coll_t& coll, const ghobject_t &log_oid,
+  map<eversion_t, hobject_t> &divergent_priors,
+  eversion_t dirty_to,
+  eversion_t dirty_from,
+  eversion_t writeout_from,
+  bool dirty_divergent_priors,
+  bool touch_log,
+  bool require_rollback,
+  eversion_t dirty_to_dups,
+  eversion_t dirty_from_dups,
+  eversion_t write_from_dups,
+  unsigned pack_entries,
+  set<string> *log_keys_debug
+  )
+{
+  // dout(10) << "write_log_and_missing, clearing up to " << dirty_to << dendl;
+  if (touch_log)
+    t.touch(coll, log_oid);
+  set<string> to_remove;
+  _write_log_entries(
+    t, km, log, coll, log_oid,
+    dirty_to, dirty_from, writeout_from,
+    set<eversion_t>(), &to_remove,
+    pack_entries, log_keys_debug);
+  if (!to_remove.empty())
+    t.omap_rmkeys(coll, log_oid, to_remove);
+
   // process dups after log_keys_debug is filled, so dups do not
   // end up in that set
   if (dirty_to_dups != eversion_t()) {
@@ -785,6 +906,7 @@ void PGLog::_write_log_and_missing(
   eversion_t dirty_from_dups,
   eversion_t write_from_dups,
   bool *rebuilt_missing_with_deletes, // in/out param
+  unsigned pack_entries,
   set<string> *log_keys_debug
   ) {
   set<string> to_remove;
@@ -796,54 +918,19 @@ void PGLog::_write_log_and_missing(
       assert(it != log_keys_debug->end());
       log_keys_debug->erase(it);
     }
-    to_remove.emplace(std::move(key));
+    // packed entries are dropped along with their pack
+    if (!pack_entries)
+      to_remove.emplace(std::move(key));
   }
-  trimmed.clear();
 
   if (touch_log)
     t.touch(coll, log_oid);
-  if (dirty_to != eversion_t()) {
-    t.omap_rmkeyrange(
-      coll, log_oid,
-      eversion_t().get_key_name(), dirty_to.get_key_name());
-    clear_up_to(log_keys_debug, dirty_to.get_key_name());
-  }
-  if (dirty_to != eversion_t::max() && dirty_from != eversion_t::max()) {
-    //   dout(10) << "write_log_and_missing, clearing from " << dirty_from << dendl;
-    t.omap_rmkeyrange(
-      coll, log_oid,
-      dirty_from.get_key_name(), eversion_t::max().get_key_name());
-    clear_after(log_keys_debug, dirty_from.get_key_name());
-  }
-
-  for (list<pg_log_entry_t>::iterator p = log.log.begin();
-       p != log.log.end() && p->version <= dirty_to;
-       ++p) {
-    bufferlist bl(sizeof(*p) * 2);
-    p->encode_with_checksum(bl);
-    (*km)[p->get_key_name()].claim(bl);
-  }
-
-  for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
-       p != log.log.rend() &&
-	 (p->version >= dirty_from || p->version >= writeout_from) &&
-	 p->version >= dirty_to;
-       ++p) {
-    bufferlist bl(sizeof(*p) * 2);
-    p->encode_with_checksum(bl);
-    (*km)[p->get_key_name()].claim(bl);
-  }
-
-  if (log_keys_debug) {
-    for (map<string, bufferlist>::iterator i = (*km).begin();
-	 i != (*km).end();
-	 ++i) {
-      if (i->first[0] == '_')
-	continue;
-      assert(!log_keys_debug->count(i->first));
-      log_keys_debug->insert(i->first);
-    }
-  }
+  _write_log_entries(
+    t, km, log, coll, log_oid,
+    dirty_to, dirty_from, writeout_from,
+    trimmed, &to_remove,
+    pack_entries, log_keys_debug);
+  trimmed.clear();
 
   // process dups after log_keys_debug is filled, so dups do not
   // end up in that set
@@ -98,7 +98,7 @@ public:
      * It's a reverse_iterator because rend() is a natural representation for
      * tail, and rbegin() works nicely for head.
      */
-    mempool::osd_pglog::list<pg_log_entry_t>::reverse_iterator
+    mempool::osd_pglog::slab_list<pg_log_entry_t>::reverse_iterator
       rollback_info_trimmed_to_riter;
 
     template <typename F>
@@ -143,8 +143,9 @@ public:
       indexed_data(0),
       rollback_info_trimmed_to_riter(log.rbegin())
     {
+      // indexes are built on first use; most logs loaded at startup
+      // belong to idle pgs that never need them
       reset_rollback_info_trimmed_to_riter();
-      index();
     }
 
     IndexedLog(const IndexedLog &rhs) :
@@ -183,7 +184,7 @@ public:
       advance_can_rollback_to(head, [&](const pg_log_entry_t &entry) {});
     }
 
-    mempool::osd_pglog::list<pg_log_entry_t> rewind_from_head(eversion_t newhead) {
+    mempool::osd_pglog::slab_list<pg_log_entry_t> rewind_from_head(eversion_t newhead) {
       auto divergent = pg_log_t::rewind_from_head(newhead);
       index();
       reset_rollback_info_trimmed_to_riter();
@@ -241,6 +242,14 @@ public:
       last_requested = 0;
     }
 
+    /// latest entry for each logged object; built on first use
+    const ceph::unordered_map<hobject_t,pg_log_entry_t*>& get_objects() const {
+      if (!(indexed_data & PGLOG_INDEXED_OBJECTS)) {
+         index_objects();
+      }
+      return objects;
+    }
+
     bool logged_object(const hobject_t& oid) const {
       if (!(indexed_data & PGLOG_INDEXED_OBJECTS)) {
          index_objects();
@@ -559,6 +568,8 @@ protected:
   set<string> trimmed_dups;    ///< must clear keys in trimmed_dups
   CephContext *cct;
   bool pg_log_debug;
+  /// entries per omap key on disk; 0 for one key per entry
+  unsigned pack_entries;
   /// Log is clean on [dirty_to, dirty_from)
   bool touched_log;
   bool clear_divergent_priors;
@@ -651,6 +662,8 @@ public:
     write_from_dups(eversion_t::max()),
     cct(cct),
     pg_log_debug(!(cct && !(cct->_conf->osd_debug_pg_log_writeout))),
+    pack_entries(cct ?
+		 cct->_conf->get_val<uint64_t>("osd_pg_log_pack_entries") : 0),
     touched_log(false),
     clear_divergent_priors(false)
   { }
@@ -806,8 +819,8 @@ public:
 
 protected:
   static void split_by_object(
-    mempool::osd_pglog::list<pg_log_entry_t> &entries,
-    map<hobject_t, mempool::osd_pglog::list<pg_log_entry_t>> *out_entries) {
+    mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
+    map<hobject_t, mempool::osd_pglog::slab_list<pg_log_entry_t>> *out_entries) {
     while (!entries.empty()) {
       auto &out_list = (*out_entries)[entries.front().soid];
       out_list.splice(out_list.end(), entries, entries.begin());
@@ -838,7 +851,7 @@ protected:
   static void _merge_object_divergent_entries(
     const IndexedLog &log,               ///< [in] log to merge against
     const hobject_t &hoid,               ///< [in] object we are merging
-    const mempool::osd_pglog::list<pg_log_entry_t> &orig_entries, ///< [in] entries for hoid to merge
+    const mempool::osd_pglog::slab_list<pg_log_entry_t> &orig_entries, ///< [in] entries for hoid to merge
     const pg_info_t &info,              ///< [in] info for merging entries
     eversion_t olog_can_rollback_to,     ///< [in] rollback boundary
     missing_type &missing,               ///< [in,out] missing to adjust, use
@@ -857,7 +870,7 @@ protected:
     // entries is non-empty
     assert(!orig_entries.empty());
     // strip out and ignore ERROR entries
-    mempool::osd_pglog::list<pg_log_entry_t> entries;
+    mempool::osd_pglog::slab_list<pg_log_entry_t> entries;
     eversion_t last;
     bool seen_non_error = false;
     for (list<pg_log_entry_t>::const_iterator i = orig_entries.begin();
@@ -911,8 +924,8 @@ protected:
 		       << dendl;
 
     ceph::unordered_map<hobject_t, pg_log_entry_t*>::const_iterator objiter =
-      log.objects.find(hoid);
-    if (objiter != log.objects.end() &&
+      log.get_objects().find(hoid);
+    if (objiter != log.get_objects().end() &&
 	objiter->second->version >= first_divergent_update) {
       /// Case 1)
       ldpp_dout(dpp, 10) << __func__ << ": more recent entry found: "
@@ -1048,16 +1061,16 @@ protected:
   template <typename missing_type>
   static void _merge_divergent_entries(
     const IndexedLog &log,               ///< [in] log to merge against
-    mempool::osd_pglog::list<pg_log_entry_t> &entries,       ///< [in] entries to merge
+    mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,       ///< [in] entries to merge
     const pg_info_t &oinfo,              ///< [in] info for merging entries
     eversion_t olog_can_rollback_to,     ///< [in] rollback boundary
     missing_type &omissing,              ///< [in,out] missing to adjust, use
     LogEntryHandler *rollbacker,         ///< [in] optional rollbacker object
     const DoutPrefixProvider *dpp        ///< [in] logging provider
     ) {
-    map<hobject_t, mempool::osd_pglog::list<pg_log_entry_t> > split;
+    map<hobject_t, mempool::osd_pglog::slab_list<pg_log_entry_t> > split;
     split_by_object(entries, &split);
-    for (map<hobject_t, mempool::osd_pglog::list<pg_log_entry_t>>::iterator i = split.begin();
+    for (map<hobject_t, mempool::osd_pglog::slab_list<pg_log_entry_t>>::iterator i = split.begin();
 	 i != split.end();
 	 ++i) {
       _merge_object_divergent_entries(
@@ -1081,7 +1094,7 @@ protected:
     const pg_log_entry_t& oe,
     const pg_info_t& info,
     LogEntryHandler *rollbacker) {
-    mempool::osd_pglog::list<pg_log_entry_t> entries;
+    mempool::osd_pglog::slab_list<pg_log_entry_t> entries;
     entries.push_back(oe);
     _merge_object_divergent_entries(
       log,
@@ -1114,7 +1127,7 @@ public:
   static bool append_log_entries_update_missing(
     const hobject_t &last_backfill,
     bool last_backfill_bitwise,
-    const mempool::osd_pglog::list<pg_log_entry_t> &entries,
+    const mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
     bool maintain_rollback,
     IndexedLog *log,
     missing_type &missing,
@@ -1158,7 +1171,7 @@ public:
   bool append_new_log_entries(
     const hobject_t &last_backfill,
     bool last_backfill_bitwise,
-    const mempool::osd_pglog::list<pg_log_entry_t> &entries,
+    const mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
     LogEntryHandler *rollbacker) {
     bool invalidate_stats = append_log_entries_update_missing(
       last_backfill,
@@ -1199,7 +1212,8 @@ public:
     pg_log_t &log,
     const coll_t& coll,
     const ghobject_t &log_oid, map<eversion_t, hobject_t> &divergent_priors,
-    bool require_rollback);
+    bool require_rollback,
+    unsigned pack_entries = 0);
 
   static void write_log_and_missing(
     ObjectStore::Transaction& t,
@@ -1209,7 +1223,36 @@ public:
     const ghobject_t &log_oid,
     const pg_missing_tracker_t &missing,
     bool require_rollback,
-    bool *rebuilt_missing_set_with_deletes);
+    bool *rebuilt_missing_set_with_deletes,
+    unsigned pack_entries = 0);
+
+  /// omap key of the pack holding versions [n * pack_entries, (n+1) * pack_entries)
+  static string get_pack_key(uint64_t n) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "pack_%020llu", (unsigned long long)n);
+    return string(buf);
+  }
+  static bool is_pack_key(const string& key) {
+    return key.compare(0, 5, "pack_") == 0;
+  }
+  /// decode a pack written by _write_log_entries, trimmed entries included
+  static void decode_pack(
+    bufferlist::const_iterator &bp,
+    __u32 *packed_by,
+    list<pg_log_entry_t> *entries);
+
+  static void _write_log_entries(
+    ObjectStore::Transaction& t,
+    map<string,bufferlist>* km,
+    pg_log_t &log,
+    const coll_t& coll, const ghobject_t &log_oid,
+    eversion_t dirty_to,
+    eversion_t dirty_from,
+    eversion_t writeout_from,
+    const set<eversion_t> &trimmed,
+    set<string> *to_remove,
+    unsigned pack_entries,
+    set<string> *log_keys_debug);
 
   static void _write_log_and_missing_wo_missing(
     ObjectStore::Transaction& t,
@@ -1226,6 +1269,7 @@ public:
     eversion_t dirty_to_dups,
     eversion_t dirty_from_dups,
     eversion_t write_from_dups,
+    unsigned pack_entries,
     set<string> *log_keys_debug
     );
 
@@ -1247,6 +1291,7 @@ public:
     eversion_t dirty_from_dups,
     eversion_t write_from_dups,
     bool *rebuilt_missing_with_deletes,
+    unsigned pack_entries,
     set<string> *log_keys_debug
     );
 
@@ -1259,14 +1304,24 @@ public:
     bool tolerate_divergent_missing_log,
     bool debug_verify_stored_missing = false
     ) {
-    return read_log_and_missing(
+    int on_disk_pack_entries = -1;
+    read_log_and_missing(
       store, ch, pgmeta_oid, info,
       log, missing, oss,
       tolerate_divergent_missing_log,
       &clear_divergent_priors,
       this,
       (pg_log_debug ? &log_keys_debug : nullptr),
-      debug_verify_stored_missing);
+      debug_verify_stored_missing,
+      &on_disk_pack_entries);
+    if (on_disk_pack_entries >= 0 &&
+	(unsigned)on_disk_pack_entries != pack_entries) {
+      // convert to the configured layout with the next write
+      ldpp_dout(this, 10) << "read_log_and_missing log packed by "
+			  << on_disk_pack_entries << ", want " << pack_entries
+			  << "; will rewrite" << dendl;
+      mark_log_for_rewrite();
+    }
   }
 
   template <typename missing_type>
@@ -1282,7 +1337,8 @@ public:
     bool *clear_divergent_priors = nullptr,
     const DoutPrefixProvider *dpp = nullptr,
     set<string> *log_keys_debug = nullptr,
-    bool debug_verify_stored_missing = false
+    bool debug_verify_stored_missing = false,
+    int *on_disk_pack_entries = nullptr ///< [out] 0 if one key per entry
     ) {
     ldpp_dout(dpp, 20) << "read_log_and_missing coll " << ch->cid
 		       << " " << pgmeta_oid << dendl;
@@ -1338,6 +1394,25 @@ public:
 	    assert(dups.back().version < dup.version);
 	  }
 	  dups.push_back(dup);
+	} else if (is_pack_key(p->key())) {
+	  __u32 packed_by;
+	  list<pg_log_entry_t> pack;
+	  decode_pack(bp, &packed_by, &pack);
+	  for (auto& e : pack) {
+	    // packs are only removed once all of their entries are trimmed
+	    if (e.version <= info.log_tail)
+	      continue;
+	    ldpp_dout(dpp, 20) << "read_log_and_missing " << e << dendl;
+	    if (!entries.empty()) {
+	      assert(entries.back().version.version < e.version.version);
+	      assert(entries.back().version.epoch <= e.version.epoch);
+	    }
+	    entries.push_back(e);
+	    if (log_keys_debug)
+	      log_keys_debug->insert(e.get_key_name());
+	  }
+	  if (on_disk_pack_entries)
+	    *on_disk_pack_entries = packed_by;
 	} else {
 	  pg_log_entry_t e;
 	  e.decode_with_checksum(bp);
@@ -1350,6 +1425,8 @@ public:
 	  entries.push_back(e);
 	  if (log_keys_debug)
 	    log_keys_debug->insert(e.get_key_name());
+	  if (on_disk_pack_entries)
+	    *on_disk_pack_entries = 0;
 	}
       }
     }
@@ -375,7 +375,7 @@ void PrimaryLogPG::on_local_recover(
   if (!is_delete && pg_log.get_missing().is_missing(recovery_info.soid) &&
       pg_log.get_missing().get_items().find(recovery_info.soid)->second.need > recovery_info.version) {
     assert(is_primary());
-    const pg_log_entry_t *latest = pg_log.get_log().objects.find(recovery_info.soid)->second;
+    const pg_log_entry_t *latest = pg_log.get_log().get_objects().find(recovery_info.soid)->second;
     if (latest->op == pg_log_entry_t::LOST_REVERT &&
 	latest->reverting_to == recovery_info.version) {
       dout(10) << " got old revert version " << recovery_info.version
@@ -1666,6 +1666,9 @@ PrimaryLogPG::PrimaryLogPG(OSDService *o, OSDMapRef curmap,
   object_contexts(o->cct, o->cct->_conf->osd_pg_object_context_cache_count),
   snapset_contexts_lock("PrimaryLogPG::snapset_contexts_lock"),
   new_backfill(false),
+  backfill_prefetching(false),
+  backfill_prefetched(false),
+  backfill_prefetch_seq(0),
   temp_seq(0),
   snap_trimmer_machine(this)
 { 
@@ -1701,6 +1704,72 @@ void PrimaryLogPG::handle_backoff(OpRequestRef& op)
   session->ack_backoff(cct, m->pgid, m->id, begin, end);
 }
 
+/*
+ * An op may be run by the dispatching messenger thread, skipping the op
+ * queue, only if do_op will answer it straight from memory: a plain read
+ * of a small head object whose context we already hold, that nobody is
+ * writing, in a clean pg we are primary for, with the data resident in
+ * the ObjectStore's cache.  Anything else takes the normal path.
+ */
+bool PrimaryLogPG::can_run_inline(OpRequestRef& op, uint64_t max_bytes)
+{
+  assert(is_locked());
+  if (op->get_req()->get_type() != CEPH_MSG_OSD_OP)
+    return false;
+  if (!is_primary() || !is_active() || !is_clean() || is_deleting() ||
+      !waiting_for_map.empty() || !have_same_or_newer_map(op->min_epoch))
+    return false;
+  if (!pool.info.is_replicated() ||
+      pool.info.is_tier() || pool.info.has_tiers() || hit_set)
+    return false;
+
+  MOSDOp *m = static_cast<MOSDOp*>(op->get_nonconst_req());
+  if (m->finish_decode()) {
+    op->reset_desc();   // for TrackedOp
+    m->clear_payload();
+  }
+  if (m->get_snapid() != CEPH_NOSNAP ||
+      (m->get_flags() & (CEPH_OSD_FLAG_WRITE |
+			 CEPH_OSD_FLAG_RWORDERED |
+			 CEPH_OSD_FLAG_PARALLELEXEC)))
+    return false;
+
+  hobject_t soid = m->get_hobj();
+  ObjectContextRef obc = object_contexts.lookup(soid);
+  if (!obc || !obc->obs.exists || obc->is_blocked() ||
+      !obc->rwstate.waiters.empty() ||
+      obc->rwstate.state == ObjectContext::RWState::RWWRITE ||
+      obc->rwstate.state == ObjectContext::RWState::RWEXCL)
+    return false;
+
+  ghobject_t goid(soid, ghobject_t::NO_GEN, info.pgid.shard);
+  uint64_t bytes = 0;
+  for (auto& osd_op : m->ops) {
+    const ceph_osd_op& o = osd_op.op;
+    switch (o.op) {
+    case CEPH_OSD_OP_READ:
+    case CEPH_OSD_OP_SYNC_READ:
+      {
+	uint64_t len = o.extent.length ? o.extent.length : obc->obs.oi.size;
+	bytes += len;
+	if (bytes > max_bytes ||
+	    !osd->store->is_cached(ch, goid, o.extent.offset, len))
+	  return false;
+      }
+      break;
+    case CEPH_OSD_OP_STAT:
+    case CEPH_OSD_OP_GETXATTR:
+    case CEPH_OSD_OP_GETXATTRS:
+      if (!osd->store->is_cached(ch, goid, 0, 0))
+	return false;
+      break;
+    default:
+      return false;
+    }
+  }
+  return !m->ops.empty();
+}
+
 void PrimaryLogPG::do_request(
   OpRequestRef& op,
   ThreadPool::TPHandle &handle)
@@ -2662,7 +2731,7 @@ void PrimaryLogPG::record_write_error(OpRequestRef op, const hobject_t &soid,
   dout(20) << __func__ << " r=" << r << dendl;
   assert(op->may_write());
   const osd_reqid_t &reqid = static_cast<const MOSDOp*>(op->get_req())->get_reqid();
-  mempool::osd_pglog::list<pg_log_entry_t> entries;
+  mempool::osd_pglog::slab_list<pg_log_entry_t> entries;
   entries.push_back(pg_log_entry_t(pg_log_entry_t::ERROR, soid,
 				   get_next_version(), eversion_t(), 0,
 				   reqid, utime_t(), r));
@@ -7279,9 +7348,10 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	bool truncated = false;
 	bufferlist bl;
 	if (oi.is_omap()) {
-	  ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(
-	    ch, ghobject_t(soid)
-	    );
+	  // bounded by max_return and osd_max_omap_bytes_per_request, so the
+	  // values may stay pinned in the store until the reply is sent
+	  ObjectMap::ObjectMapIterator iter =
+	    osd->store->get_omap_iterator_pinned(ch, ghobject_t(soid));
           if (!iter) {
             result = -ENOENT;
             goto fail;
@@ -10506,7 +10576,7 @@ void PrimaryLogPG::simple_opc_submit(OpContextUPtr ctx)
 
 
 void PrimaryLogPG::submit_log_entries(
-  const mempool::osd_pglog::list<pg_log_entry_t> &entries,
+  const mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
   ObcLockManager &&manager,
   boost::optional<std::function<void(void)> > &&_on_complete,
   OpRequestRef op,
@@ -10690,10 +10760,10 @@ void PrimaryLogPG::check_blacklisted_obc_watchers(ObjectContextRef obc)
 void PrimaryLogPG::populate_obc_watchers(ObjectContextRef obc)
 {
   assert(is_active());
-  auto it_objects = pg_log.get_log().objects.find(obc->obs.oi.soid);
+  auto it_objects = pg_log.get_log().get_objects().find(obc->obs.oi.soid);
   assert((recovering.count(obc->obs.oi.soid) ||
 	  !is_missing_object(obc->obs.oi.soid)) ||
-	 (it_objects != pg_log.get_log().objects.end() && // or this is a revert... see recover_primary()
+	 (it_objects != pg_log.get_log().get_objects().end() && // or this is a revert... see recover_primary()
 	  it_objects->second->op ==
 	    pg_log_entry_t::LOST_REVERT &&
 	  it_objects->second->reverting_to ==
@@ -10810,11 +10880,11 @@ ObjectContextRef PrimaryLogPG::get_object_context(
   bool can_create,
   const map<string, bufferlist> *attrs)
 {
-  auto it_objects = pg_log.get_log().objects.find(soid);
+  auto it_objects = pg_log.get_log().get_objects().find(soid);
   assert(
     attrs || !pg_log.get_missing().is_missing(soid) ||
     // or this is a revert... see recover_primary()
-    (it_objects != pg_log.get_log().objects.end() &&
+    (it_objects != pg_log.get_log().get_objects().end() &&
       it_objects->second->op ==
       pg_log_entry_t::LOST_REVERT));
   ObjectContextRef obc = object_contexts.lookup(soid);
@@ -11660,7 +11730,7 @@ void PrimaryLogPG::mark_all_unfound_lost(
   pg_log.get_log().print(*_dout);
   *_dout << dendl;
 
-  mempool::osd_pglog::list<pg_log_entry_t> log_entries;
+  mempool::osd_pglog::slab_list<pg_log_entry_t> log_entries;
 
   utime_t mtime = ceph_clock_now();
   map<hobject_t, pg_missing_item>::const_iterator m =
@@ -12153,6 +12223,7 @@ void PrimaryLogPG::_clear_recovery_state()
   recovering_oids.clear();
 #endif
   last_backfill_started = hobject_t();
+  cancel_backfill_prefetch();
   set<hobject_t>::iterator i = backfills_in_flight.begin();
   while (i != backfills_in_flight.end()) {
     assert(recovering.count(*i));
@@ -12420,8 +12491,8 @@ uint64_t PrimaryLogPG::recover_primary(uint64_t max, ThreadPool::TPHandle &handl
     hobject_t soid;
     version_t v = p->first;
 
-    auto it_objects = pg_log.get_log().objects.find(p->second);
-    if (it_objects != pg_log.get_log().objects.end()) {
+    auto it_objects = pg_log.get_log().get_objects().find(p->second);
+    if (it_objects != pg_log.get_log().get_objects().end()) {
       latest = it_objects->second;
       assert(latest->is_update() || latest->is_delete());
       soid = latest->soid;
@@ -12847,6 +12918,7 @@ uint64_t PrimaryLogPG::recover_backfill(
       peer_backfill_info[*i].reset(peer_info[*i].last_backfill);
     }
     backfill_info.reset(last_backfill_started);
+    cancel_backfill_prefetch();
 
     backfills_in_flight.clear();
     pending_backfill_updates.clear();
@@ -12884,10 +12956,18 @@ uint64_t PrimaryLogPG::recover_backfill(
     if (backfill_info.begin <= earliest_peer_backfill() &&
 	!backfill_info.extends_to_end() && backfill_info.empty()) {
       hobject_t next = backfill_info.end;
-      backfill_info.reset(next);
-      backfill_info.end = hobject_t::get_max();
+      if (backfill_prefetched && backfill_prefetch.begin == next) {
+	dout(10) << " using prefetched interval " << backfill_prefetch << dendl;
+	backfill_info = std::move(backfill_prefetch);
+	backfill_prefetch.clear();
+	backfill_prefetched = false;
+      } else {
+	backfill_info.reset(next);
+	backfill_info.end = hobject_t::get_max();
+      }
       update_range(&backfill_info, handle);
       backfill_info.trim();
+      start_backfill_prefetch();
     }
 
     dout(20) << "   my backfill interval " << backfill_info << dendl;
@@ -13322,6 +13402,116 @@ void PrimaryLogPG::scan_range(
   }
 }
 
+struct C_BackfillPrefetchDone : public GenContext<ThreadPool::TPHandle&> {
+  PrimaryLogPGRef pg;
+  uint64_t seq;
+  int r = 0;
+  PG::BackfillInterval bi;
+  C_BackfillPrefetchDone(PrimaryLogPG *pg, uint64_t seq)
+    : pg(pg), seq(seq) {}
+  void finish(ThreadPool::TPHandle &handle) override {
+    // recovery contexts run with the pg locked
+    pg->finish_backfill_prefetch(seq, r, bi);
+  }
+};
+
+struct C_BackfillPrefetch : public Context {
+  PrimaryLogPGRef pg;
+  uint64_t seq;
+  hobject_t begin;
+  eversion_t version;
+  int min, max;
+  C_BackfillPrefetch(PrimaryLogPG *pg, uint64_t seq, const hobject_t &begin,
+		     eversion_t version, int min, int max)
+    : pg(pg), seq(seq), begin(begin), version(version), min(min), max(max) {}
+  void finish(int) override {
+    // no pg lock here: only read from the store, as scan_range() would
+    // without the object context cache; finish_backfill_prefetch()
+    // overlays the cache
+    C_BackfillPrefetchDone *done = new C_BackfillPrefetchDone(pg.get(), seq);
+    PG::BackfillInterval &bi = done->bi;
+    bi.begin = begin;
+    bi.version = version;
+    vector<hobject_t> ls;
+    done->r = pg->pgbackend->objects_list_partial(begin, min, max, &ls, &bi.end);
+    for (auto p = ls.begin(); done->r >= 0 && p != ls.end(); ++p) {
+      bufferlist bl;
+      int r = pg->pgbackend->objects_get_attr(*p, OI_ATTR, &bl);
+      if (r == -ENOENT)
+	continue;
+      if (r < 0) {
+	done->r = r;
+	break;
+      }
+      object_info_t oi(bl);
+      bi.objects[*p] = oi.version;
+    }
+    pg->osd->queue_recovery_context(pg.get(), done);
+  }
+};
+
+void PrimaryLogPG::start_backfill_prefetch()
+{
+  if (!cct->_conf->get_val<bool>("osd_backfill_scan_prefetch") ||
+      backfill_prefetching ||
+      backfill_info.extends_to_end())
+    return;
+  if (backfill_prefetched) {
+    if (backfill_prefetch.begin == backfill_info.end)
+      return;
+    backfill_prefetch.clear();
+    backfill_prefetched = false;
+  }
+  dout(10) << __func__ << " from " << backfill_info.end
+	   << " at " << info.last_update << dendl;
+  // refused once the osd is shutting down; scan synchronously then
+  backfill_prefetching = osd->queue_backfill_scan(
+    info.pgid,
+    new C_BackfillPrefetch(
+      this, backfill_prefetch_seq, backfill_info.end, info.last_update,
+      cct->_conf->osd_backfill_scan_min,
+      cct->_conf->osd_backfill_scan_max));
+}
+
+void PrimaryLogPG::finish_backfill_prefetch(
+  uint64_t seq, int r, BackfillInterval &bi)
+{
+  if (seq != backfill_prefetch_seq) {
+    dout(20) << __func__ << " dropping canceled scan from " << bi.begin
+	     << dendl;
+    return;
+  }
+  backfill_prefetching = false;
+  if (r < 0) {
+    // recover_backfill() will scan it synchronously instead
+    dout(10) << __func__ << " scan from " << bi.begin << " failed: "
+	     << cpp_strerror(r) << dendl;
+    return;
+  }
+  // the store can lag writes that are already covered by bi.version,
+  // and update_range() will not replay those; prefer the cached object
+  // info as scan_range() does
+  for (auto& p : bi.objects) {
+    ObjectContextRef obc = object_contexts.lookup(p.first);
+    if (obc && obc->obs.oi.version != p.second) {
+      dout(20) << __func__ << "  " << p.first << " " << p.second
+	       << " -> " << obc->obs.oi.version << dendl;
+      p.second = obc->obs.oi.version;
+    }
+  }
+  dout(10) << __func__ << " " << bi << dendl;
+  backfill_prefetch = std::move(bi);
+  backfill_prefetched = true;
+}
+
+void PrimaryLogPG::cancel_backfill_prefetch()
+{
+  ++backfill_prefetch_seq;
+  backfill_prefetching = false;
+  backfill_prefetched = false;
+  backfill_prefetch.clear();
+}
+
 
 /** check_local
  * 
@@ -886,7 +886,7 @@ protected:
    * Also used to store error log entries for dup detection.
    */
   void submit_log_entries(
-    const mempool::osd_pglog::list<pg_log_entry_t> &entries,
+    const mempool::osd_pglog::slab_list<pg_log_entry_t> &entries,
     ObcLockManager &&manager,
     boost::optional<std::function<void(void)> > &&on_complete,
     OpRequestRef op = OpRequestRef(),
@@ -1090,6 +1090,12 @@ protected:
   hobject_t last_backfill_started;
   bool new_backfill;
 
+  /// local interval following backfill_info, see start_backfill_prefetch()
+  BackfillInterval backfill_prefetch;
+  bool backfill_prefetching;      ///< a prefetch scan is in flight
+  bool backfill_prefetched;       ///< backfill_prefetch is filled
+  uint64_t backfill_prefetch_seq; ///< bumped to orphan in-flight scans
+
   int prep_object_replica_pushes(const hobject_t& soid, eversion_t v,
 				 PGBackend::RecoveryHandle *h,
 				 bool *work_started);
@@ -1252,6 +1258,21 @@ protected:
     ThreadPool::TPHandle &handle ///< [in] tp handle
     );
 
+  /**
+   * scan the interval after backfill_info on the pg's backfill scan
+   * finisher
+   *
+   * The scan runs without the pg lock and records the version it
+   * started from, so update_range() can bring it up to date once
+   * recover_backfill() gets to it.
+   */
+  void start_backfill_prefetch();
+  void finish_backfill_prefetch(
+    uint64_t seq, int r, BackfillInterval &bi);
+  void cancel_backfill_prefetch();
+  friend struct C_BackfillPrefetch;
+  friend struct C_BackfillPrefetchDone;
+
   int prep_backfill_object_push(
     hobject_t oid, eversion_t v, ObjectContextRef obc,
     vector<pg_shard_t> peers,
@@ -1437,6 +1458,7 @@ public:
   void do_request(
     OpRequestRef& op,
     ThreadPool::TPHandle &handle) override;
+  bool can_run_inline(OpRequestRef& op, uint64_t max_bytes) override;
   void do_op(OpRequestRef& op);
   void record_write_error(OpRequestRef op, const hobject_t &soid,
 			  MOSDOpReply *orig_reply, int r);
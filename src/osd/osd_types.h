@@ -64,6 +64,7 @@
 #define CEPH_OSD_FEATURE_INCOMPAT_MISSING CompatSet::Feature(14, "explicit missing set")
 #define CEPH_OSD_FEATURE_INCOMPAT_FASTINFO CompatSet::Feature(15, "fastinfo pg attr")
 #define CEPH_OSD_FEATURE_INCOMPAT_RECOVERY_DELETES CompatSet::Feature(16, "deletes in missing set")
+#define CEPH_OSD_FEATURE_INCOMPAT_PGLOG_PACKS CompatSet::Feature(17, "packed pg log")
 
 
 /// min recovery priority for MBackfillReserve
@@ -3513,18 +3514,18 @@ protected:
 
 public:
   // the actual log
-  mempool::osd_pglog::list<pg_log_entry_t> log;
+  mempool::osd_pglog::slab_list<pg_log_entry_t> log;
 
   // entries just for dup op detection ordered oldest to newest
-  mempool::osd_pglog::list<pg_log_dup_t> dups;
+  mempool::osd_pglog::slab_list<pg_log_dup_t> dups;
 
   pg_log_t() = default;
   pg_log_t(const eversion_t &last_update,
 	   const eversion_t &log_tail,
 	   const eversion_t &can_rollback_to,
 	   const eversion_t &rollback_info_trimmed_to,
-	   mempool::osd_pglog::list<pg_log_entry_t> &&entries,
-	   mempool::osd_pglog::list<pg_log_dup_t> &&dup_entries)
+	   mempool::osd_pglog::slab_list<pg_log_entry_t> &&entries,
+	   mempool::osd_pglog::slab_list<pg_log_dup_t> &&dup_entries)
     : head(last_update), tail(log_tail), can_rollback_to(can_rollback_to),
       rollback_info_trimmed_to(rollback_info_trimmed_to),
       log(std::move(entries)), dups(std::move(dup_entries)) {}
@@ -3560,7 +3561,7 @@ public:
 
 
   pg_log_t split_out_child(pg_t child_pgid, unsigned split_bits) {
-    mempool::osd_pglog::list<pg_log_entry_t> oldlog, childlog;
+    mempool::osd_pglog::slab_list<pg_log_entry_t> oldlog, childlog;
     oldlog.swap(log);
 
     eversion_t old_tail;
@@ -3590,11 +3591,11 @@ public:
       std::move(childdups));
     }
 
-  mempool::osd_pglog::list<pg_log_entry_t> rewind_from_head(eversion_t newhead) {
+  mempool::osd_pglog::slab_list<pg_log_entry_t> rewind_from_head(eversion_t newhead) {
     assert(newhead >= tail);
 
-    mempool::osd_pglog::list<pg_log_entry_t>::iterator p = log.end();
-    mempool::osd_pglog::list<pg_log_entry_t> divergent;
+    mempool::osd_pglog::slab_list<pg_log_entry_t>::iterator p = log.end();
+    mempool::osd_pglog::slab_list<pg_log_entry_t> divergent;
     while (true) {
       if (p == log.begin()) {
 	// yikes, the whole thing is divergent!
@@ -0,0 +1,145 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <iostream>
+#include <string.h>
+
+#include "include/types.h"
+#include "include/buffer.h"
+#include "include/crc32c.h"
+#include "common/ceph_time.h"
+#include "common/csum_mb.h"
+#include "common/Checksummer.h"
+
+#include "gtest/gtest.h"
+
+static bufferptr random_buffer(size_t len)
+{
+  bufferptr bp(len);
+  for (size_t i = 0; i < len; ++i) {
+    bp.c_str()[i] = rand();
+  }
+  return bp;
+}
+
+TEST(CsumMb, MatchesGeneric) {
+  std::cout << "csum_mb implementation: " << ceph_csum_mb.name << std::endl;
+  bufferptr bp = random_buffer(1 << 20);
+  const unsigned char *data = (const unsigned char *)bp.c_str();
+  for (size_t len : {8, 16, 24, 32, 48, 512, 4096, 4100, 65536}) {
+    for (size_t n : {1, 3, 4, 5, 8, 15, 16, 17, 31, 32}) {
+      if (len * n > bp.length())
+	continue;
+      uint32_t a[32], b[32];
+      uint64_t c[32], d[32];
+      ceph_crc32c_mb(-1, data, len, n, a);
+      ceph_csum_mb_generic.crc32c(-1, data, len, n, b);
+      for (size_t i = 0; i < n; ++i) {
+	ASSERT_EQ(b[i], a[i]) << "crc32c len " << len << " n " << n;
+	ASSERT_EQ(ceph_crc32c(-1, data + i * len, len), a[i]);
+      }
+      ceph_xxhash32_mb(1234, data, len, n, a);
+      ceph_csum_mb_generic.xxhash32(1234, data, len, n, b);
+      for (size_t i = 0; i < n; ++i) {
+	ASSERT_EQ(b[i], a[i]) << "xxhash32 len " << len << " n " << n;
+      }
+      ceph_xxhash64_mb(-1, data, len, n, c);
+      ceph_csum_mb_generic.xxhash64(-1, data, len, n, d);
+      for (size_t i = 0; i < n; ++i) {
+	ASSERT_EQ(d[i], c[i]) << "xxhash64 len " << len << " n " << n;
+      }
+    }
+  }
+}
+
+template<class Alg>
+static void check_checksummer(size_t csum_block_size)
+{
+  // several buffers, some of which split csum blocks
+  bufferlist bl;
+  bl.append(random_buffer(csum_block_size * 40));
+  bl.append(random_buffer(csum_block_size / 2));
+  bl.append(random_buffer(csum_block_size * 7 + csum_block_size / 2));
+  bl.append(random_buffer(csum_block_size * 3));
+  size_t blocks = bl.length() / csum_block_size;
+  bufferptr csum_data(blocks * sizeof(typename Alg::value_t));
+  Checksummer::calculate<Alg>(csum_block_size, 0, bl.length(), bl,
+			      &csum_data);
+
+  // compare against one block at a time
+  typename Alg::state_t state;
+  Alg::init(&state);
+  bufferlist::const_iterator p = bl.begin();
+  const typename Alg::value_t *pv =
+    reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
+  for (size_t i = 0; i < blocks; ++i) {
+    typename Alg::value_t v = Alg::calc(state, -1, csum_block_size, p);
+    ASSERT_EQ(v, pv[i]) << "block " << i;
+  }
+  Alg::fini(&state);
+
+  uint64_t bad_csum = 0;
+  ASSERT_EQ(-1, Checksummer::verify<Alg>(csum_block_size, 0, bl.length(), bl,
+					 csum_data, &bad_csum));
+
+  // corrupt one block inside a batch and one straddling two buffers
+  for (size_t bad_block : {size_t(17), size_t(40)}) {
+    bufferlist bad;
+    for (auto& bp : bl.buffers()) {
+      bad.append(bufferptr(bp.c_str(), bp.length()));
+    }
+    size_t off = bad_block * csum_block_size + csum_block_size - 1;
+    char c = bad[off] ^ 1;
+    bad.copy_in(off, 1, &c);
+    ASSERT_EQ((int)(bad_block * csum_block_size),
+	      Checksummer::verify<Alg>(csum_block_size, 0, bad.length(), bad,
+				       csum_data, &bad_csum));
+  }
+}
+
+TEST(CsumMb, Checksummer) {
+  for (size_t csum_block_size : {4096, 8192}) {
+    check_checksummer<Checksummer::crc32c>(csum_block_size);
+    check_checksummer<Checksummer::crc32c_16>(csum_block_size);
+    check_checksummer<Checksummer::crc32c_8>(csum_block_size);
+    check_checksummer<Checksummer::xxhash32>(csum_block_size);
+    check_checksummer<Checksummer::xxhash64>(csum_block_size);
+  }
+}
+
+TEST(CsumMb, Performance) {
+  const size_t len = 64 << 20;
+  const size_t chunk_len = 4096;
+  const size_t n = Checksummer::mb_batch;
+  const int count = 20;
+  bufferptr bp = random_buffer(len);
+  const unsigned char *data = (const unsigned char *)bp.c_str();
+  uint32_t out32[Checksummer::mb_batch];
+  uint64_t out64[Checksummer::mb_batch];
+
+  const ceph_csum_mb_impl_t *impls[] = { &ceph_csum_mb_generic, &ceph_csum_mb };
+
+  std::cout << "csum_mb implementation: " << ceph_csum_mb.name << std::endl;
+  for (const ceph_csum_mb_impl_t *impl : impls) {
+    for (const char *alg : { "crc32c", "xxhash32", "xxhash64" }) {
+      ceph::mono_clock::time_point start = ceph::mono_clock::now();
+      for (int i = 0; i < count; ++i) {
+	for (size_t off = 0; off + n * chunk_len <= len; off += n * chunk_len) {
+	  if (strcmp(alg, "crc32c") == 0) {
+	    impl->crc32c(-1, data + off, chunk_len, n, out32);
+	  } else if (strcmp(alg, "xxhash32") == 0) {
+	    impl->xxhash32(-1, data + off, chunk_len, n, out32);
+	  } else {
+	    impl->xxhash64(-1, data + off, chunk_len, n, out64);
+	  }
+	}
+      }
+      ceph::mono_clock::time_point end = ceph::mono_clock::now();
+      auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	end - start);
+      double gbsec = (double)count * (double)len / (double)dur.count();
+      std::cout << (impl == &ceph_csum_mb_generic ? "generic " : "mb ")
+		<< alg << ": " << gbsec << " GB/sec" << std::endl;
+    }
+  }
+}
@@ -148,6 +148,7 @@ TYPE(bluestore_blob_use_tracker_t)
 // approach.
 // TYPE_FEATUREFUL(bluestore_blob_t)
 // TYPE(bluestore_shared_blob_t) there is no encode here
+TYPE(bluestore_shared_blob_delta_t)
 TYPE(bluestore_onode_t)
 TYPE(bluestore_deferred_op_t)
 TYPE(bluestore_deferred_transaction_t)
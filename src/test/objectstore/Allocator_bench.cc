@@ -5,6 +5,7 @@
  * Author: Igor Fedotov, ifedotov@suse.com
  */
 #include <iostream>
+#include <thread>
 #include <boost/scoped_ptr.hpp>
 #include <gtest/gtest.h>
 
@@ -40,6 +41,8 @@ public:
   }
   void doOverwriteTest(uint64_t capacity, uint64_t prefill,
     uint64_t overwrite);
+  void doMultiThreadTest(uint64_t capacity, size_t num_threads,
+    uint64_t ops_per_thread);
 };
 
 const uint64_t _1m = 1024 * 1024;
@@ -329,6 +332,72 @@ TEST_P(AllocTest, test_alloc_bench_10_300)
   doOverwriteTest(capacity, prefill, overwrite);
 }
 
+void AllocTest::doMultiThreadTest(uint64_t capacity, size_t num_threads,
+  uint64_t ops_per_thread)
+{
+  uint64_t alloc_unit = 4096;
+
+  init_alloc(capacity, alloc_unit);
+  alloc->init_add_free(0, capacity);
+
+  auto worker = [&](size_t n) {
+    gen_type rng(time(NULL) + n);
+    boost::uniform_int<> u1(0, 4); // 4K-64K
+    PExtentVector held, tmp;
+    for (uint64_t i = 0; i < ops_per_thread; ++i) {
+      uint64_t want = alloc_unit << u1(rng);
+      tmp.clear();
+      auto r = alloc->allocate(want, alloc_unit, want, 0, &tmp);
+      ASSERT_EQ((int64_t)want, r);
+      held.insert(held.end(), tmp.begin(), tmp.end());
+      // keep a bounded working set per thread
+      while (held.size() > 256) {
+	size_t pos = rng() % held.size();
+	interval_set<uint64_t> release_set;
+	release_set.insert(held[pos].offset, held[pos].length);
+	alloc->release(release_set);
+	held[pos] = held.back();
+	held.pop_back();
+      }
+    }
+    alloc->release(held);
+  };
+
+  utime_t start = ceph_clock_now();
+  std::vector<std::thread> threads;
+  for (size_t n = 0; n < num_threads; ++n) {
+    threads.emplace_back(worker, n);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  utime_t dur = ceph_clock_now() - start;
+  std::cout << num_threads << " threads: "
+	    << num_threads * ops_per_thread / (double)dur
+	    << " allocs/sec" << std::endl;
+  EXPECT_EQ(capacity, alloc->get_free());
+  init_close();
+}
+
+TEST_P(AllocTest, test_alloc_bench_mt)
+{
+  uint64_t capacity = uint64_t(1024) * 1024 * 1024 * 1024;
+  vector<string> shard_settings = { "0" };
+  if (string(GetParam()) == "bitmap") {
+    shard_settings.push_back(stringify(std::thread::hardware_concurrency()));
+  }
+  for (auto& shards : shard_settings) {
+    g_ceph_context->_conf->set_val("bluestore_bitmap_allocator_shards",
+				   shards);
+    std::cout << "bluestore_bitmap_allocator_shards = " << shards
+	      << std::endl;
+    for (size_t num_threads : { 1, 2, 4, 8, 16 }) {
+      doMultiThreadTest(capacity, num_threads, 200000);
+    }
+  }
+  g_ceph_context->_conf->set_val("bluestore_bitmap_allocator_shards", "0");
+}
+
 INSTANTIATE_TEST_CASE_P(
   Allocator,
   AllocTest,
@@ -316,6 +316,27 @@ TEST_P(AllocTest, test_alloc_bug_24598)
   EXPECT_EQ(tmp.size(), 1);
 }
 
+TEST_P(AllocTest, test_alloc_dump_free)
+{
+  uint64_t capacity = 4 * 1024 * 1024;
+  uint64_t alloc_unit = 4096;
+
+  init_alloc(capacity, alloc_unit);
+  alloc->init_add_free(0, capacity);
+  alloc->init_rm_free(0x10000, 0x2000);
+  alloc->init_rm_free(0x20000, 0x1000);
+
+  interval_set<uint64_t> free;
+  alloc->dump([&](uint64_t offset, uint64_t length) {
+      free.insert(offset, length);
+    });
+  EXPECT_EQ(alloc->get_free(), free.size());
+  EXPECT_EQ(3u, free.num_intervals());
+  EXPECT_TRUE(free.contains(0, 0x10000));
+  EXPECT_TRUE(free.contains(0x12000, 0xe000));
+  EXPECT_TRUE(free.contains(0x21000, capacity - 0x21000));
+}
+
 INSTANTIATE_TEST_CASE_P(
   Allocator,
   AllocTest,
@@ -28,6 +28,7 @@
 #include "os/filestore/FileStore.h"
 #if defined(WITH_BLUESTORE)
 #include "os/bluestore/BlueStore.h"
+#include "os/bluestore/io_uring.h"
 #endif
 #include "include/Context.h"
 #include "common/ceph_argparse.h"
@@ -862,6 +863,60 @@ TEST_P(StoreTest, BufferCacheReadTest) {
   }
 }
 
+TEST_P(StoreTest, IsCachedTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_FALSE(store->is_cached(ch, hoid, 0, 0));
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(0x20000, 'a'));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+
+  // nothing is loaded after a remount
+  ASSERT_FALSE(store->is_cached(ch, hoid, 0, 0));
+  ASSERT_FALSE(store->is_cached(ch, hoid, 0, 0x1000));
+  {
+    bufferlist bl;
+    r = store->read(ch, hoid, 0, 0x10000, bl);
+    ASSERT_EQ(r, 0x10000);
+  }
+  ASSERT_TRUE(store->is_cached(ch, hoid, 0, 0));
+  ASSERT_TRUE(store->is_cached(ch, hoid, 0, 0x10000));
+  ASSERT_TRUE(store->is_cached(ch, hoid, 0x1000, 0x1000));
+  ASSERT_FALSE(store->is_cached(ch, hoid, 0x10000, 0x1000));
+  ASSERT_FALSE(store->is_cached(ch, hoid, 0, 0x20000));
+  // past eof there is nothing to read
+  ASSERT_TRUE(store->is_cached(ch, hoid, 0x20000, 0x1000));
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 void StoreTest::doCompressionTest()
 {
   int r;
@@ -5818,6 +5873,34 @@ TEST_P(StoreTestSpecificAUSize, Many4KWritesNoCSumTest) {
   doMany4KWritesTest(store, 1, 1000, max_object, 4*1024, 0 );
 }
 
+TEST_P(StoreTestSpecificAUSize, Many4KWritesIoUringTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  if (!ioring_queue_t::supported()) {
+    cout << "io_uring not supported, skipping" << std::endl;
+    return;
+  }
+  SetVal(g_conf, "bdev_ioring", "true");
+  StartDeferred(0x10000);
+
+  map<string,string> pm;
+  store->collect_metadata(&pm);
+  ASSERT_EQ("io_uring", pm["bluestore_bdev_aio_backend"]);
+
+  const unsigned max_object = 4*1024*1024;
+  doMany4KWritesTest(store, 1, 1000, max_object, 4*1024, 0);
+}
+
+TEST_P(StoreTestSpecificAUSize, Many4KWritesKVSyncLanesTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf, "bluestore_kv_sync_lanes", "4");
+  StartDeferred(0x10000);
+
+  const unsigned max_object = 4*1024*1024;
+  doMany4KWritesTest(store, 1, 1000, max_object, 4*1024, 0);
+}
+
 TEST_P(StoreTestSpecificAUSize, TooManyBlobsTest) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -5941,6 +6024,653 @@ TEST_P(StoreTestSpecificAUSize, OnodeSizeTracking) {
   }
 }
 
+TEST_P(StoreTestSpecificAUSize, OnodeWarmupOnMount) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_onode_warmup", "true");
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  const unsigned num_objects = 20;
+  uint64_t total_bytes, total_onodes;
+
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  bufferlist bl;
+  bl.append(std::string(4096, 'a'));
+  for (unsigned i = 0; i < num_objects; ++i) {
+    ObjectStore::Transaction t;
+    ghobject_t hoid(hobject_t("warmup_" + stringify(i), "", CEPH_NOSNAP, 0, -1, ""));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  get_mempool_stats(&total_bytes, &total_onodes);
+  ASSERT_EQ(total_onodes, 0u);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+
+  // the onodes are loaded in the background; give it a moment
+  for (unsigned i = 0; i < 100; ++i) {
+    get_mempool_stats(&total_bytes, &total_onodes);
+    if (total_onodes >= num_objects)
+      break;
+    usleep(100000);
+  }
+  ASSERT_GE(total_onodes, num_objects);
+
+  ch = store->open_collection(cid);
+  for (unsigned i = 0; i < num_objects; ++i) {
+    bufferlist in;
+    ghobject_t hoid(hobject_t("warmup_" + stringify(i), "", CEPH_NOSNAP, 0, -1, ""));
+    r = store->read(ch, hoid, 0, bl.length(), in);
+    ASSERT_EQ((int)bl.length(), r);
+    ASSERT_TRUE(bl_eq(bl, in));
+  }
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i < num_objects; ++i) {
+      t.remove(cid, ghobject_t(hobject_t("warmup_" + stringify(i), "", CEPH_NOSNAP, 0, -1, "")));
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, FastTierPlacement) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_fast_tier_size", "268435456");
+  SetVal(g_conf, "bluestore_fast_tier_promote_hits", "2");
+  SetVal(g_conf, "bluestore_fast_tier_migrate_interval", ".1");
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  const PerfCounters* logger = store->get_perf_counters();
+  ghobject_t hot(hobject_t("fast_tier_hot", "", CEPH_NOSNAP, 0, -1, ""));
+  ghobject_t cold(hobject_t("fast_tier_cold", "", CEPH_NOSNAP, 0, -1, ""));
+  ghobject_t big(hobject_t("fast_tier_big", "", CEPH_NOSNAP, 0, -1, ""));
+
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  bufferlist small_bl, big_bl;
+  small_bl.append(std::string(4096, 'a'));
+  big_bl.append(std::string(1048576, 'b'));
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hot, 0, small_bl.length(), small_bl);
+    t.write(cid, cold, 0, small_bl.length(), small_bl,
+	    CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    t.write(cid, big, 0, big_bl.length(), big_bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // the object written with DONTNEED lands in the slow tier; reading it
+  // repeatedly should get it promoted in the background.
+  for (unsigned i = 0; i < 5; ++i) {
+    bufferlist in;
+    r = store->read(ch, cold, 0, small_bl.length(), in);
+    ASSERT_EQ((int)small_bl.length(), r);
+    ASSERT_TRUE(bl_eq(small_bl, in));
+  }
+  for (unsigned i = 0; i < 100; ++i) {
+    if (logger->get(l_bluestore_fast_tier_promoted) > 0)
+      break;
+    usleep(100000);
+  }
+  ASSERT_GE(logger->get(l_bluestore_fast_tier_promoted), 1u);
+
+  {
+    bufferlist in;
+    r = store->read(ch, hot, 0, small_bl.length(), in);
+    ASSERT_EQ((int)small_bl.length(), r);
+    ASSERT_TRUE(bl_eq(small_bl, in));
+    in.clear();
+    r = store->read(ch, cold, 0, small_bl.length(), in);
+    ASSERT_EQ((int)small_bl.length(), r);
+    ASSERT_TRUE(bl_eq(small_bl, in));
+    in.clear();
+    r = store->read(ch, big, 0, big_bl.length(), in);
+    ASSERT_EQ((int)big_bl.length(), r);
+    ASSERT_TRUE(bl_eq(big_bl, in));
+  }
+
+  // and everything survives a remount
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  {
+    bufferlist in;
+    r = store->read(ch, cold, 0, small_bl.length(), in);
+    ASSERT_EQ((int)small_bl.length(), r);
+    ASSERT_TRUE(bl_eq(small_bl, in));
+    in.clear();
+    r = store->read(ch, big, 0, big_bl.length(), in);
+    ASSERT_EQ((int)big_bl.length(), r);
+    ASSERT_TRUE(bl_eq(big_bl, in));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hot);
+    t.remove(cid, cold);
+    t.remove(cid, big);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, Defrag) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_defrag_interval", ".1");
+  SetVal(g_conf, "bluestore_defrag_min_fragmentation", "0");
+  SetVal(g_conf, "bluestore_defrag_min_extents", "4");
+  SetVal(g_conf, "bluestore_defrag_extent_ratio", "2");
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  const PerfCounters* logger = store->get_perf_counters();
+  ghobject_t a(hobject_t("defrag_a", "", CEPH_NOSNAP, 0, -1, ""));
+  ghobject_t b(hobject_t("defrag_b", "", CEPH_NOSNAP, 0, -1, ""));
+
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // interleave the two objects' allocations so each ends up spread over
+  // one extent per write
+  bufferlist a_bl, b_bl;
+  for (unsigned i = 0; i < 32; ++i) {
+    bufferlist abl, bbl;
+    abl.append(std::string(4096, 'a' + i % 26));
+    bbl.append(std::string(4096, 'A' + i % 26));
+    ObjectStore::Transaction t;
+    t.write(cid, a, i * 4096, abl.length(), abl);
+    t.write(cid, b, i * 4096, bbl.length(), bbl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    a_bl.append(abl);
+    b_bl.append(bbl);
+  }
+
+  for (unsigned i = 0; i < 100; ++i) {
+    if (logger->get(l_bluestore_defrag_objects) >= 2)
+      break;
+    usleep(100000);
+  }
+  ASSERT_GE(logger->get(l_bluestore_defrag_objects), 2u);
+  SetVal(g_conf, "bluestore_defrag_interval", "0");
+
+  {
+    bufferlist in;
+    r = store->read(ch, a, 0, a_bl.length(), in);
+    ASSERT_EQ((int)a_bl.length(), r);
+    ASSERT_TRUE(bl_eq(a_bl, in));
+    in.clear();
+    r = store->read(ch, b, 0, b_bl.length(), in);
+    ASSERT_EQ((int)b_bl.length(), r);
+    ASSERT_TRUE(bl_eq(b_bl, in));
+  }
+
+  // and the rewritten data survives a remount
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  {
+    bufferlist in;
+    r = store->read(ch, a, 0, a_bl.length(), in);
+    ASSERT_EQ((int)a_bl.length(), r);
+    ASSERT_TRUE(bl_eq(a_bl, in));
+    in.clear();
+    r = store->read(ch, b, 0, b_bl.length(), in);
+    ASSERT_EQ((int)b_bl.length(), r);
+    ASSERT_TRUE(bl_eq(b_bl, in));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove(cid, b);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, CompressionSampling) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_compression_mode", "force");
+  SetVal(g_conf, "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf, "bluestore_compression_algorithm_cold", "zlib");
+  SetVal(g_conf, "bluestore_compression_sample_size", "4096");
+  StartDeferred(65536);
+
+  int r;
+  coll_t cid;
+  const PerfCounters* logger = store->get_perf_counters();
+  ghobject_t hoid(hobject_t("random", "", CEPH_NOSNAP, 0, -1, ""));
+  ghobject_t hoid2(hobject_t("text", "", CEPH_NOSNAP, 0, -1, ""));
+  ghobject_t hoid3(hobject_t("cold", "", CEPH_NOSNAP, 0, -1, ""));
+
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // incompressible data is rejected from a sample
+  std::string rnd(0x40000, 0);
+  for (auto& c : rnd) {
+    c = rand();
+  }
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(rnd);
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_GT(logger->get(l_bluestore_compress_skipped_count), 0u);
+  ASSERT_EQ(logger->get(l_bluestore_compress_skipped_bytes), rnd.size());
+  ASSERT_EQ(logger->get(l_bluestore_compress_success_count), 0u);
+  ASSERT_EQ(logger->get(l_bluestore_compress_rejected_count), 0u);
+
+  // compressible data is still compressed
+  std::string txt;
+  for (size_t i = 0; i < 0x40000; i++) {
+    txt.push_back('a' + i / 256 % 26);
+  }
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(txt);
+    t.write(cid, hoid2, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_GT(logger->get(l_bluestore_compress_success_count), 0u);
+  ASSERT_EQ(logger->get(l_bluestore_compress_skipped_bytes), rnd.size());
+  {
+    struct store_statfs_t statfs;
+    ASSERT_EQ(0, store->statfs(&statfs));
+    ASSERT_EQ(statfs.compressed_original, txt.size());
+  }
+
+  // write-once, sequentially read data goes to the cold compressor
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(txt);
+    t.set_alloc_hint(cid, hoid3, 0x40000, 0x40000,
+		     CEPH_OSD_ALLOC_HINT_FLAG_SEQUENTIAL_READ |
+		     CEPH_OSD_ALLOC_HINT_FLAG_IMMUTABLE);
+    t.write(cid, hoid3, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  {
+    JSONFormatter f(false);
+    store->dump_compression_stats(&f);
+    stringstream ss;
+    f.flush(ss);
+    ASSERT_NE(string::npos, ss.str().find("\"skipped_bytes\":" +
+					  stringify(rnd.size())));
+    ASSERT_EQ(string::npos, ss.str().find("\"cold\":0"));
+  }
+
+  for (auto& p : { make_pair(hoid, &rnd), make_pair(hoid2, &txt),
+		   make_pair(hoid3, &txt) }) {
+    bufferlist in, expected;
+    expected.append(*p.second);
+    r = store->read(ch, p.first, 0, 0, in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove(cid, hoid3);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, SharedBlobMerge) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  StartDeferred(65536);
+
+  int r;
+  coll_t cid;
+  const PerfCounters* logger = store->get_perf_counters();
+  ghobject_t hoid(hobject_t("head", "", CEPH_NOSNAP, 0, -1, ""));
+  ghobject_t snap1(hobject_t("head", "", 1, 0, -1, ""));
+  ghobject_t snap2(hobject_t("head", "", 2, 0, -1, ""));
+
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  bufferlist orig;
+  orig.append(std::string(0x40000, 'a'));
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, orig.length(), orig);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // the first clone creates the shared blobs...
+  {
+    ObjectStore::Transaction t;
+    t.clone(cid, hoid, snap1);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(logger->get(l_bluestore_shared_blob_merges), 0u);
+
+  // ...further clones and overwrites only move refs around
+  {
+    ObjectStore::Transaction t;
+    t.clone(cid, hoid, snap2);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  uint64_t merges = logger->get(l_bluestore_shared_blob_merges);
+  ASSERT_GT(merges, 0u);
+  bufferlist head;
+  head.append(std::string(0x10000, 'b'));
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, head.length(), head);
+    t.remove(cid, snap1);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_GT(logger->get(l_bluestore_shared_blob_merges), merges);
+
+  // the merged records must agree with the objects
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  ASSERT_EQ(store->fsck(false), 0);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  {
+    bufferlist in, expected;
+    r = store->read(ch, snap2, 0, 0, in);
+    ASSERT_EQ((int)orig.length(), r);
+    ASSERT_TRUE(bl_eq(orig, in));
+    in.clear();
+    expected.append(head);
+    expected.append(std::string(orig.length() - head.length(), 'a'));
+    r = store->read(ch, hoid, 0, 0, in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+
+  // dropping the last sharer removes the records
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, snap2);
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  ASSERT_EQ(store->fsck(false), 0);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+}
+
+TEST_P(StoreTestSpecificAUSize, InlineData) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_inline_data_max", "4096");
+  StartDeferred(65536);
+
+  int r;
+  coll_t cid;
+  const PerfCounters* logger = store->get_perf_counters();
+  ghobject_t hoid(hobject_t("inline", "", CEPH_NOSNAP, 0, -1, ""));
+  ghobject_t hoid2(hobject_t("inline_clone", "", CEPH_NOSNAP, 0, -1, ""));
+
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // small writes stay in the onode and take no space
+  struct store_statfs_t statfs0, statfs;
+  ASSERT_EQ(0, store->statfs(&statfs0));
+  bufferlist expected;
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(100, 'a'));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    bufferlist bl2;
+    bl2.append(std::string(50, 'b'));
+    t.write(cid, hoid, 200, bl2.length(), bl2);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    expected.append(bl);
+    expected.append_zero(100);
+    expected.append(bl2);
+  }
+  ASSERT_EQ(logger->get(l_bluestore_write_inline), 2u);
+  ASSERT_EQ(0, store->statfs(&statfs));
+  ASSERT_EQ(statfs0.allocated, statfs.allocated);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, 0, in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_TRUE(bl_eq(expected, in));
+    in.clear();
+    r = store->read(ch, hoid, 190, 20, in);
+    ASSERT_EQ(20, r);
+    bufferlist e;
+    e.substr_of(expected, 190, 20);
+    ASSERT_TRUE(bl_eq(e, in));
+  }
+
+  // zero, truncate and clone of an inline object
+  {
+    ObjectStore::Transaction t;
+    t.zero(cid, hoid, 10, 20);
+    t.truncate(cid, hoid, 240);
+    t.clone(cid, hoid, hoid2);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    bufferlist e;
+    e.substr_of(expected, 0, 10);
+    e.append_zero(20);
+    bufferlist tail;
+    tail.substr_of(expected, 30, 210);
+    e.append(tail);
+    expected.swap(e);
+  }
+  for (auto& o : { hoid, hoid2 }) {
+    bufferlist in;
+    r = store->read(ch, o, 0, 0, in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+
+  // growing past the limit moves the data into blobs
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(8192, 'c'));
+    t.write(cid, hoid, 1000, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    expected.append_zero(1000 - expected.length());
+    expected.append(bl);
+  }
+  ASSERT_EQ(0, store->statfs(&statfs));
+  ASSERT_LT(statfs0.allocated, statfs.allocated);
+
+  // and everything survives a remount
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, 0, in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_TRUE(bl_eq(expected, in));
+    in.clear();
+    r = store->read(ch, hoid2, 0, 0, in);
+    ASSERT_EQ(240, r);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, DeferredElevator) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_deferred_elevator_hdd", "true");
+  SetVal(g_conf, "bluestore_deferred_elevator_ssd", "true");
+  SetVal(g_conf, "bluestore_deferred_batch_ops", "8");
+  SetVal(g_conf, "bluestore_prefer_deferred_size", "65536");
+  StartDeferred(65536);
+
+  int r;
+  const unsigned num_colls = 4;
+  const unsigned obj_size = 262144;
+  const PerfCounters* logger = store->get_perf_counters();
+  vector<coll_t> cids;
+  vector<ObjectStore::CollectionHandle> chs;
+  ghobject_t hoid(hobject_t("deferred_elevator", "", CEPH_NOSNAP, 0, -1, ""));
+  vector<bufferlist> expected(num_colls);
+  for (unsigned c = 0; c < num_colls; ++c) {
+    cids.push_back(coll_t(spg_t(pg_t(c, 1), shard_id_t::NO_SHARD)));
+    chs.push_back(store->create_new_collection(cids.back()));
+    ObjectStore::Transaction t;
+    t.create_collection(cids.back(), 0);
+    expected[c].append(std::string(obj_size, 'a' + c));
+    t.write(cids.back(), hoid, 0, obj_size, expected[c]);
+    r = queue_transaction(store, chs.back(), std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // small overwrites from every sequencer, interleaved, go through the
+  // deferred path and are flushed together
+  uint64_t passes = logger->get(l_bluestore_deferred_elevator_passes);
+  for (unsigned i = 0; i < 16; ++i) {
+    for (unsigned c = 0; c < num_colls; ++c) {
+      uint64_t off = ((i * 7 + c * 3) % (obj_size / 4096)) * 4096;
+      bufferlist bl;
+      bl.append(std::string(4096, 'A' + (i + c) % 26));
+      ObjectStore::Transaction t;
+      t.write(cids[c], hoid, off, bl.length(), bl);
+      r = queue_transaction(store, chs[c], std::move(t));
+      ASSERT_EQ(r, 0);
+      bufferlist e;
+      e.substr_of(expected[c], 0, off);
+      e.append(bl);
+      bufferlist tail;
+      tail.substr_of(expected[c], off + 4096, obj_size - off - 4096);
+      e.append(tail);
+      expected[c].swap(e);
+    }
+  }
+  for (unsigned i = 0; i < 100; ++i) {
+    if (logger->get(l_bluestore_deferred_elevator_passes) > passes)
+      break;
+    usleep(100000);
+  }
+  ASSERT_GT(logger->get(l_bluestore_deferred_elevator_passes), passes);
+
+  // read back from disk, not from the cache
+  chs.clear();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  for (unsigned c = 0; c < num_colls; ++c) {
+    auto ch = store->open_collection(cids[c]);
+    bufferlist in;
+    r = store->read(ch, hoid, 0, obj_size, in);
+    ASSERT_EQ((int)obj_size, r);
+    ASSERT_TRUE(bl_eq(expected[c], in));
+    ObjectStore::Transaction t;
+    t.remove(cids[c], hoid);
+    t.remove_collection(cids[c]);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, BlobReuseOnOverwrite) {
 
   if (string(GetParam()) != "bluestore")
@@ -6984,6 +7714,78 @@ TEST_P(StoreTest, BluestoreRepairTest) {
   cerr << "Completing" << std::endl;
   bstore->mount();
 }
+
+TEST_P(StoreTest, BluestoreFsckThreads) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_fsck_on_mount", "false");
+  SetVal(g_conf, "bluestore_fsck_on_umount", "false");
+  SetVal(g_conf, "bluestore_max_blob_size", "65536");
+  SetVal(g_conf, "bluestore_extent_map_shard_max_size", "12000");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+
+  // enough objects to fill several worker batches, with clones (shared
+  // blobs), sharded extent maps and omaps
+  coll_t cid(spg_t(pg_t(0,555), shard_id_t::NO_SHARD));
+  ghobject_t hoid_ff;  // unshared, with several blobs
+  {
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    for (unsigned i = 0; i < 400; ++i) {
+      ObjectStore::Transaction t;
+      ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i),
+					  CEPH_NOSNAP)));
+      if (i == 3) {
+	hoid_ff = hoid;
+      }
+      bufferlist bl;
+      bl.append(string(4096 + i * 37, 'a' + i % 26));
+      for (unsigned j = 0; j < 1 + i % 8; ++j) {
+	t.write(cid, hoid, j * 65536, bl.length(), bl);
+      }
+      if (i % 10 == 0) {
+	ghobject_t clone = hoid;
+	clone.hobj.snap = 1;
+	t.clone(cid, hoid, clone);
+      }
+      if (i % 7 == 0) {
+	map<string, bufferlist> m;
+	m["key" + stringify(i)] = bl;
+	t.omap_setkeys(cid, hoid, m);
+      }
+      r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+  bstore->umount();
+
+  for (auto threads : { "1", "4" }) {
+    cerr << "fsck with " << threads << " thread(s)" << std::endl;
+    SetVal(g_conf, "bluestore_fsck_threads", threads);
+    g_ceph_context->_conf->apply_changes(NULL);
+    ASSERT_EQ(bstore->fsck(false), 0);
+    ASSERT_EQ(bstore->fsck(true), 0);
+  }
+
+  bstore->mount();
+  bstore->inject_false_free(cid, hoid_ff);
+  bstore->umount();
+  for (auto threads : { "1", "4" }) {
+    SetVal(g_conf, "bluestore_fsck_threads", threads);
+    g_ceph_context->_conf->apply_changes(NULL);
+    ASSERT_EQ(bstore->fsck(false), 2);
+  }
+  ASSERT_EQ(bstore->repair(false), 0);
+  ASSERT_EQ(bstore->fsck(true), 0);
+  bstore->mount();
+}
+
 TEST_P(StoreTest, BluestoreStatistics) {
   if (string(GetParam()) != "bluestore")
     return;
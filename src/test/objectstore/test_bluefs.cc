@@ -567,6 +567,129 @@ TEST(BlueFS, test_replay) {
   rm_temp_bdev(fn);
 }
 
+void fsync_stress(BlueFS &fs, int id, utime_t end, uint64_t *ops,
+		  uint64_t *bytes)
+{
+  string dir = "dir.stress." + to_string(id);
+  ASSERT_EQ(0, fs.mkdir(dir));
+  BlueFS::FileWriter *h;
+  ASSERT_EQ(0, fs.open_for_write(dir, "wal", &h, false));
+  ASSERT_NE(nullptr, h);
+  h->writer_type = BlueFS::WRITER_WAL;
+  std::unique_ptr<char[]> buf = gen_buffer(ALLOC_SIZE);
+  // cap the op count too; every fsync also appends a block to the log
+  while (*ops < 1024 && ceph_clock_now() < end) {
+    h->append(buf.get(), ALLOC_SIZE);
+    ASSERT_EQ(0, fs.fsync(h));
+    ++*ops;
+    *bytes += ALLOC_SIZE;
+  }
+  fs.close_writer(h);
+}
+
+TEST(BlueFS, test_fsync_stress) {
+  uint64_t size = 1048576 * 256;
+  const int num_threads = 8;
+  g_ceph_context->_conf->set_val(
+    "bluefs_alloc_size",
+    "65536");
+  for (auto depth : { "1", "2", "4" }) {
+    g_ceph_context->_conf->set_val("bluefs_log_flush_pipeline_depth", depth);
+    g_ceph_context->_conf->apply_changes(NULL);
+
+    string fn = get_temp_bdev(size);
+    BlueFS fs(g_ceph_context);
+    ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, fn, false));
+    fs.add_block_extent(BlueFS::BDEV_DB, 1048576, size - 1048576);
+    uuid_d fsid;
+    ASSERT_EQ(0, fs.mkfs(fsid));
+    ASSERT_EQ(0, fs.mount());
+
+    vector<uint64_t> ops(num_threads, 0), bytes(num_threads, 0);
+    utime_t start = ceph_clock_now();
+    utime_t end = start;
+    end += 2.0;
+    {
+      std::vector<std::thread> threads;
+      for (int i = 0; i < num_threads; ++i) {
+	threads.push_back(std::thread(fsync_stress, std::ref(fs), i, end,
+				      &ops[i], &bytes[i]));
+      }
+      join_all(threads);
+    }
+    double elapsed = ceph_clock_now() - start;
+    uint64_t total = 0;
+    for (auto o : ops) {
+      total += o;
+    }
+    std::cout << "pipeline depth " << depth << ": " << num_threads
+	      << " writers, " << total << " fsyncs in " << elapsed << "s, "
+	      << (double)total / elapsed << " fsyncs/sec" << std::endl;
+    fs.umount();
+
+    // everything we fsynced must survive a remount
+    ASSERT_EQ(0, fs.mount());
+    for (int i = 0; i < num_threads; ++i) {
+      uint64_t fsize = 0;
+      utime_t mtime;
+      ASSERT_EQ(0, fs.stat("dir.stress." + to_string(i), "wal",
+			   &fsize, &mtime));
+      ASSERT_EQ(bytes[i], fsize);
+    }
+    fs.umount();
+    rm_temp_bdev(fn);
+  }
+  g_ceph_context->_conf->set_val("bluefs_log_flush_pipeline_depth", "2");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+#if defined(HAVE_PMEM)
+TEST(BlueFS, pmem_emulated_wal) {
+  uint64_t size = 1048576 * 128;
+  g_ceph_context->_conf->set_val("bdev_pmem_emulate", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+  auto reset = make_scope_guard([] {
+    g_ceph_context->_conf->set_val("bdev_pmem_emulate", "false");
+    g_ceph_context->_conf->apply_changes(NULL);
+  });
+  string fn = get_temp_bdev(size);
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, fn, false));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, size - 1048576);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+  {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.mkdir("dir"));
+    ASSERT_EQ(0, fs.open_for_write("dir", "wal", &h, false));
+    h->writer_type = BlueFS::WRITER_WAL;
+    for (unsigned i = 0; i < 1000; ++i) {
+      h->append("abcdeabcdeabcdeabcdeabc", 23);
+      ASSERT_EQ(0, fs.fsync(h));
+    }
+    fs.close_writer(h);
+  }
+  fs.umount();
+
+  // synced appends must be readable after a remount replays the log
+  ASSERT_EQ(0, fs.mount());
+  {
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("dir", "wal", &h));
+    bufferlist bl;
+    BlueFS::FileReaderBuffer buf(4096);
+    ASSERT_EQ(23000, fs.read(h, &buf, 0, 23000, &bl, NULL));
+    for (unsigned i = 0; i < 1000; ++i) {
+      ASSERT_EQ(0, strncmp("abcdeabcdeabcdeabcdeabc", bl.c_str() + i * 23, 23));
+    }
+    delete h;
+  }
+  fs.umount();
+  rm_temp_bdev(fn);
+}
+#endif
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -238,6 +238,41 @@ TEST(bluestore_extent_ref_map_t, intersects)
   ASSERT_FALSE(m.intersects(55, 1));
 }
 
+TEST(bluestore_shared_blob_delta_t, apply)
+{
+  bluestore_extent_ref_map_t m;
+  m.get(10, 30);
+  bluestore_shared_blob_delta_t d;
+  d.add(10, 30, 1);
+  d.add(10, 30, 1);
+  d.add(50, 10, 1);
+  d.add(20, 10, -1);
+  ASSERT_EQ(3u, d.records.size());
+  d.add(20, 10, 1);
+  ASSERT_EQ(2u, d.records.size());
+
+  bufferlist bl;
+  encode(d, bl);
+  bluestore_shared_blob_delta_t d2;
+  auto p = bl.cbegin();
+  decode(d2, p);
+  cout << d2 << std::endl;
+  ASSERT_EQ(2u, d2.records.size());
+  ASSERT_EQ(2, d2.records[0].refs);
+
+  d2.apply(&m);
+  cout << m << std::endl;
+  ASSERT_EQ(2u, m.ref_map.size());
+  ASSERT_EQ(3u, m.ref_map[10].refs);
+  ASSERT_EQ(1u, m.ref_map[50].refs);
+
+  bluestore_shared_blob_delta_t put;
+  put.add(10, 30, -3);
+  put.add(50, 10, -1);
+  put.apply(&m);
+  ASSERT_TRUE(m.empty());
+}
+
 TEST(bluestore_blob_t, calc_csum)
 {
   bufferlist bl;
@@ -1179,6 +1214,47 @@ TEST(ExtentMap, compress_extent_map)
   ASSERT_EQ(6u, em.extent_map.size());
 }
 
+TEST(ExtentMap, decode_bench)
+{
+  BlueStore::LRUCache cache(g_ceph_context);
+  BlueStore store(g_ceph_context, "", 4096);
+  BlueStore::CollectionRef coll(new BlueStore::Collection(&store, &cache, coll_t()));
+  BlueStore::Onode onode(coll.get(), ghobject_t(), "");
+  BlueStore::ExtentMap em(&onode);
+
+  // one shard worth of 4k extents, one blob each
+  const unsigned num_extents = 64;
+  for (unsigned i = 0; i < num_extents; ++i) {
+    BlueStore::BlobRef b(coll->new_blob());
+    b->dirty_blob().allocated_test(
+      bluestore_pextent_t(0x100000 + i * 0x10000, 0x1000));
+    b->dirty_blob().init_csum(Checksummer::CSUM_CRC32C, 12, 0x1000);
+    em.extent_map.insert(*new BlueStore::Extent(i * 0x1000, 0, 0x1000, b));
+    b->get_ref(coll.get(), 0, 0x1000);
+  }
+  bufferlist bl;
+  unsigned n = 0;
+  ASSERT_FALSE(em.encode_some(0, num_extents * 0x1000, bl, &n));
+  ASSERT_EQ(num_extents, n);
+  bl.rebuild();
+
+  int count = 20000;
+  ceph::mono_clock::time_point start = ceph::mono_clock::now();
+  for (int i = 0; i < count; ++i) {
+    BlueStore::ExtentMap dm(&onode);
+    ASSERT_EQ(num_extents, dm.decode_some(bl));
+    dm.clear();
+  }
+  ceph::mono_clock::time_point end = ceph::mono_clock::now();
+  auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+  double per_sec = (double)count / (double)dur.count() * 1000000000.0;
+  cout << "decode_some " << num_extents << " extents, "
+       << (double)dur.count() / 1000000000.0 << " seconds, "
+       << per_sec << " decodes/sec, "
+       << per_sec * num_extents << " extents/sec" << std::endl;
+  em.clear();
+}
+
 TEST(GarbageCollector, BasicTest)
 {
   BlueStore::LRUCache cache(g_ceph_context);
@@ -17,6 +17,8 @@
 #include <iostream>
 #include <time.h>
 #include <sys/mount.h>
+#include <atomic>
+#include <thread>
 #include "kv/KeyValueDB.h"
 #include "include/Context.h"
 #include "common/ceph_argparse.h"
@@ -195,6 +197,76 @@ TEST_P(KVTest, BenchCommit) {
   fini();
 }
 
+TEST_P(KVTest, BenchConcurrentReads) {
+  const unsigned nkeys = 10000;
+  const unsigned ops_per_thread = 100000;
+  ASSERT_EQ(0, db->create_and_open(cout));
+  auto val_of = [](unsigned i) {
+    return string(100, 'a' + (i % 26)) + stringify(i);
+  };
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (unsigned i = 0; i < nkeys; ++i) {
+      bufferlist bl;
+      bl.append(val_of(i));
+      t->set("prefix", stringify(i), bl);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+
+  for (unsigned nthreads : { 1, 2, 4, 8 }) {
+    std::atomic<bool> stop = { false };
+    std::atomic<unsigned> errors = { 0 };
+    // a writer keeps rewriting a separate prefix so readers contend with it
+    std::thread writer([&] {
+      unsigned i = 0;
+      while (!stop) {
+	KeyValueDB::Transaction t = db->get_transaction();
+	bufferlist bl;
+	bl.append(val_of(i));
+	t->set("other", stringify(i++ % nkeys), bl);
+	db->submit_transaction(t);
+      }
+    });
+    std::vector<std::thread> readers;
+    utime_t start = ceph_clock_now();
+    for (unsigned n = 0; n < nthreads; ++n) {
+      readers.emplace_back([&, n] {
+	unsigned k = n * 7919;
+	for (unsigned i = 0; i < ops_per_thread; ++i) {
+	  k = (k * 1103515245 + 12345) % nkeys;
+	  if (i % 16 == 0) {
+	    // short range scan
+	    KeyValueDB::Iterator it = db->get_iterator("prefix");
+	    it->lower_bound(stringify(k));
+	    for (unsigned j = 0; j < 8 && it->valid(); ++j, it->next()) {
+	      if (_bl_to_str(it->value()) != val_of(atoi(it->key().c_str())))
+		++errors;
+	    }
+	  } else {
+	    bufferlist bl;
+	    if (db->get("prefix", stringify(k), &bl) < 0 ||
+		_bl_to_str(bl) != val_of(k))
+	      ++errors;
+	  }
+	}
+      });
+    }
+    for (auto& t : readers) {
+      t.join();
+    }
+    utime_t dur = ceph_clock_now() - start;
+    stop = true;
+    writer.join();
+    ASSERT_EQ(0u, errors.load());
+    cout << nthreads << " reader threads: " << (nthreads * ops_per_thread)
+	 << " ops in " << dur << ", "
+	 << (uint64_t)((double)(nthreads * ops_per_thread) / (double)dur)
+	 << " ops/sec" << std::endl;
+  }
+  fini();
+}
+
 struct AppendMOP : public KeyValueDB::MergeOperator {
   void merge_nonexistent(
     const char *rdata, size_t rlen, std::string *new_value) override {
@@ -467,6 +539,169 @@ TEST_P(KVTest, RocksDBCFMerge) {
   fini();
 }
 
+TEST_P(KVTest, RocksDBShardedCFTest) {
+  if(string(GetParam()) != "rocksdb")
+    return;
+
+  std::vector<KeyValueDB::ColumnFamily> cfs;
+  ASSERT_EQ(-EINVAL, KeyValueDB::ColumnFamily::parse_list("O(0)=", &cfs));
+  ASSERT_EQ(-EINVAL, KeyValueDB::ColumnFamily::parse_list("O(2,4-4)=", &cfs));
+  cfs.clear();
+  ASSERT_EQ(0, KeyValueDB::ColumnFamily::parse_list(
+	      "O(4,0-2)=bloom_bits=10 M=block_cache_share=0.1", &cfs));
+  ASSERT_EQ(2u, cfs.size());
+  ASSERT_EQ(0, db->init(g_conf->bluestore_rocksdb_options));
+  cout << "creating a sharded column family and opening it" << std::endl;
+  ASSERT_EQ(0, db->create_and_open(cout, cfs));
+
+  const unsigned num = 200;
+  auto key_of = [](unsigned i) {
+    char k[16];
+    snprintf(k, sizeof(k), "%03u.key", i);
+    return string(k);
+  };
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (unsigned i = 0; i < num; ++i) {
+      bufferlist bl;
+      bl.append(stringify(i));
+      t->set("O", key_of(i), bl);
+      t->set("M", key_of(i), bl);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  auto verify = [&](unsigned first, unsigned last) {
+    KeyValueDB::Iterator iter = db->get_iterator("O");
+    unsigned i = first;
+    for (iter->seek_to_first(); iter->valid(); iter->next(), ++i) {
+      ASSERT_EQ(key_of(i), iter->key());
+      ASSERT_EQ(stringify(i), _bl_to_str(iter->value()));
+    }
+    ASSERT_EQ(last, i);
+    // walk backwards, and switch direction mid-way
+    iter->seek_to_last();
+    for (i = last; i > first; --i) {
+      ASSERT_TRUE(iter->valid());
+      ASSERT_EQ(key_of(i - 1), iter->key());
+      iter->prev();
+    }
+    ASSERT_FALSE(iter->valid());
+    // a seek positions only the shard owning the key's hashed bytes;
+    // walking on must still visit every later key in order
+    iter->lower_bound(key_of(first + 1));
+    for (i = first + 1; iter->valid(); iter->next(), ++i) {
+      ASSERT_EQ(key_of(i), iter->key());
+    }
+    ASSERT_EQ(last, i);
+    iter->lower_bound(key_of((first + last) / 2));
+    iter->prev();
+    iter->next();
+    iter->next();
+    ASSERT_TRUE(iter->valid());
+    ASSERT_EQ(key_of((first + last) / 2 + 1), iter->key());
+    bufferlist v;
+    ASSERT_EQ(0, db->get("O", key_of(first), &v));
+    ASSERT_EQ(stringify(first), _bl_to_str(v));
+  };
+  verify(0, num);
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rm_range_keys("O", key_of(0), key_of(10));
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  verify(10, num);
+  fini();
+
+  init();
+  ASSERT_EQ(0, db->open(cout, cfs));
+  cout << "reopen db and check the sharded keys" << std::endl;
+  verify(10, num);
+  fini();
+
+  cout << "reshard into a different layout" << std::endl;
+  init();
+  ASSERT_EQ(0, db->init(g_conf->bluestore_rocksdb_options));
+  std::vector<KeyValueDB::ColumnFamily> new_cfs;
+  ASSERT_EQ(0, KeyValueDB::ColumnFamily::parse_list("O(3)= M(2,0-3)=", &new_cfs));
+  ASSERT_EQ(0, db->reshard(new_cfs, cout));
+  fini();
+
+  init();
+  ASSERT_EQ(0, db->open(cout, new_cfs));
+  verify(10, num);
+  {
+    KeyValueDB::Iterator iter = db->get_iterator("M");
+    unsigned n = 0;
+    for (iter->seek_to_first(); iter->valid(); iter->next())
+      ++n;
+    ASSERT_EQ(num, n);
+    bufferlist v;
+    ASSERT_EQ(0, db->get("M", key_of(7), &v));
+    ASSERT_EQ("7", _bl_to_str(v));
+  }
+  fini();
+}
+
+TEST_P(KVTest, PinnedReads) {
+  std::vector<KeyValueDB::ColumnFamily> cfs;
+  cfs.push_back(KeyValueDB::ColumnFamily("cf1", ""));
+  ASSERT_EQ(0, db->init(g_conf->bluestore_rocksdb_options));
+  if (string(GetParam()) == "rocksdb") {
+    ASSERT_EQ(0, db->create_and_open(cout, cfs));
+  } else {
+    ASSERT_EQ(0, db->create_and_open(cout));
+  }
+  const unsigned num = 20;
+  auto val_of = [](unsigned i) {
+    return string(4096 + i, 'a' + i);
+  };
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (unsigned i = 0; i < num; ++i) {
+      bufferlist bl;
+      bl.append(val_of(i));
+      t->set("prefix", stringify(i), bl);
+      t->set("cf1", stringify(i), bl);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+
+  map<string,bufferlist> held;
+  for (auto prefix : { "prefix", "cf1" }) {
+    bufferlist bl;
+    ASSERT_EQ(0, db->get_pinned(prefix, "3", &bl));
+    held[string(prefix) + ".get"] = bl;
+    ASSERT_EQ(-ENOENT, db->get_pinned(prefix, "nope", &bl));
+    KeyValueDB::Iterator it = db->get_iterator(
+      prefix, KeyValueDB::ITERATOR_PIN_VALUES);
+    for (it->seek_to_first(); it->valid(); it->next()) {
+      held[string(prefix) + "." + it->key()] = it->value();
+    }
+  }
+  ASSERT_EQ(2 * (num + 1), held.size());
+
+  // overwrite and compact everything away; the held values must not change
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (unsigned i = 0; i < num; ++i) {
+      bufferlist bl;
+      bl.append("x");
+      t->set("prefix", stringify(i), bl);
+      t->set("cf1", stringify(i), bl);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  db->compact();
+  for (auto prefix : { "prefix", "cf1" }) {
+    ASSERT_EQ(val_of(3), _bl_to_str(held[string(prefix) + ".get"]));
+    for (unsigned i = 0; i < num; ++i) {
+      ASSERT_EQ(val_of(i), _bl_to_str(held[string(prefix) + "." + stringify(i)]));
+    }
+  }
+  held.clear();
+  fini();
+}
+
 INSTANTIATE_TEST_CASE_P(
   KeyValueDB,
   KVTest,
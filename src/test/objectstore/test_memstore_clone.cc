@@ -180,6 +180,49 @@ TEST_F(MemStoreClone, CloneRangeHoleEnd)
   ASSERT_EQ(expected, result);
 }
 
+// omap is kept in a sorted vector; an open iterator has to survive
+// inserts and removals around its position
+TEST_F(MemStoreClone, OmapIteratorAcrossWrites)
+{
+  ASSERT_TRUE(store);
+
+  const auto obj = make_ghobject("omap1");
+  auto set_keys = [&](std::initializer_list<const char*> keys) {
+    map<string,bufferlist> kv;
+    for (auto k : keys) {
+      kv[k].append(k);
+    }
+    ObjectStore::Transaction t;
+    t.touch(cid, obj);
+    t.omap_setkeys(cid, obj, kv);
+    ASSERT_EQ(0u, store->queue_transaction(ch, std::move(t)));
+  };
+  set_keys({"b", "d", "f", "h"});
+
+  auto it = store->get_omap_iterator(ch, obj);
+  it->seek_to_first();
+  it->next();
+  ASSERT_TRUE(it->valid());
+  ASSERT_EQ("d", it->key());
+
+  // insert ahead of and behind the iterator, then drop its key
+  set_keys({"a", "c", "e"});
+  ASSERT_EQ("d", it->key());
+  ASSERT_EQ("d", string(it->value().c_str(), it->value().length()));
+  {
+    ObjectStore::Transaction t;
+    set<string> rm = {"d"};
+    t.omap_rmkeys(cid, obj, rm);
+    ASSERT_EQ(0u, store->queue_transaction(ch, std::move(t)));
+  }
+  it->next();
+  vector<string> rest;
+  for (; it->valid(); it->next()) {
+    rest.push_back(it->key());
+  }
+  ASSERT_EQ(vector<string>({"e", "f", "h"}), rest);
+}
+
 int main(int argc, char** argv)
 {
   // default to memstore
@@ -0,0 +1,63 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <set>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "os/bluestore/ThreadQueueCache.h"
+
+struct TestQueue {
+  uint64_t seq;
+  std::thread::id thread;
+};
+
+TEST(ThreadQueueCache, PerDevice)
+{
+  std::set<uint64_t> live = {1, 2};
+  auto is_live = [&](uint64_t s) { return live.count(s) > 0; };
+  ThreadQueueCache<TestQueue> c;
+  TestQueue a{1}, b{2};
+
+  ASSERT_EQ(nullptr, c.get(1));
+  c.add(1, &a, is_live);
+  c.add(2, &b, is_live);
+  // alternating between two open devices keeps both queues
+  for (unsigned i = 0; i < 4; ++i) {
+    ASSERT_EQ(&a, c.get(1));
+    ASSERT_EQ(&b, c.get(2));
+  }
+  ASSERT_EQ(2u, c.size());
+
+  // a reopened device gets a new seq; the old queue is never handed out
+  // and is dropped once another queue is added
+  live.erase(1);
+  live.insert(3);
+  TestQueue a2{3};
+  ASSERT_EQ(nullptr, c.get(3));
+  c.add(3, &a2, is_live);
+  ASSERT_EQ(nullptr, c.get(1));
+  ASSERT_EQ(&a2, c.get(3));
+  ASSERT_EQ(&b, c.get(2));
+  ASSERT_EQ(2u, c.size());
+}
+
+TEST(ThreadQueueCache, PerThread)
+{
+  static thread_local ThreadQueueCache<TestQueue> cache;
+  auto is_live = [](uint64_t) { return true; };
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+	ASSERT_EQ(nullptr, cache.get(1));
+	TestQueue q{1, std::this_thread::get_id()};
+	cache.add(1, &q, is_live);
+	TestQueue *got = cache.get(1);
+	ASSERT_EQ(&q, got);
+	ASSERT_EQ(std::this_thread::get_id(), got->thread);
+      });
+  }
+  for (auto& t : threads)
+    t.join();
+  ASSERT_EQ(nullptr, cache.get(1));
+}
@@ -2672,6 +2672,138 @@ TEST_F(PGLogMergeDupsTest, Superset) {
 }
 
 
+class PGLogPackTest : protected PGLog, public PGLogTestBase,
+		      public StoreTestFixture {
+public:
+  PGLogPackTest() : PGLog(g_ceph_context), StoreTestFixture("memstore") { }
+
+  void SetUp() override {
+    StoreTestFixture::SetUp();
+    ObjectStore::Transaction t;
+    test_coll = coll_t(spg_t(pg_t(1, 1)));
+    ch = store->create_new_collection(test_coll);
+    t.create_collection(test_coll, 0);
+    store->queue_transaction(ch, std::move(t));
+    hobject_t hoid;
+    hoid.pool = 1;
+    hoid.oid = "log";
+    log_oid = ghobject_t(hoid);
+  }
+
+  void TearDown() override {
+    clear();
+    StoreTestFixture::TearDown();
+  }
+
+  void add_entries(unsigned from, unsigned to) {
+    for (unsigned v = from; v <= to; ++v) {
+      add(mk_ple_mod(mk_obj(v), mk_evt(1, v), mk_evt(1, v - 1)));
+    }
+    info.last_update = info.last_complete = log.head;
+  }
+
+  void write_and_reread() {
+    ObjectStore::Transaction t;
+    map<string, bufferlist> km;
+    write_log_and_missing(t, &km, test_coll, log_oid, false);
+    if (!km.empty()) {
+      t.omap_setkeys(test_coll, log_oid, km);
+    }
+    ASSERT_EQ(0u, store->queue_transaction(ch, std::move(t)));
+
+    list<eversion_t> orig;
+    for (auto& e : log.log) {
+      orig.push_back(e.version);
+    }
+    clear();
+    ostringstream err;
+    read_log_and_missing(store.get(), ch, log_oid, info, err, false);
+    list<eversion_t> got;
+    for (auto& e : log.log) {
+      got.push_back(e.version);
+    }
+    ASSERT_EQ(orig, got);
+  }
+
+  void count_keys(unsigned *packs, unsigned *entries) {
+    *packs = *entries = 0;
+    auto it = store->get_omap_iterator(ch, log_oid);
+    for (it->seek_to_first(); it->valid(); it->next()) {
+      if (it->key().substr(0, 5) == "pack_")
+	++*packs;
+      else if (isdigit(it->key()[0]))
+	++*entries;
+    }
+  }
+
+  coll_t test_coll;
+  ghobject_t log_oid;
+  pg_info_t info;
+};
+
+TEST_F(PGLogPackTest, RoundTrip) {
+  unsigned packs, entries;
+  pack_entries = 4;
+  info.last_backfill = hobject_t::get_max();
+  log.head = log.tail = info.log_tail = mk_evt(1, 0);
+
+  // versions 1..10 land in packs 0, 1 and 2
+  add_entries(1, 10);
+  write_and_reread();
+  EXPECT_FALSE(is_dirty());
+  count_keys(&packs, &entries);
+  EXPECT_EQ(3u, packs);
+  EXPECT_EQ(0u, entries);
+
+  // appends rewrite only the tail pack
+  add_entries(11, 12);
+  write_and_reread();
+  count_keys(&packs, &entries);
+  EXPECT_EQ(4u, packs);
+  EXPECT_EQ(12u, log.log.size());
+
+  // trimming into pack 1 drops pack 0 and hides the trimmed part of pack 1
+  trim(mk_evt(1, 5), info);
+  write_and_reread();
+  count_keys(&packs, &entries);
+  EXPECT_EQ(3u, packs);
+  EXPECT_EQ(7u, log.log.size());
+  EXPECT_EQ(mk_evt(1, 6), log.log.front().version);
+}
+
+TEST_F(PGLogPackTest, Convert) {
+  unsigned packs, entries;
+  info.last_backfill = hobject_t::get_max();
+  log.head = log.tail = info.log_tail = mk_evt(1, 0);
+
+  add_entries(1, 10);
+  write_and_reread();
+  count_keys(&packs, &entries);
+  EXPECT_EQ(0u, packs);
+  EXPECT_EQ(10u, entries);
+
+  // a legacy log is rewritten packed once loaded with packing enabled
+  pack_entries = 4;
+  clear();
+  ostringstream err;
+  read_log_and_missing(store.get(), ch, log_oid, info, err, false);
+  EXPECT_TRUE(is_dirty());
+  write_and_reread();
+  count_keys(&packs, &entries);
+  EXPECT_EQ(3u, packs);
+  EXPECT_EQ(0u, entries);
+
+  // and back again
+  pack_entries = 0;
+  clear();
+  read_log_and_missing(store.get(), ch, log_oid, info, err, false);
+  EXPECT_TRUE(is_dirty());
+  write_and_reread();
+  count_keys(&packs, &entries);
+  EXPECT_EQ(0u, packs);
+  EXPECT_EQ(10u, entries);
+}
+
 struct PGLogTrimTest :
   public ::testing::Test,
   public PGLogTestBase,
@@ -2922,7 +3054,7 @@ TEST_F(PGLogTest, _merge_object_divergent_entries) {
                    /*hash*/77,
                    /*pool*/5,
                    /*nspace*/string(""));
-    mempool::osd_pglog::list<pg_log_entry_t> orig_entries;
+    mempool::osd_pglog::slab_list<pg_log_entry_t> orig_entries;
     orig_entries.push_back(mk_ple_mod(hoid, eversion_t(8336, 957), eversion_t(8336, 952)));
     orig_entries.push_back(mk_ple_err(hoid, eversion_t(8336, 958)));
     orig_entries.push_back(mk_ple_err(hoid, eversion_t(8336, 959)));
@@ -2950,7 +3082,7 @@ TEST_F(PGLogTest, _merge_object_divergent_entries) {
                    /*hash*/77,
                    /*pool*/5,
                    /*nspace*/string(""));
-    mempool::osd_pglog::list<pg_log_entry_t> orig_entries;
+    mempool::osd_pglog::slab_list<pg_log_entry_t> orig_entries;
     orig_entries.push_back(mk_ple_err(hoid, eversion_t(8336, 956)));
     orig_entries.push_back(mk_ple_mod(hoid, eversion_t(8336, 957), eversion_t(8336, 952)));
     log.add(mk_ple_mod(hoid, eversion_t(8973, 1075), eversion_t(8971, 1070)));
@@ -204,6 +204,86 @@ TEST(mempool, test_factory)
    check_usage(mempool::osdmap::id);
 }
 
+struct slab_obj {
+  MEMPOOL_CLASS_HELPERS();
+  uint64_t a;
+  uint64_t b;
+  uint64_t c;
+  slab_obj() : a(1), b(2), c(3) {}
+};
+MEMPOOL_DEFINE_SLAB_OBJECT_FACTORY(slab_obj, slab_obj, unittest_2);
+
+TEST(mempool, test_slab_factory)
+{
+  size_t items = mempool::unittest_2::allocated_items();
+  size_t bytes = mempool::unittest_2::allocated_bytes();
+  const size_t n = 10000;
+  vector<slab_obj*> v;
+  for (size_t i = 0; i < n; ++i) {
+    slab_obj *o = new slab_obj();
+    EXPECT_EQ(0u, (uintptr_t)o % alignof(slab_obj));
+    o->a = i;
+    v.push_back(o);
+  }
+  EXPECT_EQ(items + n, mempool::unittest_2::allocated_items());
+  EXPECT_EQ(bytes + n * sizeof(slab_obj),
+	    mempool::unittest_2::allocated_bytes());
+  for (size_t i = 0; i < n; ++i) {
+    EXPECT_EQ(i, v[i]->a);
+    EXPECT_EQ(3u, v[i]->c);
+  }
+
+  mempool::slab_stats_t st;
+  mempool::unittest_2::alloc_slab_obj.get_stats(&st);
+  EXPECT_EQ(n, st.items);
+  EXPECT_GT(st.slabs, 0u);
+  size_t refills = st.refills;
+
+  // freed slots are recycled without new slabs
+  for (size_t i = 0; i < n; i += 2) {
+    delete v[i];
+  }
+  for (size_t i = 0; i < n; i += 2) {
+    v[i] = new slab_obj();
+  }
+  mempool::unittest_2::alloc_slab_obj.get_stats(&st);
+  EXPECT_EQ(n, st.items);
+  EXPECT_EQ(refills, st.refills);
+
+  for (auto o : v) {
+    delete o;
+  }
+  EXPECT_EQ(items, mempool::unittest_2::allocated_items());
+  EXPECT_EQ(bytes, mempool::unittest_2::allocated_bytes());
+  mempool::unittest_2::alloc_slab_obj.get_stats(&st);
+  EXPECT_EQ(0u, st.items);
+  EXPECT_EQ(st.refills - st.releases, st.slabs);
+}
+
+TEST(mempool, test_slab_list)
+{
+  size_t items = mempool::unittest_1::allocated_items();
+  {
+    mempool::unittest_1::slab_list<obj> a, b;
+    for (int i = 0; i < 1000; ++i) {
+      a.push_back(obj(i));
+    }
+    EXPECT_EQ(items + 1000, mempool::unittest_1::allocated_items());
+
+    // nodes move between lists and are freed through either of them
+    b.splice(b.end(), a, a.begin(), std::next(a.begin(), 500));
+    EXPECT_EQ(500u, a.size());
+    EXPECT_EQ(500u, b.size());
+    EXPECT_EQ(0, b.front().a);
+    EXPECT_EQ(500, a.front().a);
+    a.swap(b);
+    a.pop_front();
+    b.clear();
+    EXPECT_EQ(items + 499, mempool::unittest_1::allocated_items());
+  }
+  EXPECT_EQ(items, mempool::unittest_1::allocated_items());
+}
+
 TEST(mempool, vector)
 {
   {
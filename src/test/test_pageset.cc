@@ -1,5 +1,6 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 // vim: ts=8 sw=2 smarttab
+#include <set>
 #include "gtest/gtest.h"
 
 #include "os/memstore/PageSet.h"
@@ -281,3 +282,41 @@ TEST(PageSet, FreeHoles)
   pages.get_range(0, 8, range);
   ASSERT_EQ(0u, range.size());
 }
+
+TEST(PageSet, HugePageArena)
+{
+  const size_t page_size = 64 << 10;
+  PageSet pages(page_size, true);
+  ASSERT_TRUE(pages.uses_huge_pages());
+  PageSet::page_vector range;
+
+  pages.alloc_range(0, page_size * 4, range);
+  ASSERT_EQ(4u, range.size());
+  std::set<Page*> allocated;
+  for (auto &page : range) {
+    ASSERT_TRUE(is_aligned(page.get()));
+    std::fill(page->data, page->data + page_size, 'x');
+    allocated.insert(page.get());
+  }
+  range.clear();
+
+  // freed buffers are reused by the next allocation from this thread
+  auto arena = PageArena::get(Page::buffer_size(page_size));
+  const auto mapped = arena->get_chunk_bytes();
+  ASSERT_LE(4 * arena->get_slot_size(), mapped);
+  pages.free_pages_after(0);
+  pages.alloc_range(0, page_size, range);
+  ASSERT_EQ(1u, range.size());
+  ASSERT_EQ(1u, allocated.count(range[0].get()));
+  ASSERT_EQ(mapped, arena->get_chunk_bytes());
+  range.clear();
+
+  // encode/decode round trip keeps the arena
+  bufferlist bl;
+  pages.encode(bl);
+  PageSet copy(page_size, true);
+  auto p = bl.cbegin();
+  copy.decode(p);
+  ASSERT_TRUE(copy.uses_huge_pages());
+  ASSERT_EQ(1u, copy.size());
+}
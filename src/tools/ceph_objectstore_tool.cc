@@ -18,6 +18,9 @@
 #include <boost/optional.hpp>
 
 #include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include "common/Formatter.h"
 #include "common/errno.h"
@@ -552,6 +555,36 @@ int do_trim_pg_log(ObjectStore *store, const coll_t &coll,
 
       bufferlist bl = p->value();
       auto bp = bl.cbegin();
+      if (PGLog::is_pack_key(p->key())) {
+	// osd_pg_log_pack_entries: a pack can only go once all of its
+	// entries are trimmed; the osd skips the rest by log_tail
+	__u32 packed_by;
+	list<pg_log_entry_t> pack;
+	try {
+	  PGLog::decode_pack(bp, &packed_by, &pack);
+	} catch (const buffer::error &e) {
+	  cerr << "Error reading pg log pack " << p->key() << ": " << e
+	       << std::endl;
+	  done = true;
+	  break;
+	}
+	for (auto& e : pack) {
+	  if (debug) {
+	    cerr << "read entry " << e << std::endl;
+	  }
+	  if (e.version.version > trim_to) {
+	    done = true;
+	    break;
+	  }
+	  new_tail = e.version;
+	}
+	if (done)
+	  break;
+	keys_to_trim.insert(p->key());
+	if (keys_to_trim.size() >= trim_at_once)
+	  break;
+	continue;
+      }
       pg_log_entry_t e;
       try {
 	e.decode_with_checksum(bp);
@@ -2751,14 +2784,183 @@ int remove_clone(
   return 0;
 }
 
-int dup(string srcpath, ObjectStore *src, string dstpath, ObjectStore *dst)
+struct dup_stats_t {
+  std::atomic<uint64_t> objects = {0};
+  std::atomic<uint64_t> bytes = {0};
+  std::atomic<uint64_t> keys = {0};
+  std::atomic<uint64_t> txns = {0};
+};
+
+// Copy one collection, packing many objects (or pieces of a large
+// object) into each transaction.  The target is not marked ready until
+// everything is copied, so a transaction may end mid-object.
+static int dup_collection(ObjectStore *src, ObjectStore *dst, coll_t cid,
+			  uint64_t batch_bytes, dup_stats_t *stats)
+{
+  const uint64_t chunk = std::min<uint64_t>(batch_bytes, 4 << 20);
+  const unsigned max_batch_objects = 1000;
+  int r;
+
+  auto ch = src->open_collection(cid);
+  auto dch = dst->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    int bits = src->collection_bits(ch);
+    if (bits < 0) {
+      if (src->get_type() == "filestore" && cid.is_meta()) {
+	bits = 0;
+      } else {
+	cerr << "cannot get bit count for collection " << cid << ": "
+	     << cpp_strerror(bits) << std::endl;
+	return bits;
+      }
+    }
+    t.create_collection(cid, bits);
+    dst->queue_transaction(dch, std::move(t));
+  }
+
+  ObjectStore::Transaction t;
+  uint64_t t_bytes = 0;
+  unsigned t_objects = 0;
+  auto flush = [&]() {
+    if (t.empty()) {
+      return;
+    }
+    dst->queue_transaction(dch, std::move(t));
+    t = ObjectStore::Transaction();
+    t_bytes = 0;
+    t_objects = 0;
+    ++stats->txns;
+  };
+
+  ghobject_t pos;
+  uint64_t n = 0, bytes = 0, keys = 0;
+  while (true) {
+    vector<ghobject_t> ls;
+    r = src->collection_list(ch, pos, ghobject_t::get_max(), 1000, &ls, &pos);
+    if (r < 0) {
+      cerr << "collection_list on " << cid << " from " << pos << " got: "
+	   << cpp_strerror(r) << std::endl;
+      return r;
+    }
+    if (ls.empty()) {
+      break;
+    }
+
+    for (auto& oid : ls) {
+      n++;
+      t.touch(cid, oid);
+
+      map<string,bufferptr> attrs;
+      src->getattrs(ch, oid, attrs);
+      if (!attrs.empty()) {
+	for (auto& a : attrs) {
+	  t_bytes += a.first.length() + a.second.length();
+	}
+	t.setattrs(cid, oid, attrs);
+      }
+
+      // data, skipping holes the source knows about
+      struct stat st;
+      r = src->stat(ch, oid, &st);
+      if (r < 0) {
+	cerr << "stat " << cid << " " << oid << " got: "
+	     << cpp_strerror(r) << std::endl;
+	return r;
+      }
+      if (st.st_size > 0) {
+	map<uint64_t,uint64_t> extents;
+	if (src->fiemap(ch, oid, 0, st.st_size, extents) < 0) {
+	  extents.clear();
+	  extents[0] = st.st_size;
+	}
+	for (auto& e : extents) {
+	  for (uint64_t off = e.first; off < e.first + e.second; ) {
+	    uint64_t len = std::min(chunk, e.first + e.second - off);
+	    bufferlist bl;
+	    r = src->read(ch, oid, off, len, bl);
+	    if (r < 0) {
+	      cerr << "read " << cid << " " << oid << " 0x" << std::hex << off
+		   << std::dec << " got: " << cpp_strerror(r) << std::endl;
+	      return r;
+	    }
+	    if (bl.length()) {
+	      t.write(cid, oid, off, bl.length(), bl);
+	      t_bytes += bl.length();
+	      bytes += bl.length();
+	    }
+	    off += len;
+	    if (t_bytes >= batch_bytes) {
+	      flush();
+	    }
+	  }
+	}
+	t.truncate(cid, oid, st.st_size);
+      }
+
+      // omap, streamed in batches
+      bufferlist header;
+      src->omap_get_header(ch, oid, &header);
+      if (header.length()) {
+	t.omap_setheader(cid, oid, header);
+	t_bytes += header.length();
+	++keys;
+      }
+      auto iter = src->get_omap_iterator(ch, oid);
+      if (iter) {
+	map<string,bufferlist> omap;
+	uint64_t omap_bytes = 0;
+	for (iter->seek_to_first(); iter->valid(); iter->next()) {
+	  bufferlist v = iter->value();
+	  omap_bytes += iter->key().length() + v.length();
+	  omap[iter->key()].claim(v);
+	  if (omap.size() >= 1024 || t_bytes + omap_bytes >= batch_bytes) {
+	    keys += omap.size();
+	    t.omap_setkeys(cid, oid, omap);
+	    omap.clear();
+	    t_bytes += omap_bytes;
+	    omap_bytes = 0;
+	    if (t_bytes >= batch_bytes) {
+	      flush();
+	    }
+	  }
+	}
+	if (!omap.empty()) {
+	  keys += omap.size();
+	  t.omap_setkeys(cid, oid, omap);
+	  t_bytes += omap_bytes;
+	}
+      }
+
+      if (t_bytes >= batch_bytes || ++t_objects >= max_batch_objects) {
+	flush();
+      }
+    }
+  }
+  flush();
+
+  stats->objects += n;
+  stats->bytes += bytes;
+  stats->keys += keys;
+  return 0;
+}
+
+int dup(string srcpath, ObjectStore *src, string dstpath, ObjectStore *dst,
+	unsigned threads, uint64_t batch_bytes)
 {
   cout << "dup from " << src->get_type() << ": " << srcpath << "\n"
        << "      to " << dst->get_type() << ": " << dstpath
        << std::endl;
-  int num, i;
+  int num;
   vector<coll_t> collections;
   int r;
+  dup_stats_t stats;
+  std::atomic<int> next = {0};
+  std::atomic<int> error = {0};
+  std::mutex out_lock;
+  vector<std::thread> workers;
+  utime_t start = ceph_clock_now();
+  double elapsed;
 
   r = src->mount();
   if (r < 0) {
@@ -2796,89 +2998,49 @@ int dup(string srcpath, ObjectStore *src, string dstpath, ObjectStore *dst)
   }
 
   num = collections.size();
-  cout << num << " collections" << std::endl;
-  i = 1;
-  for (auto cid : collections) {
-    cout << i++ << "/" << num << " " << cid << std::endl;
-    auto ch = src->open_collection(cid);
-    auto dch = dst->create_new_collection(cid);
-    {
-      ObjectStore::Transaction t;
-      int bits = src->collection_bits(ch);
-      if (bits < 0) {
-        if (src->get_type() == "filestore" && cid.is_meta()) {
-          bits = 0;
-        } else {
-          cerr << "cannot get bit count for collection " << cid << ": "
-               << cpp_strerror(bits) << std::endl;
-          goto out;
-        }
-      }
-      t.create_collection(cid, bits);
-      dst->queue_transaction(dch, std::move(t));
-    }
-
-    ghobject_t pos;
-    uint64_t n = 0;
-    uint64_t bytes = 0, keys = 0;
-    while (true) {
-      vector<ghobject_t> ls;
-      r = src->collection_list(ch, pos, ghobject_t::get_max(), 1000, &ls, &pos);
-      if (r < 0) {
-	cerr << "collection_list on " << cid << " from " << pos << " got: "
-	     << cpp_strerror(r) << std::endl;
-	goto out;
-      }
-      if (ls.empty()) {
-	break;
-      }
-      
-      for (auto& oid : ls) {
-	//cout << "  " << cid << " " << oid << std::endl;
-	if (n % 100 == 0) {
-	  cout << "  " << std::setw(16) << n << " objects, "
-	       << std::setw(16) << bytes << " bytes, "
-	       << std::setw(16) << keys << " keys"
-	       << std::setw(1) << "\r" << std::flush;
-	}
-	n++;
-
-	ObjectStore::Transaction t;
-	t.touch(cid, oid);
-
-	map<string,bufferptr> attrs;
-	src->getattrs(ch, oid, attrs);
-	if (!attrs.empty()) {
-	  t.setattrs(cid, oid, attrs);
-	}
-
-	bufferlist bl;
-	src->read(ch, oid, 0, 0, bl);
-	if (bl.length()) {
-	  t.write(cid, oid, 0, bl.length(), bl);
-	  bytes += bl.length();
-	}
-
-	bufferlist header;
-	map<string,bufferlist> omap;
-	src->omap_get(ch, oid, &header, &omap);
-	if (header.length()) {
-	  t.omap_setheader(cid, oid, header);
-	  ++keys;
-	}
-	if (!omap.empty()) {
-	  keys += omap.size();
-	  t.omap_setkeys(cid, oid, omap);
+  threads = std::max(1u, std::min<unsigned>(threads, num));
+  cout << num << " collections, " << threads << " threads, "
+       << byte_u_t(batch_bytes) << " per transaction" << std::endl;
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.emplace_back([&]() {
+	while (!error) {
+	  int idx = next++;
+	  if (idx >= num) {
+	    break;
+	  }
+	  auto& cid = collections[idx];
+	  dup_stats_t cs;
+	  int rc = dup_collection(src, dst, cid, batch_bytes, &cs);
+	  if (rc < 0) {
+	    error = rc;
+	    break;
+	  }
+	  stats.objects += cs.objects;
+	  stats.bytes += cs.bytes;
+	  stats.keys += cs.keys;
+	  stats.txns += cs.txns;
+	  std::lock_guard<std::mutex> l(out_lock);
+	  cout << idx + 1 << "/" << num << " " << cid << ": "
+	       << std::setw(16) << cs.objects << " objects, "
+	       << std::setw(16) << cs.bytes << " bytes, "
+	       << std::setw(16) << cs.keys << " keys"
+	       << std::endl;
 	}
-
-	dst->queue_transaction(dch, std::move(t));
-      }
-    }
-    cout << "  " << std::setw(16) << n << " objects, "
-	 << std::setw(16) << bytes << " bytes, "
-	 << std::setw(16) << keys << " keys"
-	 << std::setw(1) << std::endl;
+      });
+  }
+  for (auto& w : workers) {
+    w.join();
   }
+  if (error) {
+    r = error;
+    goto out;
+  }
+  elapsed = ceph_clock_now() - start;
+  cout << stats.objects << " objects, " << byte_u_t(stats.bytes) << ", "
+       << stats.keys << " keys in " << stats.txns << " transactions, "
+       << elapsed << " seconds ("
+       << byte_u_t(elapsed > 0 ? stats.bytes / elapsed : 0) << "/s)"
+       << std::endl;
 
   // keyring
   cout << "keyring" << std::endl;
@@ -3035,6 +3197,8 @@ int main(int argc, char **argv)
 {
   string dpath, jpath, pgidstr, op, file, mountpoint, mon_store_path, object;
   string target_data_path, fsid;
+  unsigned dup_threads;
+  uint64_t dup_batch_bytes;
   string objcmd, arg1, arg2, type, format, argnspace, pool;
   boost::optional<std::string> nspace;
   spg_t pgid;
@@ -3070,6 +3234,10 @@ int main(int argc, char **argv)
      "fsid for new store created by mkfs")
     ("target-data-path", po::value<string>(&target_data_path),
      "path of target object store (for --op dup)")
+    ("dup-threads", po::value<unsigned>(&dup_threads)->default_value(4),
+     "number of collections to copy in parallel (for --op dup)")
+    ("dup-batch-bytes", po::value<uint64_t>(&dup_batch_bytes)->default_value(64 << 20),
+     "bytes of data to copy per transaction (for --op dup)")
     ("mountpoint", po::value<string>(&mountpoint),
      "fuse mountpoint")
     ("format", po::value<string>(&format)->default_value("json-pretty"),
@@ -3408,7 +3576,8 @@ int main(int argc, char **argv)
       cerr << "Unable to open store of type " << target_type << std::endl;
       return 1;
     }
-    int r = dup(dpath, fs, target_data_path, targetfs);
+    int r = dup(dpath, fs, target_data_path, targetfs,
+		dup_threads, dup_batch_bytes);
     if (r < 0) {
       cerr << "dup failed: " << cpp_strerror(r) << std::endl;
       return 1;